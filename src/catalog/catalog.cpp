@@ -1,6 +1,5 @@
 #include "catalog/catalog.h"
 
-#include <limits>
 #include <string>
 
 #include "index/file_index.h"
@@ -127,7 +126,6 @@ bool Catalog::deletePath(MemIndex::Handle handle) {
     if (!file_index_reader) return false;
 
     int depth = 0;
-    int container_deletion_depth = std::numeric_limits<int>::max();
     std::string path;
     while (true) {
       const FileIndexReader::Entry *entry = file_index_reader.next();
@@ -136,21 +134,12 @@ bool Catalog::deletePath(MemIndex::Handle handle) {
         file_index_writer.containerEnd();
         --depth;
       }
-      if (entry->depth() > container_deletion_depth) {
-        // We're in the subdirectory that is getting deleted - ignore.
-        continue;
-      } else if (entry->depth() == container_deletion_depth) {
-        // Make sure that once we're out of the subdirectory getting deleted,
-        // we're done deleting.
-        container_deletion_depth = std::numeric_limits<int>::max();
-      }
       depth = entry->depth();
       std::string path = entry->getPath();
       if (path == path_to_delete) {
-        if (entry->isFile()) {
-          // Simply skip.
-        } else {
-          container_deletion_depth = entry->depth();
+        if (entry->isContainer()) {
+          // Skip the subdirectory getting deleted, without reading it.
+          file_index_reader.skipSubtree();
         }
         continue;
       }
@@ -160,7 +149,7 @@ bool Catalog::deletePath(MemIndex::Handle handle) {
             entry->container_type() == ZIP ? entry->file_size() : 0);
       } else {
         file_index_writer.addFile(entry->file_type(), entry->name(),
-                                  entry->file_size());
+                                  entry->file_size(), entry->meta());
       }
     }
     while (depth > 0) {
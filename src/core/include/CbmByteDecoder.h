@@ -0,0 +1,59 @@
+#pragma once
+
+#include <inttypes.h>
+
+// CBM ROM loader pulse lengths, in TAP units: (S)hort ~0x30, (M)edium ~0x42
+// and (L)ong ~0x56. Pulses outside [CBM_MIN_UNITS, CBM_MAX_UNITS) are not part
+// of the encoding.
+#define CBM_MIN_UNITS 0x24
+#define CBM_SM_UNITS 0x3B
+#define CBM_ML_UNITS 0x4E
+#define CBM_MAX_UNITS 0x64
+
+namespace TapuinoNext
+{
+    // Decodes the bytes of the CBM ROM loader encoding from the pulses. Every
+    // byte is a (L,M) marker followed by 9 bit pairs, (S,M) for 0 and (M,S)
+    // for 1, LSB first, the last one an odd parity bit. A (L,S) marker ends
+    // the data.
+    class CbmByteDecoder
+    {
+      public:
+        // Pulse() results other than a decoded byte.
+        static const int NONE = -1;  // nothing completed
+        static const int END = -2;   // end of data marker
+        static const int ERROR = -3; // a byte marker, followed by no valid byte
+
+        CbmByteDecoder()
+        {
+            Reset();
+        }
+
+        void Reset();
+
+        // Returns the byte (0-255) completed by the pulse, or NONE, END or
+        // ERROR.
+        int Pulse(uint32_t units);
+
+        static bool IsCbmPulse(uint32_t units)
+        {
+            return units >= CBM_MIN_UNITS && units < CBM_MAX_UNITS;
+        }
+
+      private:
+        enum class PulseClass : uint8_t
+        {
+            None,
+            Short,
+            Medium,
+            Long,
+        };
+
+        PulseClass prev;
+        bool inByte;
+        uint8_t half;
+        PulseClass first;
+        uint8_t bit;
+        uint16_t shift;
+    };
+} // namespace TapuinoNext
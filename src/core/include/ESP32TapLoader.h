@@ -18,6 +18,7 @@ namespace TapuinoNext
       protected:
         virtual void HWStartTimer();
         virtual void HWStopTimer();
+        virtual void HWResetSignal();
 
         // 2Mhz timer
         // The computed signal value is for the full length of the signal as measured from high-low to high-low transition.
@@ -30,6 +31,8 @@ namespace TapuinoNext
         hw_timer_t* tapSignalTimer;
         static ESP32TapLoader* internalClass;
         static void IRAM_ATTR TapSignalTimerStatic();
+        // Current value of the 2Mhz timer counter, in 0.5 us ticks.
+        uint32_t ReadTimerTicks();
         bool signal1stHalf = true;
         bool stopping;
         bool stopped;
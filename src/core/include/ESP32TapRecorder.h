@@ -9,18 +9,21 @@ namespace TapuinoNext
     class ESP32TapRecorder : public TapRecorder
     {
       public:
-        ESP32TapRecorder(UtilityCollection* utilityCollection);
+        ESP32TapRecorder(UtilityCollection* utilityCollection, roo_scheduler::Scheduler& scheduler);
         ~ESP32TapRecorder();
 
       protected:
-        void TapSignalCallback(uint64_t curEdgeTime);
+        // Only queues the time since the previous edge; the encoding happens in
+        // the recorder task.
+        void TapSignalCallback(uint32_t curEdgeTime);
         virtual void HWStartSampling();
         virtual void HWStopSampling();
 
       private:
         static ESP32TapRecorder* internalClass;
         static void IRAM_ATTR TapSignalCallbackStatic();
-        uint64_t lastEdgeTime = 0;
+        uint32_t lastEdgeTime = 0;
+        bool firstEdge = true;
     };
 
 } // namespace TapuinoNext
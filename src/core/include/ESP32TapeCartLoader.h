@@ -2,19 +2,66 @@
 #ifdef ESP32
 
 #include <Arduino.h>
+#include <functional>
+#include "ErrorCodes.h"
 #include "UtilityCollection.h"
 #include "config.h"
 
+#include "io/input_stream.h"
+#include "roo_scheduler.h"
+
+// Size of each half of the transmit double buffer.
+#define TAPECART_BUFFER_SIZE 1024
+
 namespace TapuinoNext
 {
+    // Sends programs to a fastloader on the C64 that speaks the TapeCart
+    // protocol: the fastloader announces itself by pulsing the motor line
+    // with a magic pattern on the write line, and then clocks in the bytes,
+    // two bits at a time on the sense and write lines.
+    //
+    // The transfer runs in the background. A byte is offered by pulling sense
+    // low; the C64 requests it by raising write, and the interrupt of that
+    // edge clocks it out, and releases write. The interrupt of the falling
+    // edge that follows offers the next byte. Interrupts are thus only held
+    // off for the ~41 us of clocking out each byte, and the scheduler refills
+    // one half of the double buffer from the input while the other half is
+    // being sent. If the data runs out, sense stays high and the C64 waits.
     class ESP32TapeCartLoader
     {
       public:
-        ESP32TapeCartLoader(UtilityCollection* utilityCollection, File& prgFile);
+        ESP32TapeCartLoader(UtilityCollection* utilityCollection, roo_scheduler::Scheduler& scheduler);
         ~ESP32TapeCartLoader();
+        // Starts listening for the handshake of the fastloader.
         void Init();
+        void Stop();
+        // Waits a little for the handshake, if not seen already. Stops
+        // listening.
         bool CheckForMode();
-        bool LoadPRG();
+
+        // Starts sending the program read from the input, in the PRG format
+        // (the load address, followed by the data). BASIC programs are RUN.
+        // When done, calls onFinished with OK, OPERATION_ABORTED if the C64
+        // turned the motor on, or FILE_ERROR.
+        ErrorCodes Send(tapuino::InputStream input, std::function<void(ErrorCodes)> onFinished);
+        // Stops the transfer, without calling onFinished.
+        void Abort();
+
+        bool IsSending() const
+        {
+            return sending;
+        }
+        // Bytes of the transfer, including the addresses and the BASIC starter.
+        uint32_t GetBytesSent() const
+        {
+            return bytesSent;
+        }
+        uint32_t GetTotalBytes() const
+        {
+            return totalBytes;
+        }
+        // Transfer rate of the current (or last) transfer, in bytes/s.
+        uint32_t GetBytesPerSecond() const;
 
       protected:
         void MotorSignalCallback(bool writeHigh);
@@ -22,15 +69,56 @@ namespace TapuinoNext
         virtual void HWStopSampling();
 
       private:
-        bool FastSendByte(uint8_t byte);
+        void IRAM_ATTR WriteSignalCallback();
+        // Advances to the next byte, and offers it if there is one.
+        void IRAM_ATTR ByteDone();
+        inline void IRAM_ATTR WaitUntil(uint32_t start, uint32_t us)
+        {
+            while (ESP.getCycleCount() - start < us * cyclesPerUs)
+                ;
+        }
+        static void IRAM_ATTR WriteSignalCallbackStatic();
+        void RefillTick();
+        int32_t ReadSource(uint8_t* buffer, uint32_t size);
+        void Refill();
+        void Finish(ErrorCodes result);
+
         UtilityCollection* utilityCollection;
-        FlipBuffer* flipBuffer;
         static ESP32TapeCartLoader* internalClass;
         static void IRAM_ATTR MotorSignalCallbackStatic();
         volatile uint16_t shiftReg;
-        bool loaderMode;
-        File prgFile;
-        uint16_t callAddr, loadAddr, endAddr;
+        volatile bool loaderMode;
+        bool sampling;
+
+        roo_scheduler::RepetitiveTask refillTick;
+        std::function<void(ErrorCodes)> onFinished;
+        tapuino::InputStream input;
+        bool sourceFailed;
+        uint32_t bytesRead;
+        // The addresses and the BASIC starter, sent ahead of the input.
+        uint8_t prefix[16];
+        uint8_t prefixSize;
+        uint8_t prefixPos;
+
+        // Shared with the interrupt. A half of the buffer is owned by the
+        // interrupt while its fill is non-zero, and by the refill otherwise.
+        uint8_t buffers[2][TAPECART_BUFFER_SIZE];
+        volatile uint32_t fill[2];
+        volatile uint8_t active;
+        volatile uint32_t bufferPos;
+        // Whether a byte is offered, i.e. sense is low.
+        volatile bool ready;
+        // Whether the offered byte has been clocked out, and the C64 is yet to
+        // lower write.
+        volatile bool clocked;
+        volatile uint32_t bytesSent;
+        portMUX_TYPE mux;
+
+        bool sending;
+        uint32_t totalBytes;
+        uint32_t cyclesPerUs;
+        uint32_t startTime;
+        uint32_t endTime;
     };
 } // namespace TapuinoNext
 #endif
@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <inttypes.h>
+
+#include "ErrorCodes.h"
+
+namespace TapuinoNext
+{
+    // Lock-free ring of edge-to-edge durations (in us), with a single producer
+    // (the edge interrupt) and a single consumer (the recorder task). Pushing
+    // is cheap enough for the ISR; when the ring is full, the value is dropped
+    // and counted as an overflow.
+    class EdgeRing
+    {
+      public:
+        // The size must be a power of 2.
+        EdgeRing(uint32_t size);
+        ~EdgeRing();
+
+        ErrorCodes Init();
+        // Frees the storage; Init() allocates it again.
+        void Release();
+        // Empties the ring and clears the overflow counter. Must not be called
+        // while the producer is active.
+        void Reset();
+
+        // Called by the producer.
+        inline bool Push(uint32_t value)
+        {
+            uint32_t head = this->head.load(std::memory_order_relaxed);
+            if (head - tail.load(std::memory_order_acquire) == size)
+            {
+                overflowCounter++;
+                return false;
+            }
+            pBuffer[head & mask] = value;
+            this->head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Called by the consumer.
+        inline bool Pop(uint32_t& value)
+        {
+            uint32_t tail = this->tail.load(std::memory_order_relaxed);
+            if (head.load(std::memory_order_acquire) == tail)
+            {
+                return false;
+            }
+            value = pBuffer[tail & mask];
+            this->tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Number of values waiting for the consumer.
+        uint32_t pending() const
+        {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        }
+
+        // Number of values dropped because the ring was full.
+        uint32_t overflows() const
+        {
+            return overflowCounter;
+        }
+
+      private:
+        uint32_t* pBuffer;
+        uint32_t size;
+        uint32_t mask;
+        // Free-running counters; the slot is the counter masked by the size.
+        std::atomic<uint32_t> head; // written by the producer only
+        std::atomic<uint32_t> tail; // written by the consumer only
+        volatile uint32_t overflowCounter;
+    };
+} // namespace TapuinoNext
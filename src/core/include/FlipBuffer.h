@@ -18,22 +18,77 @@ namespace TapuinoNext
         ErrorCodes SetHeader(uint8_t* byteFiller, uint32_t size);
         ErrorCodes FillWholeBuffer(tapuino::InputStream& tapFile, uint32_t atPos = 0);
 
+        // Whole-file mode: the next `size` bytes of the input are read into a
+        // dedicated RAM buffer, and ReadByte() serves them without ever
+        // requesting a refill. Fails with OUT_OF_MEMORY if the heap can't hold
+        // them (keeping a reserve), in which case the streaming mode remains.
+        ErrorCodes LoadWhole(tapuino::InputStream& tapFile, uint32_t size);
+        // In whole-file mode, moves the read position to the specified offset.
+        void SeekWhole(uint32_t pos);
+        // Frees the whole-file buffer, returning to the streaming mode.
+        void ReleaseWhole();
+        bool IsWhole() const
+        {
+            return wholeBuffer != NULL;
+        }
+
+        // Playlist support: pre-fills a side buffer with the beginning of the
+        // next input, while the current data plays out.
+        ErrorCodes Prefetch(tapuino::InputStream& tapFile);
+        bool HasPrefetched() const
+        {
+            return prefetchBuffer != NULL;
+        }
+        // Makes the prefetched data current, as if it was just loaded with
+        // FillWholeBuffer(). Leaves the whole-file mode, if it was on.
+        void UsePrefetched();
+        void DropPrefetched();
+
         uint8_t ReadByte();
+        // The byte that the next ReadByte() returns.
+        uint8_t PeekByte() const
+        {
+            return pBuffer[bufferPos];
+        }
         ErrorCodes FillBufferIfNeeded(tapuino::InputStream& tapFile);
+        // Whether ReadByte() has moved on to the next half of the buffer, so
+        // that FillBufferIfNeeded() would refill the other one.
+        bool RefillPending() const
+        {
+            return bufferSwitchFlag;
+        }
 
         void WriteByte(uint8_t value);
         void FlushBufferIfNeeded(File tapFile);
         void FlushBufferFinal(File tapFile);
         uint32_t counter() const { return cyclicByteCounter; }
 
+        // Total number of bytes loaded into the buffer since FillWholeBuffer().
+        uint32_t filled() const { return filledByteCounter; }
+        // Bytes loaded but not yet read.
+        uint32_t available() const
+        {
+            uint32_t read = cyclicByteCounter;
+            return filledByteCounter > read ? filledByteCounter - read : 0;
+        }
+        // How many times ReadByte() caught up with data that was not refilled.
+        uint32_t underruns() const { return underrunCounter; }
+
       private:
-        uint8_t* pBuffer;                       // buffer of raw TAP data
+        uint8_t* pBuffer;                       // buffer of raw TAP data; the streaming or the whole-file buffer
+        uint8_t* streamBuffer;                  // the streaming buffer, of bufferSize
+        uint8_t* wholeBuffer;                   // the whole-file buffer, if in whole-file mode
+        uint32_t wholeSize;                     // size of the whole-file buffer
+        uint8_t* prefetchBuffer;                // beginning of the next input, of bufferSize, if prefetched
+        uint32_t prefetchFilled;                // number of bytes in the prefetch buffer
         uint32_t bufferSize;                    // full size of the TAP buffer this is a ^2
         uint32_t halfBufferSize;                // half size of the TAP buffer
         uint32_t bufferPos;                     // current position in the TAP buffer
         uint32_t bufferMask;                    // bit mask used to reset the bufferPos as it moves passed the bufferSize
         uint32_t bufferSwitchPos;               // position at which to switch to the "next" half of the buffer, alternates between halfBufferSize and 0
-        uint32_t cyclicByteCounter;             // increments on every byte read from the buffer.
+        volatile uint32_t cyclicByteCounter;    // increments on every byte read from the buffer.
+        volatile uint32_t filledByteCounter;    // increments by the number of bytes loaded into the buffer.
+        volatile uint32_t underrunCounter;      // increments when a read finds no fresh data.
         volatile bool bufferSwitchFlag = false; // flag set by ReadByte that notifies the main loop to fill the next half of the buffer
     };
 } // namespace TapuinoNext
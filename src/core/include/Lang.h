@@ -78,6 +78,11 @@ namespace TapuinoNext
     const char S_BACKLIGHT[] = "Backlight";
     const char S_MACHINE_TYPE[] = "Machine Type";
     const char S_VIDEO_MODE[] = "Video Mode";
+    const char S_FAST_PILOT[] = "Fast Pilot";
+    const char S_AUTO_CONTINUE[] = "Auto-continue";
+    const char S_TURBO_PRG[] = "Turbo PRG";
+    const char S_TAPECART[] = "TapeCart Fast Load";
+    const char S_HIDE_UNPLAYABLE[] = "Hide Unplayable";
     const char S_ON[] = "on";
     const char S_OFF[] = "off";
     const char S_TRUE[] = "true";
@@ -21,6 +21,11 @@ namespace TapuinoNext
         AutoPlay,
         Backlight,
         Machine,
+        FastPilot,
+        AutoContinue,
+        TurboPrg,
+        TapeCart,
+        HideUnplayable,
         LAST
     };
 
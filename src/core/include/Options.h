@@ -19,6 +19,11 @@ namespace TapuinoNext
         ToggleOption autoPlay;
         ToggleOption backlight;
         EnumOption machineType;
+        ToggleOption fastPilot;
+        ToggleOption autoContinue;
+        ToggleOption turboPrg;
+        ToggleOption tapeCart;
+        ToggleOption hideUnplayable;
 
       protected:
         const char* TagIdToString(OptionTagId id);
@@ -0,0 +1,116 @@
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "SharedTypes.h"
+
+namespace TapuinoNext
+{
+    // Safety limits for shortening the pilot tone and the gaps of a loader
+    // type, used in the fast pilot mode. A loader is recognized by the length
+    // of its pilot pulse (as the 8-bit TAP value) on a given machine.
+    struct PilotProfile
+    {
+        const char* name;
+        MACHINE_TYPE machine;
+        uint8_t minPulse;
+        uint8_t maxPulse;
+        // Number of pilot pulses always played before any are dropped; enough
+        // for the loader to sync.
+        uint16_t minKeep;
+        // Maximum number of identical pulses dropped per pulse played.
+        uint8_t maxSkip;
+        // Pauses (overflow values) following the loader's pilot are clamped
+        // to this length.
+        uint32_t maxGapMicros;
+    };
+
+    // Returns the profile matching the pilot pulse, or NULL if the pulse is
+    // not a pilot pulse of a known loader, in which case nothing is shortened.
+    const PilotProfile* FindPilotProfile(uint8_t platform, uint8_t pulse);
+
+    // Follows the runs of identical pulses of a TAP in the fast pilot mode,
+    // and tells how many pulses of a pilot can be dropped. Only the first run
+    // after a pause (or at the start of a block) is taken for a pilot. Data
+    // can have long runs of identical pulses too, e.g. a Turbo Tape block of
+    // zero bytes, but always after the pilot and the sync.
+    class PilotRunTracker
+    {
+      public:
+        PilotRunTracker()
+        {
+            Reset(0, false);
+        }
+
+        // Starts over, on the given machine; `atBlockStart` tells whether a
+        // pilot can follow.
+        void Reset(uint8_t platform, bool atBlockStart)
+        {
+            this->platform = platform;
+            pilotPulse = 0;
+            pilotExpected = atBlockStart;
+            pilotRun = 0;
+            runProfile = NULL;
+            gapProfile = NULL;
+        }
+
+        // A pause breaks any run, and the next run may be a pilot.
+        void Pause()
+        {
+            pilotPulse = 0;
+            pilotExpected = true;
+        }
+
+        // Counts a pulse. Returns how many of the identical pulses right after
+        // it can be dropped.
+        uint32_t Pulse(uint8_t pulse)
+        {
+            if (pulse != pilotPulse)
+            {
+                pilotPulse = pulse;
+                pilotRun = 1;
+                if (pilotExpected)
+                {
+                    runProfile = FindPilotProfile(platform, pulse);
+                    // A new block; only gaps after a shortened pilot's block
+                    // are clamped, so wait for this one to be shortened.
+                    gapProfile = NULL;
+                }
+                else
+                {
+                    runProfile = NULL;
+                }
+                pilotExpected = false;
+                return 0;
+            }
+            pilotRun++;
+            if (runProfile == NULL || pilotRun <= runProfile->minKeep)
+            {
+                return 0;
+            }
+            gapProfile = runProfile;
+            return runProfile->maxSkip;
+        }
+
+        // Counts the pulses dropped after the last one.
+        void Skipped(uint32_t count)
+        {
+            pilotRun += count;
+        }
+
+        // The profile of the pilot of the current block, if shortened, which
+        // limits the gaps following the block; NULL otherwise.
+        const PilotProfile* GapProfile() const
+        {
+            return gapProfile;
+        }
+
+      private:
+        uint8_t platform;
+        uint8_t pilotPulse;             // pulse of the current run
+        bool pilotExpected;             // whether the next run can be a pilot
+        uint32_t pilotRun;              // length of the current run
+        const PilotProfile* runProfile; // loader profile matching the run, if any
+        const PilotProfile* gapProfile; // profile of the last shortened pilot
+    };
+} // namespace TapuinoNext
@@ -0,0 +1,132 @@
+#pragma once
+#include <inttypes.h>
+
+namespace TapuinoNext
+{
+    // Power-of-two bucketed histogram. Bucket 0 counts zeros; bucket N (N > 0)
+    // counts values in [2^(N-1), 2^N). Cheap enough to be updated from the
+    // timer ISR.
+    class TelemetryHistogram
+    {
+      public:
+        static const int kBuckets = 20;
+
+        TelemetryHistogram()
+        {
+            Reset();
+        }
+
+        void Reset();
+
+        inline void Record(uint32_t value)
+        {
+            int bucket = (value == 0) ? 0 : 32 - __builtin_clz(value);
+            if (bucket >= kBuckets) bucket = kBuckets - 1;
+            buckets[bucket]++;
+            count++;
+            if (value > maxValue) maxValue = value;
+        }
+
+        uint32_t Count() const
+        {
+            return count;
+        }
+
+        uint32_t Max() const
+        {
+            return maxValue;
+        }
+
+        uint32_t BucketCount(int bucket) const
+        {
+            return buckets[bucket];
+        }
+
+        // Returns the upper bound of the bucket that contains the specified
+        // percentile (0-100) of the recorded values, or 0 if nothing has been
+        // recorded.
+        uint32_t Percentile(uint8_t percent) const;
+
+      private:
+        volatile uint32_t buckets[kBuckets];
+        volatile uint32_t count;
+        volatile uint32_t maxValue;
+    };
+
+    // Health statistics of a single playback session. Buffer and refill stats
+    // are recorded by the refill task; ISR stats by the timer interrupt.
+    class PlaybackTelemetry
+    {
+      public:
+        PlaybackTelemetry()
+        {
+            Reset();
+        }
+
+        void Reset();
+
+        // Number of buffered bytes not yet consumed by the ISR, sampled right
+        // before each refill check.
+        void RecordBufferFill(uint32_t fill);
+
+        // A single refill of the flip buffer from the input stream.
+        void RecordRefill(uint32_t durationMicros, uint32_t bytes);
+
+        // Both values in timer ticks (0.5 us). Lateness is the time between the
+        // alarm firing and the ISR starting to execute.
+        inline void RecordIsr(uint32_t execTicks, uint32_t latenessTicks)
+        {
+            isrExecTicks.Record(execTicks);
+            isrLatenessTicks.Record(latenessTicks);
+        }
+
+        void SetUnderruns(uint32_t underruns)
+        {
+            this->underruns = underruns;
+        }
+
+        uint32_t MinBufferFill() const
+        {
+            return fillSamples == 0 ? 0 : minFill;
+        }
+
+        uint32_t AvgBufferFill() const
+        {
+            return fillSamples == 0 ? 0 : (uint32_t) (fillSum / fillSamples);
+        }
+
+        uint32_t Underruns() const
+        {
+            return underruns;
+        }
+
+        // Effective read throughput of the source (SD or inflate), in bytes/s.
+        uint32_t SourceBytesPerSecond() const;
+
+        const TelemetryHistogram& RefillMicros() const
+        {
+            return refillMicros;
+        }
+
+        const TelemetryHistogram& IsrExecTicks() const
+        {
+            return isrExecTicks;
+        }
+
+        const TelemetryHistogram& IsrLatenessTicks() const
+        {
+            return isrLatenessTicks;
+        }
+
+      private:
+        uint32_t minFill;
+        uint64_t fillSum;
+        uint32_t fillSamples;
+        uint32_t underruns;
+        uint64_t sourceBytes;
+        uint64_t sourceMicros;
+        TelemetryHistogram refillMicros;
+        TelemetryHistogram isrExecTicks;
+        TelemetryHistogram isrLatenessTicks;
+    };
+} // namespace TapuinoNext
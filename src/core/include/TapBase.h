@@ -81,5 +81,9 @@ namespace TapuinoNext
         // these values convert the TAP data into the number of microseconds that the signal last for (high and low edge)
         double cycleMultRaw; // cycle multiplier for a raw (3 byte value from a TAP file, version 1+)
         double cycleMult8;   // cycle multiplier for a scaled (1 byte value from a TAP file)
+        // the same multipliers in 16.16 fixed point, for the timer ISR: the ESP32 has no double
+        // precision FPU, so double math there is emulated and too slow to keep pace with short pulses
+        uint32_t cycleMultRawFixed;
+        uint32_t cycleMult8Fixed;
     };
 } // namespace TapuinoNext
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+
+#include "CbmByteDecoder.h"
+#include "ErrorCodes.h"
+#include "FS.h"
+
+namespace TapuinoNext
+{
+    enum class TapBlockType : uint8_t
+    {
+        Unknown = 0,
+        // Standard Kernal loader blocks. A header carries the file name, type
+        // and load addresses of the data block that follows it.
+        CbmHeader = 1,
+        CbmData = 2,
+        // Turbo Tape 64 (and the many loaders derived from it).
+        TurboTapeHeader = 3,
+        TurboTapeData = 4,
+        // Some other two-pulse (1 bit per pulse) turbo encoding.
+        Turbo = 5,
+    };
+
+    // A block of the tape: a run of pulses between pauses, starting with its
+    // pilot tone.
+    struct TapBlock
+    {
+        uint32_t position; // byte offset of the first pulse, excluding the TAP header
+        uint32_t cycles;   // accumulated signal time up to that pulse, in us
+        TapBlockType type;
+        // Of the headers: the file type byte, the load addresses, and the
+        // file name (in ASCII, zero padded).
+        uint8_t fileType;
+        uint16_t startAddress;
+        uint16_t endAddress;
+        char name[17];
+
+        bool IsHeader() const
+        {
+            return type == TapBlockType::CbmHeader || type == TapBlockType::TurboTapeHeader;
+        }
+    };
+
+    // Short, human readable name of the block type.
+    const char* TapBlockTypeName(TapBlockType type);
+
+    // The blocks of a TAP, as found by the TapBlockAnalyzer. Persisted in a
+    // sidecar file, so that the TAP only needs to be analyzed once.
+    class TapBlockIndex
+    {
+      public:
+        TapBlockIndex();
+
+        void Clear();
+
+        // Whether the index covers a TAP with the specified data length.
+        bool IsBuiltFor(uint32_t tapLength) const
+        {
+            return complete && length == tapLength;
+        }
+
+        void Begin(uint32_t tapLength);
+        void Add(const TapBlock& block);
+        void Finish();
+
+        size_t Count() const
+        {
+            return blocks.size();
+        }
+
+        const TapBlock& Get(size_t i) const
+        {
+            return blocks[i];
+        }
+
+        // Returns the index of the last block starting at or before the
+        // position, or -1 if there is none.
+        int Find(uint32_t position) const;
+
+        ErrorCodes Load(FS& fs, const char* path, uint32_t tapLength);
+        ErrorCodes Store(FS& fs, const char* path) const;
+
+      private:
+        std::vector<TapBlock> blocks;
+        uint32_t length;
+        bool complete;
+    };
+
+    // Splits a pulse stream into blocks, and recognizes the loader of each.
+    //
+    // Blocks are separated by pauses, or by the start of a long pilot tone
+    // following data. Every pulse is put through a histogram and through
+    // decoders of the CBM ROM encoding (S/M/L pulses, with byte markers) and
+    // of the two-pulse turbo encodings (with the bit threshold learned from
+    // the pilot). A block is classified by what decodes: a CBM countdown, a
+    // Turbo Tape pilot and sync sequence, or, failing these, by the shape of
+    // its histogram. The names and addresses are taken from the headers.
+    //
+    // Pulse lengths are in TAP units (8 machine cycles), regardless of the TAP
+    // version.
+    class TapBlockAnalyzer
+    {
+      public:
+        explicit TapBlockAnalyzer(TapBlockIndex& index);
+
+        void Begin(uint32_t tapLength);
+        // Feeds the pulse starting at the specified position and time.
+        void Pulse(uint32_t position, uint32_t cycles, uint32_t units);
+        void Finish();
+
+      private:
+        void StartBlock(uint32_t position, uint32_t cycles);
+        void EndBlock();
+        void ResetDecoders();
+        void CbmPulse(uint32_t units);
+        void CbmByte(uint8_t b);
+        void CbmSequenceEnd();
+        void TurboPulse(uint32_t units);
+        void TurboByte(uint8_t b);
+        bool HasTwoPeaks() const;
+        static void CopyName(const uint8_t* petscii, char* name);
+
+        TapBlockIndex& index;
+
+        // The block being analyzed.
+        bool inBlock;
+        TapBlock block;
+        uint32_t pulses;
+        uint16_t histogram[256];
+
+        // Run of (nearly) identical pulses, which could be a pilot tone.
+        uint32_t runPulse;
+        uint32_t runLength;
+        uint32_t runPosition;
+        uint32_t runCycles;
+        uint32_t runStartPulses; // pulses of the block preceding the run
+
+        // CBM ROM decoder.
+        CbmByteDecoder cbmDecoder;
+        uint32_t cbmCount; // bytes of the current sequence, countdown included
+        uint8_t cbmCountdown;
+        bool cbmDone;
+        uint32_t cbmDataBytes;
+        uint8_t cbmData[21];
+
+        // Turbo decoder.
+        uint32_t turboMin;
+        uint32_t turboMax;
+        uint32_t turboThreshold;
+        uint8_t turboShift;
+        bool turboAligned;
+        bool turboInverted;
+        uint8_t turboBits;
+        uint32_t turboPilotBytes;
+        bool turboSynced;
+        bool turboCountdown;
+        uint8_t turboNext;
+        uint32_t turboDataBytes;
+        uint8_t turboData[22];
+    };
+} // namespace TapuinoNext
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include "ErrorCodes.h"
+#include "FS.h"
+
+namespace TapuinoNext
+{
+    // Position within the TAP data at a pulse boundary, with the tape counter
+    // reading at that point.
+    struct TapCheckpoint
+    {
+        uint32_t position; // byte offset, excluding the TAP header
+        uint32_t cycles;   // accumulated signal time up to that pulse, in us
+        uint16_t counter;
+    };
+
+    // Table of checkpoints taken every kCheckpointInterval pulses, so that
+    // seeking to a tape counter is a table lookup followed by a short forward
+    // decode. Persisted in a sidecar file, so that it only needs to be built
+    // once per TAP.
+    class TapCounterIndex
+    {
+      public:
+        static const uint32_t kCheckpointInterval = 2048;
+
+        TapCounterIndex();
+
+        void Clear();
+
+        // Whether the index covers a TAP with the specified data length.
+        bool IsBuiltFor(uint32_t tapLength) const
+        {
+            return complete && length == tapLength;
+        }
+
+        void Begin(uint32_t tapLength);
+        void Add(uint32_t position, uint32_t cycles);
+        void Finish();
+
+        // Returns the last checkpoint whose counter does not exceed the target.
+        const TapCheckpoint& Find(uint16_t targetCounter) const;
+
+        ErrorCodes Load(FS& fs, const char* path, uint32_t tapLength);
+        ErrorCodes Store(FS& fs, const char* path) const;
+
+        // Inverse of CYCLES_TO_COUNTER: the smallest number of cycles at which
+        // the counter reaches the specified value.
+        static uint32_t CounterToCycles(uint16_t counter);
+
+      private:
+        std::vector<TapCheckpoint> checkpoints;
+        uint32_t length;
+        bool complete;
+    };
+} // namespace TapuinoNext
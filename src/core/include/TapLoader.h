@@ -1,12 +1,18 @@
 #pragma once
 
 #include <functional>
+#include <string>
 
 #include "ErrorCodes.h"
+#include "PilotProfiles.h"
+#include "PlaybackTelemetry.h"
 #include "TapBase.h"
+#include "TapBlockIndex.h"
+#include "TapCounterIndex.h"
 
 #include "io/tap_file.h"
 #include "io/input_stream.h"
+#include "io/wav_input_stream.h"
 #include "roo_scheduler.h"
 
 namespace TapuinoNext
@@ -19,30 +25,111 @@ namespace TapuinoNext
         ErrorCodes Play(tapuino::TapFile& tapFile,
                         std::function<void(ErrorCodes)> playFinishedCb);
         bool IsPlaying() const { return isTiming; }
+        // Whether the TAP data is served from RAM rather than streamed.
+        bool IsPlayingFromRam() const { return flipBuffer->IsWhole(); }
         void Stop();
         void Reset();
+        // Stops, and positions the playback at the start of the TAP.
+        void Rewind();
+
+        // Positions the (stopped) playback at the specified tape counter, so
+        // that a subsequent Play() resumes from there, and calls seekedCb
+        // with the result. Uses the counter index of the TAP. If it is not
+        // known yet, waits for the background analysis (see AnalyzeBlocks())
+        // to build it, starting the analysis if needed; seekedCb is then
+        // called when done, or with OPERATION_ABORTED if the analysis gets
+        // aborted.
+        void SeekToCounter(tapuino::TapFile& tapFile, uint16_t targetCounter,
+                           std::function<void(ErrorCodes)> seekedCb);
+
+        // Makes the blocks of the TAP available in GetBlockIndex(): from its
+        // sidecar, or else by analyzing the (stopped, rewound) TAP in the
+        // background, a slice per scheduler tick. The analysis builds the
+        // counter index along the way; for a WAV recording whose length is
+        // not known yet, it first scans for the length, the same way. Calls
+        // analyzedCb when done; the index is empty if the blocks are not
+        // known. Playing, rewinding or seeking aborts the analysis.
+        void AnalyzeBlocks(tapuino::TapFile& tapFile, std::function<void()> analyzedCb);
+        bool IsAnalyzing() const { return analyzing; }
+        // How far the analysis is, in percent.
+        int GetAnalysisProgress() const;
+        const TapBlockIndex& GetBlockIndex() const { return blockIndex; }
+
+        // Positions the (stopped) playback at the start of the specified
+        // block of the block index.
+        ErrorCodes SeekToBlock(tapuino::TapFile& tapFile, size_t block);
+
+        // Playlist support. Whether the current TAP is close to its end, with
+        // all of its remaining data buffered, so that the next one can be
+        // prefetched.
+        bool IsReadyForPrefetch() const;
+        // Opens the next TAP of the playlist, validates its header, and
+        // pre-fills a side buffer with the beginning of its data, so that it
+        // can start without delay. Releases the input of the current TAP
+        // (which is then re-opened if rewound).
+        ErrorCodes PrefetchNext(tapuino::TapFile& next);
+        bool HasPrefetched() const;
+        void DropPrefetched();
+        // Stops the current TAP (if playing), and starts playing the
+        // prefetched one.
+        ErrorCodes PlayPrefetched(std::function<void(ErrorCodes)> playFinishedCb);
+        // When set, reaching the end of the TAP with the next one prefetched
+        // does not stop the playback; it continues with the next TAP, as if it
+        // was on the same tape, and calls the callback. nullptr disables.
+        void SetAutoContinue(std::function<void()> continuedCb);
         
         const TAP_INFO* GetTapInfo()
         {
             return &tapInfo;
         }
 
+        // Health statistics of the current (or most recent) playback.
+        const PlaybackTelemetry& GetTelemetry() const
+        {
+            return telemetry;
+        }
+
       protected:
         // Interface for the derrived class that implemtents the hardware interface
         /******************************************************/
         virtual void HWStartTimer() = 0;
         virtual void HWStopTimer() = 0;
+        // Makes the next timer interrupt start a new pulse.
+        virtual void HWResetSignal() = 0;
         /******************************************************/
         uint32_t CalcSignalTime();
 
+        PlaybackTelemetry telemetry;
+
       private:
         uint32_t ReadNextByte();
-        ErrorCodes ReadTapHeader(tapuino::InputStream& input);
+        void SkipPilotPulses(uint8_t pulse, uint32_t signalTime);
+        uint32_t ClampGap(uint32_t signalTime);
+        bool AtBlockStart();
+        static ErrorCodes ReadTapHeader(tapuino::InputStream& input, TAP_INFO& tapInfo);
+        ErrorCodes OpenInput(tapuino::TapFile& tapFile);
+        bool HasInput() const;
+        ErrorCodes FillFrom(uint32_t position);
+        void SwitchToPrefetched();
+        void Start(std::function<void(ErrorCodes)> playFinishedCb);
+        uint32_t NextPulseCycles();
+        bool LoadCounterIndex(tapuino::TapFile& tapFile);
+        ErrorCodes SeekToCounterNow(uint16_t targetCounter);
+        ErrorCodes SeekTo(uint32_t position, uint32_t cycles);
+        bool StartLengthScan(tapuino::TapFile& tapFile, std::function<void()> analyzedCb);
+        void StartAnalysis(tapuino::TapFile& tapFile, std::function<void()> analyzedCb);
+        void FinishSeek(ErrorCodes ret);
+        void AnalyzeTick();
+        void FinishAnalysis(bool ok);
+        void AbortAnalysis();
         void StartTimer();
         void StopTimer();
 
         // Called from the playTick task.
         void PlayTick();
+        // Refills the flip buffer from the input, if needed. Called from
+        // PlayTick(), and by the SPI bus as soon as a refill is due.
+        void Refill();
 
         roo_scheduler::Scheduler& scheduler;
 
@@ -50,16 +137,56 @@ namespace TapuinoNext
         // stream.
         roo_scheduler::RepetitiveTask playTick;
 
-        // When playing, the source input stream. Otherwise, a null input.
+        // If set, refills are run through it, ahead of the display.
+        tapuino::SpiBus* spiBus;
+
+        // When playing, the source input stream. Otherwise, or when the whole
+        // TAP has been loaded into RAM, a null input.
         tapuino::InputStream input;
 
+        // Whether the input has been read to the end and closed, so that the
+        // next TAP could be prefetched.
+        bool inputDrained;
+
+        // The input and the header of the prefetched TAP, if any.
+        tapuino::InputStream nextInput;
+        TAP_INFO nextInfo;
+
         std::function<void(ErrorCodes status)> playFinishedCb;
+        std::function<void()> continuedCb;
 
         // bool InPlayMenu(File tapFile);
-        // bool SeekToCounter(File tapFile, uint16_t targetCounter);
+
+        // Counter index of the most recently seeked TAP, and its sidecar path.
+        TapCounterIndex counterIndex;
+        std::string counterIndexPath;
+
+        // Block index of the most recently analyzed TAP, and its sidecar path.
+        TapBlockIndex blockIndex;
+        std::string blockIndexPath;
+
+        // When analyzing, advances the analysis.
+        roo_scheduler::RepetitiveTask analyzeTick;
+        TapBlockAnalyzer blockAnalyzer;
+        bool analyzing;
+        uint32_t analyzedPulses;
+        FS* analyzedFs;
+        std::function<void()> analyzedCb;
+        // The length scan of a WAV recording, done before its analysis.
+        tapuino::WavLengthScanner lengthScan;
+        tapuino::TapFile* scannedFile;
+
+        // A seek waiting for the analysis to build the counter index.
+        std::function<void(ErrorCodes)> seekedCb;
+        uint16_t seekTarget;
 
         bool isTiming;
 
+        // Fast pilot mode state, used by the ISR. Enabled on every start of
+        // the timer, if the option is set.
+        bool fastPilot;
+        PilotRunTracker pilotRuns;
+
         ErrorCodes loadingStatus;
     };
 } // namespace TapuinoNext
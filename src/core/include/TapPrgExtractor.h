@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include "CbmByteDecoder.h"
+#include "ErrorCodes.h"
+
+#include "io/input_stream.h"
+
+namespace TapuinoNext
+{
+    // Recovers the program from a TAP recorded with the standard CBM ROM
+    // loader: a header block and a data block, each recorded twice. Like the
+    // Kernal, takes the first copy of the data, and repairs the bytes with
+    // read errors from the second one; the checksum must match.
+    //
+    // Only plain recordings qualify, so that nothing is lost by loading the
+    // program by other means: a TAP with pulses of a turbo loader, or with
+    // more than one program, is rejected.
+    class TapPrgExtractor
+    {
+      public:
+        TapPrgExtractor();
+
+        // Reads the TAP from the input, which must be at its start. On
+        // success, prg holds the program in the PRG format: the load address,
+        // followed by the data.
+        ErrorCodes Extract(tapuino::InputStream& input, std::vector<uint8_t>& prg);
+
+      private:
+        enum class Sequence : uint8_t
+        {
+            Idle,
+            Countdown,
+            Payload,
+        };
+
+        enum class DataStatus : uint8_t
+        {
+            None,    // no copy of the right length yet
+            Partial, // a copy with bad bytes, waiting for the repeated copy
+            Good,
+        };
+
+        void Pulse(uint32_t units);
+        void Byte(int result);
+        void PayloadByte(uint8_t b, bool bad);
+        void SequenceEnd();
+        void HeaderSequence();
+        void DataSequence();
+
+        CbmByteDecoder decoder;
+        std::vector<uint8_t>* prg;
+
+        Sequence sequence;
+        uint8_t countdown;
+        uint32_t count;
+        bool repeated;
+
+        // The first 192 bytes of the current sequence, plus the checksum.
+        uint8_t headerBytes[193];
+        bool headerBad;
+        bool hasHeader;
+        // Whether the last sequence was the first copy of the header.
+        bool followsHeader;
+        uint8_t header[193];
+        uint32_t dataLength;
+
+        DataStatus dataStatus;
+        std::vector<uint32_t> badBytes;
+        size_t repairNext;
+        bool repairFailed;
+
+        uint32_t foreignPulses;
+        bool otherFiles;
+    };
+} // namespace TapuinoNext
@@ -1,20 +1,50 @@
 #pragma once
 
+#include "EdgeRing.h"
 #include "ErrorCodes.h"
 #include "InputHandler.h"
 #include "LCDUtils.h"
 #include "TapBase.h"
+#include "TapWriter.h"
 #include "config.h"
 
+#include "roo_scheduler.h"
+
 namespace TapuinoNext
 {
     class TapRecorder : public TapBase
     {
       public:
-        TapRecorder(UtilityCollection* utilityCollection);
+        TapRecorder(UtilityCollection* utilityCollection, roo_scheduler::Scheduler& scheduler);
         ~TapRecorder();
         void RecordTap(File tapFile);
 
+        // Creates the TAP at the specified path (relative to the filesystem
+        // mounted at the mountpoint, e.g. Sd::mountpoint()), writes its
+        // header, and starts sampling the write line. The edge interrupt only
+        // queues the edge-to-edge durations; the recorder task encodes them
+        // and writes the TAP data to the file.
+        ErrorCodes StartRecording(const char* mountpoint, const char* path);
+        // Stops sampling, encodes whatever is still queued, and finalizes the
+        // TAP.
+        ErrorCodes StopRecording();
+        bool IsRecording() const
+        {
+            return isSampling;
+        }
+
+        // Number of edges lost because the recorder task did not keep up.
+        uint32_t GetOverflows() const
+        {
+            return edgeRing.overflows();
+        }
+
+        // Worst-case latency of a single SD card write, in us.
+        uint32_t GetMaxWriteMicros() const
+        {
+            return writer.MaxWriteMicros();
+        }
+
       protected:
         // Interface for the derrived class that implemtents the hardware interface
         /******************************************************/
@@ -22,13 +52,22 @@ namespace TapuinoNext
         virtual void HWStopSampling() = 0;
         /******************************************************/
         void CalcTapData(uint32_t signalTime);
-        void FinalizeRecording(File tapFile);
+        ErrorCodes FinalizeRecording();
+
+        // Edge-to-edge durations in us, pushed by the HW edge interrupt.
+        EdgeRing edgeRing;
 
       private:
+        // Called from the recordTick task.
+        void RecordTick();
+
+        roo_scheduler::RepetitiveTask recordTick;
+        TapWriter writer;
+
         bool isSampling;
         void WriteNextByte(uint8_t nextByte);
         bool InRecordMenu(File tapFile);
-        ErrorCodes CreateTap(File tapFile);
+        ErrorCodes CreateTap();
         void StartSampling();
         void StopSampling();
     };
@@ -0,0 +1,91 @@
+#pragma once
+#include <inttypes.h>
+
+#include "ErrorCodes.h"
+
+namespace TapuinoNext
+{
+    // Writes a recorded TAP to the SD card with bounded latency. Data is
+    // collected in a queue of sector-aligned blocks and written out block by
+    // block, at block-aligned file offsets, within a time budget per call.
+    // The file is extended in large chunks ahead of the data (with
+    // ftruncate(), which FatFs implements by linking the clusters up to the
+    // new size), so that the FAT updates happen once per chunk rather than
+    // on block writes. This is not a real preallocation: the clusters need
+    // not be contiguous, and if the extension fails, the data is written
+    // without it. Finish() truncates the file to the real length.
+    class TapWriter
+    {
+      public:
+        static const uint32_t kBlockSize = 4096;
+        static const uint32_t kBlockCount = 4;
+        static const uint32_t kPreallocChunk = 256 * 1024;
+
+        TapWriter();
+        ~TapWriter();
+
+        // Creates (or truncates) the file, at the path relative to the
+        // filesystem mounted at the mountpoint, and allocates the block queue.
+        ErrorCodes Open(const char* mountpoint, const char* path);
+        bool IsOpen() const
+        {
+            return fd >= 0;
+        }
+
+        void WriteByte(uint8_t value)
+        {
+            if (fill == kBlockSize)
+            {
+                NextBlock();
+            }
+            blocks[current][fill++] = value;
+            length++;
+        }
+        ErrorCodes Write(const uint8_t* data, uint32_t size);
+
+        // Writes queued blocks until the queue is empty or the time budget runs
+        // out. Called periodically by the recorder task.
+        ErrorCodes Service(uint32_t budgetMicros);
+
+        // Writes out everything, truncates the file to the length of the data,
+        // overwrites `size` bytes at `offset` with `patch` (the final header),
+        // and closes the file.
+        ErrorCodes Finish(uint32_t offset, const uint8_t* patch, uint32_t size);
+
+        // Closes the file without finishing it.
+        void Close();
+
+        uint32_t Length() const
+        {
+            return length;
+        }
+        // The longest single block write (or file extension), in us.
+        uint32_t MaxWriteMicros() const
+        {
+            return maxWriteMicros;
+        }
+        // How many times the queue was full, so that a block had to be written
+        // synchronously.
+        uint32_t Stalls() const
+        {
+            return stalls;
+        }
+
+      private:
+        void NextBlock();
+        ErrorCodes WriteBlock(const uint8_t* data, uint32_t size);
+
+        int fd;
+        uint8_t* blocks[kBlockCount];
+        uint32_t current;   // block being filled
+        uint32_t fill;      // bytes in the current block
+        uint32_t queued;    // full blocks waiting to be written, preceding the current one
+        uint32_t length;    // total bytes written into the writer
+        uint32_t written;   // bytes written to the file
+        uint32_t allocated; // size the file has been extended to
+        bool extending;     // false once an extension failed
+        uint32_t maxWriteMicros;
+        uint32_t stalls;
+        ErrorCodes status;
+    };
+} // namespace TapuinoNext
@@ -4,13 +4,16 @@
 #include "Options.h"
 #include "FlipBuffer.h"
 
+#include "io/spi_bus.h"
+
 namespace TapuinoNext
 {
     class UtilityCollection
     {
       public:
-        UtilityCollection(InputHandler* inputHandler, Options* options, FlipBuffer* flipBuffer)
-            : inputHandler(inputHandler), options(options), flipBuffer(flipBuffer)
+        UtilityCollection(InputHandler* inputHandler, Options* options, FlipBuffer* flipBuffer,
+                          tapuino::SpiBus* spiBus = NULL)
+            : inputHandler(inputHandler), options(options), flipBuffer(flipBuffer), spiBus(spiBus)
         {
         }
 
@@ -21,5 +24,7 @@ namespace TapuinoNext
         InputHandler* inputHandler;
         Options* options;
         FlipBuffer* flipBuffer;
+        // The bus shared by the SD card and the display; optional.
+        tapuino::SpiBus* spiBus;
     };
 } // namespace TapuinoNext
\ No newline at end of file
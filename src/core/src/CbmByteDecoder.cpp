@@ -0,0 +1,71 @@
+#include "core/include/CbmByteDecoder.h"
+
+using namespace TapuinoNext;
+
+void CbmByteDecoder::Reset()
+{
+    prev = PulseClass::None;
+    inByte = false;
+}
+
+int CbmByteDecoder::Pulse(uint32_t units)
+{
+    PulseClass c = units < CBM_MIN_UNITS   ? PulseClass::None
+                   : units < CBM_SM_UNITS  ? PulseClass::Short
+                   : units < CBM_ML_UNITS  ? PulseClass::Medium
+                   : units < CBM_MAX_UNITS ? PulseClass::Long
+                                           : PulseClass::None;
+    if (!inByte)
+    {
+        int result = NONE;
+        if (prev == PulseClass::Long && c == PulseClass::Medium)
+        {
+            inByte = true;
+            half = 0;
+            bit = 0;
+            shift = 0;
+        }
+        else if (prev == PulseClass::Long && c == PulseClass::Short)
+        {
+            result = END;
+        }
+        prev = c;
+        return result;
+    }
+    prev = c;
+    if (half == 0)
+    {
+        first = c;
+        half = 1;
+        return NONE;
+    }
+    half = 0;
+    uint16_t value;
+    if (first == PulseClass::Short && c == PulseClass::Medium)
+    {
+        value = 0;
+    }
+    else if (first == PulseClass::Medium && c == PulseClass::Short)
+    {
+        value = 1;
+    }
+    else
+    {
+        // Start over with the next marker.
+        inByte = false;
+        return ERROR;
+    }
+    shift |= value << bit;
+    if (++bit < 9)
+    {
+        return NONE;
+    }
+    inByte = false;
+    uint8_t b = shift & 0xFF;
+    uint8_t parity = 1;
+    for (uint8_t v = b; v != 0; v >>= 1)
+    {
+        parity ^= v & 1;
+    }
+    return (shift >> 8) == parity ? b : ERROR;
+}
@@ -72,6 +72,22 @@ void ESP32TapLoader::HWStopTimer()
     }
 }
 
+void ESP32TapLoader::HWResetSignal()
+{
+    signal1stHalf = true;
+    lastSignalTime = 0;
+}
+
+inline uint32_t IRAM_ATTR ESP32TapLoader::ReadTimerTicks()
+{
+#ifdef ROO_TESTING
+    // The emulated timer is a scheduler task; there is no counter to read.
+    return 0;
+#else
+    return (uint32_t) timerRead(tapSignalTimer);
+#endif
+}
+
 void IRAM_ATTR ESP32TapLoader::TapSignalTimerStatic()
 {
     ESP32TapLoader::internalClass->TapSignalTimer();
@@ -79,6 +95,9 @@ void IRAM_ATTR ESP32TapLoader::TapSignalTimerStatic()
 
 void IRAM_ATTR ESP32TapLoader::TapSignalTimer()
 {
+    // The alarm auto-reloads the counter, so whatever it reads now is the time
+    // elapsed since the alarm fired.
+    uint32_t isrStart = ReadTimerTicks();
     // default to an idle mode that keeps the timer ticking while not processing any signals
     uint32_t signalTime = IDLE_TIMER_EXECUTE;
     motorOn = digitalRead(C64_MOTOR_PIN);
@@ -121,6 +140,11 @@ void IRAM_ATTR ESP32TapLoader::TapSignalTimer()
         signal1stHalf = !signal1stHalf;
     }
 
+    if (processSignal && motorOn)
+    {
+        telemetry.RecordIsr(ReadTimerTicks() - isrStart, isrStart);
+    }
+
     if (!stopping)
     {
 #ifdef ROO_TESTING
@@ -4,7 +4,8 @@ using namespace TapuinoNext;
 
 ESP32TapRecorder* ESP32TapRecorder::internalClass = NULL;
 
-ESP32TapRecorder::ESP32TapRecorder(UtilityCollection* utilityCollection) : TapRecorder(utilityCollection)
+ESP32TapRecorder::ESP32TapRecorder(UtilityCollection* utilityCollection, roo_scheduler::Scheduler& scheduler)
+    : TapRecorder(utilityCollection, scheduler)
 {
     ESP32TapRecorder::internalClass = this;
 }
@@ -13,23 +14,23 @@ ESP32TapRecorder::~ESP32TapRecorder()
 {
 }
 
-void ESP32TapRecorder::TapSignalCallback(uint64_t curEdgeTime)
+void IRAM_ATTR ESP32TapRecorder::TapSignalCallback(uint32_t curEdgeTime)
 {
-    if (lastEdgeTime == 0)
+    if (firstEdge)
     {
-        lastEdgeTime = curEdgeTime;
+        firstEdge = false;
     }
     else
     {
-        uint64_t diffTime = curEdgeTime - lastEdgeTime;
-        lastEdgeTime = curEdgeTime;
-        CalcTapData(diffTime);
+        // Wraps correctly, as long as edges are less than ~71 minutes apart.
+        edgeRing.Push(curEdgeTime - lastEdgeTime);
     }
+    lastEdgeTime = curEdgeTime;
 }
 
 void ESP32TapRecorder::HWStartSampling()
 {
-    lastEdgeTime = 0;
+    firstEdge = true;
     attachInterrupt(digitalPinToInterrupt(C64_WRITE_PIN), TapSignalCallbackStatic, RISING);
 }
 
@@ -41,6 +42,6 @@ void ESP32TapRecorder::HWStopSampling()
 void IRAM_ATTR ESP32TapRecorder::TapSignalCallbackStatic()
 {
     // capture as close to the interrupt as possible
-    uint64_t curEdgeTime = esp_timer_get_time();
+    uint32_t curEdgeTime = (uint32_t) esp_timer_get_time();
     ESP32TapRecorder::internalClass->TapSignalCallback(curEdgeTime);
 }
@@ -1,169 +1,401 @@
 #ifdef ESP32
 #include "core/include/ESP32TapeCartLoader.h"
-#include "core/include/2-DCube.h"
+#include "soc/gpio_struct.h"
 
 using namespace TapuinoNext;
 
 #define MAGIC_LOADER_VALUE 0xca65
 
+// Byte timing, in us from the rising edge of write: the four bit pairs are
+// put on sense+write at these times, each for 9 us. The C64 samples them in
+// the middle, which absorbs the latency of the interrupt.
+#define SLOT_0_US 4
+#define SLOT_1_US 13
+#define SLOT_2_US 22
+#define SLOT_3_US 31
+#define RELEASE_US 41
+
 ESP32TapeCartLoader* ESP32TapeCartLoader::internalClass = NULL;
 
-ESP32TapeCartLoader::ESP32TapeCartLoader(UtilityCollection* utilityCollection, File& prgFile)
+// The bit pairs of each byte, in the order of sending: bits 5+4, 7+6, 1+0
+// and 3+2 (sense+write) end up in bits 1+0, 3+2, 5+4 and 7+6.
+static DRAM_ATTR uint8_t slotPatterns[256];
+
+static inline void IRAM_ATTR SetPin(uint8_t pin, bool high)
 {
-    this->flipBuffer = utilityCollection->flipBuffer;
-    this->prgFile = prgFile;
+    if (pin < 32)
+    {
+        if (high)
+            GPIO.out_w1ts = 1UL << pin;
+        else
+            GPIO.out_w1tc = 1UL << pin;
+    }
+    else
+    {
+        if (high)
+            GPIO.out1_w1ts.val = 1UL << (pin - 32);
+        else
+            GPIO.out1_w1tc.val = 1UL << (pin - 32);
+    }
+}
+
+static inline bool IRAM_ATTR GetPin(uint8_t pin)
+{
+    return pin < 32 ? (GPIO.in >> pin) & 1 : (GPIO.in1.val >> (pin - 32)) & 1;
+}
+
+// Switches between driving the pin and the input with the pull-up, without
+// touching the pad configuration.
+static inline void IRAM_ATTR SetPinOutput(uint8_t pin, bool output)
+{
+    if (pin < 32)
+    {
+        if (output)
+            GPIO.enable_w1ts = 1UL << pin;
+        else
+            GPIO.enable_w1tc = 1UL << pin;
+    }
+    else
+    {
+        if (output)
+            GPIO.enable1_w1ts.val = 1UL << (pin - 32);
+        else
+            GPIO.enable1_w1tc.val = 1UL << (pin - 32);
+    }
+}
+
+static inline void IRAM_ATTR ClearPinInterrupt(uint8_t pin)
+{
+    if (pin < 32)
+        GPIO.status_w1tc = 1UL << pin;
+    else
+        GPIO.status1_w1tc.val = 1UL << (pin - 32);
+}
+
+ESP32TapeCartLoader::ESP32TapeCartLoader(UtilityCollection* utilityCollection, roo_scheduler::Scheduler& scheduler)
+    : refillTick(scheduler, [this](){RefillTick(); }, roo_time::Millis(10))
+{
+    this->utilityCollection = utilityCollection;
     ESP32TapeCartLoader::internalClass = this;
     loaderMode = false;
+    sampling = false;
     shiftReg = 0;
+    sending = false;
+    ready = false;
+    bytesSent = 0;
+    totalBytes = 0;
+    startTime = 0;
+    endTime = 0;
+    mux = portMUX_INITIALIZER_UNLOCKED;
+
+    for (int b = 0; b < 256; b++)
+    {
+        slotPatterns[b] = ((b >> 4) & 0x03) | (((b >> 6) & 0x03) << 2) | ((b & 0x03) << 4) | (((b >> 2) & 0x03) << 6);
+    }
 }
 
 ESP32TapeCartLoader::~ESP32TapeCartLoader()
 {
+    Abort();
+    Stop();
 }
 
 void ESP32TapeCartLoader::Init()
 {
-    HWStartSampling();
+    loaderMode = false;
+    shiftReg = 0;
+    if (!sampling)
+    {
+        sampling = true;
+        HWStartSampling();
+    }
 }
 
-bool ESP32TapeCartLoader::FastSendByte(uint8_t byte)
+void ESP32TapeCartLoader::Stop()
 {
-    portDISABLE_INTERRUPTS();
-    digitalWrite(C64_SENSE_PIN, LOW);
+    if (sampling)
+    {
+        sampling = false;
+        HWStopSampling();
+    }
+}
 
-    /* wait until write is high or abort if motor is active */
-    while (!digitalRead(C64_WRITE_PIN))
+bool ESP32TapeCartLoader::CheckForMode()
+{
+    int count = 0;
+    while (!loaderMode && sampling && count < 10)
     {
-        if (digitalRead(C64_MOTOR_PIN))
-        {
-            digitalWrite(C64_SENSE_PIN, HIGH);
-            portENABLE_INTERRUPTS();
-            return false;
-        }
+        count++;
+        delay(100);
     }
+    Stop();
+    return (loaderMode);
+}
 
-    uint64_t curTime = esp_timer_get_time();
+ErrorCodes ESP32TapeCartLoader::Send(tapuino::InputStream input, std::function<void(ErrorCodes)> onFinished)
+{
+    static const uint8_t basicStarter[] = {
+        0x20, 0x59, 0xa6, // jsr $a659    ; set basic pointer and CLR
+        0x4c, 0xae, 0xa7, // jmp $a7ae    ; RUN
+        0x00              // $0800 must be zero
+    };
+
+    Abort();
+    uint8_t callAddrBuf[2];
+    uint32_t size = input.size();
+    if (size < 3 || input.readFully(callAddrBuf, 2) != 2)
+    {
+        return ErrorCodes::FILE_ERROR;
+    }
+    // remove the call / load address from the size
+    uint32_t dataSize = size - 2;
+    uint16_t callAddr = callAddrBuf[0] | ((uint16_t) callAddrBuf[1] << 8);
+    uint32_t starterSize = 0;
+    if (callAddr == 0x0801)
+    {
+        starterSize = sizeof(basicStarter);
+        callAddr = 0x0801 - starterSize;
+    }
+    uint16_t loadAddr = callAddr;
+    uint16_t endAddr = loadAddr + starterSize + dataSize;
+    uint8_t header[] = {
+        (uint8_t) (callAddr & 0xff), (uint8_t) (callAddr >> 8), (uint8_t) (endAddr & 0xff),
+        (uint8_t) (endAddr >> 8),    (uint8_t) (loadAddr & 0xff), (uint8_t) (loadAddr >> 8),
+    };
+    memcpy(prefix, header, sizeof(header));
+    memcpy(prefix + sizeof(header), basicStarter, starterSize);
+    prefixSize = sizeof(header) + starterSize;
+    prefixPos = 0;
+    this->input = std::move(input);
+    this->onFinished = onFinished;
+    sourceFailed = false;
+    totalBytes = prefixSize + dataSize;
+    bytesRead = 0;
+    bytesSent = 0;
+    cyclesPerUs = getCpuFrequencyMhz();
+
+    fill[0] = 0;
+    fill[1] = 0;
+    active = 0;
+    bufferPos = 0;
+    ready = false;
+    clocked = false;
+    Refill();
+    if (sourceFailed)
+    {
+        this->input.close();
+        return ErrorCodes::FILE_ERROR;
+    }
 
-    /* at 4us: set write to output, send bits 5+4 on sense+write */
-    while (esp_timer_get_time() - curTime < 4)
-        ;
+    // OUTPUT first, so that the pad is routed to the GPIO output when the
+    // interrupt enables the driver.
     pinMode(C64_WRITE_PIN, OUTPUT);
-    digitalWrite(C64_SENSE_PIN, byte & (1 << 5));
-    digitalWrite(C64_WRITE_PIN, byte & (1 << 4));
+    pinMode(C64_WRITE_PIN, INPUT_PULLUP);
+    digitalWrite(C64_SENSE_PIN, HIGH);
+    sending = true;
+    startTime = micros();
+    endTime = startTime;
+    attachInterrupt(digitalPinToInterrupt(C64_WRITE_PIN), WriteSignalCallbackStatic, CHANGE);
+    portENTER_CRITICAL(&mux);
+    ready = true;
+    SetPin(C64_SENSE_PIN, LOW);
+    portEXIT_CRITICAL(&mux);
+    refillTick.start();
+    return ErrorCodes::OK;
+}
 
-    /* at 13us: send bits 7+6 on sense+write */
-    while (esp_timer_get_time() - curTime < 13)
-        ;
-    digitalWrite(C64_SENSE_PIN, byte & (1 << 7));
-    digitalWrite(C64_WRITE_PIN, byte & (1 << 6));
+void ESP32TapeCartLoader::Abort()
+{
+    if (!sending)
+    {
+        return;
+    }
+    onFinished = nullptr;
+    Finish(ErrorCodes::OPERATION_ABORTED);
+}
 
-    /* at 22us: send bits 1+0 on sense+write */
-    while (esp_timer_get_time() - curTime < 22)
-        ;
-    digitalWrite(C64_SENSE_PIN, byte & (1 << 1));
-    digitalWrite(C64_WRITE_PIN, byte & (1 << 0));
+uint32_t ESP32TapeCartLoader::GetBytesPerSecond() const
+{
+    uint32_t elapsed = (sending ? micros() : endTime) - startTime;
+    return elapsed == 0 ? 0 : (uint32_t) ((uint64_t) bytesSent * 1000000 / elapsed);
+}
 
-    /* at 31us: send bits 3+2 on sense+write */
-    while (esp_timer_get_time() - curTime < 31)
-        ;
-    digitalWrite(C64_SENSE_PIN, byte & (1 << 3));
-    digitalWrite(C64_WRITE_PIN, byte & (1 << 2));
+void ESP32TapeCartLoader::RefillTick()
+{
+    if (!sending)
+    {
+        return;
+    }
+    if (bytesSent == totalBytes)
+    {
+        Finish(ErrorCodes::OK);
+        return;
+    }
+    if (digitalRead(C64_MOTOR_PIN))
+    {
+        Finish(ErrorCodes::OPERATION_ABORTED);
+        return;
+    }
+    Refill();
+    if (sourceFailed)
+    {
+        Finish(ErrorCodes::FILE_ERROR);
+    }
+}
 
-    /* at 41us: set write to input again */
-    while (esp_timer_get_time() - curTime < 41)
-        ;
-    pinMode(C64_WRITE_PIN, INPUT_PULLUP); // enables pullup
+int32_t ESP32TapeCartLoader::ReadSource(uint8_t* buffer, uint32_t size)
+{
+    uint32_t n = 0;
+    while (prefixPos < prefixSize && n < size)
+    {
+        buffer[n++] = prefix[prefixPos++];
+    }
+    if (n < size)
+    {
+        int32_t read = input.read(buffer + n, size - n);
+        if (read < 0)
+        {
+            return read;
+        }
+        n += read;
+    }
+    bytesRead += n;
+    return n;
+}
 
-    /* at 53us: wait until write is low to ensure we don't accidentally re-trigger immediately */
-    while (esp_timer_get_time() - curTime < 53)
-        ;
-    while (digitalRead(C64_WRITE_PIN) && !digitalRead(C64_MOTOR_PIN))
-        ;
+void ESP32TapeCartLoader::Refill()
+{
+    // The active half first, in case the interrupt waits for it.
+    uint8_t first = active;
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        uint8_t b = first ^ i;
+        if (fill[b] != 0)
+        {
+            continue;
+        }
+        int32_t n = ReadSource(buffers[b], TAPECART_BUFFER_SIZE);
+        if (n < 0 || (n == 0 && bytesRead < totalBytes))
+        {
+            // An error, or the input is shorter than it claimed.
+            sourceFailed = true;
+            return;
+        }
+        if (n == 0)
+        {
+            return;
+        }
+        portENTER_CRITICAL(&mux);
+        fill[b] = n;
+        if (sending && !ready && b == active)
+        {
+            // Resume the stalled transfer.
+            ready = true;
+            SetPin(C64_SENSE_PIN, LOW);
+        }
+        portEXIT_CRITICAL(&mux);
+    }
+}
 
+void ESP32TapeCartLoader::Finish(ErrorCodes result)
+{
+    refillTick.stop();
+    detachInterrupt(digitalPinToInterrupt(C64_WRITE_PIN));
+    sending = false;
+    ready = false;
+    clocked = false;
+    endTime = micros();
     digitalWrite(C64_SENSE_PIN, HIGH);
-    portENABLE_INTERRUPTS();
-    return true;
+    // Back to the idle state of the line, as set up by TapBase.
+    pinMode(C64_WRITE_PIN, INPUT_PULLDOWN);
+    input.close();
+    std::function<void(ErrorCodes)> callback = std::move(onFinished);
+    onFinished = nullptr;
+    if (callback)
+    {
+        callback(result);
+    }
 }
 
-bool ESP32TapeCartLoader::CheckForMode()
+void IRAM_ATTR ESP32TapeCartLoader::WriteSignalCallbackStatic()
 {
-    int count = 0;
-    if (!loaderMode)
+    ESP32TapeCartLoader::internalClass->WriteSignalCallback();
+}
+
+void IRAM_ATTR ESP32TapeCartLoader::WriteSignalCallback()
+{
+    uint32_t start = ESP.getCycleCount();
+    if (!GetPin(C64_WRITE_PIN))
     {
-        // utilityCollection->lcdUtils->Title("Fastloader init");
-        // utilityCollection->lcdUtils->Status("Waiting...");
-        while (count < 10)
+        // The C64 is done with the byte clocked out last, if any.
+        if (clocked)
         {
-            count++;
-            delay(100);
+            ByteDone();
         }
+        return;
     }
-    HWStopSampling();
-    if (!loaderMode)
+    if (!ready || clocked)
     {
-        // utilityCollection->lcdUtils->Error("FastLoader", "Not detected!");
+        // Not a request for a byte of ours.
+        return;
+    }
+    uint8_t pattern = slotPatterns[buffers[active][bufferPos]];
+
+    /* at 4us: set write to output, send bits 5+4 on sense+write */
+    WaitUntil(start, SLOT_0_US);
+    SetPin(C64_SENSE_PIN, pattern & 0x02);
+    SetPin(C64_WRITE_PIN, pattern & 0x01);
+    SetPinOutput(C64_WRITE_PIN, true);
+
+    /* at 13us: send bits 7+6 on sense+write */
+    WaitUntil(start, SLOT_1_US);
+    SetPin(C64_SENSE_PIN, pattern & 0x08);
+    SetPin(C64_WRITE_PIN, pattern & 0x04);
+
+    /* at 22us: send bits 1+0 on sense+write */
+    WaitUntil(start, SLOT_2_US);
+    SetPin(C64_SENSE_PIN, pattern & 0x20);
+    SetPin(C64_WRITE_PIN, pattern & 0x10);
+
+    /* at 31us: send bits 3+2 on sense+write */
+    WaitUntil(start, SLOT_3_US);
+    SetPin(C64_SENSE_PIN, pattern & 0x80);
+    SetPin(C64_WRITE_PIN, pattern & 0x40);
+
+    /* at 41us: set write to input again */
+    WaitUntil(start, RELEASE_US);
+    SetPinOutput(C64_WRITE_PIN, false);
+    clocked = true;
+
+    // Driving write has registered as edges. The byte is done when the C64
+    // lowers write, which it may have already; otherwise, the falling edge
+    // raises the interrupt again (even if it comes right after the check).
+    ClearPinInterrupt(C64_WRITE_PIN);
+    if (!GetPin(C64_WRITE_PIN))
+    {
+        ByteDone();
     }
-    return (loaderMode);
 }
 
-bool ESP32TapeCartLoader::LoadPRG()
-{
-    // if (!CheckForMode())
-    // {
-    //     return false;
-    // }
-
-    // flipBuffer->Reset();
-
-    // uint8_t callAddrBuf[2];
-    // size_t dataSize = prgFile.size();
-
-    // prgFile.read(callAddrBuf, 2);
-    // // remove the call / load address from the size
-    // dataSize -= 2;
-
-    // callAddr = callAddrBuf[0] | ((uint16_t) callAddrBuf[1] << 8);
-    // uint32_t starterSize = 0;
-
-    // if (callAddr == 0x0801)
-    // {
-    //     static uint8_t basic_starter[] = {
-    //         //            0xfa, 0x07,       // load at $07fa
-    //         0x20, 0x59, 0xa6, // jsr $a659    ; set basic pointer and CLR
-    //         0x4c, 0xae, 0xa7, // jmp $a7ae    ; RUN
-    //         0x00              // $0800 must be zero
-    //     };
-    //     starterSize = sizeof(basic_starter) / sizeof(uint8_t);
-    //     flipBuffer->SetHeader(basic_starter, starterSize);
-    //     callAddr = 0x0801 - starterSize;
-    // }
-    // flipBuffer->FillWholeBuffer(prgFile, starterSize);
-    // loadAddr = callAddr;
-    // endAddr = loadAddr + dataSize;
-
-    // if (!FastSendByte(callAddr & 0xff))
-    //     return false;
-    // if (!FastSendByte(callAddr >> 8))
-    //     return false;
-    // if (!FastSendByte(endAddr & 0xff))
-    //     return false;
-    // if (!FastSendByte(endAddr >> 8))
-    //     return false;
-    // if (!FastSendByte(loadAddr & 0xff))
-    //     return false;
-    // if (!FastSendByte(loadAddr >> 8))
-    //     return false;
-
-    // /* transmit data */
-    // while (dataSize > 0)
-    // {
-    //     dataSize--;
-    //     if (!FastSendByte(flipBuffer->ReadByte()))
-    //         return false;
-    //     flipBuffer->FillBufferIfNeeded(prgFile);
-    // }
-
-    return true;
+void IRAM_ATTR ESP32TapeCartLoader::ByteDone()
+{
+    portENTER_CRITICAL_ISR(&mux);
+    clocked = false;
+    bytesSent++;
+    if (++bufferPos == fill[active])
+    {
+        // Hand the half over to the refill.
+        fill[active] = 0;
+        active ^= 1;
+        bufferPos = 0;
+    }
+    ready = fill[active] != 0;
+    SetPin(C64_SENSE_PIN, HIGH);
+    if (ready)
+    {
+        SetPin(C64_SENSE_PIN, LOW);
+    }
+    portEXIT_CRITICAL_ISR(&mux);
 }
 
 void ESP32TapeCartLoader::MotorSignalCallback(bool writeHigh)
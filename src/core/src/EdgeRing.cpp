@@ -0,0 +1,41 @@
+#include "core/include/EdgeRing.h"
+
+#include <stdlib.h>
+
+using namespace TapuinoNext;
+
+EdgeRing::EdgeRing(uint32_t size) : pBuffer(NULL), size(size), mask(size - 1), head(0), tail(0), overflowCounter(0)
+{
+}
+
+EdgeRing::~EdgeRing()
+{
+    Release();
+}
+
+ErrorCodes EdgeRing::Init()
+{
+    if (pBuffer == NULL)
+    {
+        pBuffer = (uint32_t*) malloc(size * sizeof(uint32_t));
+        if (pBuffer == NULL) return ErrorCodes::OUT_OF_MEMORY;
+    }
+    Reset();
+    return ErrorCodes::OK;
+}
+
+void EdgeRing::Release()
+{
+    if (pBuffer != NULL)
+    {
+        free(pBuffer);
+        pBuffer = NULL;
+    }
+}
+
+void EdgeRing::Reset()
+{
+    head.store(0);
+    tail.store(0);
+    overflowCounter = 0;
+}
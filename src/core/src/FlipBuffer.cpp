@@ -1,5 +1,7 @@
 #include "core/include/FlipBuffer.h"
 
+#include "esp_heap_caps.h"
+
 #include "io/buffered_reader.h"
 #include "io/input_stream.h"
 
@@ -19,30 +21,45 @@ FlipBuffer::FlipBuffer(uint32_t bufferSize) {
   bufferSwitchPos = halfBufferSize;
 
   pBuffer = NULL;
+  streamBuffer = NULL;
+  wholeBuffer = NULL;
+  wholeSize = 0;
+  prefetchBuffer = NULL;
+  prefetchFilled = 0;
   bufferPos = 0;
+  cyclicByteCounter = 0;
+  filledByteCounter = 0;
+  underrunCounter = 0;
 }
 
 FlipBuffer::~FlipBuffer() {
-  if (pBuffer != NULL) {
-    free(pBuffer);
+  ReleaseWhole();
+  DropPrefetched();
+  if (streamBuffer != NULL) {
+    free(streamBuffer);
+    streamBuffer = NULL;
     pBuffer = NULL;
   }
 }
 
 ErrorCodes FlipBuffer::Init() {
-  if (pBuffer == NULL) {
-    pBuffer = (uint8_t*)malloc(bufferSize);
-    if (pBuffer == NULL) return ErrorCodes::OUT_OF_MEMORY;
+  if (streamBuffer == NULL) {
+    streamBuffer = (uint8_t*)malloc(bufferSize);
+    if (streamBuffer == NULL) return ErrorCodes::OUT_OF_MEMORY;
   }
+  pBuffer = streamBuffer;
 
   bufferPos = 0;
   return ErrorCodes::OK;
 }
 
 void FlipBuffer::Reset() {
+  ReleaseWhole();
   if (pBuffer != NULL) {
     memset(pBuffer, 0, bufferSize);
     bufferPos = 0;
+    bufferSwitchPos = halfBufferSize;
+    bufferSwitchFlag = false;
   }
 }
 
@@ -59,20 +76,118 @@ ErrorCodes FlipBuffer::SetHeader(uint8_t* header, uint32_t size) {
 ErrorCodes FlipBuffer::FillWholeBuffer(tapuino::InputStream& tapFile,
                                        uint32_t atPos) {
   if (atPos < bufferSize) {
-    if (tapFile.readFully(&pBuffer[atPos], bufferSize - atPos) < 0) {
+    int32_t read = tapFile.readFully(&pBuffer[atPos], bufferSize - atPos);
+    if (read < 0) {
       return ErrorCodes::FILE_ERROR;
     }
     bufferPos = 0;
+    bufferSwitchPos = halfBufferSize;
+    bufferSwitchFlag = false;
+    cyclicByteCounter = 0;
+    filledByteCounter = atPos + read;
+    underrunCounter = 0;
     return ErrorCodes::OK;
   }
   return ErrorCodes::OUT_OF_RANGE;
 }
 
+// Heap left free when loading a whole file, for the rest of the system.
+#define WHOLE_FILE_HEAP_RESERVE (32 * 1024)
+
+ErrorCodes FlipBuffer::LoadWhole(tapuino::InputStream& tapFile, uint32_t size) {
+  ReleaseWhole();
+  if (size == 0 ||
+      heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) < size + WHOLE_FILE_HEAP_RESERVE) {
+    return ErrorCodes::OUT_OF_MEMORY;
+  }
+  // Zero-padded, so that a multi-byte pulse truncated at the end of the file
+  // does not read past the buffer.
+  uint8_t* buffer = (uint8_t*)heap_caps_calloc(size + 4, 1, MALLOC_CAP_8BIT);
+  if (buffer == NULL) {
+    return ErrorCodes::OUT_OF_MEMORY;
+  }
+  int32_t read = tapFile.readFully(buffer, size);
+  if (read != (int32_t)size) {
+    free(buffer);
+    return ErrorCodes::FILE_ERROR;
+  }
+  wholeBuffer = buffer;
+  wholeSize = size;
+  pBuffer = wholeBuffer;
+  // The switch position is never reached, so no refills are requested.
+  bufferMask = 0xFFFFFFFF;
+  SeekWhole(0);
+  return ErrorCodes::OK;
+}
+
+void FlipBuffer::SeekWhole(uint32_t pos) {
+  bufferPos = pos;
+  bufferSwitchPos = 0xFFFFFFFF;
+  bufferSwitchFlag = false;
+  cyclicByteCounter = pos;
+  filledByteCounter = wholeSize;
+  underrunCounter = 0;
+}
+
+void FlipBuffer::ReleaseWhole() {
+  if (wholeBuffer == NULL) return;
+  free(wholeBuffer);
+  wholeBuffer = NULL;
+  wholeSize = 0;
+  pBuffer = streamBuffer;
+  bufferMask = bufferSize - 1;
+  bufferPos = 0;
+  bufferSwitchPos = halfBufferSize;
+  bufferSwitchFlag = false;
+}
+
+ErrorCodes FlipBuffer::Prefetch(tapuino::InputStream& tapFile) {
+  DropPrefetched();
+  uint8_t* buffer = (uint8_t*)malloc(bufferSize);
+  if (buffer == NULL) {
+    return ErrorCodes::OUT_OF_MEMORY;
+  }
+  int32_t read = tapFile.readFully(buffer, bufferSize);
+  if (read < 0) {
+    free(buffer);
+    return ErrorCodes::FILE_ERROR;
+  }
+  prefetchBuffer = buffer;
+  prefetchFilled = read;
+  return ErrorCodes::OK;
+}
+
+void FlipBuffer::UsePrefetched() {
+  if (prefetchBuffer == NULL) return;
+  ReleaseWhole();
+  free(streamBuffer);
+  streamBuffer = prefetchBuffer;
+  pBuffer = streamBuffer;
+  prefetchBuffer = NULL;
+  bufferPos = 0;
+  bufferSwitchPos = halfBufferSize;
+  bufferSwitchFlag = false;
+  cyclicByteCounter = 0;
+  filledByteCounter = prefetchFilled;
+  underrunCounter = 0;
+  prefetchFilled = 0;
+}
+
+void FlipBuffer::DropPrefetched() {
+  if (prefetchBuffer == NULL) return;
+  free(prefetchBuffer);
+  prefetchBuffer = NULL;
+  prefetchFilled = 0;
+}
+
 uint8_t FlipBuffer::ReadByte() {
   if (bufferPos == bufferSwitchPos) {
     bufferSwitchFlag = true;
   }
 
+  if (cyclicByteCounter++ == filledByteCounter) {
+    underrunCounter++;
+  }
   uint8_t ret = pBuffer[bufferPos++];
   bufferPos &= bufferMask;
   return ret;
@@ -86,6 +201,7 @@ ErrorCodes FlipBuffer::FillBufferIfNeeded(tapuino::InputStream& tapFile) {
     if (read < 0) {
       return ErrorCodes::FILE_ERROR;
     }
+    filledByteCounter += read;
   }
   return ErrorCodes::OK;
 }
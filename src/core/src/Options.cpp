@@ -16,26 +16,41 @@ TheMenu optionsMenu = {S_OPTIONS, (MenuEntry*) optionsMenuEntries, 3, 0, NULL};
 MenuEntry optionsInputMenuEntries[] = {
     {MenuEntryType::ValueEntry, S_BTN_CLICK_TIME, NULL}, {MenuEntryType::ValueEntry, S_BTN_HOLD_TIME, NULL}, {MenuEntryType::ValueEntry, S_TICKER_TIME, NULL},
     {MenuEntryType::ToggleEntry, S_AUTOPLAY, NULL},      {MenuEntryType::ToggleEntry, S_BACKLIGHT, NULL},
+    {MenuEntryType::ToggleEntry, S_HIDE_UNPLAYABLE, NULL},
 };
 
 MenuEntry optionsMachineMenuEntries[] = {
     {MenuEntryType::ToggleEntry, S_VIDEO_MODE, NULL},
     {MenuEntryType::EnumEntry, S_MACHINE_TYPE, NULL},
+    {MenuEntryType::ToggleEntry, S_FAST_PILOT, NULL},
+    {MenuEntryType::ToggleEntry, S_AUTO_CONTINUE, NULL},
+    {MenuEntryType::ToggleEntry, S_TURBO_PRG, NULL},
+    {MenuEntryType::ToggleEntry, S_TAPECART, NULL},
 };
 
-TheMenu optionsInputMenu = {S_INPUT_AND_UI, (MenuEntry*) optionsInputMenuEntries, 5, 0, &optionsMenu};
-TheMenu optionsMachineMenu = {S_MACHINE, (MenuEntry*) optionsMachineMenuEntries, 2, 0, &optionsMenu};
+TheMenu optionsInputMenu = {S_INPUT_AND_UI, (MenuEntry*) optionsInputMenuEntries, 6, 0, &optionsMenu};
+TheMenu optionsMachineMenu = {S_MACHINE, (MenuEntry*) optionsMachineMenuEntries, 6, 0, &optionsMenu};
 
 Options::Options(IChangeNotify* notify, ActionCallback* updateCallback)
     : ntscPAL(OptionTagId::IsNTSC, notify, false, "PAL", "NTSC"),
       autoPlay(OptionTagId::AutoPlay, notify, true, S_FALSE, S_TRUE),
       backlight(OptionTagId::Backlight, notify, false, S_OFF, S_ON),
-      machineType(OptionTagId::Machine, notify, machineTypeNames, 3, 0)
+      machineType(OptionTagId::Machine, notify, machineTypeNames, 3, 0),
+      fastPilot(OptionTagId::FastPilot, notify, false, S_OFF, S_ON),
+      autoContinue(OptionTagId::AutoContinue, notify, false, S_OFF, S_ON),
+      turboPrg(OptionTagId::TurboPrg, notify, false, S_OFF, S_ON),
+      tapeCart(OptionTagId::TapeCart, notify, false, S_OFF, S_ON),
+      hideUnplayable(OptionTagId::HideUnplayable, notify, false, S_OFF, S_ON)
 {
     allOptions.push_back(&ntscPAL);
     allOptions.push_back(&autoPlay);
     allOptions.push_back(&backlight);
     allOptions.push_back(&machineType);
+    allOptions.push_back(&fastPilot);
+    allOptions.push_back(&autoContinue);
+    allOptions.push_back(&turboPrg);
+    allOptions.push_back(&tapeCart);
+    allOptions.push_back(&hideUnplayable);
 }
 
 const char* Options::TagIdToString(OptionTagId id)
@@ -66,6 +81,19 @@ const char* Options::TagIdToString(OptionTagId id)
         case OptionTagId::Machine:
             return "Machine";
             break;
+        case OptionTagId::FastPilot:
+            return "FastPilot";
+            break;
+        case OptionTagId::AutoContinue:
+            return "AutoContinue";
+            break;
+        case OptionTagId::TurboPrg:
+            return "TurboPrg";
+        case OptionTagId::TapeCart:
+            return "TapeCart";
+        case OptionTagId::HideUnplayable:
+            return "HideUnplayable";
+            break;
         case OptionTagId::LAST:
         default:
             return "";
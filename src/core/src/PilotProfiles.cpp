@@ -0,0 +1,32 @@
+#include "core/include/PilotProfiles.h"
+#include <stddef.h>
+
+using namespace TapuinoNext;
+
+// Ranges must not overlap. The data pulses of many loaders fall in these
+// ranges too, and a run of identical data bytes makes a long run of identical
+// pulses; only the first run after a pause (before any sync) is matched, see
+// PilotRunTracker. Loaders with bit-encoded pilot bytes (e.g. Turbo Tape, and
+// the turbo mode of PRG playback) have no such run, so their pilot is played
+// as is.
+static const PilotProfile pilotProfiles[] = {
+    // Kernal loader: 0x6A00 and 0x1A00 pulse pilots, (S)hort pulse ~0x30. It
+    // syncs within a few hundred pulses; processing between blocks (and the
+    // "FOUND" pause) happens with the motor stopped.
+    {"CBM ROM", MACHINE_TYPE::C64, 0x2B, 0x37, 1536, 3, 1000000},
+    // Turbo loaders with a plain short pulse pilot (e.g. Novaload). Less is
+    // known about them, so keep more of the pilot and the gaps.
+    {"Short pilot turbo", MACHINE_TYPE::C64, 0x14, 0x2A, 4096, 1, 2000000},
+};
+
+const PilotProfile* TapuinoNext::FindPilotProfile(uint8_t platform, uint8_t pulse)
+{
+    for (const PilotProfile& profile : pilotProfiles)
+    {
+        if ((uint8_t) profile.machine == platform && pulse >= profile.minPulse && pulse <= profile.maxPulse)
+        {
+            return &profile;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,72 @@
+#include "core/include/PlaybackTelemetry.h"
+
+using namespace TapuinoNext;
+
+void TelemetryHistogram::Reset()
+{
+    for (int i = 0; i < kBuckets; i++)
+    {
+        buckets[i] = 0;
+    }
+    count = 0;
+    maxValue = 0;
+}
+
+uint32_t TelemetryHistogram::Percentile(uint8_t percent) const
+{
+    uint32_t total = count;
+    if (total == 0)
+    {
+        return 0;
+    }
+    // Rank of the percentile, rounded up, so that p100 lands on the last value.
+    uint32_t rank = (uint32_t) (((uint64_t) total * percent + 99) / 100);
+    if (rank == 0) rank = 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < kBuckets; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            uint32_t upper = (i == 0) ? 0 : (uint32_t) ((1ULL << i) - 1);
+            return upper < maxValue ? upper : maxValue;
+        }
+    }
+    return maxValue;
+}
+
+void PlaybackTelemetry::Reset()
+{
+    minFill = 0xFFFFFFFF;
+    fillSum = 0;
+    fillSamples = 0;
+    underruns = 0;
+    sourceBytes = 0;
+    sourceMicros = 0;
+    refillMicros.Reset();
+    isrExecTicks.Reset();
+    isrLatenessTicks.Reset();
+}
+
+void PlaybackTelemetry::RecordBufferFill(uint32_t fill)
+{
+    if (fill < minFill) minFill = fill;
+    fillSum += fill;
+    fillSamples++;
+}
+
+void PlaybackTelemetry::RecordRefill(uint32_t durationMicros, uint32_t bytes)
+{
+    refillMicros.Record(durationMicros);
+    sourceBytes += bytes;
+    sourceMicros += durationMicros;
+}
+
+uint32_t PlaybackTelemetry::SourceBytesPerSecond() const
+{
+    if (sourceMicros == 0)
+    {
+        return 0;
+    }
+    return (uint32_t) (sourceBytes * 1000000 / sourceMicros);
+}
@@ -19,6 +19,8 @@ TapBase::TapBase(UtilityCollection* utilityCollection)
 
     cycleMultRaw = 1;
     cycleMult8 = 1;
+    cycleMultRawFixed = 1 << 16;
+    cycleMult8Fixed = 1 << 16;
     
     pinMode(C64_SENSE_PIN, OUTPUT);
     digitalWrite(C64_SENSE_PIN, HIGH);
@@ -59,12 +61,16 @@ void TapBase::SetupCycleTiming()
 
     switch ((VIDEO_MODE) tapInfo.video)
     {
-        case VIDEO_MODE::PAL:
-            cycleMultRaw = (1000000.0 / pal_cycles_per_second);
-            break;
         case VIDEO_MODE::NSTC:
             cycleMultRaw = (1000000.0 / ntsc_cycles_per_second);
             break;
+        // Unknown values default to PAL, as the indexer assumes.
+        case VIDEO_MODE::PAL:
+        default:
+            cycleMultRaw = (1000000.0 / pal_cycles_per_second);
+            break;
     }
     cycleMult8 = (cycleMultRaw * 8.0);
+    cycleMultRawFixed = (uint32_t) (cycleMultRaw * 65536.0 + 0.5);
+    cycleMult8Fixed = (uint32_t) (cycleMult8 * 65536.0 + 0.5);
 }
@@ -0,0 +1,533 @@
+#include "core/include/TapBlockIndex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "io/buffered_reader.h"
+#include "io/buffered_writer.h"
+
+using namespace TapuinoNext;
+
+#define BLOCK_INDEX_MAGIC 0x54424C4B // "TBLK"
+#define BLOCK_INDEX_VERSION 1
+// Position, cycles, type, file type, addresses, name.
+#define BLOCK_RECORD_SIZE 30
+
+static uint32_t ReadBE32(const uint8_t* p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// Pulses of at least this many TAP units (~2 ms) are pauses between blocks.
+#define PAUSE_UNITS 0x100
+
+// Runs of pulses between pauses shorter than this are noise, not blocks.
+#define MIN_BLOCK_PULSES 256
+
+// A run of this many identical pulses, following at least MIN_BLOCK_PULSES
+// others, is the pilot of a new block, even without a pause before it.
+#define PILOT_SPLIT_RUN 1024
+#define PILOT_TOLERANCE 2
+
+// Only this many pulses of a block go into its histogram, so that the 16-bit
+// bins can't overflow.
+#define HISTOGRAM_PULSES 65535
+
+#define CBM_COUNTDOWN_BYTES 9
+// 192 bytes, plus the checksum.
+#define CBM_HEADER_BYTES 193
+
+// The turbo bit threshold is learned from this many pulses of the pilot.
+#define TURBO_LEARN_PULSES 32
+#define TURBO_PILOT_BYTE 0x02
+#define TURBO_SYNC_BYTE 0x09
+#define TURBO_MIN_PILOT_BYTES 16
+
+const char* TapuinoNext::TapBlockTypeName(TapBlockType type)
+{
+    switch (type)
+    {
+        case TapBlockType::CbmHeader:
+            return "CBM header";
+        case TapBlockType::CbmData:
+            return "CBM data";
+        case TapBlockType::TurboTapeHeader:
+            return "Turbo Tape header";
+        case TapBlockType::TurboTapeData:
+            return "Turbo Tape data";
+        case TapBlockType::Turbo:
+            return "Turbo";
+        default:
+            return "Unknown";
+    }
+}
+
+TapBlockIndex::TapBlockIndex()
+{
+    Clear();
+}
+
+void TapBlockIndex::Clear()
+{
+    blocks.clear();
+    length = 0;
+    complete = false;
+}
+
+void TapBlockIndex::Begin(uint32_t tapLength)
+{
+    Clear();
+    length = tapLength;
+}
+
+void TapBlockIndex::Add(const TapBlock& block)
+{
+    blocks.push_back(block);
+}
+
+void TapBlockIndex::Finish()
+{
+    complete = true;
+}
+
+int TapBlockIndex::Find(uint32_t position) const
+{
+    size_t lo = 0;
+    size_t hi = blocks.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (blocks[mid].position <= position)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (int) lo - 1;
+}
+
+ErrorCodes TapBlockIndex::Load(FS& fs, const char* path, uint32_t tapLength)
+{
+    Clear();
+    File f = fs.open(path, "r");
+    if (!f)
+    {
+        return ErrorCodes::FILE_NOT_FOUND;
+    }
+    tapuino::BufferedReader<> reader;
+    reader.set(f);
+    if (reader.readU32() != BLOCK_INDEX_MAGIC || reader.readU16() != BLOCK_INDEX_VERSION ||
+        reader.readU32() != tapLength)
+    {
+        reader.close();
+        return ErrorCodes::FILE_ERROR;
+    }
+    uint32_t count = reader.readU32();
+    if (reader.eof())
+    {
+        reader.close();
+        return ErrorCodes::FILE_ERROR;
+    }
+    blocks.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t* record = reader.peek(BLOCK_RECORD_SIZE);
+        if (record == NULL)
+        {
+            break;
+        }
+        TapBlock block;
+        block.position = ReadBE32(record);
+        block.cycles = ReadBE32(record + 4);
+        block.type = (TapBlockType) record[8];
+        block.fileType = record[9];
+        block.startAddress = (record[10] << 8) | record[11];
+        block.endAddress = (record[12] << 8) | record[13];
+        memcpy(block.name, record + 14, 16);
+        block.name[16] = 0;
+        blocks.push_back(block);
+        reader.consume(BLOCK_RECORD_SIZE);
+    }
+    bool ok = !reader.eof();
+    reader.close();
+    if (!ok)
+    {
+        Clear();
+        return ErrorCodes::FILE_ERROR;
+    }
+    length = tapLength;
+    complete = true;
+    return ErrorCodes::OK;
+}
+
+ErrorCodes TapBlockIndex::Store(FS& fs, const char* path) const
+{
+    File f = fs.open(path, "w");
+    if (!f)
+    {
+        return ErrorCodes::FILE_WRITE_ERROR;
+    }
+    tapuino::BufferedWriter<> writer;
+    writer.set(f);
+    writer.writeU32(BLOCK_INDEX_MAGIC);
+    writer.writeU16(BLOCK_INDEX_VERSION);
+    writer.writeU32(length);
+    writer.writeU32(blocks.size());
+    for (const TapBlock& block : blocks)
+    {
+        writer.writeU32(block.position);
+        writer.writeU32(block.cycles);
+        writer.writeU8((uint8_t) block.type);
+        writer.writeU8(block.fileType);
+        writer.writeU16(block.startAddress);
+        writer.writeU16(block.endAddress);
+        writer.write((const uint8_t*) block.name, 16);
+    }
+    writer.close();
+    return f.getWriteError() == 0 ? ErrorCodes::OK : ErrorCodes::FILE_WRITE_ERROR;
+}
+
+TapBlockAnalyzer::TapBlockAnalyzer(TapBlockIndex& index) : index(index)
+{
+    inBlock = false;
+    runLength = 0;
+}
+
+void TapBlockAnalyzer::Begin(uint32_t tapLength)
+{
+    index.Begin(tapLength);
+    inBlock = false;
+    runLength = 0;
+}
+
+void TapBlockAnalyzer::Finish()
+{
+    EndBlock();
+    index.Finish();
+}
+
+void TapBlockAnalyzer::Pulse(uint32_t position, uint32_t cycles, uint32_t units)
+{
+    if (units >= PAUSE_UNITS)
+    {
+        EndBlock();
+        return;
+    }
+    if (!inBlock)
+    {
+        StartBlock(position, cycles);
+    }
+
+    if (runLength > 0 && units + PILOT_TOLERANCE >= runPulse && units <= runPulse + PILOT_TOLERANCE)
+    {
+        runLength++;
+        if (runLength == PILOT_SPLIT_RUN && runStartPulses >= MIN_BLOCK_PULSES)
+        {
+            // The run started a new block; the decoders only lose (some of)
+            // its pilot.
+            uint32_t length = runLength;
+            EndBlock();
+            StartBlock(runPosition, runCycles);
+            pulses = length - 1;
+            runLength = length;
+            runStartPulses = 0;
+        }
+    }
+    else
+    {
+        runPulse = units;
+        runLength = 1;
+        runPosition = position;
+        runCycles = cycles;
+        runStartPulses = pulses;
+    }
+
+    pulses++;
+    if (pulses <= HISTOGRAM_PULSES)
+    {
+        histogram[units]++;
+    }
+    CbmPulse(units);
+    TurboPulse(units);
+}
+
+void TapBlockAnalyzer::StartBlock(uint32_t position, uint32_t cycles)
+{
+    inBlock = true;
+    memset(&block, 0, sizeof(block));
+    block.position = position;
+    block.cycles = cycles;
+    pulses = 0;
+    memset(histogram, 0, sizeof(histogram));
+    ResetDecoders();
+}
+
+void TapBlockAnalyzer::ResetDecoders()
+{
+    cbmDecoder.Reset();
+    cbmCount = 0;
+    cbmDone = false;
+    cbmDataBytes = 0;
+
+    turboMin = UINT32_MAX;
+    turboMax = 0;
+    turboThreshold = 0;
+    turboShift = 0;
+    turboAligned = false;
+    turboPilotBytes = 0;
+    turboSynced = false;
+    turboCountdown = false;
+    turboDataBytes = 0;
+}
+
+void TapBlockAnalyzer::EndBlock()
+{
+    runLength = 0;
+    if (!inBlock)
+    {
+        return;
+    }
+    inBlock = false;
+    if (pulses < MIN_BLOCK_PULSES)
+    {
+        return;
+    }
+    // Data up to the end of the block, with no end marker.
+    CbmSequenceEnd();
+
+    if (cbmDataBytes > 0)
+    {
+        uint8_t fileType = cbmData[0];
+        if (fileType >= 1 && fileType <= 5 && cbmDataBytes >= CBM_HEADER_BYTES - 3 &&
+            cbmDataBytes <= CBM_HEADER_BYTES + 1)
+        {
+            block.type = TapBlockType::CbmHeader;
+            block.fileType = fileType;
+            block.startAddress = cbmData[1] | (cbmData[2] << 8);
+            block.endAddress = cbmData[3] | (cbmData[4] << 8);
+            CopyName(cbmData + 5, block.name);
+        }
+        else
+        {
+            block.type = TapBlockType::CbmData;
+        }
+    }
+    else if (turboSynced && turboCountdown)
+    {
+        // Turbo Tape 64 headers: file type (1 or 2), start and end address,
+        // a reserved byte, and the name. Data blocks start with a 0.
+        if (turboDataBytes >= sizeof(turboData) && (turboData[0] == 1 || turboData[0] == 2))
+        {
+            block.type = TapBlockType::TurboTapeHeader;
+            block.fileType = turboData[0];
+            block.startAddress = turboData[1] | (turboData[2] << 8);
+            block.endAddress = turboData[3] | (turboData[4] << 8);
+            CopyName(turboData + 6, block.name);
+        }
+        else
+        {
+            block.type = TapBlockType::TurboTapeData;
+        }
+    }
+    else if (turboSynced || HasTwoPeaks())
+    {
+        block.type = TapBlockType::Turbo;
+    }
+    else
+    {
+        block.type = TapBlockType::Unknown;
+    }
+    index.Add(block);
+}
+
+// The CBM data starts with a countdown: $89 to $81 in the first copy, $09 to
+// $01 in the repeated one.
+void TapBlockAnalyzer::CbmPulse(uint32_t units)
+{
+    if (cbmDone)
+    {
+        return;
+    }
+    int result = cbmDecoder.Pulse(units);
+    if (result >= 0)
+    {
+        CbmByte(result);
+    }
+    else if (result != CbmByteDecoder::NONE)
+    {
+        CbmSequenceEnd();
+    }
+}
+
+// Ends the current byte sequence. If it got past the countdown, it is the
+// data of the block; the repeated copy adds nothing.
+void TapBlockAnalyzer::CbmSequenceEnd()
+{
+    if (cbmCount > CBM_COUNTDOWN_BYTES)
+    {
+        cbmDataBytes = cbmCount - CBM_COUNTDOWN_BYTES;
+        cbmDone = true;
+    }
+    cbmCount = 0;
+}
+
+void TapBlockAnalyzer::CbmByte(uint8_t b)
+{
+    if (cbmCount > 0 && cbmCount < CBM_COUNTDOWN_BYTES && b != cbmCountdown - cbmCount)
+    {
+        cbmCount = 0;
+    }
+    if (cbmCount == 0)
+    {
+        if (b == 0x89 || b == 0x09)
+        {
+            cbmCountdown = b;
+            cbmCount = 1;
+        }
+        return;
+    }
+    if (cbmCount >= CBM_COUNTDOWN_BYTES && cbmCount - CBM_COUNTDOWN_BYTES < sizeof(cbmData))
+    {
+        cbmData[cbmCount - CBM_COUNTDOWN_BYTES] = b;
+    }
+    cbmCount++;
+}
+
+// Decodes two-pulse turbo encodings: a pulse longer than the threshold is a 1,
+// MSB first. The threshold is half way between the short and the long pulse
+// of the pilot, which is a repeated byte, followed by a sync byte. Turbo Tape
+// 64 uses $02 and $09, followed by a countdown from $08 to $01; the same bytes
+// with the bit sense inverted are recognized as well.
+void TapBlockAnalyzer::TurboPulse(uint32_t units)
+{
+    if (pulses <= TURBO_LEARN_PULSES)
+    {
+        if (units < turboMin)
+        {
+            turboMin = units;
+        }
+        if (units > turboMax)
+        {
+            turboMax = units;
+        }
+        if (pulses == TURBO_LEARN_PULSES && turboMax * 4 >= turboMin * 5)
+        {
+            turboThreshold = (turboMin + turboMax) / 2;
+        }
+        return;
+    }
+    if (turboThreshold == 0 || turboDataBytes >= sizeof(turboData))
+    {
+        return;
+    }
+    turboShift = (turboShift << 1) | (units > turboThreshold ? 1 : 0);
+    if (!turboAligned)
+    {
+        if (turboShift == TURBO_PILOT_BYTE || turboShift == (uint8_t) ~TURBO_PILOT_BYTE)
+        {
+            turboAligned = true;
+            turboInverted = turboShift != TURBO_PILOT_BYTE;
+            turboBits = 0;
+            turboPilotBytes = 1;
+        }
+        return;
+    }
+    if (++turboBits < 8)
+    {
+        return;
+    }
+    turboBits = 0;
+    TurboByte(turboInverted ? ~turboShift : turboShift);
+}
+
+void TapBlockAnalyzer::TurboByte(uint8_t b)
+{
+    if (!turboSynced)
+    {
+        if (b == TURBO_PILOT_BYTE)
+        {
+            turboPilotBytes++;
+        }
+        else if (b == TURBO_SYNC_BYTE && turboPilotBytes >= TURBO_MIN_PILOT_BYTES)
+        {
+            turboSynced = true;
+            turboNext = TURBO_SYNC_BYTE - 1;
+        }
+        else
+        {
+            turboAligned = false;
+        }
+        return;
+    }
+    if (!turboCountdown && turboNext > 0 && turboDataBytes == 0)
+    {
+        if (b == turboNext)
+        {
+            turboCountdown = --turboNext == 0;
+            return;
+        }
+        turboNext = 0;
+    }
+    turboData[turboDataBytes++] = b;
+}
+
+// Whether the histogram is dominated by two peaks: one pulse length for each
+// bit value.
+bool TapBlockAnalyzer::HasTwoPeaks() const
+{
+    uint32_t total = 0;
+    int first = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        total += histogram[i];
+        if (histogram[i] > histogram[first])
+        {
+            first = i;
+        }
+    }
+    int second = -1;
+    for (int i = 0; i < 256; i++)
+    {
+        if (abs(i - first) > 2 * PILOT_TOLERANCE && (second < 0 || histogram[i] > histogram[second]))
+        {
+            second = i;
+        }
+    }
+    if (total == 0 || second < 0 || histogram[second] < total / 16)
+    {
+        return false;
+    }
+    uint32_t peaks = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (abs(i - first) <= PILOT_TOLERANCE || abs(i - second) <= PILOT_TOLERANCE)
+        {
+            peaks += histogram[i];
+        }
+    }
+    return peaks * 10 >= total * 9;
+}
+
+// Converts a 16 character PETSCII name, padded with (shifted) spaces.
+void TapBlockAnalyzer::CopyName(const uint8_t* petscii, char* name)
+{
+    int length = 16;
+    while (length > 0 && (petscii[length - 1] == 0x20 || petscii[length - 1] == 0xA0))
+    {
+        length--;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        uint8_t c = petscii[i];
+        if (c >= 0xC1 && c <= 0xDA)
+        {
+            // Shifted letters.
+            c -= 0x80;
+        }
+        name[i] = (c >= 0x20 && c < 0x60) ? c : '?';
+    }
+    name[length] = 0;
+}
@@ -0,0 +1,150 @@
+#include "core/include/TapCounterIndex.h"
+#include "core/include/TapBase.h"
+
+#include <math.h>
+
+#include "io/buffered_reader.h"
+#include "io/buffered_writer.h"
+
+using namespace TapuinoNext;
+
+#define COUNTER_INDEX_MAGIC 0x54434E54 // "TCNT"
+#define COUNTER_INDEX_VERSION 1
+// Position, cycles, counter.
+#define CHECKPOINT_RECORD_SIZE 10
+
+static uint32_t ReadBE32(const uint8_t* p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+TapCounterIndex::TapCounterIndex()
+{
+    Clear();
+}
+
+void TapCounterIndex::Clear()
+{
+    checkpoints.clear();
+    length = 0;
+    complete = false;
+}
+
+void TapCounterIndex::Begin(uint32_t tapLength)
+{
+    Clear();
+    length = tapLength;
+    Add(0, 0);
+}
+
+void TapCounterIndex::Add(uint32_t position, uint32_t cycles)
+{
+    uint16_t counter = CYCLES_TO_COUNTER(cycles);
+    checkpoints.push_back(TapCheckpoint{position, cycles, counter});
+}
+
+void TapCounterIndex::Finish()
+{
+    complete = true;
+}
+
+const TapCheckpoint& TapCounterIndex::Find(uint16_t targetCounter) const
+{
+    // Counters are monotonic, so binary search for the first checkpoint past
+    // the target, and step back.
+    size_t lo = 0;
+    size_t hi = checkpoints.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (checkpoints[mid].counter <= targetCounter)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return checkpoints[lo == 0 ? 0 : lo - 1];
+}
+
+uint32_t TapCounterIndex::CounterToCycles(uint16_t counter)
+{
+    double root = counter / DS_G + DS_R / DS_D;
+    double seconds = (root * root - (DS_R * DS_R) / (DS_D * DS_D)) * (DS_D * PI / DS_V_PLAY);
+    return (uint32_t) ceil(seconds * 1000000.0);
+}
+
+ErrorCodes TapCounterIndex::Load(FS& fs, const char* path, uint32_t tapLength)
+{
+    Clear();
+    File f = fs.open(path, "r");
+    if (!f)
+    {
+        return ErrorCodes::FILE_NOT_FOUND;
+    }
+    tapuino::BufferedReader<> reader;
+    reader.set(f);
+    if (reader.readU32() != COUNTER_INDEX_MAGIC || reader.readU16() != COUNTER_INDEX_VERSION ||
+        reader.readU32() != kCheckpointInterval || reader.readU32() != tapLength)
+    {
+        reader.close();
+        return ErrorCodes::INVALID_COUNTER_POS;
+    }
+    uint32_t count = reader.readU32();
+    if (reader.eof() || count == 0)
+    {
+        reader.close();
+        return ErrorCodes::INVALID_COUNTER_POS;
+    }
+    checkpoints.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t* record = reader.peek(CHECKPOINT_RECORD_SIZE);
+        if (record == NULL)
+        {
+            break;
+        }
+        TapCheckpoint cp;
+        cp.position = ReadBE32(record);
+        cp.cycles = ReadBE32(record + 4);
+        cp.counter = (record[8] << 8) | record[9];
+        checkpoints.push_back(cp);
+        reader.consume(CHECKPOINT_RECORD_SIZE);
+    }
+    bool ok = !reader.eof();
+    reader.close();
+    if (!ok)
+    {
+        Clear();
+        return ErrorCodes::INVALID_COUNTER_POS;
+    }
+    length = tapLength;
+    complete = true;
+    return ErrorCodes::OK;
+}
+
+ErrorCodes TapCounterIndex::Store(FS& fs, const char* path) const
+{
+    File f = fs.open(path, "w");
+    if (!f)
+    {
+        return ErrorCodes::FILE_WRITE_ERROR;
+    }
+    tapuino::BufferedWriter<> writer;
+    writer.set(f);
+    writer.writeU32(COUNTER_INDEX_MAGIC);
+    writer.writeU16(COUNTER_INDEX_VERSION);
+    writer.writeU32(kCheckpointInterval);
+    writer.writeU32(length);
+    writer.writeU32(checkpoints.size());
+    for (const TapCheckpoint& cp : checkpoints)
+    {
+        writer.writeU32(cp.position);
+        writer.writeU32(cp.cycles);
+        writer.writeU16(cp.counter);
+    }
+    writer.close();
+    return f.getWriteError() == 0 ? ErrorCodes::OK : ErrorCodes::FILE_WRITE_ERROR;
+}
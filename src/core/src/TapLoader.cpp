@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "io/sd.h"
+#include "roo_logging.h"
 
 using namespace std;
 
@@ -17,15 +18,43 @@ using namespace TapuinoNext;
 
 #define OUT_OF_FILE_MARKER 0xFFFFFFFF
 
+// Pilot pulses are only dropped while the flip buffer holds more than this
+// many unread bytes.
+#define PILOT_SKIP_RESERVE 1024
+
+// The next TAP of a playlist is prefetched when the current one has at most
+// this many bytes left to play (and they are all buffered already).
+#define PREFETCH_DISTANCE 16384
+
+// Pulses analyzed per tick of the block analysis (a few ms worth of work).
+#define ANALYSIS_PULSES_PER_TICK 4096
+
+// PCM chunks (of 2 KB) decoded per tick of the length scan of a WAV.
+#define LENGTH_SCAN_CHUNKS_PER_TICK 4
+
 TapLoader::TapLoader(UtilityCollection* utilityCollection,
                      roo_scheduler::Scheduler& scheduler)
     : TapBase(utilityCollection),
       scheduler(scheduler),
       playTick(scheduler, [this](){PlayTick(); }, roo_time::Millis(200)),
+      spiBus(utilityCollection->spiBus),
       input(),
-      playFinishedCb(nullptr)
+      nextInput(),
+      playFinishedCb(nullptr),
+      continuedCb(nullptr),
+      analyzeTick(scheduler, [this](){AnalyzeTick(); }, roo_time::Millis(10)),
+      blockAnalyzer(blockIndex),
+      analyzedFs(NULL),
+      analyzedCb(nullptr),
+      scannedFile(NULL),
+      seekedCb(nullptr)
 {
     isTiming = false;
+    analyzing = false;
+    analyzedPulses = 0;
+    seekTarget = 0;
+    inputDrained = false;
+    fastPilot = false;
     tapInfo.position = 0;
 }
 
@@ -50,10 +79,16 @@ uint32_t TapLoader::CalcSignalTime()
     uint32_t signalTime = ReadNextByte();
     if (signalTime != 0)
     {
-        signalTime = (uint32_t) ((double) signalTime * cycleMult8);
+        uint8_t pulse = signalTime;
+        signalTime = (signalTime * cycleMult8Fixed) >> 16;
+        if (fastPilot)
+        {
+            SkipPilotPulses(pulse, signalTime);
+        }
     }
     else
     {
+        pilotRuns.Pause();
         if (tapInfo.version == 0)
         {
             // in version 0 TAP files a zero length signal indicates an
@@ -65,7 +100,11 @@ uint32_t TapLoader::CalcSignalTime()
             signalTime = ReadNextByte();
             signalTime |= ReadNextByte() << 8;
             signalTime |= ReadNextByte() << 16;
-            signalTime = (uint32_t) ((double) signalTime * cycleMultRaw);
+            signalTime = (uint32_t) (((uint64_t) signalTime * cycleMultRawFixed) >> 16);
+            if (fastPilot)
+            {
+                signalTime = ClampGap(signalTime);
+            }
         }
     }
     if (tapInfo.version == 2)
@@ -79,54 +118,418 @@ uint32_t TapLoader::CalcSignalTime()
     return (signalTime);
 }
 
-// bool TapLoader::SeekToCounter(File tapFile, uint16_t targetCounter)
-// {
-//     // save everything!
-//     uint64_t saveFilePos = tapFile.position();
-//     TAP_INFO saveTapInfo;
-//     memcpy(&saveTapInfo, &tapInfo, sizeof(TAP_INFO));
+// Called from the ISR for every 8-bit pulse in the fast pilot mode. Once a run
+// of identical pilot pulses is longer than what its loader needs to sync, drops
+// some of the following identical pulses (still counting their time, so that
+// the tape counter stays right). Drops only while the flip buffer has data to
+// spare, so that it can't outrun the refill.
+void TapLoader::SkipPilotPulses(uint8_t pulse, uint32_t signalTime)
+{
+    uint32_t maxSkip = pilotRuns.Pulse(pulse);
+    uint32_t skipped = 0;
+    while (skipped < maxSkip && tapInfo.position < tapInfo.length &&
+           flipBuffer->available() > PILOT_SKIP_RESERVE && flipBuffer->PeekByte() == pulse)
+    {
+        flipBuffer->ReadByte();
+        tapInfo.position++;
+        skipped++;
+    }
+    pilotRuns.Skipped(skipped);
+    tapInfo.cycles += skipped * signalTime;
+}
 
-//     if (tapInfo.counterActual > targetCounter)
-//     {
-//         // only start from the begining of the tap if we are seeking backwards
-//         // get to the first byte of actual tap data
-//         tapFile.seek(TAP_HEADER_LENGTH);
-//         flipBuffer->FillWholeBuffer(tapFile);
-//         tapInfo.cycles = 0;
-//         tapInfo.position = 0;
-//         tapInfo.counterActual = 0;
-//     }
+// Called from the ISR for every pause (overflow value) in the fast pilot mode.
+uint32_t TapLoader::ClampGap(uint32_t signalTime)
+{
+    const PilotProfile* gapProfile = pilotRuns.GapProfile();
+    if (gapProfile == NULL || signalTime <= gapProfile->maxGapMicros)
+    {
+        return (signalTime);
+    }
+    tapInfo.cycles += signalTime - gapProfile->maxGapMicros;
+    return (gapProfile->maxGapMicros);
+}
 
-//     lcdUtils->Title(S_SEEKING);
-//     lcdUtils->Status("");
+// Whether the playback is at the start of the TAP or of a known block, i.e.
+// what follows can be a pilot. Resuming anywhere else may be in the middle
+// of the data.
+bool TapLoader::AtBlockStart()
+{
+    if (tapInfo.position == 0)
+    {
+        return true;
+    }
+    int block = blockIndex.Find(tapInfo.position);
+    return block >= 0 && blockIndex.Get(block).position == tapInfo.position;
+}
 
-//     // TODO: there is a chance that we may slightly overrun the desired value
-//     // at this point we accept that, but we may want to restore and let the user
-//     // choose a lower counter value
-//     while (tapInfo.counterActual < targetCounter)
-//     {
-//         uint32_t signalTime = CalcSignalTime();
-//         flipBuffer->FillBufferIfNeeded(tapFile);
+// Reads the next pulse, returning its duration in us as accumulated into
+// tapInfo.cycles by the timer ISR, or OUT_OF_FILE_MARKER.
+uint32_t TapLoader::NextPulseCycles()
+{
+    uint32_t signalTime = CalcSignalTime();
+    if (signalTime == OUT_OF_FILE_MARKER)
+    {
+        return (OUT_OF_FILE_MARKER);
+    }
+    if (tapInfo.version == 2)
+    {
+        uint32_t secondHalf = CalcSignalTime();
+        if (secondHalf == OUT_OF_FILE_MARKER)
+        {
+            return (OUT_OF_FILE_MARKER);
+        }
+        return ((signalTime >> 1) + (secondHalf >> 1));
+    }
+    return ((signalTime >> 1) << 1);
+}
 
-//         if (signalTime == OUT_OF_FILE_MARKER)
-//         {
-//             // Ran out of file!
-//             tapFile.seek(saveFilePos);
-//             memcpy(&tapInfo, &saveTapInfo, sizeof(TAP_INFO));
-//             lcdUtils->Error(S_COUNTER_GR_SIZE, "");
-//             lcdUtils->PlayUI(false, tapInfo.counterActual, 0);
-//             return (false);
-//         }
-//         else
-//         {
-//             tapInfo.cycles += signalTime;
-//             // (uint16_t) (DS_G * (sqrt((tapInfo.cycles / 1000000.0 * (DS_V_PLAY / DS_D / PI)) + ((DS_R * DS_R) / (DS_D * DS_D))) - (DS_R / DS_D)));
-//             tapInfo.counterActual = CYCLES_TO_COUNTER(tapInfo.cycles);
-//             lcdUtils->PlayUI(true, tapInfo.counterActual, 1000);
-//         }
-//     }
-//     return (true);
-// }
+bool TapLoader::LoadCounterIndex(tapuino::TapFile& tapFile)
+{
+    std::string path = tapFile.sidecarPath("cnt");
+    if (path == counterIndexPath && counterIndex.IsBuiltFor(tapInfo.length))
+    {
+        return true;
+    }
+    counterIndexPath = path;
+    return counterIndex.Load(tapFile.fs(), path.c_str(), tapInfo.length) == ErrorCodes::OK;
+}
+
+void TapLoader::SeekToCounter(tapuino::TapFile& tapFile, uint16_t targetCounter,
+                              std::function<void(ErrorCodes)> seekedCb)
+{
+    Stop();
+    // Supersedes the seek waiting for the analysis, if any.
+    FinishSeek(ErrorCodes::OPERATION_ABORTED);
+    if (analyzing)
+    {
+        // The running analysis builds the counter index; seek when it's done.
+        this->seekedCb = seekedCb;
+        seekTarget = targetCounter;
+        return;
+    }
+    // If released for a prefetch, the input needs to be opened again.
+    inputDrained = false;
+    ErrorCodes ret = ErrorCodes::OK;
+    if (!HasInput())
+    {
+        if (StartLengthScan(tapFile, []() {}))
+        {
+            this->seekedCb = seekedCb;
+            seekTarget = targetCounter;
+            return;
+        }
+        ret = OpenInput(tapFile);
+    }
+    if (ret != ErrorCodes::OK)
+    {
+        Reset();
+        seekedCb(ret);
+        return;
+    }
+    if (!LoadCounterIndex(tapFile))
+    {
+        // Built by the analysis, in the background, from the start.
+        tapInfo.position = 0;
+        tapInfo.cycles = 0;
+        tapInfo.counterActual = 0;
+        this->seekedCb = seekedCb;
+        seekTarget = targetCounter;
+        StartAnalysis(tapFile, []() {});
+        return;
+    }
+    seekedCb(SeekToCounterNow(targetCounter));
+}
+
+ErrorCodes TapLoader::SeekToCounterNow(uint16_t targetCounter)
+{
+    if (!counterIndex.IsBuiltFor(tapInfo.length))
+    {
+        Reset();
+        return ErrorCodes::FILE_ERROR;
+    }
+    const TapCheckpoint& checkpoint = counterIndex.Find(targetCounter);
+    ErrorCodes ret = SeekTo(checkpoint.position, checkpoint.cycles);
+    if (ret != ErrorCodes::OK)
+    {
+        return ret;
+    }
+
+    // Short forward decode from the checkpoint. Comparing cycles rather than
+    // counters keeps sqrt out of the loop.
+    uint32_t targetCycles = TapCounterIndex::CounterToCycles(targetCounter);
+    while (tapInfo.cycles < targetCycles)
+    {
+        uint32_t pulseCycles = NextPulseCycles();
+        if (pulseCycles == OUT_OF_FILE_MARKER)
+        {
+            Reset();
+            return ErrorCodes::INVALID_COUNTER_POS;
+        }
+        tapInfo.cycles += pulseCycles;
+        ret = flipBuffer->FillBufferIfNeeded(input);
+        if (ret != ErrorCodes::OK)
+        {
+            Reset();
+            return ret;
+        }
+    }
+    tapInfo.counterActual = CYCLES_TO_COUNTER(tapInfo.cycles);
+    HWResetSignal();
+    return ErrorCodes::OK;
+}
+
+// Positions the playback at a pulse boundary, with the signal time up to it.
+ErrorCodes TapLoader::SeekTo(uint32_t position, uint32_t cycles)
+{
+    tapInfo.position = position;
+    tapInfo.cycles = cycles;
+    tapInfo.counterActual = CYCLES_TO_COUNTER(cycles);
+    telemetry.Reset();
+    ErrorCodes ret = FillFrom(position);
+    if (ret != ErrorCodes::OK)
+    {
+        Reset();
+        return ret;
+    }
+    HWResetSignal();
+    return ErrorCodes::OK;
+}
+
+ErrorCodes TapLoader::SeekToBlock(tapuino::TapFile& tapFile, size_t block)
+{
+    if (analyzing || block >= blockIndex.Count())
+    {
+        return ErrorCodes::OUT_OF_RANGE;
+    }
+    Stop();
+    inputDrained = false;
+    if (!HasInput())
+    {
+        ErrorCodes ret = OpenInput(tapFile);
+        if (ret != ErrorCodes::OK)
+        {
+            Reset();
+            return ret;
+        }
+    }
+    const TapBlock& b = blockIndex.Get(block);
+    return SeekTo(b.position, b.cycles);
+}
+
+void TapLoader::AnalyzeBlocks(tapuino::TapFile& tapFile, std::function<void()> analyzedCb)
+{
+    AbortAnalysis();
+    if (!HasInput() && StartLengthScan(tapFile, analyzedCb))
+    {
+        return;
+    }
+    if (!HasInput() && OpenInput(tapFile) != ErrorCodes::OK)
+    {
+        Reset();
+        blockIndex.Clear();
+        analyzedCb();
+        return;
+    }
+    std::string path = tapFile.sidecarPath("blk");
+    if (path == blockIndexPath && blockIndex.IsBuiltFor(tapInfo.length))
+    {
+        analyzedCb();
+        return;
+    }
+    blockIndexPath = path;
+    if (blockIndex.Load(tapFile.fs(), path.c_str(), tapInfo.length) == ErrorCodes::OK)
+    {
+        analyzedCb();
+        return;
+    }
+    // The analysis reads the TAP through the playback buffer, so it can only
+    // run from the start, while stopped.
+    if (IsPlaying() || tapInfo.position != 0)
+    {
+        analyzedCb();
+        return;
+    }
+    StartAnalysis(tapFile, analyzedCb);
+}
+
+// Starts the length scan of a WAV recording, if it is one whose length is not
+// known yet, to be followed by the analysis of its blocks.
+bool TapLoader::StartLengthScan(tapuino::TapFile& tapFile, std::function<void()> analyzedCb)
+{
+    if (!tapFile.beginLengthScan(lengthScan))
+    {
+        return false;
+    }
+    scannedFile = &tapFile;
+    this->analyzedCb = analyzedCb;
+    analyzing = true;
+    analyzeTick.start();
+    return true;
+}
+
+int TapLoader::GetAnalysisProgress() const
+{
+    if (lengthScan.active())
+    {
+        return lengthScan.progress();
+    }
+    return tapInfo.length == 0 ? 0 : (int) ((uint64_t) 100 * tapInfo.position / tapInfo.length);
+}
+
+// Starts the background analysis, from the start of the (stopped) TAP.
+void TapLoader::StartAnalysis(tapuino::TapFile& tapFile, std::function<void()> analyzedCb)
+{
+    blockIndexPath = tapFile.sidecarPath("blk");
+    tapInfo.cycles = 0;
+    // The analysis reads through the input, which makes the later seeks fast
+    // if it indexes itself on the way (ZIP entries do).
+    input.indexForSeeking();
+    if (FillFrom(0) != ErrorCodes::OK)
+    {
+        Reset();
+        analyzedCb();
+        FinishSeek(ErrorCodes::FILE_ERROR);
+        return;
+    }
+    counterIndexPath = tapFile.sidecarPath("cnt");
+    counterIndex.Begin(tapInfo.length);
+    blockAnalyzer.Begin(tapInfo.length);
+    // Not being able to persist the indexes only costs a rebuild next time.
+    analyzedFs = tapFile.makeSidecarDir() ? &tapFile.fs() : NULL;
+    analyzedPulses = 0;
+    this->analyzedCb = analyzedCb;
+    analyzing = true;
+    analyzeTick.start();
+}
+
+void TapLoader::AnalyzeTick()
+{
+    if (lengthScan.active())
+    {
+        if (lengthScan.step(LENGTH_SCAN_CHUNKS_PER_TICK))
+        {
+            return;
+        }
+        // The WAV can be opened now; go on with its blocks, and with the
+        // seek waiting for them, if any. Opened here, so that a length that
+        // could not be stored doesn't start another scan.
+        analyzeTick.stop();
+        analyzing = false;
+        std::function<void()> cb = analyzedCb;
+        analyzedCb = nullptr;
+        std::function<void(ErrorCodes)> seek = seekedCb;
+        seekedCb = nullptr;
+        ErrorCodes ret = OpenInput(*scannedFile);
+        if (ret != ErrorCodes::OK)
+        {
+            Reset();
+            blockIndex.Clear();
+            cb();
+            if (seek != nullptr)
+            {
+                seek(ret);
+            }
+            return;
+        }
+        AnalyzeBlocks(*scannedFile, cb);
+        if (seek != nullptr)
+        {
+            SeekToCounter(*scannedFile, seekTarget, seek);
+        }
+        return;
+    }
+    for (int i = 0; i < ANALYSIS_PULSES_PER_TICK; i++)
+    {
+        uint32_t position = tapInfo.position;
+        uint32_t pulseCycles = NextPulseCycles();
+        if (pulseCycles == OUT_OF_FILE_MARKER)
+        {
+            FinishAnalysis(true);
+            return;
+        }
+        // Back to TAP units, rounding.
+        uint32_t units = (((uint64_t) pulseCycles << 16) + cycleMult8Fixed / 2) / cycleMult8Fixed;
+        blockAnalyzer.Pulse(position, tapInfo.cycles, units);
+        tapInfo.cycles += pulseCycles;
+        if (++analyzedPulses % TapCounterIndex::kCheckpointInterval == 0)
+        {
+            counterIndex.Add(tapInfo.position, tapInfo.cycles);
+        }
+        if (flipBuffer->FillBufferIfNeeded(input) != ErrorCodes::OK)
+        {
+            FinishAnalysis(false);
+            return;
+        }
+    }
+}
+
+void TapLoader::FinishAnalysis(bool ok)
+{
+    analyzeTick.stop();
+    analyzing = false;
+    if (ok)
+    {
+        blockAnalyzer.Finish();
+        counterIndex.Finish();
+        // Each costs only its own rebuild next time, if not stored.
+        if (analyzedFs == NULL || blockIndex.Store(*analyzedFs, blockIndexPath.c_str()) != ErrorCodes::OK)
+        {
+            LOG(WARNING) << "Failed to store the block index: " << blockIndexPath;
+        }
+        if (analyzedFs == NULL || counterIndex.Store(*analyzedFs, counterIndexPath.c_str()) != ErrorCodes::OK)
+        {
+            LOG(WARNING) << "Failed to store the counter index: " << counterIndexPath;
+        }
+    }
+    else
+    {
+        blockIndex.Clear();
+        counterIndex.Clear();
+    }
+    // Back to the start, as Play() expects at position 0.
+    tapInfo.position = 0;
+    tapInfo.cycles = 0;
+    tapInfo.counterActual = 0;
+    std::function<void()> cb = analyzedCb;
+    analyzedCb = nullptr;
+    cb();
+    if (seekedCb != nullptr)
+    {
+        FinishSeek(SeekToCounterNow(seekTarget));
+    }
+}
+
+void TapLoader::AbortAnalysis()
+{
+    if (!analyzing)
+    {
+        return;
+    }
+    analyzeTick.stop();
+    analyzing = false;
+    blockIndex.Clear();
+    counterIndex.Clear();
+    tapInfo.position = 0;
+    tapInfo.cycles = 0;
+    tapInfo.counterActual = 0;
+    std::function<void()> cb = analyzedCb;
+    analyzedCb = nullptr;
+    cb();
+    FinishSeek(ErrorCodes::OPERATION_ABORTED);
+}
+
+// Reports the result of the seek waiting for the analysis, if any.
+void TapLoader::FinishSeek(ErrorCodes ret)
+{
+    if (seekedCb == nullptr)
+    {
+        return;
+    }
+    std::function<void(ErrorCodes)> cb = seekedCb;
+    seekedCb = nullptr;
+    cb(ret);
+}
 
 void TapLoader::StartTimer()
 {
@@ -138,6 +541,9 @@ void TapLoader::StartTimer()
         // tell the C64 that play has been pressed
         digitalWrite(C64_SENSE_PIN, LOW);
         processSignal = true;
+        // Half-wave (v2) values can't be dropped one by one.
+        fastPilot = options->fastPilot.GetValue() && tapInfo.version != TAP_HEADER_VERSION_2;
+        pilotRuns.Reset(tapInfo.platform, AtBlockStart());
         HWStartTimer();
     }
     else
@@ -153,6 +559,7 @@ void TapLoader::StopTimer()
         isTiming = false;
         // prevent any further buffer processing
         processSignal = false;
+        fastPilot = false;
         // shutdown the hardware timer
         HWStopTimer();
 
@@ -167,7 +574,7 @@ void TapLoader::StopTimer()
     }
 }
 
-ErrorCodes TapLoader::ReadTapHeader(tapuino::InputStream& input)
+ErrorCodes TapLoader::ReadTapHeader(tapuino::InputStream& input, TAP_INFO& tapInfo)
 {
     uint32_t size;
     // byte wise header magic is read into 32bit values for easy comparison
@@ -175,7 +582,6 @@ ErrorCodes TapLoader::ReadTapHeader(tapuino::InputStream& input)
     uint32_t tap_magic[TAP_HEADER_MAGIC_LENGTH / 4];
     memset(&tapInfo, 0, sizeof(tapInfo));
 
-    flipBuffer->Reset();
     size = input.size();
 
     // safety first! minimum possible TAP size?
@@ -213,7 +619,6 @@ ErrorCodes TapLoader::ReadTapHeader(tapuino::InputStream& input)
         return ErrorCodes::UNKNOWN_TAP_FORMAT;
     }
 
-    SetupCycleTiming();
     // tapInfo.length += 1024;
 
     return ErrorCodes::OK;
@@ -261,13 +666,163 @@ ErrorCodes TapLoader::ReadTapHeader(tapuino::InputStream& input)
 //     }
 // }
 
+ErrorCodes TapLoader::OpenInput(tapuino::TapFile& tapFile)
+{
+    // Only one input can be open at a time (a ZIP may only be open once).
+    if (lengthScan.active())
+    {
+        // Interrupted by playing; the rest of the scan is still needed.
+        if (lengthScan.lengthPath() == tapFile.sidecarPath("wln"))
+        {
+            lengthScan.finish();
+        }
+        lengthScan.cancel();
+    }
+    DropPrefetched();
+    inputDrained = false;
+    flipBuffer->Reset();
+    input = tapFile.open();
+    ErrorCodes ret = ReadTapHeader(input, tapInfo);
+    if (ret != ErrorCodes::OK)
+    {
+        return ret;
+    }
+    SetupCycleTiming();
+    // If the whole TAP fits in RAM, read (or inflate) it now, so that playback
+    // does not depend on the SD card (which shares the SPI bus with the
+    // display) at all.
+    ret = flipBuffer->LoadWhole(input, tapInfo.length);
+    if (ret == ErrorCodes::OK)
+    {
+        input.close();
+        input = tapuino::InputStream();
+        return ErrorCodes::OK;
+    }
+    if (ret != ErrorCodes::OUT_OF_MEMORY)
+    {
+        return ret;
+    }
+    // Doesn't fit; stream.
+    return ErrorCodes::OK;
+}
+
+bool TapLoader::HasInput() const
+{
+    return flipBuffer->IsWhole() || inputDrained || (input.isOpen() && input);
+}
+
+bool TapLoader::IsReadyForPrefetch() const
+{
+    if (tapInfo.length - tapInfo.position > PREFETCH_DISTANCE)
+    {
+        return false;
+    }
+    // All of the data must be in the buffer already, so that the input can be
+    // released.
+    return flipBuffer->IsWhole() || inputDrained ||
+           (input.isOpen() && input.tell() >= TAP_HEADER_LENGTH + tapInfo.length);
+}
+
+ErrorCodes TapLoader::PrefetchNext(tapuino::TapFile& next)
+{
+    if (!IsReadyForPrefetch())
+    {
+        return ErrorCodes::OPERATION_ABORTED;
+    }
+    DropPrefetched();
+    if (!flipBuffer->IsWhole() && !inputDrained)
+    {
+        input.close();
+        input = tapuino::InputStream();
+        inputDrained = true;
+    }
+    nextInput = next.open();
+    ErrorCodes ret = ReadTapHeader(nextInput, nextInfo);
+    if (ret == ErrorCodes::OK)
+    {
+        ret = flipBuffer->Prefetch(nextInput);
+    }
+    if (ret != ErrorCodes::OK)
+    {
+        DropPrefetched();
+    }
+    return ret;
+}
+
+bool TapLoader::HasPrefetched() const
+{
+    return flipBuffer->HasPrefetched();
+}
+
+void TapLoader::DropPrefetched()
+{
+    flipBuffer->DropPrefetched();
+    nextInput.close();
+    nextInput = tapuino::InputStream();
+}
+
+// Makes the prefetched TAP current, positioned at its start. The timer must not
+// be processing the signal.
+void TapLoader::SwitchToPrefetched()
+{
+    input.close();
+    input = std::move(nextInput);
+    nextInput = tapuino::InputStream();
+    inputDrained = false;
+    tapInfo = nextInfo;
+    SetupCycleTiming();
+    flipBuffer->UsePrefetched();
+    telemetry.Reset();
+    HWResetSignal();
+    fastPilot = options->fastPilot.GetValue() && tapInfo.version != TAP_HEADER_VERSION_2;
+    pilotRuns.Reset(tapInfo.platform, true);
+}
+
+ErrorCodes TapLoader::PlayPrefetched(std::function<void(ErrorCodes)> playFinishedCb)
+{
+    if (!HasPrefetched())
+    {
+        return ErrorCodes::OPERATION_ABORTED;
+    }
+    Stop();
+    SwitchToPrefetched();
+    Start(playFinishedCb);
+    return ErrorCodes::OK;
+}
+
+void TapLoader::SetAutoContinue(std::function<void()> continuedCb)
+{
+    this->continuedCb = continuedCb;
+}
+
+// Positions the data source at the specified offset of the TAP data (i.e.
+// excluding the header), and pre-fills the buffer from there.
+ErrorCodes TapLoader::FillFrom(uint32_t position)
+{
+    if (flipBuffer->IsWhole())
+    {
+        flipBuffer->SeekWhole(position);
+        return ErrorCodes::OK;
+    }
+    if (!input.seek(TAP_HEADER_LENGTH + position))
+    {
+        return ErrorCodes::FILE_ERROR;
+    }
+    // Pre-fill the entire buffer. When the buffer index (bufferPos) crosses the
+    // half way point (bufferSwitchPos) bufferSwitchFlag will be set and the
+    // first half of the buffer will be filled with new data. this will toggle
+    // with the code below in the while loop, filling the second half of the
+    // buffer as the index resets to zero etc.
+    return flipBuffer->FillWholeBuffer(input);
+}
+
 ErrorCodes TapLoader::Play(tapuino::TapFile& tapFile, 
                            std::function<void(ErrorCodes)> playFinishedCb)
 {
     if (IsPlaying()) return ErrorCodes::OK;
-    if (!input || tapInfo.position == 0) {
-        input = tapFile.open();
-        ErrorCodes ret = ReadTapHeader(input);
+    AbortAnalysis();
+    if (!HasInput()) {
+        ErrorCodes ret = OpenInput(tapFile);
         if (ret != ErrorCodes::OK)
         {
             Reset();
@@ -276,24 +831,37 @@ ErrorCodes TapLoader::Play(tapuino::TapFile& tapFile,
 
         // lcdUtils->Title(S_TAP_OK);
         // delay(1000);
-
-        // Pre-fill the entire buffer. When the buffer index (bufferPos) crosses the
-        // half way point (bufferSwitchPos) bufferSwitchFlag will be set and the
-        // first half of the buffer will be filled with new data. this will toggle
-        // with the code below in the while loop, filling the second half of the
-        // buffer as the index resets to zero etc.
-        tapInfo.position = 0;
-        ret = flipBuffer->FillWholeBuffer(input);
+    }
+    if (tapInfo.position == 0) {
+        // Fresh start or rewound.
+        tapInfo.cycles = 0;
+        tapInfo.counterActual = 0;
+        telemetry.Reset();
+        HWResetSignal();
+        ErrorCodes ret = FillFrom(0);
         if (ret != ErrorCodes::OK) {
-            input.close();
-            input = tapuino::InputStream();
+            Reset();
             return ret;
         }
     }
 
+    Start(playFinishedCb);
+    return ErrorCodes::OK;
+}
+
+void TapLoader::Start(std::function<void(ErrorCodes)> playFinishedCb)
+{
     loadingStatus = ErrorCodes::OK;
     this->playFinishedCb = playFinishedCb;
     playTick.start();
+    if (spiBus != NULL)
+    {
+        // Refill as soon as the ISR moves on to the next half of the buffer,
+        // rather than on the next tick, and never behind a redraw.
+        spiBus->setUrgent(
+            [this]() { return processSignal && !inputDrained && flipBuffer->RefillPending(); },
+            [this]() { Refill(); });
+    }
 
     // // skip the menu if auto play is set.
     // if (!options->autoPlay.GetValue())
@@ -309,14 +877,35 @@ ErrorCodes TapLoader::Play(tapuino::TapFile& tapFile,
     // uint32_t tickerTime = options->tickerTime.GetValue();
     
     StartTimer();
-    return ErrorCodes::OK;
 }
 
 void TapLoader::Reset() {
+    AbortAnalysis();
+    lengthScan.cancel();
     Stop();
+    DropPrefetched();
     input.close();
     input = tapuino::InputStream();
+    inputDrained = false;
+    flipBuffer->ReleaseWhole();
     tapInfo.position = 0;
+    tapInfo.cycles = 0;
+    tapInfo.counterActual = 0;
+}
+
+void TapLoader::Rewind() {
+    AbortAnalysis();
+    Stop();
+    if (inputDrained)
+    {
+        // Released for a prefetch; Play() needs to open it again.
+        inputDrained = false;
+    }
+    // Play() seeks back to the start of the (still open) input, or the RAM
+    // copy.
+    tapInfo.position = 0;
+    tapInfo.cycles = 0;
+    tapInfo.counterActual = 0;
 }
 
 void TapLoader::Stop() {
@@ -327,6 +916,10 @@ void TapLoader::Stop() {
     }
     StopTimer();
     playTick.stop();
+    if (spiBus != NULL)
+    {
+        spiBus->clearUrgent();
+    }
     playFinishedCb(loadingStatus);
     return;
 }
@@ -337,6 +930,17 @@ void TapLoader::PlayTick() {
     }
     if (!processSignal)
     {
+        if (continuedCb != nullptr && HasPrefetched() && tapInfo.position >= tapInfo.length)
+        {
+            // Continue with the next TAP as if it was on the same tape: the
+            // 'sense' line stays on, and only the timer is restarted.
+            HWStopTimer();
+            SwitchToPrefetched();
+            processSignal = true;
+            HWStartTimer();
+            continuedCb();
+            return;
+        }
         Serial.println("Signal not processed anymore; calling Stop()");
         // ensure we clean up the timer if we ran out of TAP file, as triggered by CalcSignalTime() returning 0xFFFFFFFF
         // TODO: investigate a possibly cleaner way to handle all of this instead of relying on magic values, processSignal should be owned by Stop/StartTimer
@@ -345,10 +949,7 @@ void TapLoader::PlayTick() {
         return;
     }
 
-    loadingStatus = flipBuffer->FillBufferIfNeeded(input);
-    if (loadingStatus != ErrorCodes::OK) {
-      Stop();
-    }
+    Refill();
 
     // (uint16_t) (DS_G * (sqrt((tapInfo.cycles / 1000000.0 * (DS_V_PLAY / DS_D / PI)) + ((DS_R * DS_R) / (DS_D * DS_D))) - (DS_R / DS_D)));
     tapInfo.counterActual = CYCLES_TO_COUNTER(tapInfo.cycles);
@@ -372,7 +973,22 @@ void TapLoader::PlayTick() {
     //     // lcdUtils->ShowFile(tapFile.name(), false);
     //     StartTimer();
     // }
-    Serial.println("Finishing playTick");
-    Serial.println(playTick.is_active());
+}
+
+void TapLoader::Refill()
+{
+    telemetry.RecordBufferFill(flipBuffer->available());
+    uint32_t filledBefore = flipBuffer->filled();
+    uint32_t refillStart = micros();
+    if (!inputDrained) {
+      loadingStatus = flipBuffer->FillBufferIfNeeded(input);
+    }
+    if (flipBuffer->filled() != filledBefore) {
+      telemetry.RecordRefill(micros() - refillStart, flipBuffer->filled() - filledBefore);
+    }
+    telemetry.SetUnderruns(flipBuffer->underruns());
+    if (loadingStatus != ErrorCodes::OK) {
+      Stop();
+    }
 }
 
@@ -0,0 +1,342 @@
+#include "core/include/TapPrgExtractor.h"
+#include "core/include/TapBase.h"
+
+#include <string.h>
+
+using namespace TapuinoNext;
+
+// Pulses of at least this many TAP units (~2 ms) are pauses.
+#define PAUSE_UNITS 0x100
+
+// A plain recording has no pulses outside of the CBM encoding, except for some
+// noise.
+#define MAX_FOREIGN_PULSES 1024
+
+#define CBM_COUNTDOWN_BYTES 9
+#define CBM_HEADER_BYTES 193
+
+// The Kernal gives up on a block with more read errors than this.
+#define MAX_BAD_BYTES 30
+
+#define HEADER_TYPE_BASIC 1
+#define HEADER_TYPE_PRG 3
+#define HEADER_TYPE_END_OF_TAPE 5
+
+static uint8_t Checksum(const uint8_t* data, size_t size)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        sum ^= data[i];
+    }
+    return sum;
+}
+
+TapPrgExtractor::TapPrgExtractor()
+{
+    prg = NULL;
+}
+
+ErrorCodes TapPrgExtractor::Extract(tapuino::InputStream& input, std::vector<uint8_t>& prg)
+{
+    uint8_t buffer[512];
+    if (input.readFully(buffer, TAP_HEADER_LENGTH) != TAP_HEADER_LENGTH ||
+        memcmp(buffer, "C64-TAPE-RAW", TAP_HEADER_MAGIC_LENGTH) != 0)
+    {
+        return ErrorCodes::INVALID_TAP_FILE;
+    }
+    uint8_t version = buffer[12];
+    if (buffer[13] != (uint8_t) MACHINE_TYPE::C64 || version > TAP_HEADER_VERSION_2)
+    {
+        return ErrorCodes::UNKNOWN_TAP_FORMAT;
+    }
+
+    this->prg = &prg;
+    prg.clear();
+    decoder.Reset();
+    sequence = Sequence::Idle;
+    hasHeader = false;
+    followsHeader = false;
+    dataLength = 0;
+    dataStatus = DataStatus::None;
+    badBytes.clear();
+    foreignPulses = 0;
+    otherFiles = false;
+
+    // Pulse values can span reads, so the buffer is consumed through a small
+    // state machine: `pending` bytes of a long pause still to come, and the
+    // first half wave of a v2 pulse.
+    uint32_t pending = 0;
+    uint32_t pause = 0;
+    int pauseShift = 0;
+    bool halfWave = false;
+    uint32_t firstHalf = 0;
+    while (true)
+    {
+        int32_t n = input.read(buffer, sizeof(buffer));
+        if (n < 0)
+        {
+            return ErrorCodes::FILE_ERROR;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        for (int32_t i = 0; i < n; i++)
+        {
+            uint32_t units;
+            if (pending > 0)
+            {
+                pause |= (uint32_t) buffer[i] << pauseShift;
+                pauseShift += 8;
+                if (--pending > 0)
+                {
+                    continue;
+                }
+                units = pause / 8;
+            }
+            else if (buffer[i] != 0)
+            {
+                units = buffer[i];
+            }
+            else if (version == TAP_HEADER_VERSION_0)
+            {
+                units = 256;
+            }
+            else
+            {
+                pending = 3;
+                pause = 0;
+                pauseShift = 0;
+                continue;
+            }
+            if (version == TAP_HEADER_VERSION_2)
+            {
+                halfWave = !halfWave;
+                if (halfWave)
+                {
+                    firstHalf = units;
+                    continue;
+                }
+                units += firstHalf;
+            }
+            Pulse(units);
+        }
+    }
+    if (sequence == Sequence::Payload)
+    {
+        SequenceEnd();
+    }
+    this->prg = NULL;
+
+    if (!hasHeader || dataStatus != DataStatus::Good || otherFiles ||
+        foreignPulses > MAX_FOREIGN_PULSES)
+    {
+        prg.clear();
+        return ErrorCodes::UNKNOWN_TAP_FORMAT;
+    }
+    // Drop the checksum.
+    prg.resize(2 + dataLength);
+    uint16_t start = header[1] | (header[2] << 8);
+    if (header[0] == HEADER_TYPE_BASIC)
+    {
+        // Relocated to the start of BASIC, as by LOAD"".
+        start = 0x0801;
+    }
+    prg[0] = start & 0xFF;
+    prg[1] = start >> 8;
+    return ErrorCodes::OK;
+}
+
+void TapPrgExtractor::Pulse(uint32_t units)
+{
+    if (units >= PAUSE_UNITS)
+    {
+        if (sequence == Sequence::Payload)
+        {
+            SequenceEnd();
+        }
+        sequence = Sequence::Idle;
+        decoder.Reset();
+        return;
+    }
+    if (!CbmByteDecoder::IsCbmPulse(units))
+    {
+        foreignPulses++;
+    }
+    int result = decoder.Pulse(units);
+    if (result != CbmByteDecoder::NONE)
+    {
+        Byte(result);
+    }
+}
+
+// The data of a block starts with a countdown: $89 to $81 in the first copy,
+// $09 to $01 in the repeated one.
+void TapPrgExtractor::Byte(int result)
+{
+    switch (sequence)
+    {
+        case Sequence::Idle:
+            if (result == 0x89 || result == 0x09)
+            {
+                sequence = Sequence::Countdown;
+                countdown = result;
+                count = 1;
+            }
+            return;
+        case Sequence::Countdown:
+            if (result == countdown - (int) count)
+            {
+                if (++count == CBM_COUNTDOWN_BYTES)
+                {
+                    sequence = Sequence::Payload;
+                    count = 0;
+                    repeated = countdown == 0x09;
+                    headerBad = false;
+                    repairNext = 0;
+                    repairFailed = false;
+                }
+            }
+            else
+            {
+                sequence = Sequence::Idle;
+                Byte(result);
+            }
+            return;
+        case Sequence::Payload:
+            if (result == CbmByteDecoder::END)
+            {
+                SequenceEnd();
+                sequence = Sequence::Idle;
+            }
+            else
+            {
+                PayloadByte(result < 0 ? 0 : result, result < 0);
+            }
+            return;
+    }
+}
+
+void TapPrgExtractor::PayloadByte(uint8_t b, bool bad)
+{
+    if (count < CBM_HEADER_BYTES)
+    {
+        headerBytes[count] = b;
+        headerBad |= bad;
+    }
+    if (hasHeader && count <= dataLength)
+    {
+        std::vector<uint8_t>& data = *prg;
+        switch (dataStatus)
+        {
+            case DataStatus::None:
+                // Taken as a candidate data copy.
+                if (count == 0)
+                {
+                    data.resize(2 + dataLength + 1);
+                    badBytes.clear();
+                }
+                data[2 + count] = b;
+                if (bad && badBytes.size() <= MAX_BAD_BYTES)
+                {
+                    badBytes.push_back(count);
+                }
+                break;
+            case DataStatus::Partial:
+                // The repeated copy, for the bytes missing from the first one.
+                if (repeated && repairNext < badBytes.size() && badBytes[repairNext] == count)
+                {
+                    data[2 + count] = b;
+                    repairFailed |= bad;
+                    repairNext++;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    count++;
+}
+
+void TapPrgExtractor::SequenceEnd()
+{
+    // The repeated copy of the header comes right after the first one; it
+    // could be mistaken for the data of a program of 192 bytes.
+    bool headerRepeat = repeated && followsHeader;
+    followsHeader = false;
+    if (hasHeader && count == dataLength + 1 && !headerRepeat &&
+        (dataStatus == DataStatus::None || (dataStatus == DataStatus::Partial && repeated)))
+    {
+        DataSequence();
+    }
+    else if (count == CBM_HEADER_BYTES)
+    {
+        HeaderSequence();
+    }
+}
+
+void TapPrgExtractor::HeaderSequence()
+{
+    if (headerBad || Checksum(headerBytes, CBM_HEADER_BYTES) != 0)
+    {
+        return;
+    }
+    uint8_t type = headerBytes[0];
+    if (!hasHeader)
+    {
+        if (type != HEADER_TYPE_BASIC && type != HEADER_TYPE_PRG)
+        {
+            otherFiles |= type != HEADER_TYPE_END_OF_TAPE;
+            return;
+        }
+        uint16_t start = headerBytes[1] | (headerBytes[2] << 8);
+        uint16_t end = headerBytes[3] | (headerBytes[4] << 8);
+        if (end <= start)
+        {
+            return;
+        }
+        memcpy(header, headerBytes, CBM_HEADER_BYTES);
+        hasHeader = true;
+        followsHeader = !repeated;
+        dataLength = end - start;
+        return;
+    }
+    // Anything but the repeated header, or the end of tape marker, is another
+    // file, which the program may go on to load.
+    if (type != HEADER_TYPE_END_OF_TAPE && memcmp(header, headerBytes, CBM_HEADER_BYTES) != 0)
+    {
+        otherFiles = true;
+    }
+}
+
+void TapPrgExtractor::DataSequence()
+{
+    std::vector<uint8_t>& data = *prg;
+    if (dataStatus == DataStatus::None)
+    {
+        if (badBytes.size() > MAX_BAD_BYTES)
+        {
+            return;
+        }
+        if (!badBytes.empty())
+        {
+            dataStatus = DataStatus::Partial;
+            return;
+        }
+    }
+    else if (repairFailed || repairNext < badBytes.size())
+    {
+        // The same bytes are bad in both copies.
+        return;
+    }
+    if (Checksum(&data[2], dataLength + 1) == 0)
+    {
+        dataStatus = DataStatus::Good;
+    }
+    else
+    {
+        // Undetected errors; start over with the next copy.
+        dataStatus = DataStatus::None;
+    }
+}
@@ -2,11 +2,24 @@
 #include "core/include/Lang.h"
 #include <Arduino.h>
 
+#include "roo_logging.h"
+
 using namespace std;
 
 using namespace TapuinoNext;
 
-TapRecorder::TapRecorder(UtilityCollection* utilityCollection) : TapBase(utilityCollection)
+// Capacity of the edge queue (allocated while recording only). Holds about 2
+// seconds of the densest turbo saves, so the recorder task can be held up by
+// slow SD card writes without losing edges.
+#define EDGE_RING_SIZE 8192
+
+// Time the recorder task may spend writing to the SD card per tick.
+#define WRITE_BUDGET_MICROS 20000
+
+TapRecorder::TapRecorder(UtilityCollection* utilityCollection, roo_scheduler::Scheduler& scheduler)
+    : TapBase(utilityCollection),
+      edgeRing(EDGE_RING_SIZE),
+      recordTick(scheduler, [this]() { RecordTick(); }, roo_time::Millis(50))
 {
     isSampling = false;
 }
@@ -17,7 +30,7 @@ TapRecorder::~TapRecorder()
 
 inline void TapRecorder::WriteNextByte(uint8_t nextByte)
 {
-    flipBuffer->WriteByte(nextByte);
+    writer.WriteByte(nextByte);
     tapInfo.position++;
 }
 
@@ -62,6 +75,7 @@ void TapRecorder::StartSampling()
     {
         isSampling = true;
         processSignal = true;
+        edgeRing.Reset();
         HWStartSampling();
         // tell the C64 that play has been pressed
         digitalWrite(C64_SENSE_PIN, LOW);
@@ -91,14 +105,11 @@ void TapRecorder::StopSampling()
     }
 }
 
-ErrorCodes TapRecorder::CreateTap(File tapFile)
+ErrorCodes TapRecorder::CreateTap()
 {
     uint32_t tap_magic[TAP_HEADER_MAGIC_LENGTH / 4];
     memset(&tapInfo, 0, sizeof(tapInfo));
 
-    flipBuffer->Reset();
-    tapFile.seek(0);
-
     // TODO: C16 recording is not properly implemented as yet.
     // The user can set the value to the C16 machine type, but half-wave recording WILL NOT OCCUR!!!
     MACHINE_TYPE machineType = (MACHINE_TYPE) options->machineType.GetValue();
@@ -112,18 +123,13 @@ ErrorCodes TapRecorder::CreateTap(File tapFile)
     tapInfo.video = (uint8_t) (options->ntscPAL.GetValue() ? VIDEO_MODE::NSTC : VIDEO_MODE::PAL);
     tapInfo.platform = (uint8_t) machineType;
 
-    size_t written = tapFile.write((uint8_t*) &tap_magic, TAP_HEADER_MAGIC_LENGTH);
-    if (written != TAP_HEADER_MAGIC_LENGTH)
+    // The length is patched in when finalizing.
+    writer.Write((uint8_t*) &tap_magic, TAP_HEADER_MAGIC_LENGTH);
+    ErrorCodes ret = writer.Write((uint8_t*) &tapInfo, TAP_HEADER_DATA_LENGTH);
+    if (ret != ErrorCodes::OK)
     {
-        Serial.printf("unable to write TAP magic! Length: %d\n", (int)written);
-        return ErrorCodes::FILE_WRITE_ERROR;
-    }
-
-    written = tapFile.write((uint8_t*) &tapInfo, TAP_HEADER_DATA_LENGTH);
-    if (written != TAP_HEADER_DATA_LENGTH)
-    {
-        Serial.printf("unable to write TAP header! Length: %d\n", (int)written);
-        return ErrorCodes::FILE_WRITE_ERROR;
+        Serial.println("unable to write TAP header!");
+        return ret;
     }
 
     SetupCycleTiming();
@@ -155,11 +161,74 @@ bool TapRecorder::InRecordMenu(File tapFile)
     return false;
 }
 
-void TapRecorder::FinalizeRecording(File tapFile)
+ErrorCodes TapRecorder::FinalizeRecording()
+{
+    // Drops the preallocated tail, and patches the header with the length.
+    return writer.Finish(TAP_HEADER_MAGIC_LENGTH, (uint8_t*) &tapInfo, TAP_HEADER_DATA_LENGTH);
+}
+
+ErrorCodes TapRecorder::StartRecording(const char* mountpoint, const char* path)
+{
+    if (isSampling)
+    {
+        return ErrorCodes::OK;
+    }
+    ErrorCodes ret = edgeRing.Init();
+    if (ret == ErrorCodes::OK)
+    {
+        ret = writer.Open(mountpoint, path);
+    }
+    if (ret == ErrorCodes::OK)
+    {
+        ret = CreateTap();
+    }
+    if (ret != ErrorCodes::OK)
+    {
+        writer.Close();
+        edgeRing.Release();
+        return ret;
+    }
+    StartSampling();
+    recordTick.start();
+    return ErrorCodes::OK;
+}
+
+ErrorCodes TapRecorder::StopRecording()
+{
+    if (!isSampling)
+    {
+        return ErrorCodes::OK;
+    }
+    StopSampling();
+    recordTick.stop();
+    // Encode the edges still in the queue.
+    RecordTick();
+    ErrorCodes ret = FinalizeRecording();
+    LOG(INFO) << "Recording finished: " << tapInfo.length << " bytes, lost edges: "
+              << edgeRing.overflows() << ", max write: " << writer.MaxWriteMicros()
+              << " us, stalls: " << writer.Stalls();
+    edgeRing.Release();
+    return ret;
+}
+
+void TapRecorder::RecordTick()
 {
-    flipBuffer->FlushBufferFinal(tapFile);
-    tapFile.seek(TAP_HEADER_MAGIC_LENGTH);
-    tapFile.write((uint8_t*) &tapInfo, TAP_HEADER_DATA_LENGTH);
+    motorOn = digitalRead(C64_MOTOR_PIN);
+    uint32_t signalTime;
+    while (edgeRing.Pop(signalTime))
+    {
+        CalcTapData(signalTime);
+    }
+    tapInfo.counterActual = CYCLES_TO_COUNTER(tapInfo.cycles);
+    // Edges keep being queued by the ISR while this blocks on the card.
+    if (writer.Service(WRITE_BUDGET_MICROS) != ErrorCodes::OK && isSampling)
+    {
+        Serial.println("Recording write failed; stopping");
+        StopSampling();
+        recordTick.stop();
+        writer.Close();
+        edgeRing.Release();
+    }
 }
 
 void TapRecorder::RecordTap(File tapFile)
@@ -0,0 +1,171 @@
+#include "core/include/TapWriter.h"
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+using namespace TapuinoNext;
+
+TapWriter::TapWriter() : fd(-1)
+{
+    for (uint32_t i = 0; i < kBlockCount; i++)
+    {
+        blocks[i] = NULL;
+    }
+}
+
+TapWriter::~TapWriter()
+{
+    Close();
+}
+
+ErrorCodes TapWriter::Open(const char* mountpoint, const char* path)
+{
+    Close();
+    for (uint32_t i = 0; i < kBlockCount; i++)
+    {
+        blocks[i] = (uint8_t*) malloc(kBlockSize);
+        if (blocks[i] == NULL)
+        {
+            Close();
+            return ErrorCodes::OUT_OF_MEMORY;
+        }
+    }
+    std::string vfsPath = std::string(mountpoint) + path;
+    fd = open(vfsPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        Serial.printf("Unable to create: %s\n", vfsPath.c_str());
+        Close();
+        return ErrorCodes::FILE_WRITE_ERROR;
+    }
+    current = 0;
+    fill = 0;
+    queued = 0;
+    length = 0;
+    written = 0;
+    allocated = 0;
+    extending = true;
+    maxWriteMicros = 0;
+    stalls = 0;
+    status = ErrorCodes::OK;
+    return ErrorCodes::OK;
+}
+
+void TapWriter::Close()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    for (uint32_t i = 0; i < kBlockCount; i++)
+    {
+        free(blocks[i]);
+        blocks[i] = NULL;
+    }
+}
+
+ErrorCodes TapWriter::Write(const uint8_t* data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        WriteByte(data[i]);
+    }
+    return status;
+}
+
+void TapWriter::NextBlock()
+{
+    if (queued == kBlockCount - 1)
+    {
+        // No free block; write the oldest one now.
+        stalls++;
+        Service(0);
+    }
+    current = (current + 1) % kBlockCount;
+    queued++;
+    fill = 0;
+}
+
+ErrorCodes TapWriter::WriteBlock(const uint8_t* data, uint32_t size)
+{
+    if (status != ErrorCodes::OK)
+    {
+        return status;
+    }
+    uint32_t start = micros();
+    if (extending && written + size > allocated)
+    {
+        // Extend the file ahead of the data, so that its clusters are linked
+        // in one go rather than on every block write.
+        allocated += kPreallocChunk;
+        if (ftruncate(fd, allocated) != 0)
+        {
+            // Only costs the latency; the writes extend the file as needed.
+            extending = false;
+        }
+        if (lseek(fd, written, SEEK_SET) != (off_t) written)
+        {
+            status = ErrorCodes::FILE_WRITE_ERROR;
+            return status;
+        }
+    }
+    if (write(fd, data, size) != (ssize_t) size)
+    {
+        status = ErrorCodes::FILE_WRITE_ERROR;
+        return status;
+    }
+    written += size;
+    uint32_t elapsed = micros() - start;
+    if (elapsed > maxWriteMicros)
+    {
+        maxWriteMicros = elapsed;
+    }
+    return status;
+}
+
+ErrorCodes TapWriter::Service(uint32_t budgetMicros)
+{
+    uint32_t start = micros();
+    // Always writes at least one block, if any is queued.
+    while (queued > 0 && status == ErrorCodes::OK)
+    {
+        uint32_t oldest = (current + kBlockCount - queued) % kBlockCount;
+        WriteBlock(blocks[oldest], kBlockSize);
+        queued--;
+        if (micros() - start >= budgetMicros)
+        {
+            break;
+        }
+    }
+    return status;
+}
+
+ErrorCodes TapWriter::Finish(uint32_t offset, const uint8_t* patch, uint32_t size)
+{
+    if (fd < 0)
+    {
+        return ErrorCodes::FILE_ERROR;
+    }
+    while (queued > 0 && status == ErrorCodes::OK)
+    {
+        Service(0);
+    }
+    if (fill > 0)
+    {
+        WriteBlock(blocks[current], fill);
+        fill = 0;
+    }
+    if (status == ErrorCodes::OK &&
+        (ftruncate(fd, length) != 0 || lseek(fd, offset, SEEK_SET) != (off_t) offset ||
+         write(fd, patch, size) != (ssize_t) size || fsync(fd) != 0))
+    {
+        status = ErrorCodes::FILE_WRITE_ERROR;
+    }
+    ErrorCodes ret = status;
+    Close();
+    return ret;
+}
@@ -1,59 +1,93 @@
 #include "file_index.h"
 
+#include <new>
+
 #include "io/data_io.h"
 #include "roo_logging.h"
 
 namespace tapuino {
 
+namespace {
+
+// Version 1: type, record size, parent, entry type, size, and the name length.
+constexpr uint16_t kMinRecordSize = 1 + 2 + 4 + 1 + 4 + 1;
+
+}  // namespace
+
 void FileIndexWriter::open(StringView path) {
-  CHECK(!target_);
-  target_ = fs_.open(String((const char *)path.data(), path.size()), "w");
-  if (!target_) {
+  CHECK(target_ == nullptr);
+  target_.reset(new BufferedWriter<kBufferSize>());
+  target_->set(fs_.open(String((const char *)path.data(), path.size()), "w"));
+  if (!*target_) {
     status_ = BAD_FILE;
+    return;
   }
-  fpos_ = 0;
+  uint8_t header[] = {kFileIndexMagic, kFileIndexVersion};
+  writeToFile(header, sizeof(header));
+  fpos_ = sizeof(header);
 }
 
 void FileIndexWriter::close() {
-  if (status_ != OK) return;
-  target_.close();
-  if (target_.getWriteError() != 0 || !write_path_.empty()) {
+  if (target_ == nullptr) return;
+  target_->close();
+  stats_ = target_->stats();
+  if (status_ == OK && (!*target_ || !write_path_.empty())) {
     status_ = WRITE_ERROR;
   }
+  target_.reset();
+  LOG(INFO) << "File index: " << stats_.bytes << " bytes in " << stats_.flushes
+            << " writes, " << stats_.flush_us / 1000 << " ms (slowest "
+            << stats_.max_flush_us << " us)";
 }
 
 void FileIndexWriter::containerBegin(ContainerType type, StringView name,
                                      uint32_t size) {
   if (status_ != OK) return;
-  write_path_.push_back(fpos_);
-  addEntry(true, type, name, size);
+  addEntry(true, type, name, size, TapMeta());
 }
 
-void FileIndexWriter::addFile(FileType type, StringView name, uint32_t size) {
+void FileIndexWriter::addFile(FileType type, StringView name, uint32_t size,
+                              TapMeta meta) {
   if (status_ != OK) return;
   CHECK(!write_path_.empty());
-  addEntry(false, type, name, size);
+  addEntry(false, type, name, size, meta);
 }
 
 void FileIndexWriter::addEntry(bool container, uint8_t type, StringView name,
-                               uint32_t size) {
-  uint8_t buf[1024];
-  writeU8(container ? 1 : 0, buf);
-  uint8_t *cursor = buf + 3;  // leaving space for the record size
-  uint32_t parent = (write_path_.empty() ? 0xFFFFFFFF : write_path_.back());
-  cursor = writeU32(parent, cursor);  // parent, for fseek
-  cursor = writeU8((uint8_t)type, cursor);
-  cursor = writeU32(size, cursor);
-  cursor = writeStr((const char *)name.data(), name.size(), cursor);
-  uint16_t record_size = cursor - buf;
-  writeU16(record_size, buf + 1);
-  writeToFile(buf, record_size);
-  fpos_ += record_size;
+                               uint32_t size, TapMeta meta) {
+  uint8_t head[6];
+  uint8_t body[5 + 5 + 1 + 255 + 4];
+  uint32_t parent_distance =
+      (write_path_.empty() ? 0 : fpos_ - write_path_.back().pos);
+  uint8_t *cursor = writeVarU32(parent_distance, body);
+  cursor = writeVarU32(size, cursor);
+  cursor = writeStr((const char *)name.data(),
+                    name.size() > 255 ? 255 : name.size(), cursor);
+  uint8_t *end_field = cursor;
+  if (container) {
+    // Filled in by containerEnd().
+    cursor = writeU32(0, cursor);
+  } else {
+    cursor = writeU8(meta.toByte(), cursor);
+  }
+  uint32_t body_size = cursor - body;
+  head[0] = (container ? 1 : 0) | (type & 7) << 1;
+  uint32_t head_size = writeVarU32(body_size, head + 1) - head;
+  if (container) {
+    write_path_.push_back(
+        OpenContainer{fpos_, fpos_ + head_size + (uint32_t)(end_field - body)});
+  }
+  writeToFile(head, head_size);
+  writeToFile(body, body_size);
+  fpos_ += head_size + body_size;
 }
 
 void FileIndexWriter::containerEnd() {
   if (status_ != OK) return;
   CHECK(!write_path_.empty());
+  uint8_t end[4];
+  writeU32(fpos_, end);
+  target_->patch(write_path_.back().end_field, end, sizeof(end));
   uint8_t container_end_marker = 0xFF;
   writeToFile(&container_end_marker, 1);
   write_path_.pop_back();
@@ -61,11 +95,9 @@ void FileIndexWriter::containerEnd() {
 }
 
 void FileIndexWriter::writeToFile(const uint8_t *buf, size_t size) {
-  while (size > 0 && status_ == OK) {
-    size -= target_.write(buf, size);
-    if (target_.getWriteError() != 0) {
-      status_ = WRITE_ERROR;
-    }
+  target_->write(buf, size);
+  if (!*target_) {
+    status_ = WRITE_ERROR;
   }
 }
 
@@ -92,7 +124,7 @@ void FileIndexReader::Entry::appendPath(std::string& path) const {
     parent()->appendPath(path);
     path += "/";
   }
-  path += name();
+  path.append((const char *)name_.data(), name_.size());
 }
 
 uint32_t FileIndexReader::Entry::file_size() const {
@@ -107,9 +139,21 @@ void FileIndexReader::open(StringView path) {
   if (!input_) {
     status_ = BAD_FILE;
   }
-  path_.clear();
+  top_ = 0;
+  back_ = nullptr;
   dir_pushed_ = true;
   eof_ = false;
+  version_ = 1;
+  const uint8_t *header = input_.peek(1);
+  if (header != nullptr && header[0] == kFileIndexMagic) {
+    header = input_.peek(2);
+    if (header == nullptr || header[1] != kFileIndexVersion) {
+      status_ = BAD_DATA;
+      return;
+    }
+    version_ = header[1];
+    input_.consume(2);
+  }
 }
 
 void FileIndexReader::close() {
@@ -117,18 +161,6 @@ void FileIndexReader::close() {
   input_.close();
 }
 
-bool FileIndexReader::readFromFile(uint8_t *buf, size_t len) {
-  while (len > 0) {
-    int r = input_.read(buf, len);
-    if (r < 0) {
-      return false;
-    }
-    buf += r;
-    len -= r;
-  }
-  return true;
-}
-
 const FileIndexReader::Entry *FileIndexReader::next() {
   if (status_ != OK) {
     // Read error.
@@ -143,84 +175,172 @@ const FileIndexReader::Entry *FileIndexReader::next() {
     return nullptr;
   }
   if (!dir_pushed_) {
-    path_.pop_back();
+    pop();
     dir_pushed_ = true;
   }
   while (true) {
-    uint8_t type;
-    if (!readFromFile(&type, 1)) {
-      if (!path_.empty()) {
+    // The records are parsed in place, in the reader's buffer.
+    const uint8_t *type_ptr = input_.peek(1);
+    if (type_ptr == nullptr) {
+      if (back_ != nullptr) {
         status_ = PREMATURE_EOF;
       }
       return nullptr;
     }
-    if (type == 0xFF) {
+    if (*type_ptr == 0xFF) {
       // end-of-container marker. Skip over.
-      if (path_.empty()) {
+      input_.consume(1);
+      if (back_ == nullptr) {
         // Unexpected dir end.
         status_ = BAD_DATA;
         return nullptr;
       }
-      path_.pop_back();
+      pop();
       dir_pushed_ = true;
-      if (path_.empty()) {
+      if (back_ == nullptr) {
         // Legitimate EOF.
         eof_ = true;
         return nullptr;
       }
       continue;
     }
-    uint8_t size_buf[2];
-    if (!readFromFile(size_buf, 2)) {
-      status_ = PREMATURE_EOF;
-      return nullptr;
-    }
-    uint16_t record_size;
-    readU16(record_size, size_buf);
-    if (eof_) {
-      status_ = PREMATURE_EOF;
+    Record rec;
+    status_ = (version_ == 1 ? parseV1(rec) : parseV2(rec));
+    if (status_ != OK) return nullptr;
+    if (!push(rec)) {
+      LOG(ERROR) << "File index path too long";
+      status_ = BAD_DATA;
       return nullptr;
     }
-    uint8_t record_buf[record_size - 3];
-    if (!readFromFile(record_buf, record_size - 3)) {
+    dir_pushed_ = (rec.type == 1);
+    input_.consume(rec.record_size);
+    return back_;
+  }
+}
+
+void FileIndexReader::skipSubtree() {
+  if (status_ != OK || !input_ || eof_) return;
+  if (!dir_pushed_) {
+    pop();
+    dir_pushed_ = true;
+  }
+  CHECK(back_ != nullptr);
+  if (back_->end_ != 0) {
+    if (!input_.seek(back_->end_)) status_ = PREMATURE_EOF;
+    return;
+  }
+  // No end offset; read through the subtree, stopping at its end marker.
+  int depth = 0;
+  while (true) {
+    const uint8_t *type_ptr = input_.peek(1);
+    if (type_ptr == nullptr) {
       status_ = PREMATURE_EOF;
-      return nullptr;
+      return;
     }
-    const uint8_t *cursor = record_buf;
-    uint32_t parent;
-    uint8_t entry_type;
-    uint32_t size;
-    StringView name;
-    cursor = readU32(parent, cursor);
-    cursor = readU8(entry_type, cursor);
-    entry_type &= 7;
-    cursor = readU32(size, cursor);
-    cursor = readStr(name, cursor);
-    const Entry *parent_ptr = (path_.empty() ? nullptr : &path_.back());
-    switch (type) {
-      case 1: {
-        // Container.
-        path_.emplace_back(true, entry_type,
-                           std::string((const char *)name.data(), name.size()),
-                           size, parent_ptr);
-        dir_pushed_ = true;
-        break;
-      }
-      case 0: {
-        // File.
-        path_.emplace_back(false, entry_type,
-                           std::string((const char *)name.data(), name.size()),
-                           size, parent_ptr);
-        dir_pushed_ = false;
-        break;
-      }
-      default: {
-        status_ = BAD_DATA;
-        break;
-      }
+    if (*type_ptr == 0xFF) {
+      if (depth == 0) return;
+      --depth;
+      input_.consume(1);
+      continue;
     }
-    return path_.empty() ? nullptr : &path_.back();
+    Record rec;
+    status_ = (version_ == 1 ? parseV1(rec) : parseV2(rec));
+    if (status_ != OK) return;
+    if (rec.type == 1) ++depth;
+    input_.consume(rec.record_size);
+  }
+}
+
+Status FileIndexReader::parseV1(Record &rec) {
+  const uint8_t *header = input_.peek(3);
+  if (header == nullptr) return PREMATURE_EOF;
+  rec.type = header[0];
+  readU16(rec.record_size, header + 1);
+  if (rec.type > 1 || rec.record_size < kMinRecordSize) return BAD_DATA;
+  const uint8_t *record = input_.peek(rec.record_size);
+  if (record == nullptr) return PREMATURE_EOF;
+  const uint8_t *cursor = record + 3;
+  uint32_t parent;
+  cursor = readU32(parent, cursor);
+  cursor = readU8(rec.entry_type, cursor);
+  rec.entry_type &= 7;
+  cursor = readU32(rec.size, cursor);
+  cursor = readStr(rec.name, cursor);
+  if (cursor > record + rec.record_size) return BAD_DATA;
+  rec.meta = TapMeta();
+  if (cursor < record + rec.record_size) {
+    uint8_t meta_byte;
+    cursor = readU8(meta_byte, cursor);
+    rec.meta = TapMeta::FromByte(meta_byte);
+  }
+  rec.end = 0;
+  return OK;
+}
+
+Status FileIndexReader::parseV2(Record &rec) {
+  // The flags, and the body size, which takes at most 2 bytes.
+  const uint8_t *head = input_.peek(2);
+  if (head == nullptr) return PREMATURE_EOF;
+  size_t head_size = 2;
+  if (head[1] & 0x80) {
+    head = input_.peek(3);
+    if (head == nullptr) return PREMATURE_EOF;
+    head_size = 3;
+  }
+  if (head[0] & 0xF0) return BAD_DATA;
+  rec.type = head[0] & 1;
+  rec.entry_type = (head[0] >> 1) & 7;
+  uint32_t body_size;
+  if (readVarU32(body_size, head + 1, head + head_size) == nullptr) {
+    return BAD_DATA;
+  }
+  if (head_size + body_size > 0xFFFF) return BAD_DATA;
+  rec.record_size = head_size + body_size;
+  const uint8_t *record = input_.peek(rec.record_size);
+  if (record == nullptr) return PREMATURE_EOF;
+  const uint8_t *end = record + rec.record_size;
+  const uint8_t *cursor = record + head_size;
+  uint32_t parent_distance;
+  cursor = readVarU32(parent_distance, cursor, end);
+  if (cursor == nullptr) return BAD_DATA;
+  cursor = readVarU32(rec.size, cursor, end);
+  if (cursor == nullptr || cursor >= end || cursor + 1 + *cursor > end) {
+    return BAD_DATA;
   }
+  cursor = readStr(rec.name, cursor);
+  rec.meta = TapMeta();
+  rec.end = 0;
+  if (rec.type == 1) {
+    if (end - cursor < 4) return BAD_DATA;
+    cursor = readU32(rec.end, cursor);
+  } else if (cursor < end) {
+    uint8_t meta_byte;
+    cursor = readU8(meta_byte, cursor);
+    rec.meta = TapMeta::FromByte(meta_byte);
+  }
+  return OK;
+}
+
+bool FileIndexReader::push(const Record &rec) {
+  // Keep the next entry aligned.
+  size_t frame = sizeof(Entry) + rec.name.size();
+  frame = (frame + alignof(Entry) - 1) / alignof(Entry) * alignof(Entry);
+  if (top_ + frame > kArenaSize) return false;
+  uint8_t *base = &arena_[top_];
+  uint8_t *name_copy = base + sizeof(Entry);
+  memcpy(name_copy, rec.name.data(), rec.name.size());
+  back_ = new (base)
+      Entry(rec.type == 1, rec.entry_type,
+            StringView(name_copy, rec.name.size()), rec.size, rec.meta,
+            rec.end, back_);
+  top_ += frame;
+  return true;
+}
+
+void FileIndexReader::pop() {
+  // Entries are trivially destructible.
+  top_ = (const uint8_t *)back_ - &arena_[0];
+  back_ = back_->parent();
 }
 
 }  // namespace tapuino
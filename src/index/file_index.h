@@ -3,9 +3,12 @@
 #include <FS.h>
 #include <stdint.h>
 
+#include <memory>
 #include <vector>
 
 #include "io/buffered_reader.h"
+#include "io/buffered_writer.h"
+#include "io/tap_header.h"
 #include "roo_display/core/utf8.h"
 
 namespace tapuino {
@@ -16,6 +19,7 @@ using ::roo_display::StringView;
 
 enum FileType {
   TAP_FILE = 0,
+  PRG_FILE = 1,
 };
 
 enum ContainerType {
@@ -32,6 +36,23 @@ enum Status {
   BAD_FILE = 5,
 };
 
+// The master index: the tree of directories and ZIP files, with the files
+// found in them, in depth-first order.
+//
+// Version 1 files are a sequence of records with a fixed 12-byte header: the
+// type, the record size, the offset of the parent, the entry type, and the
+// size, followed by the name and the meta byte. Each container is closed by
+// an 0xFF marker.
+//
+// Version 2 files start with kFileIndexMagic and the version. A record is a
+// flags byte (bit 0: container, bits 1-3: the entry type), and a varint size
+// of the body that follows. The body holds the varint distance back to the
+// parent record (0 for the root), the varint size, and the name; then, for
+// containers, the 32-bit offset of its end marker, and for files, the meta
+// byte. Readers ignore the bytes past the fields they know.
+constexpr uint8_t kFileIndexMagic = 0xFE;
+constexpr uint8_t kFileIndexVersion = 2;
+
 class FileIndexWriter {
  public:
   FileIndexWriter(FS& fs) : fs_(fs), status_(OK) {}
@@ -43,21 +64,38 @@ class FileIndexWriter {
   void containerBegin(ContainerType type, StringView name, uint32_t size);
   void containerEnd();
 
-  void addFile(FileType type, StringView name, uint32_t size);
+  void addFile(FileType type, StringView name, uint32_t size,
+               TapMeta meta = TapMeta());
 
   Status status() const { return status_; }
 
   operator bool() const { return status_ == OK; }
 
+  // I/O counters of the index file written last.
+  const WriteStats& stats() const { return stats_; }
+
  private:
-  void addEntry(bool container, uint8_t type, StringView name, uint32_t size);
+  // A scan writes tens of thousands of small records; they go out to the
+  // card in batches of a few sectors.
+  static constexpr size_t kBufferSize = 4096;
+
+  void addEntry(bool container, uint8_t type, StringView name, uint32_t size,
+                TapMeta meta);
 
   void writeToFile(const uint8_t* buf, size_t size);
 
+  struct OpenContainer {
+    uint32_t pos;
+    // Where the offset of the end marker goes, once known.
+    uint32_t end_field;
+  };
+
   FS& fs_;
-  File target_;
+  // Allocated on open(), to keep the buffer off the stack.
+  std::unique_ptr<BufferedWriter<kBufferSize>> target_;
+  WriteStats stats_;
   uint32_t fpos_;
-  std::vector<uint32_t> write_path_;
+  std::vector<OpenContainer> write_path_;
   Status status_;
 };
 
@@ -65,12 +103,14 @@ class FileIndexReader {
  public:
   class Entry {
    public:
-    Entry(bool is_container, uint8_t type, std::string name, uint32_t size,
-          const Entry* parent)
+    Entry(bool is_container, uint8_t type, StringView name, uint32_t size,
+          TapMeta meta, uint32_t end, const Entry* parent)
         : is_container_(is_container),
           type_(type),
-          name_(std::move(name)),
+          name_(name),
           size_(size),
+          meta_(meta),
+          end_(end),
           parent_(parent),
           depth_(parent == nullptr ? 0 : parent->depth_ + 1) {}
 
@@ -84,10 +124,12 @@ class FileIndexReader {
 
     const Entry* parent() const { return parent_; }
 
-    const std::string& name() const { return name_; }
+    // Valid as long as the entry.
+    StringView name() const { return name_; }
 
     FileType file_type() const;
     uint32_t file_size() const;
+    TapMeta meta() const { return meta_; }
 
     ContainerType container_type() const;
 
@@ -96,18 +138,22 @@ class FileIndexReader {
     void appendPath(std::string& path) const;
 
    private:
+    friend class FileIndexReader;
+
     bool is_container_;
     uint8_t type_;
-    std::string name_;
+    StringView name_;
     uint32_t size_;
+    TapMeta meta_;
+    // Of containers in v2 files, the offset of the end marker; 0 otherwise.
+    uint32_t end_;
     const Entry* parent_;
     uint8_t depth_;
   };
 
-  FileIndexReader(FS& fs) : fs_(fs), status_(OK) {
-    // Make sure that pointers don't get invalidated.
-    path_.reserve(20);
-  }
+  FileIndexReader(FS& fs)
+      : fs_(fs), arena_(new uint8_t[kArenaSize]), top_(0), back_(nullptr),
+        status_(OK) {}
 
   ~FileIndexReader() { close(); }
 
@@ -120,16 +166,47 @@ class FileIndexReader {
   // subsequent call to next(). Returns nullptr on EOS or error.
   const Entry* next();
 
+  // Skips the remaining entries of the innermost open container, i.e. the
+  // container returned by the last call to next(), or the parent of the
+  // returned file. Seeks straight past them in v2 files.
+  void skipSubtree();
+
  private:
-  bool readFromFile(uint8_t* buf, size_t len);
+  // Holds the entries of the current path, each followed by its name. Limits
+  // the total length of the names along a path, rather than its depth.
+  static constexpr size_t kArenaSize = 4096;
+
+  // A record, parsed in place in the input buffer.
+  struct Record {
+    // 0 for files, 1 for containers.
+    uint8_t type;
+    uint8_t entry_type;
+    uint32_t size;
+    StringView name;
+    TapMeta meta;
+    uint32_t end;
+    uint16_t record_size;
+  };
+
+  // Parse the record at the current position, without consuming it.
+  Status parseV1(Record& rec);
+  Status parseV2(Record& rec);
+
+  // Pushes the entry onto the arena stack. Returns false if it doesn't fit.
+  bool push(const Record& rec);
+  void pop();
 
   FS& fs_;
   // File input_;
-  // Buffering speeds up index read by ~22%. Buffer sizes > 256 bytes don't make
-  // much difference.
-  BufferedReader input_;
+  // Records are parsed in place in the buffer. A few sectors per read help
+  // the SD card; more would mostly cost stack.
+  BufferedReader<1024> input_;
+  uint8_t version_;
   bool eof_;
-  std::vector<Entry> path_;
+  // Allocated once, so that reading the records doesn't touch the heap.
+  std::unique_ptr<uint8_t[]> arena_;
+  size_t top_;
+  const Entry* back_;
   bool dir_pushed_;
   Status status_;
 };
@@ -51,8 +51,12 @@ uint16_t encodeBiSize(int32_t size) {
   return (exponent << 10) + size;
 }
 
+// Version 0x0102 added the TAP metadata byte.
+constexpr uint16_t kMemIndexVersion = 0x0102;
+
 constexpr int kParentEntryOffset = 0;
-constexpr int kNamePrefixOffset = kParentEntryOffset + 2;
+constexpr int kMetaOffset = kParentEntryOffset + 2;
+constexpr int kNamePrefixOffset = kMetaOffset + 1;
 constexpr int kUniqueNameSuffixOffset = kNamePrefixOffset + 1;
 
 void printEntrySize(uint32_t entry, char *out) {
@@ -115,6 +119,8 @@ void MemIndex::clear() {
   count_ = 0;
   data_size_ = 0;
   file_count_ = 0;
+  // Whatever gets added from now on is written over.
+  membuf::ClearDirtyIndexRange();
 }
 
 void MemIndex::init() {
@@ -136,7 +142,8 @@ std::string MemIndex::getPath(Handle h) const {
 }
 
 MemIndex::Handle MemIndex::addEntry(uint8_t type, Handle parent,
-                                    StringView name, uint32_t file_size) {
+                                    StringView name, uint32_t file_size,
+                                    TapMeta meta) {
   if (count_ == capacity_) {
     LOG(ERROR) << "Overflow: the number of entries reached the limit of "
                << capacity_;
@@ -173,6 +180,7 @@ MemIndex::Handle MemIndex::addEntry(uint8_t type, Handle parent,
 
   uint8_t *cursor = data_ + data_size_;
   cursor = writeU16(parent.val_, cursor);
+  cursor = writeU8(meta.toByte(), cursor);
   cursor = writeU8(shared_prefix_len, cursor);
   cursor = writeStr((const char *)name.data() + shared_prefix_len,
                     (uint8_t)(name_len - shared_prefix_len), cursor);
@@ -226,10 +234,18 @@ bool MemIndexEntry::isTapFile() const {
   return (getEntry() & 0xC0000000) == 0x80000000;
 }
 
+bool MemIndexEntry::isPrgFile() const {
+  return (getEntry() & 0xC0000000) == 0xC0000000;
+}
+
 void MemIndexEntry::printSize(char *out) const {
   printEntrySize(getEntry(), out);
 }
 
+TapMeta MemIndexEntry::meta() const {
+  return TapMeta::FromByte(*(getDataPtr() + kMetaOffset));
+}
+
 uint8_t MemIndexEntry::shared_name_prefix_len() const {
   return *(getDataPtr() + kNamePrefixOffset);
 }
@@ -455,7 +471,7 @@ void MemIndex::buildSortIndexes() {
   file_count_ = 0;
   for (uint16_t i = 0; i < count_; ++i) {
     MemIndexEntry a(this, (Handle)i);
-    if (a.isTapFile()) {
+    if (!a.isContainer()) {
       taps_sorted_by_name_[file_count_++] = i;
     }
   }
@@ -472,9 +488,9 @@ void MemIndex::buildSortIndexes() {
 bool MemIndex::Store(FS &fs, const char *filename) {
   File f = fs.open(filename, "w");
   if (!f) return false;
-  BufferedWriter writer;
+  BufferedWriter<> writer;
   writer.set(f);
-  writer.writeU16(0x0101);
+  writer.writeU16(kMemIndexVersion);
   writer.writeU16(count_);
   for (uint16_t i = 0; i < count_; ++i) {
     writer.writeU32(entries_[i]);
@@ -494,6 +510,7 @@ bool MemIndex::Store(FS &fs, const char *filename) {
 
 LoadResult MemIndex::Load(FS &fs, const char *filename) {
   Serial.println("Loading index into memory");
+  membuf::ClearDirtyIndexRange();
   File f = fs.open(filename, "r");
   if (!f) {
     if (errno == ENOENT) {
@@ -503,14 +520,14 @@ LoadResult MemIndex::Load(FS &fs, const char *filename) {
                         .error_details = strerror(errno)};
     }
   }
-  BufferedReader reader;
+  BufferedReader<> reader;
   reader.set(f);
   uint16_t version = reader.readU16();
   if (reader.eof()) {
     return LoadResult{.status = LoadResult::PREMATURE_EOF,
                       .error_details = "premature end of file."};
   }
-  if (version != 0x0101) {
+  if (version != kMemIndexVersion) {
     return LoadResult{
         .status = LoadResult::UNSUPPORTED_VERSION,
         .error_details = "unrecognized version or file corrupted."};
@@ -554,4 +571,30 @@ LoadResult MemIndex::Load(FS &fs, const char *filename) {
   return LoadResult{.status = LoadResult::OK};
 }
 
-}  // namespace tapuino
\ No newline at end of file
+LoadResult MemIndex::ReloadDirty(FS &fs, const char *filename) {
+  uint32_t begin, end;
+  if (!membuf::GetDirtyIndexRange(begin, end)) {
+    return LoadResult{.status = LoadResult::OK};
+  }
+  membuf::ClearDirtyIndexRange();
+  if (begin >= data_size_) {
+    // The index is small enough not to overlap.
+    return LoadResult{.status = LoadResult::OK};
+  }
+  if (end > data_size_) end = data_size_;
+  LOG(INFO) << "Reloading bytes " << begin << "-" << end << " of the index";
+  // The data follows the version, the count, the entries, and the data size.
+  uint32_t offset = 2 + 2 + 4 * (uint32_t)count_ + 4 + begin;
+  File f = fs.open(filename, "r");
+  if (f && f.seek(offset) &&
+      f.read(data_ + begin, end - begin) == (size_t)(end - begin)) {
+    f.close();
+    return LoadResult{.status = LoadResult::OK};
+  }
+  LOG(WARNING) << "Partial reload of the index failed; reloading all of it";
+  f.close();
+  clear();
+  return Load(fs, filename);
+}
+
+}  // namespace tapuino
@@ -3,6 +3,7 @@
 #include <FS.h>
 #include <stdint.h>
 
+#include "io/tap_header.h"
 #include "roo_display/core/utf8.h"
 
 namespace tapuino {
@@ -130,23 +131,35 @@ class MemIndex {
   LoadResult Load(FS &fs, const char *filename);
   bool Store(FS &fs, const char *filename);
 
+  // Repairs the index data after the unzipper has used its buffer (which
+  // overlaps the top of the index data, see membuf), by re-reading just the
+  // overwritten range from the index file that the index was loaded from.
+  // Nothing is read if the index data doesn't reach that far. Falls back to
+  // Load() if the read fails.
+  LoadResult ReloadDirty(FS &fs, const char *filename);
+
  private:
   friend class MemIndexEntry;
   friend class MemIndexBuilder;
 
   Handle addEntry(uint8_t type, Handle parent, StringView name,
-                  uint32_t file_size);
+                  uint32_t file_size, TapMeta meta);
 
   Handle addDir(Handle parent, StringView name) {
-    return addEntry(0, parent, name, 0);
+    return addEntry(0, parent, name, 0, TapMeta());
   }
 
   Handle addZip(Handle parent, StringView name, uint32_t file_size) {
-    return addEntry(1, parent, name, file_size);
+    return addEntry(1, parent, name, file_size, TapMeta());
+  }
+
+  Handle addTapFile(Handle parent, StringView name, uint32_t file_size,
+                    TapMeta meta) {
+    return addEntry(2, parent, name, file_size, meta);
   }
 
-  Handle addTapFile(Handle parent, StringView name, uint32_t file_size) {
-    return addEntry(2, parent, name, file_size);
+  Handle addPrgFile(Handle parent, StringView name, uint32_t file_size) {
+    return addEntry(3, parent, name, file_size, TapMeta());
   }
 
   void buildSortIndexes();
@@ -231,11 +244,15 @@ class MemIndexEntry {
   bool isDir() const;
   bool isZip() const;
   bool isTapFile() const;
+  bool isPrgFile() const;
 
   bool isDescendantOf(MemIndex::Handle node) const;
 
   void printSize(char *out) const;
 
+  // The properties of a TAP, as validated by the indexer.
+  TapMeta meta() const;
+
   // Returns a piece of the name that is identical to the parent directory's
   // name. Since it is a common pattern that ZIP files have similar names as
   // their entries, the trick of referencing that common suffix can save
@@ -21,8 +21,11 @@ bool MemIndexBuilder::addEntry(const FileIndexReader::Entry *entry) {
     } else {
       added = mem_index_.addZip(parent, entry->name(), 0);
     }
+  } else if (entry->file_type() == PRG_FILE) {
+    added = mem_index_.addPrgFile(parent, entry->name(), entry->file_size());
   } else {
-    added = mem_index_.addTapFile(parent, entry->name(), entry->file_size());
+    added = mem_index_.addTapFile(parent, entry->name(), entry->file_size(),
+                                  entry->meta());
   }
   if (added == MemIndex::Handle::None()) return false;
   if (entry->isContainer()) {
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <inttypes.h>
 
 #include <FS.h>
@@ -6,6 +8,9 @@
 
 namespace tapuino {
 
+// SD cards read in 512-byte sectors.
+constexpr size_t kSectorSize = 512;
+
 template <typename Stream>
 bool readAll(Stream& s, uint8_t *dest, int count) {
   while (count > 0 && s) {
@@ -17,71 +22,167 @@ bool readAll(Stream& s, uint8_t *dest, int count) {
   return true;
 }
 
+// Reads a file through a buffer of N bytes, a multiple of the sector size.
+// The file is always read N bytes at a time (or, for large reads bypassing the
+// buffer, a multiple of sectors), so that reads starting at a sector boundary
+// stay aligned.
+//
+// Records can be parsed in place: peek(n) makes the next n bytes available as
+// a contiguous range of the buffer, and consume(n) skips over them. The bytes
+// left over when the buffer runs out are moved in front of the refilled
+// block, which is what limits peek() to kMaxPeek bytes.
+template <size_t N = kSectorSize>
 class BufferedReader {
+  static_assert(N > 0 && N % kSectorSize == 0,
+                "The buffer must span whole sectors");
+
  public:
-  BufferedReader() : rem_(-1) {}
+  static constexpr size_t kMaxPeek = kSectorSize;
+
+  BufferedReader()
+      : pos_(kMaxPeek), end_(kMaxPeek), offset_(0), ok_(false), eof_(false) {}
 
   void set(File f) {
     file_ = f;
-    rem_ = f.read(buf_, 256);
-    pos_ = 0;
+    pos_ = kMaxPeek;
+    end_ = kMaxPeek;
+    offset_ = 0;
+    ok_ = (bool)file_;
     eof_ = false;
   }
 
-  int read(uint8_t* dest, int count) {
-    if (count <= rem_) {
-      memcpy(dest, &buf_[pos_], count);
-      rem_ -= count;
-      pos_ += count;
-      return count;
+  // Position in the file of the next byte to read.
+  uint32_t position() const { return offset_ - (end_ - pos_); }
+
+  // Moves to the specified position. Forward seeks within the buffer are
+  // free; others read from the sector containing the position.
+  bool seek(uint32_t pos) {
+    if (!ok_) return false;
+    if (pos >= position() && pos <= offset_) {
+      pos_ += pos - position();
+      return true;
+    }
+    uint32_t sector = pos - pos % kSectorSize;
+    if (!file_.seek(sector)) {
+      setEof();
+      return false;
+    }
+    pos_ = kMaxPeek;
+    end_ = kMaxPeek;
+    offset_ = sector;
+    if (pos > sector) {
+      if (!refill() || end_ - pos_ < pos - sector) {
+        setEof();
+        return false;
+      }
+      pos_ += pos - sector;
     }
-    if (rem_ < 0) return rem_;
-    memcpy(dest, &buf_[pos_], rem_);
-    int result = rem_;
-    if (file_.available() == 0) {
-      eof_ = true;
-      rem_ = -1;
-      pos_ = 0;
-      return -1;
+    return true;
+  }
+
+  // Returns the next n (at most kMaxPeek) bytes, without consuming them. They
+  // remain valid until the next call to any other method. Returns nullptr if
+  // the file ends sooner.
+  const uint8_t* peek(size_t n) {
+    if (end_ - pos_ < n) {
+      if (!ok_ || n > kMaxPeek || !refill() || end_ - pos_ < n) {
+        setEof();
+        return nullptr;
+      }
     }
-    rem_ = file_.read(buf_, 256);
-    pos_ = 0;
-    return result;
+    return &buf_[pos_];
+  }
+
+  // Skips over n bytes, which must have been peeked.
+  void consume(size_t n) { pos_ += n; }
+
+  // Reads up to `count` bytes. Returns the number of bytes read, or -1 if
+  // there is nothing more to read.
+  int read(uint8_t* dest, int count) {
+    if (!ok_) return -1;
+    if (count <= 0) return 0;
+    size_t avail = end_ - pos_;
+    if (avail == 0) {
+      if (count >= (int)N) {
+        // Large read; straight into the destination, in whole sectors.
+        int result = file_.read(dest, count - count % kSectorSize);
+        if (result <= 0) {
+          setEof();
+          return -1;
+        }
+        offset_ += result;
+        return result;
+      }
+      if (!refill()) {
+        setEof();
+        return -1;
+      }
+      avail = end_ - pos_;
+    }
+    size_t n = (size_t)count < avail ? count : avail;
+    memcpy(dest, &buf_[pos_], n);
+    pos_ += n;
+    return n;
   }
 
   uint8_t readU8() {
-    uint8_t val;
-    read(&val, 1);
-    return val;
+    const uint8_t* p = peek(1);
+    if (p == nullptr) return -1;
+    consume(1);
+    return p[0];
   }
 
   uint16_t readU16() {
-    uint8_t val[2];
-    if (!readAll(*this, val, 2)) return -1;
-    return val[0] << 8 | val[1];
+    const uint8_t* p = peek(2);
+    if (p == nullptr) return -1;
+    consume(2);
+    return p[0] << 8 | p[1];
   }
 
   uint32_t readU32() {
-    uint8_t val[4];
-    if (!readAll(*this, val, 4)) return -1;
-    return val[0] << 24 | val[1] << 16 | val[2] << 8 | val[3];
+    const uint8_t* p = peek(4);
+    if (p == nullptr) return -1;
+    consume(4);
+    return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
   }
 
-  operator bool() const { return rem_ >= 0; }
+  operator bool() const { return ok_; }
 
   bool eof() const { return eof_; }
 
   void close() {
     file_.close();
-    rem_ = -1;
+    ok_ = false;
   }
 
  private:
+  // Moves the remaining bytes in front of kMaxPeek, and reads the next block
+  // after them. Returns false if nothing more could be read.
+  bool refill() {
+    size_t rem = end_ - pos_;
+    if (rem > 0) memmove(&buf_[kMaxPeek - rem], &buf_[pos_], rem);
+    pos_ = kMaxPeek - rem;
+    end_ = kMaxPeek;
+    int result = file_.read(&buf_[kMaxPeek], N);
+    if (result <= 0) return false;
+    end_ += result;
+    offset_ += result;
+    return true;
+  }
+
+  void setEof() {
+    eof_ = true;
+    ok_ = false;
+  }
+
   File file_;
-  uint8_t buf_[256];
-  int rem_;
-  int pos_;
+  uint8_t buf_[kMaxPeek + N];
+  size_t pos_;
+  size_t end_;
+  // Position in the file of buf_[end_].
+  uint32_t offset_;
+  bool ok_;
   bool eof_;
 };
 
-}  // namespace tapuino
\ No newline at end of file
+}  // namespace tapuino
@@ -1,7 +1,11 @@
+#pragma once
+
+#include <Arduino.h>
 #include <inttypes.h>
 
 #include <FS.h>
 
+#include "io/buffered_reader.h"
 #include "roo_display/core/utf8.h"
 
 namespace tapuino {
@@ -15,48 +19,100 @@ void writeAll(Stream& s, const uint8_t *buf, size_t size) {
   }
 }
 
+// Counters of the writes that a BufferedWriter issues to the file, for
+// profiling.
+struct WriteStats {
+  uint32_t flushes = 0;
+  uint32_t bytes = 0;
+  // Total and worst time spent in the flushes, in microseconds.
+  uint32_t flush_us = 0;
+  uint32_t max_flush_us = 0;
+};
+
+// Writes a file through a buffer of N bytes, a multiple of the sector size.
+// The file is written N bytes at a time (or, for large writes bypassing the
+// buffer, a multiple of sectors), so that all writes but the last one start
+// and end at sector boundaries. The write error of the file is checked once
+// per flush; after an error, everything else is dropped.
+template <size_t N = kSectorSize>
 class BufferedWriter {
+  static_assert(N > 0 && N % kSectorSize == 0,
+                "The buffer must span whole sectors");
+
  public:
-  BufferedWriter() : fill_(0) {}
+  BufferedWriter() : fill_(0), flushed_(0), ok_(false) {}
 
   void set(File f) {
     file_ = f;
     fill_ = 0;
+    flushed_ = 0;
+    ok_ = (bool)file_;
+    stats_ = WriteStats();
   }
 
   void write(const uint8_t* src, size_t count) {
-    if (fill_ > 0) {
-      if (count < (256 - fill_)) {
-        memcpy(&buf_[fill_], src, count);
-        fill_ += count;
-        return;
+    while (count > 0 && ok_) {
+      size_t n;
+      if (fill_ == 0 && count >= N) {
+        // Large write; straight from the source, in whole sectors.
+        n = count - count % kSectorSize;
+        writeOut(src, n);
+        flushed_ += n;
+      } else {
+        n = N - fill_;
+        if (n > count) n = count;
+        memcpy(&buf_[fill_], src, n);
+        fill_ += n;
+        if (fill_ == N) flush();
       }
-      memcpy(&buf_[fill_], src, 256 - fill_);
-      src += (256 - fill_);
-      count -= (256 - fill_);
-      writeAll(file_, buf_, 256);
-      fill_ = 0;
+      src += n;
+      count -= n;
     }
-    while (count >= 256) {
-      writeAll(file_, src, 256);
-      src += 256;
-      count -= 256;
+  }
+
+  // Writes out the buffered bytes. Returns false if the file is in error.
+  bool flush() {
+    if (fill_ > 0 && ok_) writeOut(buf_, fill_);
+    flushed_ += fill_;
+    fill_ = 0;
+    return ok_;
+  }
+
+  // The number of bytes written so far.
+  uint32_t position() const { return flushed_ + fill_; }
+
+  // Overwrites bytes written before, at the specified position. Bytes still
+  // in the buffer are overwritten in place; the others cost two seeks.
+  void patch(uint32_t pos, const uint8_t* src, size_t count) {
+    if (!ok_) return;
+    if (pos < flushed_) {
+      size_t n = flushed_ - pos;
+      if (n > count) n = count;
+      if (!file_.seek(pos)) {
+        ok_ = false;
+        return;
+      }
+      writeOut(src, n);
+      if (!file_.seek(flushed_)) ok_ = false;
+      pos += n;
+      src += n;
+      count -= n;
     }
-    memcpy(buf_, src, count);
-    fill_ = count;
-    return;
+    memcpy(&buf_[pos - flushed_], src, count);
   }
 
-  operator bool() const { return file_; }
+  // False if the file could not be opened, or if a write has failed.
+  operator bool() const { return ok_; }
 
   void close() {
-    writeAll(file_, buf_, fill_);
+    flush();
     file_.close();
     fill_ = 0;
   }
 
   void writeU8(uint8_t v) {
-    write(&v, 1);
+    buf_[fill_++] = v;
+    if (fill_ == N) flush();
   }
 
   void writeU16(uint16_t v) {
@@ -71,10 +127,34 @@ class BufferedWriter {
     writeU8((v >> 0) & 0xFF);
   }
 
+  const WriteStats& stats() const { return stats_; }
+
  private:
+  void writeOut(const uint8_t* src, size_t count) {
+    uint32_t start = micros();
+    stats_.flushes++;
+    while (count > 0) {
+      size_t written = file_.write(src, count);
+      if (written == 0) break;
+      src += written;
+      count -= written;
+      stats_.bytes += written;
+    }
+    if (count > 0 || file_.getWriteError() != 0) {
+      ok_ = false;
+    }
+    uint32_t elapsed = micros() - start;
+    stats_.flush_us += elapsed;
+    if (elapsed > stats_.max_flush_us) stats_.max_flush_us = elapsed;
+  }
+
   File file_;
-  uint8_t buf_[256];
+  uint8_t buf_[N];
   size_t fill_;
+  // Bytes written out to the file.
+  uint32_t flushed_;
+  bool ok_;
+  WriteStats stats_;
 };
 
-}  // namespace tapuino
\ No newline at end of file
+}  // namespace tapuino
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <inttypes.h>
 
 #include "roo_display/core/utf8.h"
@@ -31,6 +33,17 @@ inline uint8_t *writeU32(uint32_t v, uint8_t *target) {
   return target;
 }
 
+// Little-endian base 128: 7 bits per byte, the top bit set on all bytes but
+// the last. Takes up to 5 bytes.
+inline uint8_t *writeVarU32(uint32_t v, uint8_t *target) {
+  while (v >= 0x80) {
+    *target++ = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  *target++ = v;
+  return target;
+}
+
 // Puts len in the first byte.
 inline uint8_t *writeStr(const char *str, uint8_t len, uint8_t *target) {
   *target++ = len;
@@ -58,6 +71,19 @@ inline const uint8_t* readU32(uint32_t& v, const uint8_t *source) {
   return source + 4;
 }
 
+// Reads a varint written by writeVarU32, not reading at or past the end.
+// Returns nullptr if it is truncated or too long.
+inline const uint8_t* readVarU32(uint32_t& v, const uint8_t *source,
+                                 const uint8_t *end) {
+  v = 0;
+  for (int shift = 0; shift < 35 && source < end; shift += 7) {
+    uint8_t b = *source++;
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) return source;
+  }
+  return nullptr;
+}
+
 // Expects len in the first byte.
 inline const uint8_t* readStr(roo_display::StringView& v, const uint8_t *source) {
   v = roo_display::StringView(source + 1, *source);
@@ -0,0 +1,106 @@
+#include "io/dir_reader.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <utility>
+
+namespace tapuino {
+
+DirReader::DirReader(DirReader&& other)
+    : mountpoint_(std::move(other.mountpoint_)),
+      path_(std::move(other.path_)),
+      dir_(other.dir_),
+      entry_(other.entry_),
+      is_dir_(other.is_dir_),
+      size_(other.size_),
+      failed_(other.failed_) {
+  other.dir_ = nullptr;
+  other.entry_ = nullptr;
+}
+
+DirReader& DirReader::operator=(DirReader&& other) {
+  if (this != &other) {
+    close();
+    mountpoint_ = std::move(other.mountpoint_);
+    path_ = std::move(other.path_);
+    dir_ = other.dir_;
+    entry_ = other.entry_;
+    is_dir_ = other.is_dir_;
+    size_ = other.size_;
+    failed_ = other.failed_;
+    other.dir_ = nullptr;
+    other.entry_ = nullptr;
+  }
+  return *this;
+}
+
+bool DirReader::open(const char* mountpoint, std::string path) {
+  close();
+  mountpoint_ = mountpoint;
+  path_ = std::move(path);
+  failed_ = false;
+  dir_ = opendir((mountpoint_ + path_).c_str());
+  return dir_ != nullptr;
+}
+
+void DirReader::close() {
+  if (dir_ == nullptr) return;
+  closedir(dir_);
+  dir_ = nullptr;
+  entry_ = nullptr;
+}
+
+bool DirReader::next() {
+  if (dir_ == nullptr) return false;
+  while (true) {
+    errno = 0;
+    entry_ = readdir(dir_);
+    if (entry_ == nullptr) {
+      failed_ = (errno != 0);
+      return false;
+    }
+    if (strcmp(entry_->d_name, ".") == 0) continue;
+    if (strcmp(entry_->d_name, "..") == 0) continue;
+    size_ = -1;
+    switch (entry_->d_type) {
+      case DT_DIR:
+        is_dir_ = true;
+        break;
+      case DT_REG:
+        is_dir_ = false;
+        break;
+      default:
+        // The type is not known to the filesystem driver.
+        is_dir_ = stat() && is_dir_;
+        break;
+    }
+    return true;
+  }
+}
+
+uint32_t DirReader::size() {
+  if (size_ < 0 && !stat()) return 0;
+  return size_;
+}
+
+std::string DirReader::path() const {
+  std::string result = path_;
+  if (result.empty() || result.back() != '/') result += '/';
+  result += name();
+  return result;
+}
+
+bool DirReader::stat() {
+  struct stat st;
+  if (::stat((mountpoint_ + path()).c_str(), &st) != 0) {
+    size_ = 0;
+    return false;
+  }
+  is_dir_ = S_ISDIR(st.st_mode);
+  size_ = st.st_size;
+  return true;
+}
+
+}  // namespace tapuino
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <dirent.h>
+#include <inttypes.h>
+
+#include <string>
+
+namespace tapuino {
+
+// Lists a directory straight through the VFS (opendir/readdir), rather than
+// through File::openNextFile(), which opens every entry, and stats it.
+// Yields the name and the type of each entry; the size costs a stat(), and is
+// only looked up on demand.
+class DirReader {
+ public:
+  DirReader()
+      : dir_(nullptr), entry_(nullptr), is_dir_(false), size_(-1),
+        failed_(false) {}
+
+  DirReader(DirReader&& other);
+  DirReader& operator=(DirReader&& other);
+  DirReader(const DirReader&) = delete;
+
+  ~DirReader() { close(); }
+
+  // The path is relative to the filesystem mounted at the mountpoint, as in
+  // FS::open().
+  bool open(const char* mountpoint, std::string path);
+  void close();
+
+  operator bool() const { return dir_ != nullptr; }
+
+  // Moves on to the next entry, skipping "." and "..". Returns false at the
+  // end of the directory, or on error.
+  bool next();
+
+  // Whether next() stopped on a read error rather than at the end.
+  bool failed() const { return failed_; }
+
+  // Of the current entry.
+  const char* name() const { return entry_->d_name; }
+  bool isDirectory() const { return is_dir_; }
+  uint32_t size();
+
+  // The path of the current entry, as in File::path().
+  std::string path() const;
+
+  // The path of the directory.
+  const std::string& dirPath() const { return path_; }
+
+ private:
+  bool stat();
+
+  std::string mountpoint_;
+  std::string path_;
+  DIR* dir_;
+  struct dirent* entry_;
+  bool is_dir_;
+  // Of the current entry; -1 until looked up.
+  int64_t size_;
+  bool failed_;
+};
+
+}  // namespace tapuino
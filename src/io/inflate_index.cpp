@@ -0,0 +1,281 @@
+#include "io/inflate_index.h"
+
+#include <stdlib.h>
+
+#include "io/buffered_reader.h"
+#include "io/buffered_writer.h"
+#include "memory/mem_buffer.h"
+#include "roo_logging.h"
+
+namespace tapuino {
+
+namespace {
+
+// Sidecar layout: the dictionaries of points 1..n-1, kWindowSize bytes each,
+// followed by the point table, followed by the fixed-size trailer.
+constexpr uint32_t kMagic = 0x5A495858;  // "ZIXX"
+constexpr uint16_t kVersion = 1;
+constexpr uint32_t kPointSize = 9;
+constexpr uint32_t kTrailerSize = 22;
+
+bool makeParentDir(FS& fs, const std::string& path) {
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos || slash == 0) return true;
+  std::string dir = path.substr(0, slash);
+  return fs.exists(dir.c_str()) || fs.mkdir(dir.c_str());
+}
+
+}  // namespace
+
+void InflateIndex::clear() {
+  abandon();
+  points_.clear();
+  path_.clear();
+  complete_ = false;
+}
+
+bool InflateIndex::load(FS& fs, std::string path, const Key& key) {
+  clear();
+  File f = fs.open(path.c_str(), "r");
+  if (!f) return false;
+  uint32_t size = f.size();
+  if (size < kTrailerSize || !f.seek(size - kTrailerSize)) {
+    f.close();
+    return false;
+  }
+  BufferedReader<> reader;
+  reader.set(f);
+  bool ok = reader.readU32() == key.compressed_size &&
+            reader.readU32() == key.uncompressed_size &&
+            reader.readU32() == key.crc;
+  uint32_t count = reader.readU32();
+  ok = ok && reader.readU16() == kVersion && reader.readU32() == kMagic &&
+       count > 0 &&
+       size == (count - 1) * kWindowSize + count * kPointSize + kTrailerSize;
+  if (!ok) {
+    reader.close();
+    return false;
+  }
+  f.seek((count - 1) * kWindowSize);
+  reader.set(f);
+  points_.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    Point p;
+    p.out = reader.readU32();
+    p.in = reader.readU32();
+    p.bits = reader.readU8();
+    points_.push_back(p);
+  }
+  ok = reader && points_[0].out == 0;
+  reader.close();
+  if (!ok) {
+    points_.clear();
+    return false;
+  }
+  fs_ = &fs;
+  path_ = std::move(path);
+  complete_ = true;
+  return true;
+}
+
+bool InflateIndex::begin(FS& fs, std::string path) {
+  clear();
+  if (!makeParentDir(fs, path)) return false;
+  sidecar_ = fs.open(path.c_str(), "w");
+  if (!sidecar_) return false;
+  fs_ = &fs;
+  path_ = std::move(path);
+  points_.push_back(Point{0, 0, 0});
+  return true;
+}
+
+bool InflateIndex::add(const Point& point, const uint8_t* window,
+                       uint32_t window_pos) {
+  points_.push_back(point);
+  // Oldest bytes first.
+  writeAll(sidecar_, window + window_pos, kWindowSize - window_pos);
+  writeAll(sidecar_, window, window_pos);
+  if (!sidecar_ || sidecar_.getWriteError() != 0) {
+    LOG(WARNING) << "Failed to write the inflate index: " << path_;
+    abandon();
+    return false;
+  }
+  return true;
+}
+
+bool InflateIndex::finish(const Key& key) {
+  BufferedWriter<> writer;
+  writer.set(sidecar_);
+  for (const Point& p : points_) {
+    writer.writeU32(p.out);
+    writer.writeU32(p.in);
+    writer.writeU8(p.bits);
+  }
+  writer.writeU32(key.compressed_size);
+  writer.writeU32(key.uncompressed_size);
+  writer.writeU32(key.crc);
+  writer.writeU32(points_.size());
+  writer.writeU16(kVersion);
+  writer.writeU32(kMagic);
+  bool ok = writer.flush();
+  writer.close();
+  if (!ok) {
+    LOG(WARNING) << "Failed to write the inflate index: " << path_;
+    abandon();
+    return false;
+  }
+  sidecar_ = File();
+  complete_ = true;
+  return true;
+}
+
+void InflateIndex::abandon() {
+  if (!sidecar_) return;
+  sidecar_.close();
+  sidecar_ = File();
+  fs_->remove(path_.c_str());
+  points_.clear();
+}
+
+int InflateIndex::find(uint32_t out) const {
+  int lo = 0;
+  int hi = points_.size();
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (points_[mid].out <= out) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo == 0 ? 0 : lo - 1;
+}
+
+bool InflateIndex::readWindow(int idx, uint8_t* window) const {
+  if (idx <= 0) return false;
+  File f = fs_->open(path_.c_str(), "r");
+  if (!f) return false;
+  bool ok = f.seek((idx - 1) * kWindowSize) &&
+            f.read(window, kWindowSize) == kWindowSize;
+  f.close();
+  return ok;
+}
+
+RawInflater::RawInflater(File& file, uint32_t data_offset,
+                         uint32_t compressed_size)
+    : file_(file),
+      data_offset_(data_offset),
+      compressed_size_(compressed_size),
+      initialized_(false),
+      finished_(false),
+      in_pos_(0),
+      out_pos_(0),
+      arena_(nullptr),
+      arena_used_(0) {
+  memset(&strm_, 0, sizeof(strm_));
+}
+
+RawInflater::~RawInflater() {
+  if (initialized_) inflateEnd(&strm_);
+  if (arena_ != nullptr) membuf::ReleaseInflateBuffer();
+}
+
+bool RawInflater::init() {
+  if (initialized_) return true;
+  if (arena_ == nullptr) arena_ = membuf::AcquireInflateBuffer();
+  strm_.zalloc = &alloc;
+  strm_.zfree = &free;
+  strm_.opaque = this;
+  initialized_ = (inflateInit2(&strm_, -MAX_WBITS) == Z_OK);
+  return initialized_;
+}
+
+voidpf RawInflater::alloc(voidpf opaque, uInt items, uInt size) {
+  RawInflater* self = (RawInflater*)opaque;
+  // The state and the window are allocated once, and freed by inflateEnd().
+  uint32_t n = ((uint32_t)items * size + 7) & ~7;
+  if (self->arena_ != nullptr &&
+      n <= membuf::kInflateBufferSize - self->arena_used_) {
+    uint8_t* p = self->arena_ + self->arena_used_;
+    self->arena_used_ += n;
+    memset(p, 0, n);
+    return p;
+  }
+  return calloc(items, size);
+}
+
+void RawInflater::free(voidpf opaque, voidpf address) {
+  RawInflater* self = (RawInflater*)opaque;
+  uint8_t* p = (uint8_t*)address;
+  if (self->arena_ != nullptr && p >= self->arena_ &&
+      p < self->arena_ + membuf::kInflateBufferSize) {
+    return;
+  }
+  ::free(address);
+}
+
+bool RawInflater::reset(const InflateIndex::Point& point,
+                        const uint8_t* window) {
+  if (!initialized_ || inflateReset(&strm_) != Z_OK) return false;
+  strm_.avail_in = 0;
+  finished_ = false;
+  in_pos_ = point.in;
+  out_pos_ = point.out;
+  if (!file_.seek(data_offset_ + point.in - (point.bits ? 1 : 0))) {
+    return false;
+  }
+  if (point.bits) {
+    uint8_t b;
+    if (file_.read(&b, 1) != 1) return false;
+    if (inflatePrime(&strm_, point.bits, b >> (8 - point.bits)) != Z_OK) {
+      return false;
+    }
+  }
+  if (point.out > 0) {
+    // Also allocates the inflate window, so it can fail on low memory.
+    if (inflateSetDictionary(&strm_, window, InflateIndex::kWindowSize) !=
+        Z_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RawInflater::fill() {
+  uint32_t remaining = compressed_size_ - in_pos_;
+  // Inflate may still have output pending after consuming all input.
+  if (remaining == 0) return true;
+  if (remaining > sizeof(in_buf_)) remaining = sizeof(in_buf_);
+  int result = file_.read(in_buf_, remaining);
+  if (result <= 0) return false;
+  in_pos_ += result;
+  strm_.next_in = in_buf_;
+  strm_.avail_in = result;
+  return true;
+}
+
+int32_t RawInflater::read(uint8_t* buf, uint32_t count, int flush) {
+  if (!initialized_) return -1;
+  if (finished_) return 0;
+  strm_.next_out = buf;
+  strm_.avail_out = count;
+  do {
+    if (strm_.avail_in == 0 && !fill()) return -1;
+    int ret = inflate(&strm_, flush);
+    if (ret == Z_STREAM_END) {
+      finished_ = true;
+      break;
+    }
+    if (ret == Z_BUF_ERROR && in_pos_ == compressed_size_) {
+      // Needs input past the end of the entry: truncated or corrupt.
+      return -1;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) return -1;
+    if (flush == Z_BLOCK) break;
+  } while (strm_.avail_out == count);
+  uint32_t result = count - strm_.avail_out;
+  out_pos_ += result;
+  return result;
+}
+
+}  // namespace tapuino
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+#include "FS.h"
+#include "zlib.h"
+
+namespace tapuino {
+
+class RawInflater;
+
+// Random access index of a raw deflate stream, in the style of zlib's zran.c:
+// points at deflate block boundaries, spaced about kSpan uncompressed bytes
+// apart, each with the kWindowSize bytes of uncompressed data that precede it
+// (the dictionary needed to resume inflating there). The point table is kept
+// in RAM; the dictionaries stay in the sidecar file and are read on demand.
+//
+// The index is built incrementally, while the stream is being inflated from
+// the start anyway: begin(), then add() at each point, then finish(). Until
+// finished, the index can't be used.
+class InflateIndex {
+ public:
+  static constexpr uint32_t kWindowSize = 32 * 1024;
+  static constexpr uint32_t kSpan = 64 * 1024;
+
+  struct Point {
+    // Offset in the uncompressed data.
+    uint32_t out;
+    // Offset of the first full byte in the compressed data.
+    uint32_t in;
+    // Number of bits of the preceding byte that belong to the point, if the
+    // block boundary is not byte-aligned.
+    uint8_t bits;
+  };
+
+  // Identifies the indexed stream, so that stale sidecars are detected.
+  struct Key {
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint32_t crc;
+  };
+
+  InflateIndex() : fs_(nullptr), complete_(false) {}
+  ~InflateIndex() { abandon(); }
+
+  void clear();
+
+  // Whether the index is complete, and can be used for seeking.
+  bool ready() const { return complete_; }
+
+  // Whether the index is being built.
+  bool building() const { return (bool)sidecar_; }
+
+  // Loads the point table from the sidecar file.
+  bool load(FS& fs, std::string path, const Key& key);
+
+  // Starts building the index into the sidecar file, with the point at the
+  // start of the stream.
+  bool begin(FS& fs, std::string path);
+
+  // Offset in the uncompressed data of the last point added.
+  uint32_t lastOut() const { return points_.back().out; }
+
+  // Adds the point, with its dictionary: the cyclic `window` of kWindowSize
+  // bytes, whose oldest byte is at `window_pos`. On failure, abandons the
+  // index.
+  bool add(const Point& point, const uint8_t* window, uint32_t window_pos);
+
+  // Completes the index of the fully inflated stream, by writing the point
+  // table. On failure, abandons the index.
+  bool finish(const Key& key);
+
+  // Stops building the index, and removes its sidecar.
+  void abandon();
+
+  // Returns the index of the last point at or before the specified offset.
+  int find(uint32_t out) const;
+
+  const Point& point(int idx) const { return points_[idx]; }
+
+  // Reads the dictionary of the specified point (which must not be the first
+  // one, as it has none) into `window`, of kWindowSize bytes.
+  bool readWindow(int idx, uint8_t* window) const;
+
+ private:
+  FS* fs_;
+  std::string path_;
+  std::vector<Point> points_;
+  // Open while the index is being built.
+  File sidecar_;
+  bool complete_;
+};
+
+// Inflates a raw deflate stream that starts at the specified offset of a file,
+// and can be restarted at any InflateIndex point. The inflate state (including
+// its 32 KiB window) goes to the inflate buffer of membuf, or, if that is in
+// use, to the heap; init() fails if it can't be allocated.
+class RawInflater {
+ public:
+  RawInflater(File& file, uint32_t data_offset, uint32_t compressed_size);
+  ~RawInflater();
+
+  bool init();
+
+  // Repositions the stream at the specified point. `window` must hold the
+  // point's dictionary, unless the point is at the start of the stream.
+  bool reset(const InflateIndex::Point& point, const uint8_t* window);
+
+  // Inflates up to `count` bytes. Returns the number of bytes inflated (zero
+  // only at the end of the stream, unless flush is Z_BLOCK), or -1 on error.
+  int32_t read(uint8_t* buf, uint32_t count, int flush = Z_NO_FLUSH);
+
+  bool finished() const { return finished_; }
+
+  // Whether the last read with Z_BLOCK stopped at a block boundary (and not
+  // after the last block).
+  bool atBlockBoundary() const {
+    return (strm_.data_type & 128) && !(strm_.data_type & 64);
+  }
+
+  uint8_t pendingBits() const { return strm_.data_type & 7; }
+
+  // Compressed bytes consumed by inflate so far.
+  uint32_t totalIn() const { return in_pos_ - strm_.avail_in; }
+
+  // Uncompressed bytes produced so far.
+  uint32_t totalOut() const { return out_pos_; }
+
+ private:
+  bool fill();
+
+  static voidpf alloc(voidpf opaque, uInt items, uInt size);
+  static void free(voidpf opaque, voidpf address);
+
+  File& file_;
+  uint32_t data_offset_;
+  uint32_t compressed_size_;
+  z_stream strm_;
+  bool initialized_;
+  bool finished_;
+  uint32_t in_pos_;
+  uint32_t out_pos_;
+  // The inflate buffer, if acquired, and how much of it is allocated.
+  uint8_t* arena_;
+  uint32_t arena_used_;
+  uint8_t in_buf_[1024];
+};
+
+}  // namespace tapuino
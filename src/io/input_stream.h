@@ -2,7 +2,11 @@
 
 #include <inttypes.h>
 
+#include <string.h>
+
+#include <algorithm>
 #include <memory>
+#include <vector>
 
 #include "FS.h"
 #include "io/sd.h"
@@ -14,6 +18,15 @@ class InputStreamImpl {
   virtual ~InputStreamImpl() { close(); }
 
   virtual int32_t read(uint8_t* buf, uint32_t count) { return -1; }
+
+  // Moves to the specified offset from the start of the stream. Returns false
+  // if that is not possible, in which case the read position is unspecified.
+  virtual bool seek(uint32_t pos) { return false; }
+
+  // Tells that the stream is about to be read through, and then seeked in.
+  // Streams for which seeking is costly can index themselves on the way.
+  virtual void indexForSeeking() {}
+
   virtual uint32_t size() const { return 0; }
   virtual bool ok() const { return true; }
   virtual void close() {}
@@ -31,6 +44,11 @@ class FileInputStreamImpl : public InputStreamImpl {
     return file_.read(buf, count);
   }
 
+  bool seek(uint32_t pos) override {
+    if (!file_ || pos > file_.size()) return false;
+    return file_.seek(pos);
+  }
+
   uint32_t size() const override { return file_.size(); }
   bool ok() const override { return file_; }
   void close() override { file_.close(); }
@@ -39,18 +57,44 @@ class FileInputStreamImpl : public InputStreamImpl {
   File file_;
 };
 
+// Serves data held in memory.
+class MemoryInputStreamImpl : public InputStreamImpl {
+ public:
+  MemoryInputStreamImpl(std::vector<uint8_t> data)
+      : data_(std::move(data)), pos_(0) {}
+
+  int32_t read(uint8_t* buf, uint32_t count) override {
+    count = std::min<uint32_t>(count, data_.size() - pos_);
+    memcpy(buf, data_.data() + pos_, count);
+    pos_ += count;
+    return count;
+  }
+
+  bool seek(uint32_t pos) override {
+    if (pos > data_.size()) return false;
+    pos_ = pos;
+    return true;
+  }
+
+  uint32_t size() const override { return data_.size(); }
+
+ private:
+  std::vector<uint8_t> data_;
+  uint32_t pos_;
+};
+
 class InputStream {
  public:
   InputStream(std::unique_ptr<InputStreamImpl> impl)
-      : impl_(std::move(impl)), num_bytes_read_(0) {}
+      : impl_(std::move(impl)), position_(0) {}
 
-  InputStream() : impl_(nullptr), num_bytes_read_(0) {}
+  InputStream() : impl_(nullptr), position_(0) {}
 
   // Tries to read at least one byte, blocking if necessary. Returns zero on
   // EOF, negative value on error, and the number of bytes read otherwise.
   int32_t read(uint8_t* buf, uint32_t count) {
     int32_t read_now = impl_ == nullptr ? 0 : impl_->read(buf, count);
-    if (read_now >= 0) num_bytes_read_ += read_now;
+    if (read_now >= 0) position_ += read_now;
     return read_now;
   }
 
@@ -62,34 +106,50 @@ class InputStream {
     while (read < count) {
       int32_t read_now = impl_->read(buf + read, count - read);
       if (read_now < 0) {
-        Serial.println("Returning error");
         return read_now;  // Error
       }
       if (read_now == 0) {
         // Reached EOF: return however many bytes read thus far.
-        Serial.println("Reached EOF");
         break;
       }
       read += read_now;
     }
-    num_bytes_read_ += read;
-    Serial.printf("Returning %d; read now %d out of %d\n", read, numBytesRead(), size());
+    position_ += read;
     return read;
   }
 
+  // Moves to the specified offset from the start of the stream. Returns false
+  // on failure, in which case the stream should not be read from anymore.
+  bool seek(uint32_t pos) {
+    if (impl_ == nullptr) return pos == 0;
+    if (pos == position_) return true;
+    if (!impl_->seek(pos)) return false;
+    position_ = pos;
+    return true;
+  }
+
+  // See InputStreamImpl::indexForSeeking().
+  void indexForSeeking() {
+    if (impl_ != nullptr) impl_->indexForSeeking();
+  }
+
+  // Current offset from the start of the stream.
+  uint32_t tell() const { return position_; }
+
   void close() {
     if (impl_ != nullptr) impl_->close();
   }
 
   uint32_t size() { return impl_ != nullptr ? impl_->size() : 0; }
 
-  uint32_t numBytesRead() const { return num_bytes_read_; }
+  // Whether the stream has a source, as opposed to being a null input.
+  bool isOpen() const { return impl_ != nullptr; }
 
   operator bool() const { return impl_ != nullptr ? impl_->ok() : true; }
 
  private:
   std::unique_ptr<InputStreamImpl> impl_;
-  uint32_t num_bytes_read_;
+  uint32_t position_;
 };
 
 }  // namespace tapuino
\ No newline at end of file
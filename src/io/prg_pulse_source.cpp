@@ -0,0 +1,426 @@
+#include "io/prg_pulse_source.h"
+
+#include <string.h>
+
+#include "roo_logging.h"
+
+namespace tapuino {
+
+namespace {
+
+// Pulse lengths of the ROM loader's encoding, as TAP values.
+constexpr uint8_t kShort = 0x30;
+constexpr uint8_t kMedium = 0x42;
+constexpr uint8_t kLong = 0x56;
+
+// Each byte is a marker (long, medium), 8 bits LSB first and an odd parity
+// bit, where a 0 is (short, medium) and a 1 is (medium, short).
+constexpr uint32_t kPulsesPerByte = 20;
+
+// Lengths of the pilot tones, in short pulses.
+constexpr uint32_t kHeaderPilot = 0x6A00;
+constexpr uint32_t kProgramPilot = 0x1A00;
+// Between a block and its repetition.
+constexpr uint32_t kRepeatPilot = 0x4F;
+// After the repetition.
+constexpr uint32_t kTrailer = 0x4E;
+// The pilots of the TURBO mode's starter: well above the few hundred pulses
+// that the ROM loader needs to sync.
+constexpr uint32_t kStarterPilot = 0x600;
+
+// The silence after each block, in cycles (about 1/3 s).
+constexpr uint32_t kPauseCycles = 330000;
+const uint8_t kPause[] = {0, kPauseCycles & 0xFF, (kPauseCycles >> 8) & 0xFF,
+                          (kPauseCycles >> 16) & 0xFF};
+
+// Precede the data of the first recording of a block, and of the repetition.
+const uint8_t kCountdown[] = {0x89, 0x88, 0x87, 0x86, 0x85,
+                              0x84, 0x83, 0x82, 0x81};
+const uint8_t kRepeatCountdown[] = {0x09, 0x08, 0x07, 0x06, 0x05,
+                                    0x04, 0x03, 0x02, 0x01};
+
+// Header block types.
+constexpr uint8_t kRelocatableProgram = 1;
+constexpr uint8_t kProgram = 3;
+
+constexpr uint16_t kBasicStart = 0x0801;
+
+// The turbo encoding: bytes MSB first, a 1 is a short pulse and a 0 a long
+// one. The loader tells them apart at the midpoint (see the timer latch
+// below), which leaves a margin of 48 cycles on either side.
+constexpr uint8_t kTurboOne = 0x0C;
+constexpr uint8_t kTurboZero = 0x18;
+constexpr uint32_t kTurboPulsesPerByte = 8;
+// A pilot of these bytes, then the sync byte.
+const uint8_t kTurboPilotByte = 0x02;
+constexpr uint8_t kTurboSync = 0x09;
+constexpr uint32_t kTurboPilot = 512;
+constexpr uint32_t kTurboTrailer = 16;
+
+// The BASIC starter of the TURBO mode: 10 SYS849.
+const uint8_t kStarter[] = {0x0A, 0x08, 0x0A, 0x00, 0x9E, 0x38,
+                            0x34, 0x39, 0x00, 0x00, 0x00};
+
+// The turbo loader, at offset 21 of the header block: past the type, the
+// addresses and the name, at $033C + 21 = 849 in the cassette buffer.
+//
+// It blanks the screen (so that no bad lines delay it), starts the motor, and
+// measures the time between the falling edges (flagged in ICR bit 4 of
+// CIA 1) with timer B of CIA 1, restarted at every edge: with the latch at
+// $0190 (the midpoint between the pulses, plus 256), the high byte of the
+// counter is still 1 at the next edge after a short pulse, and 0 after a
+// long one.
+//
+// Stream: pilot ($02...), sync ($09), start, end, run flag, data, checksum.
+// The end address goes right to the BASIC end of program pointer at $2D, as
+// with LOAD.
+constexpr uint32_t kTurboLoaderOffset = 21;
+const uint8_t kTurboLoader[] = {
+    0x78,                // 0351  START   SEI
+    0xA9, 0x0B,          // 0352          LDA #$0B
+    0x8D, 0x11, 0xD0,    // 0354          STA $D011
+    0xA9, 0x17,          // 0357          LDA #$17
+    0x85, 0x01,          // 0359          STA $01
+    0xA9, 0x90,          // 035B          LDA #$90
+    0x8D, 0x06, 0xDC,    // 035D          STA $DC06
+    0xA9, 0x01,          // 0360          LDA #$01
+    0x8D, 0x07, 0xDC,    // 0362          STA $DC07
+    0x20, 0xE7, 0x03,    // 0365  SYNC    JSR RDBIT
+    0x26, 0xFD,          // 0368          ROL BYTE
+    0xA5, 0xFD,          // 036A          LDA BYTE
+    0xC9, 0x02,          // 036C          CMP #$02
+    0xD0, 0xF5,          // 036E          BNE SYNC
+    0x20, 0xD9, 0x03,    // 0370  PILOT   JSR RDBYTE
+    0xC9, 0x02,          // 0373          CMP #$02
+    0xF0, 0xF9,          // 0375          BEQ PILOT
+    0xC9, 0x09,          // 0377          CMP #$09
+    0xD0, 0xEA,          // 0379          BNE SYNC
+    0x20, 0xD9, 0x03,    // 037B          JSR RDBYTE
+    0x85, 0xFB,          // 037E          STA PTR
+    0x20, 0xD9, 0x03,    // 0380          JSR RDBYTE
+    0x85, 0xFC,          // 0383          STA PTR+1
+    0x20, 0xD9, 0x03,    // 0385          JSR RDBYTE
+    0x85, 0x2D,          // 0388          STA END
+    0x20, 0xD9, 0x03,    // 038A          JSR RDBYTE
+    0x85, 0x2E,          // 038D          STA END+1
+    0x20, 0xD9, 0x03,    // 038F          JSR RDBYTE
+    0x85, 0x02,          // 0392          STA RUN
+    0xA0, 0x00,          // 0394          LDY #$00
+    0x84, 0xFE,          // 0396          STY CHK
+    0x20, 0xD9, 0x03,    // 0398  LOOP    JSR RDBYTE
+    0x91, 0xFB,          // 039B          STA (PTR),Y
+    0x45, 0xFE,          // 039D          EOR CHK
+    0x85, 0xFE,          // 039F          STA CHK
+    0xE6, 0xFB,          // 03A1          INC PTR
+    0xD0, 0x02,          // 03A3          BNE NOCARRY
+    0xE6, 0xFC,          // 03A5          INC PTR+1
+    0xA5, 0xFB,          // 03A7  NOCARRY LDA PTR
+    0xC5, 0x2D,          // 03A9          CMP END
+    0xA5, 0xFC,          // 03AB          LDA PTR+1
+    0xE5, 0x2E,          // 03AD          SBC END+1
+    0x90, 0xE7,          // 03AF          BCC LOOP
+    0x20, 0xD9, 0x03,    // 03B1          JSR RDBYTE
+    0x45, 0xFE,          // 03B4          EOR CHK
+    0xA8,                // 03B6          TAY
+    0xA9, 0x37,          // 03B7          LDA #$37
+    0x85, 0x01,          // 03B9          STA $01
+    0xA9, 0x1B,          // 03BB          LDA #$1B
+    0x8D, 0x11, 0xD0,    // 03BD          STA $D011
+    0x58,                // 03C0          CLI
+    0x98,                // 03C1          TYA
+    0xD0, 0x10,          // 03C2          BNE ERROR
+    0xA5, 0x02,          // 03C4          LDA RUN
+    0xF0, 0x09,          // 03C6          BEQ READY
+    0x20, 0x33, 0xA5,    // 03C8          JSR $A533
+    0x20, 0x59, 0xA6,    // 03CB          JSR $A659
+    0x4C, 0xAE, 0xA7,    // 03CE          JMP $A7AE
+    0x4C, 0x74, 0xA4,    // 03D1  READY   JMP $A474
+    0xA2, 0x1D,          // 03D4  ERROR   LDX #$1D
+    0x6C, 0x00, 0x03,    // 03D6          JMP ($0300)
+    0xA9, 0x01,          // 03D9  RDBYTE  LDA #$01
+    0x85, 0xFD,          // 03DB          STA BYTE
+    0x20, 0xE7, 0x03,    // 03DD  RB1     JSR RDBIT
+    0x26, 0xFD,          // 03E0          ROL BYTE
+    0x90, 0xF9,          // 03E2          BCC RB1
+    0xA5, 0xFD,          // 03E4          LDA BYTE
+    0x60,                // 03E6          RTS
+    0xA9, 0x10,          // 03E7  RDBIT   LDA #$10
+    0x2C, 0x0D, 0xDC,    // 03E9  RD1     BIT $DC0D
+    0xF0, 0xFB,          // 03EC          BEQ RD1
+    0xAD, 0x07, 0xDC,    // 03EE          LDA $DC07
+    0xA2, 0x11,          // 03F1          LDX #$11
+    0x8E, 0x0F, 0xDC,    // 03F3          STX $DC0F
+    0xC9, 0x01,          // 03F6          CMP #$01
+    0x60,                // 03F8          RTS
+};
+
+void encodeByte(uint8_t b, uint8_t* out) {
+  out[0] = kLong;
+  out[1] = kMedium;
+  uint8_t parity = 1;
+  for (int i = 0; i < 8; ++i) {
+    uint8_t bit = (b >> i) & 1;
+    parity ^= bit;
+    out[2 + 2 * i] = bit ? kMedium : kShort;
+    out[3 + 2 * i] = bit ? kShort : kMedium;
+  }
+  out[18] = parity ? kMedium : kShort;
+  out[19] = parity ? kShort : kMedium;
+}
+
+void encodeTurboByte(uint8_t b, uint8_t* out) {
+  for (int i = 0; i < 8; ++i) {
+    out[i] = (b & (0x80 >> i)) ? kTurboOne : kTurboZero;
+  }
+}
+
+uint8_t checksum(const uint8_t* bytes, uint32_t count) {
+  uint8_t result = 0;
+  for (uint32_t i = 0; i < count; ++i) result ^= bytes[i];
+  return result;
+}
+
+}  // namespace
+
+bool isPrgName(const char* name) {
+  size_t len = strlen(name);
+  return len >= 4 && strcasecmp(name + len - 4, ".prg") == 0;
+}
+
+PrgPulseSourceImpl::PrgPulseSourceImpl(InputStream source,
+                                       const std::string& name, Mode mode)
+    : source_(std::move(source)),
+      ok_(false),
+      tap_size_(0),
+      program_size_(0),
+      header_checksum_(0),
+      program_checksum_(0),
+      starter_checksum_(0),
+      segment_count_(0),
+      pos_(0),
+      segment_(0),
+      segment_pos_(0),
+      window_start_(0),
+      window_size_(0) {
+  ok_ = init(name, mode);
+}
+
+bool PrgPulseSourceImpl::init(const std::string& name, Mode mode) {
+  if (!source_ || !source_.isOpen()) return false;
+  uint32_t size = source_.size();
+  uint8_t address[2];
+  if (size < 3 || source_.readFully(address, 2) != 2) return false;
+  uint16_t start = address[0] | (address[1] << 8);
+  program_size_ = size - 2;
+  if (start + program_size_ > 0x10000) {
+    LOG(WARNING) << "PRG does not fit in memory: " << name;
+    return false;
+  }
+  for (uint32_t i = 0; i < program_size_; ++i) {
+    int16_t b = programByte(i);
+    if (b < 0) return false;
+    program_checksum_ ^= b;
+  }
+  uint32_t end = start + program_size_;
+
+  // The turbo loader lives in the cassette buffer, and writes to RAM as seen
+  // with the I/O area banked in.
+  if (mode == TURBO && (start < 0x0400 || end > 0xD000)) {
+    LOG(INFO) << "PRG out of the turbo loader's range; using the ROM loader";
+    mode = ROM_LOADER;
+  }
+  if (mode == ROM_LOADER) {
+    setHeader(start == kBasicStart ? kRelocatableProgram : kProgram, start,
+              end, name);
+    addBlock(header_, sizeof(header_), &header_checksum_, kHeaderPilot);
+    addSegment(Segment{PAUSE, sizeof(kPause), 0, ROM_ENCODING, kPause, 0});
+    addBlock(nullptr, program_size_, &program_checksum_, kProgramPilot);
+    addSegment(Segment{PAUSE, sizeof(kPause), 0, ROM_ENCODING, kPause, 0});
+    return true;
+  }
+
+  setHeader(kRelocatableProgram, kBasicStart, kBasicStart + sizeof(kStarter),
+            name);
+  memcpy(header_ + kTurboLoaderOffset, kTurboLoader, sizeof(kTurboLoader));
+  header_checksum_ = checksum(header_, sizeof(header_));
+  starter_checksum_ = checksum(kStarter, sizeof(kStarter));
+  addBlock(header_, sizeof(header_), &header_checksum_, kStarterPilot);
+  addSegment(Segment{PAUSE, sizeof(kPause), 0, ROM_ENCODING, kPause, 0});
+  addBlock(kStarter, sizeof(kStarter), &starter_checksum_, kStarterPilot);
+  addSegment(Segment{PAUSE, sizeof(kPause), 0, ROM_ENCODING, kPause, 0});
+
+  // The ROM loader stops the motor after the starter, so the rest is played
+  // once the turbo loader starts it again.
+  turbo_header_[0] = kTurboSync;
+  turbo_header_[1] = start & 0xFF;
+  turbo_header_[2] = start >> 8;
+  turbo_header_[3] = end & 0xFF;
+  turbo_header_[4] = end >> 8;
+  turbo_header_[5] = (start == kBasicStart) ? 1 : 0;  // Run it.
+  addBytes(TURBO_ENCODING, &kTurboPilotByte, 1, kTurboPilot);
+  addBytes(TURBO_ENCODING, turbo_header_, sizeof(turbo_header_));
+  addBytes(TURBO_ENCODING, nullptr, program_size_);
+  addBytes(TURBO_ENCODING, &program_checksum_, 1);
+  // The loader measures each pulse at the falling edge that starts the next
+  // one.
+  addPilot(kTurboOne, kTurboTrailer);
+  addSegment(Segment{PAUSE, sizeof(kPause), 0, ROM_ENCODING, kPause, 0});
+  return true;
+}
+
+void PrgPulseSourceImpl::setHeader(uint8_t type, uint16_t start, uint16_t end,
+                                   const std::string& name) {
+  header_[0] = type;
+  header_[1] = start & 0xFF;
+  header_[2] = start >> 8;
+  header_[3] = end & 0xFF;
+  header_[4] = end >> 8;
+  memset(header_ + 5, ' ', sizeof(header_) - 5);
+  // The file name without the extension, in PETSCII upper case.
+  size_t name_len = name.size() - (isPrgName(name.c_str()) ? 4 : 0);
+  if (name_len > 16) name_len = 16;
+  for (size_t i = 0; i < name_len; ++i) {
+    char c = name[i];
+    if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+    header_[5 + i] = (c >= 0x20 && c <= 0x5F) ? c : ' ';
+  }
+  header_checksum_ = checksum(header_, sizeof(header_));
+}
+
+void PrgPulseSourceImpl::addBlock(const uint8_t* bytes, uint32_t count,
+                                  const uint8_t* checksum, uint32_t pilot) {
+  for (int copy = 0; copy < 2; ++copy) {
+    addPilot(kShort, copy == 0 ? pilot : kRepeatPilot);
+    addBytes(ROM_ENCODING, copy == 0 ? kCountdown : kRepeatCountdown,
+             sizeof(kCountdown));
+    addBytes(ROM_ENCODING, bytes, count);
+    addBytes(ROM_ENCODING, checksum, 1);
+    addSegment(Segment{END_OF_DATA, 2, 0, ROM_ENCODING, nullptr, 0});
+  }
+  addPilot(kShort, kTrailer);
+}
+
+void PrgPulseSourceImpl::addPilot(uint8_t pulse, uint32_t count) {
+  addSegment(Segment{PILOT, count, pulse, ROM_ENCODING, nullptr, 0});
+}
+
+void PrgPulseSourceImpl::addBytes(Encoding encoding, const uint8_t* bytes,
+                                  uint32_t count, uint32_t repeat) {
+  uint32_t pulses =
+      (encoding == ROM_ENCODING) ? kPulsesPerByte : kTurboPulsesPerByte;
+  addSegment(
+      Segment{BYTES, count * repeat * pulses, 0, encoding, bytes, count});
+}
+
+void PrgPulseSourceImpl::addSegment(const Segment& segment) {
+  CHECK_LT(segment_count_, kMaxSegments);
+  segments_[segment_count_++] = segment;
+  tap_size_ += segment.length;
+}
+
+int16_t PrgPulseSourceImpl::programByte(uint32_t offset) {
+  if (offset < window_start_ || offset >= window_start_ + window_size_) {
+    uint32_t start = offset - offset % kWindowSize;
+    uint32_t size = program_size_ - start;
+    if (size > kWindowSize) size = kWindowSize;
+    window_size_ = 0;
+    if (!source_.seek(2 + start) ||
+        source_.readFully(window_, size) != (int32_t)size) {
+      return -1;
+    }
+    window_start_ = start;
+    window_size_ = size;
+  }
+  return window_[offset - window_start_];
+}
+
+int32_t PrgPulseSourceImpl::readSegment(uint8_t* buf, uint32_t count) {
+  const Segment& segment = segments_[segment_];
+  uint32_t n = segment.length - segment_pos_;
+  if (n > count) n = count;
+  switch (segment.type) {
+    case PILOT: {
+      memset(buf, segment.pulse, n);
+      break;
+    }
+    case END_OF_DATA: {
+      for (uint32_t i = 0; i < n; ++i) {
+        buf[i] = (segment_pos_ + i == 0) ? kLong : kShort;
+      }
+      break;
+    }
+    case PAUSE: {
+      memcpy(buf, segment.bytes + segment_pos_, n);
+      break;
+    }
+    case BYTES: {
+      uint32_t pulses_per_byte = (segment.encoding == ROM_ENCODING)
+                                     ? kPulsesPerByte
+                                     : kTurboPulsesPerByte;
+      uint8_t pulses[kPulsesPerByte];
+      uint32_t done = 0;
+      while (done < n) {
+        uint32_t pos = segment_pos_ + done;
+        uint32_t index = pos / pulses_per_byte;
+        int16_t b = (segment.bytes != nullptr)
+                        ? segment.bytes[index % segment.byte_count]
+                        : programByte(index);
+        if (b < 0) return -1;
+        if (segment.encoding == ROM_ENCODING) {
+          encodeByte(b, pulses);
+        } else {
+          encodeTurboByte(b, pulses);
+        }
+        uint32_t offset = pos % pulses_per_byte;
+        uint32_t chunk = pulses_per_byte - offset;
+        if (chunk > n - done) chunk = n - done;
+        memcpy(buf + done, pulses + offset, chunk);
+        done += chunk;
+      }
+      break;
+    }
+  }
+  segment_pos_ += n;
+  if (segment_pos_ == segment.length) {
+    ++segment_;
+    segment_pos_ = 0;
+  }
+  return n;
+}
+
+int32_t PrgPulseSourceImpl::read(uint8_t* buf, uint32_t count) {
+  if (!ok_) return -1;
+  uint32_t done = 0;
+  if (pos_ < kTapHeaderSize && count > 0) {
+    uint8_t header[kTapHeaderSize];
+    makeTapHeader(1, tap_size_, header);
+    done = kTapHeaderSize - pos_;
+    if (done > count) done = count;
+    memcpy(buf, header + pos_, done);
+    pos_ += done;
+  }
+  while (done < count && segment_ < segment_count_) {
+    int32_t n = readSegment(buf + done, count - done);
+    if (n < 0) return done > 0 ? done : n;
+    done += n;
+    pos_ += n;
+  }
+  return done;
+}
+
+bool PrgPulseSourceImpl::seek(uint32_t pos) {
+  if (!ok_ || pos > size()) return false;
+  pos_ = pos;
+  segment_ = 0;
+  segment_pos_ = 0;
+  if (pos < kTapHeaderSize) return true;
+  uint32_t offset = pos - kTapHeaderSize;
+  while (segment_ < segment_count_ && offset >= segments_[segment_].length) {
+    offset -= segments_[segment_].length;
+    ++segment_;
+  }
+  segment_pos_ = offset;
+  return true;
+}
+
+}  // namespace tapuino
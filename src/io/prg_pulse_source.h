@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+
+#include "io/input_stream.h"
+#include "io/tap_header.h"
+
+namespace tapuino {
+
+// Whether the file name has a .prg extension (in any letter case).
+bool isPrgName(const char* name);
+
+// Presents a PRG file as a TAP v1 recording. The pulses are generated as they
+// are read, from the PRG bytes, so that no TAP needs to be stored.
+//
+// In the ROM_LOADER mode, the recording is in the format of the standard CBM
+// ROM loader: a header block and a data block, each recorded twice, with their
+// pilot tones and gaps.
+//
+// In the TURBO mode, the ROM loader only loads a one-line BASIC program that
+// starts a small turbo loader, which is carried in the unused part of the
+// header block (and so lands in the cassette buffer). The program then follows
+// in a turbo encoding of 8 pulses per byte, about 15 times faster. After the
+// load, BASIC programs are started; others return to READY. Programs that
+// would overwrite the loader, or reach into the I/O area, are played in the
+// ROM_LOADER mode.
+//
+// The stream is a fixed sequence of segments (pilot tones, encoded bytes,
+// markers, pauses) of known lengths, so it has a known size and seeks are
+// direct.
+class PrgPulseSourceImpl : public InputStreamImpl {
+ public:
+  enum Mode { ROM_LOADER, TURBO };
+
+  // Takes over `source`, which reads the PRG file (or a ZIP entry). `name` is
+  // the file name, which becomes the name in the tape header.
+  PrgPulseSourceImpl(InputStream source, const std::string& name, Mode mode);
+
+  int32_t read(uint8_t* buf, uint32_t count) override;
+
+  bool seek(uint32_t pos) override;
+
+  uint32_t size() const override { return kTapHeaderSize + tap_size_; }
+
+  bool ok() const override { return ok_; }
+
+  void close() override { source_.close(); }
+
+ private:
+  enum SegmentType { PILOT, BYTES, END_OF_DATA, PAUSE };
+  enum Encoding { ROM_ENCODING, TURBO_ENCODING };
+
+  struct Segment {
+    SegmentType type;
+    // In TAP bytes.
+    uint32_t length;
+    // For PILOT, the pulse; for BYTES, how they are encoded.
+    uint8_t pulse;
+    Encoding encoding;
+    // For BYTES, the data, repeated over the length of the segment; nullptr
+    // for the program. For PAUSE, the TAP value.
+    const uint8_t* bytes;
+    uint32_t byte_count;
+  };
+
+  static constexpr int kMaxSegments = 32;
+  // Bytes of the program read from the source at a time.
+  static constexpr uint32_t kWindowSize = 256;
+
+  bool init(const std::string& name, Mode mode);
+  void setHeader(uint8_t type, uint16_t start, uint16_t end,
+                 const std::string& name);
+  // A block in the ROM loader's format.
+  void addBlock(const uint8_t* bytes, uint32_t count, const uint8_t* checksum,
+                uint32_t pilot);
+  void addPilot(uint8_t pulse, uint32_t count);
+  void addBytes(Encoding encoding, const uint8_t* bytes, uint32_t count,
+                uint32_t repeat = 1);
+  void addSegment(const Segment& segment);
+  // Returns the byte of the program at the specified offset (past the load
+  // address), or -1 on read error.
+  int16_t programByte(uint32_t offset);
+  // Writes the TAP bytes of the current segment from the current offset.
+  int32_t readSegment(uint8_t* buf, uint32_t count);
+
+  InputStream source_;
+  bool ok_;
+  uint32_t tap_size_;
+  uint32_t program_size_;
+
+  uint8_t header_[192];
+  uint8_t header_checksum_;
+  uint8_t program_checksum_;
+  // Of the TURBO mode: the checksum of the BASIC starter, and the sync byte
+  // and load parameters preceding the turbo encoded program.
+  uint8_t starter_checksum_;
+  uint8_t turbo_header_[6];
+
+  Segment segments_[kMaxSegments];
+  int segment_count_;
+
+  // The read position: in the stream, and within the current segment.
+  uint32_t pos_;
+  int segment_;
+  uint32_t segment_pos_;
+
+  uint8_t window_[kWindowSize];
+  uint32_t window_start_;
+  uint32_t window_size_;
+};
+
+}  // namespace tapuino
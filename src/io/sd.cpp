@@ -0,0 +1,131 @@
+#include "io/sd.h"
+
+#include <Preferences.h>
+
+#include "roo_logging.h"
+
+namespace tapuino {
+
+namespace {
+
+// Candidate SPI clocks, fastest first. The SPI peripheral divides them down
+// from 80 MHz.
+const uint32_t kProbeClocks[] = {40000000, 26666666, 20000000, 16000000,
+                                 10000000, 8000000,  4000000};
+
+// The places a clock is verified at: runs of consecutive sectors, the first
+// one at the start of the card, the others at random in equal parts of it.
+constexpr int kProbeSpots = 8;
+constexpr int kProbeRun = 4;
+
+// Reads of all the spots that must match, for a clock to be considered
+// stable.
+constexpr int kProbeRounds = 4;
+
+const char* kPrefsNamespace = "sd_clock";
+
+// FNV-1a.
+uint32_t Hash(uint32_t hash, const uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+constexpr uint32_t kHashSeed = 2166136261u;
+
+uint32_t CardId(const uint8_t* sector, uint64_t card_size) {
+  uint8_t size[8];
+  for (int i = 0; i < 8; ++i) {
+    size[i] = card_size >> (i * 8);
+  }
+  return Hash(Hash(kHashSeed, sector, 512), size, sizeof(size));
+}
+
+}  // namespace
+
+bool Sd::begin(uint32_t clock) {
+  digitalWrite(sd_cs_pin_, LOW);
+  bool ok = fs_.begin(sd_cs_pin_, spi_, clock, mountpoint());
+  digitalWrite(sd_cs_pin_, HIGH);
+  clock_ = ok ? clock : 0;
+  return ok;
+}
+
+void Sd::end() {
+  digitalWrite(sd_cs_pin_, LOW);
+  fs_.end();
+  digitalWrite(sd_cs_pin_, HIGH);
+  clock_ = 0;
+}
+
+bool Sd::hashRun(uint32_t sector, uint32_t& hash) {
+  uint8_t buf[512];
+  hash = kHashSeed;
+  for (int i = 0; i < kProbeRun; ++i) {
+    if (!fs_.readRAW(buf, sector + i)) return false;
+    hash = Hash(hash, buf, sizeof(buf));
+  }
+  return true;
+}
+
+bool Sd::sampleProbeSpots(ProbeSpot* spots) {
+  uint32_t stride = numSectors() / kProbeSpots;
+  for (int i = 0; i < kProbeSpots; ++i) {
+    spots[i].sector = 0;
+    if (i > 0 && stride > kProbeRun) {
+      spots[i].sector = i * stride + random(stride - kProbeRun);
+    }
+    if (!hashRun(spots[i].sector, spots[i].hash)) return false;
+  }
+  return true;
+}
+
+bool Sd::tryClock(uint32_t clock, const ProbeSpot* spots) {
+  end();
+  if (!begin(clock)) return false;
+  for (int round = 0; round < kProbeRounds; ++round) {
+    for (int i = 0; i < kProbeSpots; ++i) {
+      uint32_t hash;
+      if (!hashRun(spots[i].sector, hash) || hash != spots[i].hash) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Sd::mountTuned() {
+  if (!begin(freq_)) return false;
+  uint8_t first[512];
+  ProbeSpot spots[kProbeSpots];
+  if (!fs_.readRAW(first, 0) || !sampleProbeSpots(spots)) {
+    // Can't verify other clocks; stay on the safe one.
+    return true;
+  }
+  char key[12];
+  snprintf(key, sizeof(key), "c%08x", CardId(first, fs_.cardSize()));
+  Preferences prefs;
+  prefs.begin(kPrefsNamespace, false);
+  uint32_t remembered = prefs.getUInt(key, 0);
+  if (remembered != 0 && tryClock(remembered, spots)) {
+    LOG(INFO) << "SD clock: " << remembered << " Hz (remembered)";
+    prefs.end();
+    return true;
+  }
+  for (uint32_t clock : kProbeClocks) {
+    if (clock <= freq_) break;
+    if (tryClock(clock, spots)) {
+      LOG(INFO) << "SD clock: " << clock << " Hz (probed)";
+      prefs.putUInt(key, clock);
+      prefs.end();
+      return true;
+    }
+  }
+  prefs.end();
+  LOG(INFO) << "SD clock: " << freq_ << " Hz (base)";
+  end();
+  return begin(freq_);
+}
+
+}  // namespace tapuino
@@ -7,27 +7,40 @@
 namespace tapuino {
 
 // Uses the global SD singleton.
+//
+// The SPI clock is tuned when the card is mounted. Starting from the fastest,
+// the candidate clocks are tried until one reads a spread of sectors of the
+// card (runs of consecutive sectors, at random places all over it) reliably,
+// as compared against reads at the base clock (`freq`), which is assumed to
+// always work. The clock found is remembered per card (keyed by a hash of the
+// first sector and the card size), so that later mounts only need to verify
+// it, in the same way.
 class Sd {
  public:
   Sd(const Sd&) = delete;
   Sd(int sd_cs_pin = SS, decltype(SPI)& spi = SPI, uint32_t freq = 800000)
-      : spi_(spi), sd_cs_pin_(sd_cs_pin), freq_(freq), fs_(SD), refcount_(0) {
+      : spi_(spi),
+        sd_cs_pin_(sd_cs_pin),
+        freq_(freq),
+        clock_(0),
+        fs_(SD),
+        refcount_(0) {
     pinMode(sd_cs_pin, OUTPUT);
     digitalWrite(sd_cs_pin, HIGH);
   }
 
   FS& fs() const { return fs_; }
 
+  // Where the card is mounted in the VFS; the default of SD.begin().
+  const char* mountpoint() const { return "/sd"; }
+
   bool mount() {
     if (refcount_ == 0) {
       Serial.println("Mounting the card");
-      digitalWrite(sd_cs_pin_, LOW);
-  Serial.printf("free heap: %d", ESP.getFreeHeap());
-      bool ok = fs_.begin(sd_cs_pin_, spi_);//, freq_);
-  Serial.printf("free heap: %d", ESP.getFreeHeap());
-      digitalWrite(sd_cs_pin_, HIGH);
+      Serial.printf("free heap: %d", ESP.getFreeHeap());
+      bool ok = mountTuned();
+      Serial.printf("free heap: %d", ESP.getFreeHeap());
       if (!ok) return false;
-      
     }
     ++refcount_;
     Serial.printf("Refcount: %d\n", refcount_);
@@ -39,17 +52,49 @@ class Sd {
     Serial.printf("Refcount: %d\n", refcount_);
     if (refcount_ > 0) return;
     Serial.println("Unmounting the card");
-    digitalWrite(sd_cs_pin_, LOW);
-    fs_.end();
-    digitalWrite(sd_cs_pin_, HIGH);
+    end();
   }
 
   bool is_mounted() const { return refcount_ > 0; }
 
+  // The SPI clock that the card is mounted with.
+  uint32_t clock() const { return clock_; }
+
+  // Raw access to the card, bypassing the filesystem.
+  bool readSector(uint8_t* buf, uint32_t sector) {
+    return fs_.readRAW(buf, sector);
+  }
+  uint32_t numSectors() { return fs_.numSectors(); }
+
  private:
+  bool begin(uint32_t clock);
+  void end();
+
+  // Mounts the card with the fastest clock that reads it reliably.
+  bool mountTuned();
+
+  // A run of sectors read to verify a clock, and the hash of its contents at
+  // the base clock.
+  struct ProbeSpot {
+    uint32_t sector;
+    uint32_t hash;
+  };
+
+  // Picks the spots to probe, and reads their reference hashes. Returns false
+  // on a read error.
+  bool sampleProbeSpots(ProbeSpot* spots);
+
+  // Hashes the run of sectors starting at the specified one.
+  bool hashRun(uint32_t sector, uint32_t& hash);
+
+  // Remounts the card with the specified clock, and checks that the spots
+  // read back as the reference, repeatedly.
+  bool tryClock(uint32_t clock, const ProbeSpot* spots);
+
   decltype(SPI)& spi_;
   int sd_cs_pin_;
   uint32_t freq_;
+  uint32_t clock_;
 
   SDFS& fs_;
   int refcount_;
@@ -0,0 +1,109 @@
+#include "io/sd_benchmark.h"
+
+#include <algorithm>
+
+namespace tapuino {
+
+namespace {
+
+// 1 MiB.
+constexpr uint32_t kSequentialReads = 2048;
+constexpr uint32_t kRandomReads = 512;
+
+// Reads per call to step().
+constexpr uint32_t kReadsPerStep = 32;
+
+uint32_t KiloBytesPerSecond(uint32_t sectors, uint32_t us) {
+  if (us == 0) return 0;
+  return (uint64_t)sectors * 512 * 1000000 / 1024 / us;
+}
+
+}  // namespace
+
+SdBenchmark::SdBenchmark(Sd& sd) : sd_(sd), phase_(DONE) {}
+
+void SdBenchmark::start() {
+  result_ = Result();
+  sectors_ = sd_.numSectors();
+  // Away from the FAT, in the middle of the card, where the data is.
+  first_sector_ = sectors_ > 2 * kSequentialReads ? sectors_ / 2 : 0;
+  reads_done_ = 0;
+  sequential_us_ = 0;
+  random_us_ = 0;
+  latencies_.clear();
+  latencies_.reserve(kRandomReads);
+  phase_ = SEQUENTIAL;
+  if (sectors_ == 0) {
+    result_.errors = 1;
+    phase_ = DONE;
+  }
+}
+
+bool SdBenchmark::step() {
+  uint8_t buf[512];
+  switch (phase_) {
+    case SEQUENTIAL: {
+      uint32_t start = micros();
+      for (uint32_t i = 0; i < kReadsPerStep; ++i) {
+        if (!sd_.readSector(buf, first_sector_ + reads_done_ + i)) {
+          result_.errors++;
+        }
+      }
+      sequential_us_ += micros() - start;
+      reads_done_ += kReadsPerStep;
+      if (reads_done_ >= kSequentialReads) {
+        reads_done_ = 0;
+        phase_ = RANDOM;
+      }
+      return true;
+    }
+    case RANDOM: {
+      for (uint32_t i = 0; i < kReadsPerStep; ++i) {
+        uint32_t sector = random(sectors_);
+        uint32_t start = micros();
+        if (!sd_.readSector(buf, sector)) {
+          result_.errors++;
+        }
+        uint32_t elapsed = micros() - start;
+        random_us_ += elapsed;
+        latencies_.push_back(elapsed);
+      }
+      reads_done_ += kReadsPerStep;
+      if (reads_done_ >= kRandomReads) {
+        finish();
+        return false;
+      }
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+int SdBenchmark::progress() const {
+  switch (phase_) {
+    case SEQUENTIAL:
+      return reads_done_ * 50 / kSequentialReads;
+    case RANDOM:
+      return 50 + reads_done_ * 50 / kRandomReads;
+    default:
+      return 100;
+  }
+}
+
+void SdBenchmark::finish() {
+  result_.sequential_kbps = KiloBytesPerSecond(kSequentialReads, sequential_us_);
+  result_.random_kbps = KiloBytesPerSecond(kRandomReads, random_us_);
+  std::sort(latencies_.begin(), latencies_.end());
+  size_t n = latencies_.size();
+  result_.p50_us = latencies_[n * 50 / 100];
+  result_.p90_us = latencies_[n * 90 / 100];
+  result_.p99_us = latencies_[n * 99 / 100];
+  result_.max_us = latencies_[n - 1];
+  latencies_.clear();
+  latencies_.shrink_to_fit();
+  phase_ = DONE;
+}
+
+}  // namespace tapuino
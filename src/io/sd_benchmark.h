@@ -0,0 +1,61 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include "io/sd.h"
+
+namespace tapuino {
+
+// Measures how fast the card reads, with raw sector reads that bypass the
+// filesystem (so it needs no test file, and doesn't write to the card): a
+// sequential run, and single sectors at random positions. The latter are
+// what matters for playback, which can't afford to wait for a slow read.
+//
+// The work is done in slices, by step(), so that the UI stays responsive.
+class SdBenchmark {
+ public:
+  struct Result {
+    // Of the sequential and the random reads, in kB/s.
+    uint32_t sequential_kbps;
+    uint32_t random_kbps;
+    // Percentiles of the latencies of the random reads, in microseconds.
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint32_t errors;
+  };
+
+  explicit SdBenchmark(Sd& sd);
+
+  void start();
+
+  // Does the next slice of the work. Returns false once finished.
+  bool step();
+
+  bool done() const { return phase_ == DONE; }
+
+  // Percentage of the work done.
+  int progress() const;
+
+  const Result& result() const { return result_; }
+
+ private:
+  enum Phase { SEQUENTIAL, RANDOM, DONE };
+
+  void finish();
+
+  Sd& sd_;
+  Phase phase_;
+  uint32_t sectors_;
+  uint32_t first_sector_;
+  uint32_t reads_done_;
+  uint32_t sequential_us_;
+  uint32_t random_us_;
+  std::vector<uint32_t> latencies_;
+  Result result_;
+};
+
+}  // namespace tapuino
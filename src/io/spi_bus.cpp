@@ -0,0 +1,51 @@
+#include "io/spi_bus.h"
+
+namespace tapuino {
+
+void SpiBus::setUrgent(std::function<bool()> due, std::function<void()> run) {
+  due_ = std::move(due);
+  run_ = std::move(run);
+  stats_ = Stats();
+}
+
+void SpiBus::clearUrgent() {
+  due_ = nullptr;
+  run_ = nullptr;
+}
+
+void SpiBus::runUrgent() {
+  if (!urgentDue()) return;
+  // The work may unregister itself.
+  std::function<void()> run = run_;
+  Transaction t(*this, SD);
+  run();
+}
+
+void SpiBus::runDisplay(const std::function<void()>& tick) {
+  runUrgent();
+  uint32_t now = micros();
+  if (due_ && now - last_tick_ < kDisplayIntervalUs) {
+    ++stats_.deferred_ticks;
+    return;
+  }
+  last_tick_ = now;
+  {
+    Transaction t(*this, DISPLAY);
+    tick();
+  }
+  if (urgentDue()) {
+    uint32_t waited = micros() - now;
+    ++stats_.waits;
+    if (waited > stats_.max_wait_us) stats_.max_wait_us = waited;
+    runUrgent();
+  }
+}
+
+void SpiBus::account(Client client, uint32_t elapsed_us) {
+  Occupancy& o = stats_.clients[client];
+  ++o.transactions;
+  o.busy_us += elapsed_us;
+  if (elapsed_us > o.max_us) o.max_us = elapsed_us;
+}
+
+}  // namespace tapuino
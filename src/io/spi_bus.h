@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+#include <inttypes.h>
+
+#include <functional>
+
+namespace tapuino {
+
+// Arbitrates the SPI bus that the SD card shares with the display and the
+// touch controller.
+//
+// Everything that talks to the bus runs from the main loop, so a transaction
+// can't be cut short once started. Instead, the loop hands the UI tick (which
+// does the redraws and the touch polling) to runDisplay(), and the bus makes
+// sure that the urgent SD work (the refill of the playback buffer) goes first:
+// right before the tick, and right after it, in case it became due meanwhile.
+// While urgent work is registered, UI ticks are also spaced out by
+// kDisplayInterval, so that the redraws they do accumulate, and go out
+// together, between the refills.
+//
+// The time spent on the bus is accounted per client, along with the refills
+// that became due during a UI tick, i.e. that had to wait behind it.
+class SpiBus {
+ public:
+  enum Client { SD = 0, DISPLAY = 1 };
+  static constexpr int kNumClients = 2;
+
+  // How often the UI ticks while urgent work is registered.
+  static constexpr uint32_t kDisplayIntervalUs = 40000;
+
+  struct Occupancy {
+    uint32_t transactions = 0;
+    // Total and worst time on the bus, in microseconds.
+    uint64_t busy_us = 0;
+    uint32_t max_us = 0;
+  };
+
+  struct Stats {
+    Occupancy clients[kNumClients];
+    // UI ticks skipped to coalesce the redraws.
+    uint32_t deferred_ticks = 0;
+    // Urgent work that became due during a UI tick, and how long the worst
+    // of these ticks took (an upper bound of the wait).
+    uint32_t waits = 0;
+    uint32_t max_wait_us = 0;
+  };
+
+  // Accounts the time between its construction and destruction to the
+  // client.
+  class Transaction {
+   public:
+    Transaction(SpiBus& bus, Client client)
+        : bus_(bus), client_(client), start_(micros()) {}
+
+    ~Transaction() { bus_.account(client_, micros() - start_); }
+
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+
+   private:
+    SpiBus& bus_;
+    Client client_;
+    uint32_t start_;
+  };
+
+  SpiBus() : last_tick_(0) {}
+
+  // Registers the SD work that must not wait behind the display: `due` tells
+  // whether there is anything to do, and `run` does it. Resets the stats.
+  void setUrgent(std::function<bool()> due, std::function<void()> run);
+
+  // Unregisters the urgent work. Can be called from within its `run`.
+  void clearUrgent();
+
+  // Does the urgent work, if due.
+  void runUrgent();
+
+  // Runs the UI tick, unless deferred to coalesce the redraws. Does the
+  // urgent work first.
+  void runDisplay(const std::function<void()>& tick);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  bool urgentDue() const { return due_ && due_(); }
+
+  void account(Client client, uint32_t elapsed_us);
+
+  std::function<bool()> due_;
+  std::function<void()> run_;
+  uint32_t last_tick_;
+  Stats stats_;
+};
+
+}  // namespace tapuino
@@ -2,11 +2,39 @@
 
 #include "io/input_stream.h"
 #include "io/sd.h"
+#include "io/prg_pulse_source.h"
 #include "io/unzipper.h"
+#include "io/wav_input_stream.h"
 
 namespace tapuino {
 
-TapFile::TapFile(Sd& sd) : sd_(sd) {}
+namespace {
+
+const char* kSidecarDir = "/__tapuino/meta";
+
+// FNV-1a.
+uint32_t hashPath(const std::string& path, const std::string& entry) {
+  uint32_t hash = 2166136261u;
+  for (char c : path) hash = (hash ^ (uint8_t)c) * 16777619u;
+  hash = (hash ^ 0) * 16777619u;
+  for (char c : entry) hash = (hash ^ (uint8_t)c) * 16777619u;
+  return hash;
+}
+
+}  // namespace
+
+TapFile::TapFile(Sd& sd) : sd_(&sd), prg_(false), turbo_prg_(false) {}
+
+std::string TapFile::sidecarPath(const char* ext) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%08x.%s", hashPath(file_path_, zip_entry_),
+           ext);
+  return std::string(kSidecarDir) + name;
+}
+
+bool TapFile::makeSidecarDir() const {
+  return sd_->fs().exists(kSidecarDir) || sd_->fs().mkdir(kSidecarDir);
+}
 
 void TapFile::set(const MemIndexEntry& entry) {
   if (entry.parent().isZip()) {
@@ -16,15 +44,40 @@ void TapFile::set(const MemIndexEntry& entry) {
     zip_entry_ = entry.getName();
   } else {
     file_path_ = entry.getPath();
+    zip_entry_.clear();
   }
   simple_name_ = entry.getName();
+  prg_ = entry.isPrgFile();
 }
 
 // SdMount TapFile::mount() const { return SdMount(sd_); }
 
 InputStream TapFile::open() {
+  InputStream input = openRaw();
+  if (!input.isOpen()) return input;
+  if (prg_) {
+    return InputStream(std::unique_ptr<InputStreamImpl>(
+        new PrgPulseSourceImpl(std::move(input), simple_name_,
+                               turbo_prg_ ? PrgPulseSourceImpl::TURBO
+                                          : PrgPulseSourceImpl::ROM_LOADER)));
+  }
+  if (!isWavName(simple_name_.c_str())) return input;
+  makeSidecarDir();
+  return InputStream(std::unique_ptr<InputStreamImpl>(new WavInputStreamImpl(
+      std::move(input), sd_->fs(), sidecarPath("wln"))));
+}
+
+bool TapFile::beginLengthScan(WavLengthScanner& scanner) {
+  if (prg_ || !isWavName(simple_name_.c_str())) return false;
+  InputStream input = openRaw();
+  if (!input.isOpen()) return false;
+  makeSidecarDir();
+  return scanner.begin(std::move(input), sd_->fs(), sidecarPath("wln"));
+}
+
+InputStream TapFile::openRaw() {
   // SdMount mount(sd_);
-  File file = sd_.fs().open(file_path_.c_str());
+  File file = sd_->fs().open(file_path_.c_str());
   if (!file) {
     return InputStream();
   }
@@ -33,17 +86,17 @@ InputStream TapFile::open() {
                        std::unique_ptr<InputStreamImpl>(
                            new FileInputStreamImpl(std::move(file))));
   } else {
-    unzipper::FileInfo fi;
-    if (unzipper::OpenZip(sd_.fs(), file_path_.c_str()) != 0 ||
-        unzipper::LocateFile(zip_entry_.c_str()) != 0 ||
-        unzipper::OpenCurrentFile() != 0 ||
-        unzipper::GetCurrentFileInfo(fi) != 0) {
+    unzipper::EntryLocation location;
+    if (!unzipper::LocateEntryData(file, zip_entry_.c_str(), location)) {
       return InputStream();
     }
+    std::unique_ptr<unzipper::ZipEntryInputStreamImpl> entry(
+        new unzipper::ZipEntryInputStreamImpl(std::move(file), location,
+                                              sd_->fs(), sidecarPath("zix")));
+    if (!entry->init()) return InputStream();
     return InputStream(
         // std::move(mount),
-        std::unique_ptr<InputStreamImpl>(new unzipper::ZipEntryInputStreamImpl(
-            std::move(file), fi.info.uncompressed_size)));
+        std::move(entry));
   }
 }
 
@@ -5,6 +5,8 @@
 
 namespace tapuino {
 
+class WavLengthScanner;
+
 // Backed by either a regular file or a ZIP file.
 class TapFile {
  public:
@@ -12,21 +14,50 @@ class TapFile {
 
   void set(const MemIndexEntry& entry);
 
+  // Whether PRG files are played with the turbo loader rather than the ROM
+  // loader.
+  void setTurboPrg(bool turbo) { turbo_prg_ = turbo; }
+
   // // Makes sure that the filesystem backing the file is mounted.
   // // The mounts use reference counting. The filesystem remains mounted as long
   // // as they are any SdMount objects alive. Each InputStream carries its own
   // // mount. The mounts can be copied and moved around.
   // SdMount mount() const;
 
+  // Opens the TAP data. WAV recordings and PRG files are converted to TAP on
+  // the fly.
   InputStream open();
   const std::string& name() const { return simple_name_; }
 
+  // Whether the file is a PRG, rather than a recording.
+  bool isPrg() const { return prg_; }
+
+  // Opens the file (or the ZIP entry) as is.
+  InputStream openRaw();
+
+  // Starts finding the length of a WAV recording with the scanner, so that
+  // open() doesn't have to. Returns false if there is nothing to scan: the
+  // file is not a WAV, or its length is already known.
+  bool beginLengthScan(WavLengthScanner& scanner);
+
+  FS& fs() const { return sd_->fs(); }
+
+  // Returns the path of a metadata file kept for this TAP in the index
+  // directory (e.g. a seek index), distinguished by the extension.
+  std::string sidecarPath(const char* ext) const;
+
+  // Makes sure that the directory holding sidecar files exists.
+  bool makeSidecarDir() const;
+
  private:
-  Sd& sd_;
+  Sd* sd_;
   std::string file_path_;
   // If non-ZIP, empty string.
   std::string zip_entry_;
   std::string simple_name_;
+  // Whether the file is a PRG, played through the ROM loader's encoding.
+  bool prg_;
+  bool turbo_prg_;
 };
 
 }  // namespace tapuino
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace tapuino {
+
+constexpr uint32_t kTapHeaderSize = 20;
+
+// What the indexer learns from the header of a TAP, packed into a byte of the
+// indexes: the format version, the platform, the video standard, and whether
+// the length field disagrees with the file size. The length itself is not
+// kept; the player recomputes it from the size of the file when opening it
+// (as file size - kTapHeaderSize).
+class TapMeta {
+ public:
+  enum Platform : uint8_t {
+    C64 = 0,
+    VIC20 = 1,
+    C16 = 2,
+    // Not a TAP that the player accepts.
+    INVALID = 3,
+  };
+
+  // Not validated: not a TAP (e.g. a WAV or a PRG), or indexed before the
+  // headers were validated.
+  constexpr TapMeta() : val_(kUnknown) {}
+
+  static TapMeta Invalid() { return TapMeta(INVALID << 2); }
+
+  // Validates the first `size` bytes of a TAP file of `file_size` bytes, the
+  // way TapLoader::ReadTapHeader() does: only a file too short for any data,
+  // or a wrong magic, is invalid. Other fields out of range are recorded as
+  // the player takes them: an unknown version as 1 (that of the plain 8-bit
+  // pulses), and an unknown platform or video standard as C64 or PAL (the
+  // timing it defaults to).
+  static TapMeta FromHeader(const uint8_t* header, uint32_t size,
+                            uint32_t file_size) {
+    if (size < kTapHeaderSize || file_size <= kTapHeaderSize ||
+        (memcmp(header, "C64-TAPE-RAW", 12) != 0 &&
+         memcmp(header, "C16-TAPE-RAW", 12) != 0)) {
+      return Invalid();
+    }
+    uint8_t version = header[12] > 2 ? 1 : header[12];
+    uint8_t platform = header[13] > C16 ? C64 : header[13];
+    uint8_t video = header[14] > 1 ? 0 : header[14];
+    uint32_t length = header[16] | (header[17] << 8) | (header[18] << 16) |
+                      ((uint32_t)header[19] << 24);
+    bool length_mismatch = (length != file_size - kTapHeaderSize);
+    return TapMeta(version | (platform << 2) | (video << 4) |
+                   (length_mismatch ? 0x20 : 0));
+  }
+
+  static constexpr TapMeta FromByte(uint8_t val) { return TapMeta(val); }
+  constexpr uint8_t toByte() const { return val_; }
+
+  bool known() const { return val_ != kUnknown; }
+
+  // Unknown files are assumed playable.
+  bool playable() const { return !known() || platform() != INVALID; }
+
+  uint8_t version() const { return val_ & 3; }
+  Platform platform() const { return (Platform)((val_ >> 2) & 3); }
+  bool ntsc() const { return (val_ & 0x10) != 0; }
+  bool length_mismatch() const { return (val_ & 0x20) != 0; }
+
+ private:
+  static constexpr uint8_t kUnknown = 0xFF;
+
+  constexpr TapMeta(uint8_t val) : val_(val) {}
+
+  uint8_t val_;
+};
+
+// The header of the TAP files synthesized from other formats.
+
+// Writes a C64 PAL TAP header of the specified version, for `data_size` bytes
+// of pulse data.
+inline void makeTapHeader(uint8_t version, uint32_t data_size, uint8_t* out) {
+  memcpy(out, "C64-TAPE-RAW", 12);
+  out[12] = version;
+  out[13] = 0;  // C64.
+  out[14] = 0;  // PAL.
+  out[15] = 0;
+  out[16] = data_size;
+  out[17] = data_size >> 8;
+  out[18] = data_size >> 16;
+  out[19] = data_size >> 24;
+}
+
+}  // namespace tapuino
@@ -1,5 +1,9 @@
 #include "unzipper.h"
 
+#include <strings.h>
+
+#include <new>
+
 #include "memory/mem_buffer.h"
 #include "roo_logging.h"
 
@@ -7,19 +11,13 @@ namespace tapuino {
 
 namespace {
 
-FS *zipFs;
-File myfile;
-
 //
 // Callback functions needed by the unzipLIB to access a file system
 // The library has built-in code for memory-to-memory transfers, but needs
-// these callback functions to allow using other storage media
+// these callback functions to allow using other storage media. Apart from
+// the open callback (see UnzipContext::openCallback()), they get to the file
+// of the context through the fHandle of its ZIPFILE.
 //
-void *myOpen(const char *filename, int32_t *size) {
-  myfile = zipFs->open(filename);
-  *size = myfile.size();
-  return (void *)&myfile;
-}
 void myClose(void *p) {
   ZIPFILE *pzf = (ZIPFILE *)p;
   File *f = (File *)pzf->fHandle;
@@ -45,85 +43,462 @@ int32_t mySeek(void *p, int32_t position, int iType) {
   }
 }
 
+constexpr uint32_t kLocalHeaderSig = 0x04034b50;
+constexpr uint32_t kCentralDirSig = 0x02014b50;
+constexpr uint32_t kEndOfCentralDirSig = 0x06054b50;
+constexpr uint32_t kLocalHeaderSize = 30;
+constexpr uint32_t kCentralDirHeaderSize = 46;
+constexpr uint32_t kEndOfCentralDirSize = 22;
+
+uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Finds the end of central directory record, which is followed by a comment
+// of up to 64 KiB, scanning backwards from the end of the file.
+bool findEndOfCentralDir(File &file, uint8_t *eocd) {
+  uint32_t size = file.size();
+  if (size < kEndOfCentralDirSize) return false;
+  uint32_t lowest = size > kEndOfCentralDirSize + 0xFFFF
+                        ? size - kEndOfCentralDirSize - 0xFFFF
+                        : 0;
+  uint8_t buf[256];
+  // Highest candidate position not yet checked.
+  uint32_t pos = size - kEndOfCentralDirSize;
+  while (true) {
+    uint32_t start = pos >= sizeof(buf) - kEndOfCentralDirSize
+                         ? pos - (sizeof(buf) - kEndOfCentralDirSize)
+                         : 0;
+    if (start < lowest) start = lowest;
+    uint32_t len = pos - start + kEndOfCentralDirSize;
+    if (!file.seek(start) || file.read(buf, len) != len) return false;
+    for (int32_t i = pos - start; i >= 0; --i) {
+      if (le32(buf + i) == kEndOfCentralDirSig) {
+        memcpy(eocd, buf + i, kEndOfCentralDirSize);
+        return true;
+      }
+    }
+    if (start == lowest) return false;
+    pos = start - 1;
+  }
+}
+
 }  // namespace
 
 namespace unzipper {
 
-int OpenZip(FS &fs, const char *filename) {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  zipFs = &fs;
-  zip.zHandle =
-      unzOpen(filename, nullptr, 0, &zip, &myOpen, &myRead, &mySeek, &myClose);
-  if (zip.zHandle == nullptr) {
+namespace {
+
+int pool_size = kDefaultContextPoolSize;
+int contexts_in_use = 0;
+bool shared_in_use = false;
+
+// The context being opened; unzOpen() calls back without it.
+UnzipContext *opening = nullptr;
+
+// Of the free functions.
+UnzipContextPtr default_context;
+
+}  // namespace
+
+UnzipContext::UnzipContext(ZIPFILE *zip, bool shared)
+    : zip_(zip), shared_(shared), fs_(nullptr) {
+  zip_->zHandle = nullptr;
+}
+
+void *UnzipContext::openCallback(const char *filename, int32_t *size) {
+  UnzipContext *ctx = opening;
+  ctx->file_ = ctx->fs_->open(filename);
+  *size = ctx->file_.size();
+  return (void *)&ctx->file_;
+}
+
+int UnzipContext::open(FS &fs, const char *filename) {
+  close();
+  fs_ = &fs;
+  opening = this;
+  zip_->zHandle = unzOpen(filename, nullptr, 0, zip_, &openCallback, &myRead,
+                          &mySeek, &myClose);
+  opening = nullptr;
+  if (zip_->zHandle == nullptr) {
     LOG(ERROR) << "Error opening file: " << filename;
+    file_.close();
+    return -1;
+  }
+  return 0;
+}
+
+int UnzipContext::close() {
+  if (!isOpen()) return UNZ_OK;
+  zip_->iLastError = unzClose((unzFile)zip_->zHandle);
+  zip_->zHandle = nullptr;
+  file_.close();
+  return zip_->iLastError;
+}
+
+int UnzipContext::openCurrentFile() {
+  zip_->iLastError = unzOpenCurrentFile((unzFile)zip_->zHandle);
+  return zip_->iLastError;
+}
+
+int UnzipContext::closeCurrentFile() {
+  zip_->iLastError = unzCloseCurrentFile((unzFile)zip_->zHandle);
+  return zip_->iLastError;
+}
+
+int UnzipContext::readCurrentFile(uint8_t *buffer, size_t len) {
+  return unzReadCurrentFile((unzFile)zip_->zHandle, buffer, len);
+}
+
+int UnzipContext::gotoFirstFile() {
+  return unzGoToFirstFile((unzFile)zip_->zHandle);
+}
+
+int UnzipContext::gotoNextFile() {
+  zip_->iLastError = unzGoToNextFile((unzFile)zip_->zHandle);
+  return zip_->iLastError;
+}
+
+int UnzipContext::locateFile(const char *filename) {
+  zip_->iLastError = unzLocateFile((unzFile)zip_->zHandle, filename, 2);
+  return zip_->iLastError;
+}
+
+int UnzipContext::getCurrentFileInfo(FileInfo &info) {
+  return unzGetCurrentFileInfo((unzFile)zip_->zHandle, &info.info,
+                               info.filename, sizeof(info.filename),
+                               info.extra_field, sizeof(info.extra_field),
+                               info.comment, sizeof(info.comment));
+}
+
+void UnzipContextReleaser::operator()(UnzipContext *ctx) const {
+  ZIPFILE *zip = ctx->zip_;
+  bool shared = ctx->shared_;
+  delete ctx;
+  if (shared) {
+    shared_in_use = false;
+  } else {
+    delete zip;
+  }
+  --contexts_in_use;
+}
+
+void SetContextPoolSize(int size) { pool_size = size; }
+
+UnzipContextPtr AcquireContext() {
+  if (contexts_in_use >= pool_size) {
+    LOG(WARNING) << "All " << pool_size << " unzip contexts are in use";
+    return nullptr;
+  }
+  ZIPFILE *zip;
+  bool shared = !shared_in_use;
+  if (shared) {
+    zip = &membuf::GetUnzipBuffer();
+  } else {
+    zip = new (std::nothrow) ZIPFILE;
+    if (zip == nullptr) {
+      LOG(WARNING) << "Out of memory for an unzip context";
+      return nullptr;
+    }
+  }
+  UnzipContext *ctx = new (std::nothrow) UnzipContext(zip, shared);
+  if (ctx == nullptr) {
+    if (!shared) delete zip;
+    return nullptr;
+  }
+  shared_in_use |= shared;
+  ++contexts_in_use;
+  return UnzipContextPtr(ctx);
+}
+
+int OpenZip(FS &fs, const char *filename) {
+  if (default_context == nullptr) {
+    default_context = AcquireContext();
+    if (default_context == nullptr) return -1;
+  }
+  if (default_context->open(fs, filename) != 0) {
+    default_context.reset();
     return -1;
   }
   return 0;
 }
 
 int CloseZip() {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  zip.iLastError = unzClose((unzFile)zip.zHandle);
-  return zip.iLastError;
+  if (default_context == nullptr) return UNZ_OK;
+  int result = default_context->close();
+  default_context.reset();
+  return result;
 }
 
 int OpenCurrentFile() {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  zip.iLastError = unzOpenCurrentFile((unzFile)zip.zHandle);
-  return zip.iLastError;
+  if (default_context == nullptr) return UNZ_PARAMERROR;
+  return default_context->openCurrentFile();
 }
 
 int CloseCurrentFile() {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  zip.iLastError = unzCloseCurrentFile((unzFile)zip.zHandle);
-  return zip.iLastError;
+  if (default_context == nullptr) return UNZ_PARAMERROR;
+  return default_context->closeCurrentFile();
 }
 
 int ReadCurrentFile(uint8_t *buffer, size_t len) {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  return unzReadCurrentFile((unzFile)zip.zHandle, buffer, len);
-}
-
-int GetCurrentFilePos() {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  return (int)unztell((unzFile)zip.zHandle);
+  if (default_context == nullptr) return UNZ_PARAMERROR;
+  return default_context->readCurrentFile(buffer, len);
 }
 
 int GotoFirstFile() {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  return unzGoToFirstFile((unzFile)zip.zHandle);
+  if (default_context == nullptr) return UNZ_PARAMERROR;
+  return default_context->gotoFirstFile();
 }
 
 int GotoNextFile() {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  zip.iLastError = unzGoToNextFile((unzFile)zip.zHandle);
-  return zip.iLastError;
+  if (default_context == nullptr) return UNZ_PARAMERROR;
+  return default_context->gotoNextFile();
 }
 
 int LocateFile(const char *filename) {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  zip.iLastError = unzLocateFile((unzFile)zip.zHandle, filename, 2);
-  return zip.iLastError;
+  if (default_context == nullptr) return UNZ_PARAMERROR;
+  return default_context->locateFile(filename);
 }
 
 int GetCurrentFileInfo(FileInfo &info) {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  return unzGetCurrentFileInfo((unzFile)zip.zHandle, &info.info, info.filename,
-                               sizeof(info.filename), info.extra_field,
-                               sizeof(info.extra_field), info.comment,
-                               sizeof(info.comment));
+  if (default_context == nullptr) return UNZ_PARAMERROR;
+  return default_context->getCurrentFileInfo(info);
+}
+
+bool LocateEntryData(File &file, const char *filename, EntryLocation &loc) {
+  uint8_t eocd[kEndOfCentralDirSize];
+  if (!findEndOfCentralDir(file, eocd)) return false;
+  uint16_t entries = le16(eocd + 10);
+  if (!file.seek(le32(eocd + 16))) return false;
+  uint8_t header[kCentralDirHeaderSize];
+  char name[256];
+  for (uint16_t i = 0; i < entries; ++i) {
+    if (file.read(header, kCentralDirHeaderSize) != kCentralDirHeaderSize ||
+        le32(header) != kCentralDirSig) {
+      return false;
+    }
+    uint16_t name_len = le16(header + 28);
+    uint32_t next = file.position() + name_len + le16(header + 30) +
+                    le16(header + 32);
+    if (name_len < sizeof(name)) {
+      if (file.read((uint8_t *)name, name_len) != name_len) return false;
+      name[name_len] = 0;
+      // Same as the unzLocateFile() lookup: case-insensitive.
+      if (strcasecmp(name, filename) == 0) {
+        uint32_t local_offset = le32(header + 42);
+        uint8_t local[kLocalHeaderSize];
+        if (!file.seek(local_offset) ||
+            file.read(local, kLocalHeaderSize) != kLocalHeaderSize ||
+            le32(local) != kLocalHeaderSig) {
+          return false;
+        }
+        loc.method = le16(header + 10);
+        loc.crc = le32(header + 16);
+        loc.compressed_size = le32(header + 20);
+        loc.uncompressed_size = le32(header + 24);
+        loc.data_offset = local_offset + kLocalHeaderSize + le16(local + 26) +
+                          le16(local + 28);
+        return true;
+      }
+    }
+    if (!file.seek(next)) return false;
+  }
+  return false;
+}
+
+ZipEntryInputStreamImpl::ZipEntryInputStreamImpl(File file,
+                                                 const EntryLocation &location,
+                                                 FS &fs, std::string index_path)
+    : file_(std::move(file)),
+      fs_(fs),
+      index_path_(std::move(index_path)),
+      location_(location),
+      key_{location.compressed_size, location.uncompressed_size, location.crc},
+      entry_size_(location.uncompressed_size),
+      pos_(0),
+      mode_(CLOSED),
+      inflater_(nullptr),
+      index_loaded_(false),
+      window_(nullptr),
+      window_pos_(0),
+      window_fill_(0) {}
+
+bool ZipEntryInputStreamImpl::init() {
+  if (location_.method == 0) {
+    mode_ = STORED;
+    return seekDirect(0);
+  }
+  if (location_.method != Z_DEFLATED) {
+    LOG(ERROR) << "Unsupported compression method: " << location_.method;
+    return false;
+  }
+  inflater_.reset(new (std::nothrow) RawInflater(
+      file_, location_.data_offset, location_.compressed_size));
+  if (inflater_ == nullptr || !inflater_->init()) {
+    inflater_.reset();
+    return false;
+  }
+  mode_ = INFLATE;
+  return restart();
+}
+
+int32_t ZipEntryInputStreamImpl::read(uint8_t *buf, uint32_t count) {
+  int32_t result;
+  switch (mode_) {
+    case INFLATE: {
+      result = index_.building() ? readIndexing(buf, count)
+                                 : inflater_->read(buf, count);
+      break;
+    }
+    case STORED: {
+      if (count > entry_size_ - pos_) count = entry_size_ - pos_;
+      result = (count == 0) ? 0 : file_.read(buf, count);
+      break;
+    }
+    default: {
+      return -1;
+    }
+  }
+  if (result > 0) pos_ += result;
+  return result;
+}
+
+bool ZipEntryInputStreamImpl::seek(uint32_t pos) {
+  if (mode_ == CLOSED || pos > entry_size_) return false;
+  if (pos == pos_) return true;
+  if (mode_ == STORED) return seekDirect(pos);
+  uint8_t scratch[256];
+  if (pos > pos_ && pos - pos_ < InflateIndex::kSpan) {
+    return discard(pos - pos_, scratch, sizeof(scratch));
+  }
+  if (seekIndexed(pos)) return true;
+  if (pos < pos_ && !restart()) return false;
+  return discard(pos - pos_, scratch, sizeof(scratch));
+}
+
+void ZipEntryInputStreamImpl::indexForSeeking() {
+  if (mode_ != INFLATE || entry_size_ < InflateIndex::kSpan) return;
+  loadIndex();
+  if (index_.ready() || index_.building() || !allocateWindow()) return;
+  if (!index_.begin(fs_, index_path_)) return;
+  // Points are only added once the window holds a full dictionary.
+  window_pos_ = 0;
+  window_fill_ = 0;
+}
+
+void ZipEntryInputStreamImpl::close() {
+  if (mode_ == CLOSED) return;
+  // An index not completed is of no use.
+  index_.abandon();
+  inflater_.reset();
+  window_.reset();
+  file_.close();
+  mode_ = CLOSED;
+}
+
+bool ZipEntryInputStreamImpl::discard(uint32_t count, uint8_t *scratch,
+                                      uint32_t scratch_size) {
+  while (count > 0) {
+    int32_t result = read(scratch, count < scratch_size ? count : scratch_size);
+    if (result <= 0) return false;
+    count -= result;
+  }
+  return true;
+}
+
+bool ZipEntryInputStreamImpl::restart() {
+  pos_ = 0;
+  window_fill_ = 0;
+  return inflater_->reset(InflateIndex::Point{0, 0, 0}, nullptr);
+}
+
+bool ZipEntryInputStreamImpl::seekDirect(uint32_t pos) {
+  if (!file_.seek(location_.data_offset + pos)) return false;
+  pos_ = pos;
+  return true;
+}
+
+bool ZipEntryInputStreamImpl::seekIndexed(uint32_t pos) {
+  if (pos < InflateIndex::kSpan) return false;
+  loadIndex();
+  // The window holds the dictionary of the index being built.
+  if (!index_.ready() || !allocateWindow()) return false;
+  int idx = index_.find(pos);
+  if (idx == 0) return false;
+  const InflateIndex::Point &point = index_.point(idx);
+  bool ok = index_.readWindow(idx, window_.get()) &&
+            inflater_->reset(point, window_.get());
+  if (ok) {
+    pos_ = point.out;
+    // The window doubles as the scratch buffer.
+    ok = discard(pos - pos_, window_.get(), InflateIndex::kWindowSize);
+  }
+  if (!ok) {
+    // The inflater may have been left anywhere.
+    restart();
+  }
+  return ok;
+}
+
+bool ZipEntryInputStreamImpl::allocateWindow() {
+  if (window_ == nullptr) {
+    window_.reset(new (std::nothrow) uint8_t[InflateIndex::kWindowSize]);
+  }
+  return window_ != nullptr;
 }
 
-int GetLastError() {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  return zip.iLastError;
+void ZipEntryInputStreamImpl::loadIndex() {
+  if (index_loaded_) return;
+  index_loaded_ = true;
+  index_.load(fs_, index_path_, key_);
 }
 
-int GetGlobalComment(char *buf, size_t size) {
-  ZIPFILE &zip = membuf::GetUnzipBuffer();
-  zip.iLastError = unzGetGlobalComment((unzFile)zip.zHandle, buf, size);
-  return zip.iLastError;
+int32_t ZipEntryInputStreamImpl::readIndexing(uint8_t *buf, uint32_t count) {
+  int32_t n;
+  do {
+    // Stops at each block boundary, possibly before any output.
+    n = inflater_->read(buf, count, Z_BLOCK);
+    if (n < 0) {
+      index_.abandon();
+      return n;
+    }
+    // Keep the last kWindowSize bytes.
+    const uint8_t *src = buf;
+    uint32_t left = n;
+    if (left > InflateIndex::kWindowSize) {
+      src += left - InflateIndex::kWindowSize;
+      left = InflateIndex::kWindowSize;
+    }
+    while (left > 0) {
+      uint32_t chunk = InflateIndex::kWindowSize - window_pos_;
+      if (chunk > left) chunk = left;
+      memcpy(window_.get() + window_pos_, src, chunk);
+      window_pos_ = (window_pos_ + chunk) % InflateIndex::kWindowSize;
+      src += chunk;
+      left -= chunk;
+    }
+    window_fill_ += n;
+    // Abandoned on a write error.
+    if (!index_.building()) continue;
+    uint32_t out = inflater_->totalOut();
+    if (inflater_->finished()) {
+      if (out == key_.uncompressed_size) {
+        index_.finish(key_);
+      } else {
+        index_.abandon();
+      }
+    } else if (inflater_->atBlockBoundary() &&
+               window_fill_ >= InflateIndex::kWindowSize &&
+               out >= index_.lastOut() + InflateIndex::kSpan) {
+      index_.add(InflateIndex::Point{out, inflater_->totalIn(),
+                                     inflater_->pendingBits()},
+                 window_.get(), window_pos_);
+    }
+  } while (n == 0 && !inflater_->finished());
+  return n;
 }
 
 }  // namespace unzipper
-}  // namespace tapuino
\ No newline at end of file
+}  // namespace tapuino
@@ -1,12 +1,89 @@
 #pragma once
 
+#include <memory>
+#include <string>
+
 #include "FS.h"
+#include "io/inflate_index.h"
 #include "io/input_stream.h"
 #include "unzipLIB.h"
 
 namespace tapuino {
 namespace unzipper {
 
+struct FileInfo {
+  unz_file_info info;
+  char filename[256];
+  char extra_field[128];
+  char comment[256];
+};
+
+class UnzipContext;
+
+// Closes the ZIP, and returns the context to the pool.
+struct UnzipContextReleaser {
+  void operator()(UnzipContext *ctx) const;
+};
+
+using UnzipContextPtr = std::unique_ptr<UnzipContext, UnzipContextReleaser>;
+
+// An open ZIP file: the file, and the unzipLIB state (which holds the inflate
+// buffers, some 40 KiB). Contexts are independent of each other, so several
+// ZIP files can be open at once, e.g. one playing while the next one is
+// prefetched.
+//
+// Contexts are handed out by AcquireContext(). The methods return the
+// unzipLIB status codes.
+class UnzipContext {
+ public:
+  UnzipContext(const UnzipContext &) = delete;
+  UnzipContext &operator=(const UnzipContext &) = delete;
+
+  ~UnzipContext() { close(); }
+
+  int open(FS &fs, const char *filename);
+  int close();
+  bool isOpen() const { return zip_->zHandle != nullptr; }
+
+  int openCurrentFile();
+  int closeCurrentFile();
+  int readCurrentFile(uint8_t *buffer, size_t len);
+  int gotoFirstFile();
+  int gotoNextFile();
+  int locateFile(const char *filename);
+  int getCurrentFileInfo(FileInfo &info);
+
+  int lastError() const { return zip_->iLastError; }
+
+ private:
+  friend struct UnzipContextReleaser;
+  friend UnzipContextPtr AcquireContext();
+
+  UnzipContext(ZIPFILE *zip, bool shared);
+
+  // Called back by unzOpen(), for the context being opened.
+  static void *openCallback(const char *filename, int32_t *size);
+
+  ZIPFILE *zip_;
+  // Whether zip_ is the buffer of membuf, rather than allocated.
+  bool shared_;
+  FS *fs_;
+  File file_;
+};
+
+// How many contexts can be in use at once, by default.
+constexpr int kDefaultContextPoolSize = 2;
+
+// Sets how many contexts can be in use at once. The first one uses the unzip
+// buffer of membuf (which overlaps the memory index); the others are
+// allocated on the heap while in use.
+void SetContextPoolSize(int size);
+
+// Returns a free context, or null if all are in use or out of memory.
+UnzipContextPtr AcquireContext();
+
+// The default context, for code that only ever needs one ZIP open at a time:
+// OpenZip() acquires it, and CloseZip() releases it.
 int OpenZip(FS &fs, const char *filename);
 int CloseZip();
 int OpenCurrentFile();
@@ -15,38 +92,93 @@ int ReadCurrentFile(uint8_t *buffer, size_t len);
 int GotoFirstFile();
 int GotoNextFile();
 int LocateFile(const char *filename);
+int GetCurrentFileInfo(FileInfo &info);
 
-struct FileInfo {
-  unz_file_info info;
-  char filename[256];
-  char extra_field[128];
-  char comment[256];
+// Location of an entry's data within a ZIP file.
+struct EntryLocation {
+  uint32_t data_offset;
+  uint32_t compressed_size;
+  uint32_t uncompressed_size;
+  uint32_t crc;
+  uint16_t method;
 };
 
-int GetCurrentFileInfo(FileInfo &info);
+// Finds the entry in the central directory of the ZIP file, and resolves the
+// start of its data from the local header. Uses `file` directly, independently
+// of the unzip state.
+bool LocateEntryData(File &file, const char *filename, EntryLocation &loc);
 
+// Reads an entry of a ZIP file, straight from `file`, without the unzipLIB
+// state (which overlaps the memory index). Stored entries are read as they
+// are; deflated ones with a RawInflater, whose state fits in the inflate
+// buffer of membuf.
+//
+// Seeking forward by less than InflateIndex::kSpan inflates and discards.
+// Farther or backward seeks restart the inflater at a point of the entry's
+// InflateIndex, loaded from the sidecar at `index_path`. Without the index
+// (or if there is no memory for the dictionary), the entry is inflated again
+// from the start. After indexForSeeking(), the index is built into the
+// sidecar while the entry is being read, e.g. by the background analysis, and
+// used once the entry has been read to the end.
 class ZipEntryInputStreamImpl : public InputStreamImpl {
  public:
-  ZipEntryInputStreamImpl(File file, int entry_size)
-      : file_(std::move(file)), entry_size_(entry_size) {}
+  ZipEntryInputStreamImpl(File file, const EntryLocation &location, FS &fs,
+                          std::string index_path);
+
+  // Positions the stream at the start of the entry. Fails if the compression
+  // method is not supported, or if the inflater can't be allocated.
+  bool init();
 
-  int32_t read(uint8_t *buf, uint32_t count) override {
-    return ReadCurrentFile(buf, count);
-  }
+  int32_t read(uint8_t *buf, uint32_t count) override;
+
+  bool seek(uint32_t pos) override;
+
+  void indexForSeeking() override;
 
   uint32_t size() const override { return entry_size_; }
 
-  bool ok() const override { return file_; }
+  bool ok() const override { return file_ && mode_ != CLOSED; }
 
-  void close() override {
-    CloseCurrentFile();
-    CloseZip();
-    file_.close();
-  }
+  void close() override;
 
  private:
+  enum Mode { INFLATE, STORED, CLOSED };
+
+  bool discard(uint32_t count, uint8_t *scratch, uint32_t scratch_size);
+  bool restart();
+  bool seekDirect(uint32_t pos);
+  bool seekIndexed(uint32_t pos);
+
+  // Allocates the window, if not yet. Returns false on low memory.
+  bool allocateWindow();
+
+  // Loads the index from the sidecar, if not tried yet.
+  void loadIndex();
+
+  // Reads with Z_BLOCK, so that the deflate block boundaries are seen, and
+  // adds the points found to the index being built.
+  int32_t readIndexing(uint8_t *buf, uint32_t count);
+
   File file_;
-  int entry_size_;
+  FS &fs_;
+  std::string index_path_;
+  EntryLocation location_;
+  InflateIndex::Key key_;
+  uint32_t entry_size_;
+  uint32_t pos_;
+  Mode mode_;
+
+  std::unique_ptr<RawInflater> inflater_;
+  InflateIndex index_;
+  // Whether loading the index has been tried.
+  bool index_loaded_;
+  // While the index is being built, the last kWindowSize bytes inflated,
+  // cyclically, with the oldest one at window_pos_, and how many of them have
+  // been inflated since the inflater was reset. Otherwise, the dictionary of
+  // the indexed seeks. Allocated on first use.
+  std::unique_ptr<uint8_t[]> window_;
+  uint32_t window_pos_;
+  uint32_t window_fill_;
 };
 
 }  // namespace unzipper
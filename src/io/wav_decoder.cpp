@@ -0,0 +1,219 @@
+#include "io/wav_decoder.h"
+
+#include <string.h>
+
+namespace tapuino {
+
+namespace {
+
+uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+uint32_t le32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Thresholds never get closer to the center than this, so that noise in
+// silent parts does not trigger edges.
+constexpr int32_t kMinThreshold = 512;
+
+// Group size for skipping samples that can't contain a transition.
+constexpr uint32_t kGroup = 8;
+
+constexpr uint32_t kMaxPauseCycles = 0xFFFFFF;
+
+}  // namespace
+
+bool parseWavHeader(const uint8_t* buf, uint32_t size, WavFormat& format) {
+  if (size < 12 || memcmp(buf, "RIFF", 4) != 0 ||
+      memcmp(buf + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+  bool have_fmt = false;
+  uint32_t pos = 12;
+  while (pos + 8 <= size) {
+    const uint8_t* chunk = buf + pos;
+    uint32_t chunk_size = le32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      if (chunk_size < 16 || pos + 8 + 16 > size) return false;
+      // 1 is PCM; 0xFFFE (extensible) is accepted for plain PCM layouts.
+      uint16_t tag = le16(chunk + 8);
+      if (tag != 1 && tag != 0xFFFE) return false;
+      format.channels = le16(chunk + 10);
+      format.sample_rate = le32(chunk + 12);
+      format.bits_per_sample = le16(chunk + 22);
+      have_fmt = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!have_fmt) return false;
+      format.data_offset = pos + 8;
+      format.data_size = chunk_size;
+      return (format.channels == 1 || format.channels == 2) &&
+             (format.bits_per_sample == 8 || format.bits_per_sample == 16) &&
+             format.sample_rate >= 8000;
+    }
+    // Chunks are padded to an even size.
+    pos += 8 + chunk_size + (chunk_size & 1);
+  }
+  return false;
+}
+
+WavPulseDecoder::WavPulseDecoder() : format_(), cpu_hz_(0) {}
+
+void WavPulseDecoder::begin(const WavFormat& format, uint32_t cpu_hz) {
+  format_ = format;
+  cpu_hz_ = cpu_hz;
+  overflow_span_ =
+      ((uint64_t)kMaxPauseCycles * format.sample_rate * 256) / cpu_hz;
+  block_start_ = 0;
+  last_edge_ = 0;
+  high_ = false;
+  prev_sample_ = 0;
+  peak_ = 0;
+  hi_threshold_ = kMinThreshold;
+  lo_threshold_ = -kMinThreshold;
+}
+
+// Converts a block to signed 16-bit mono. Stereo takes the left channel, as
+// tape dumps are usually mono recordings duplicated (or with a silent right
+// channel).
+void WavPulseDecoder::convert(const uint8_t* pcm, uint32_t frames) {
+  int16_t* out = samples_;
+  if (format_.bits_per_sample == 8) {
+    uint32_t stride = format_.channels;
+    for (uint32_t i = 0; i < frames; ++i) {
+      out[i] = (int16_t)((pcm[i * stride] - 128) << 8);
+    }
+  } else {
+    uint32_t stride = format_.channels * 2;
+    for (uint32_t i = 0; i < frames; ++i) {
+      const uint8_t* p = pcm + i * stride;
+      out[i] = (int16_t)(p[0] | (p[1] << 8));
+    }
+  }
+}
+
+// Sets the trigger thresholds at a quarter of the recent peak amplitude. The
+// peak decays slowly, so that the thresholds follow the volume of the
+// recording.
+void WavPulseDecoder::adaptThresholds(uint32_t frames) {
+  int32_t block_peak = 0;
+  for (uint32_t i = 0; i < frames; ++i) {
+    int32_t v = samples_[i];
+    v = v < 0 ? -v : v;
+    block_peak = v > block_peak ? v : block_peak;
+  }
+  peak_ -= peak_ >> 4;
+  if (block_peak > peak_) peak_ = block_peak;
+  int32_t threshold = peak_ >> 2;
+  if (threshold < kMinThreshold) threshold = kMinThreshold;
+  hi_threshold_ = threshold;
+  lo_threshold_ = -threshold;
+}
+
+size_t WavPulseDecoder::scan(uint32_t frames, uint8_t* out) {
+  size_t written = 0;
+  const int16_t* s = samples_;
+  int16_t hi = hi_threshold_;
+  int16_t lo = lo_threshold_;
+  uint32_t i = 0;
+  while (i < frames) {
+    // Skip groups without a transition.
+    if (high_) {
+      while (i + kGroup <= frames) {
+        int any = 0;
+        for (uint32_t k = 0; k < kGroup; ++k) any |= (s[i + k] < lo);
+        if (any) break;
+        i += kGroup;
+      }
+      while (i < frames && s[i] >= lo) ++i;
+      if (i == frames) break;
+      high_ = false;
+    } else {
+      while (i + kGroup <= frames) {
+        int any = 0;
+        for (uint32_t k = 0; k < kGroup; ++k) any |= (s[i + k] > hi);
+        if (any) break;
+        i += kGroup;
+      }
+      while (i < frames && s[i] <= hi) ++i;
+      if (i == frames) break;
+      high_ = true;
+      // Rising edge: interpolate where the signal crossed the threshold,
+      // between the previous sample and this one. At the start of a block,
+      // the threshold may have dropped below the previous sample; the edge is
+      // then taken to be at that sample.
+      uint64_t index = block_start_ + i;
+      int32_t prev = (i > 0) ? s[i - 1] : prev_sample_;
+      int32_t frac = prev >= hi ? 0 : ((hi - prev) << 8) / (s[i] - prev);
+      uint64_t edge = index == 0 ? 0 : ((index - 1) << 8) + frac;
+      written += emitEdge(edge, out + written);
+    }
+    ++i;
+  }
+  prev_sample_ = s[frames - 1];
+  return written;
+}
+
+size_t WavPulseDecoder::emitPause(uint32_t cycles, uint8_t* out) {
+  out[0] = 0;
+  out[1] = cycles;
+  out[2] = cycles >> 8;
+  out[3] = cycles >> 16;
+  return 4;
+}
+
+size_t WavPulseDecoder::emitEdge(uint64_t edge, uint8_t* out) {
+  size_t written = 0;
+  uint64_t span = edge - last_edge_;
+  last_edge_ = edge;
+  uint64_t scale = (uint64_t)format_.sample_rate * 256;
+  uint64_t cycles = (span * cpu_hz_ + scale / 2) / scale;
+  while (cycles > kMaxPauseCycles) {
+    written += emitPause(kMaxPauseCycles, out + written);
+    cycles -= kMaxPauseCycles;
+  }
+  uint32_t value = (cycles + 4) / 8;
+  if (value == 0) value = 1;
+  if (value < 256) {
+    out[written++] = value;
+  } else {
+    written += emitPause(cycles, out + written);
+  }
+  return written;
+}
+
+size_t WavPulseDecoder::decode(const uint8_t* pcm, size_t bytes,
+                               uint8_t* out) {
+  size_t written = 0;
+  uint32_t frame_size = format_.frameSize();
+  uint32_t frames = bytes / frame_size;
+  while (frames > 0) {
+    uint32_t n = frames < kBlockFrames ? frames : kBlockFrames;
+    convert(pcm, n);
+    adaptThresholds(n);
+    written += scan(n, out + written);
+    block_start_ += n;
+    pcm += n * frame_size;
+    frames -= n;
+    // Keep long silences from accumulating, so that the output per call stays
+    // bounded.
+    uint64_t now = block_start_ << 8;
+    while (now - last_edge_ > overflow_span_) {
+      written += emitPause(kMaxPauseCycles, out + written);
+      last_edge_ += overflow_span_;
+    }
+  }
+  return written;
+}
+
+size_t WavPulseDecoder::finish(uint8_t* out) {
+  uint64_t now = block_start_ << 8;
+  if (now <= last_edge_) return 0;
+  uint64_t scale = (uint64_t)format_.sample_rate * 256;
+  uint64_t cycles = ((now - last_edge_) * cpu_hz_) / scale;
+  last_edge_ = now;
+  if (cycles == 0) return 0;
+  if (cycles > kMaxPauseCycles) cycles = kMaxPauseCycles;
+  return emitPause(cycles, out);
+}
+
+}  // namespace tapuino
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// WAV to TAP conversion. Free of Arduino dependencies, so that it also builds
+// on the host (see tools/wav2tap_bench.cpp).
+
+namespace tapuino {
+
+struct WavFormat {
+  uint16_t channels;
+  uint16_t bits_per_sample;  // 8 (unsigned) or 16 (signed).
+  uint32_t sample_rate;
+  // Location of the PCM data in the file.
+  uint32_t data_offset;
+  uint32_t data_size;
+
+  uint32_t frameSize() const { return channels * (bits_per_sample / 8); }
+};
+
+// Size of the file prefix that parseWavHeader() needs to see. Headers with
+// larger metadata chunks in front of the PCM data are not supported.
+constexpr uint32_t kWavHeaderMaxSize = 1024;
+
+// Parses the RIFF header, from the beginning of the file. Returns false if the
+// file is not a PCM WAV of a supported format.
+bool parseWavHeader(const uint8_t* buf, uint32_t size, WavFormat& format);
+
+// Turns the tape signal recorded in PCM data into TAP v1 pulse values. Uses a
+// Schmitt trigger with thresholds adapted to the signal amplitude, and measures
+// the time between rising edges, interpolated to a fraction of a sample.
+//
+// The data is processed in blocks: samples are first converted to 16-bit mono,
+// and the trigger then skips groups of samples that can't contain the next
+// transition using branch-free comparisons, which the compiler vectorizes.
+class WavPulseDecoder {
+ public:
+  // Frames processed at a time; decode() takes any number.
+  static constexpr uint32_t kBlockFrames = 512;
+
+  WavPulseDecoder();
+
+  // Starts decoding a new stream. `cpu_hz` is the clock of the target
+  // machine; TAP values are in units of 8 of its cycles.
+  void begin(const WavFormat& format, uint32_t cpu_hz);
+
+  // The maximum number of bytes that decode() outputs for the specified
+  // number of input bytes.
+  size_t maxOutput(size_t pcm_bytes) const {
+    return 2 * (pcm_bytes / format_.frameSize()) + 16;
+  }
+
+  // Consumes PCM data, which must consist of whole frames, and writes the
+  // resulting TAP data to `out`. Returns the number of bytes written.
+  size_t decode(const uint8_t* pcm, size_t bytes, uint8_t* out);
+
+  // Outputs the time since the last edge as a final pause. Writes at most
+  // 8 bytes.
+  size_t finish(uint8_t* out);
+
+ private:
+  void convert(const uint8_t* pcm, uint32_t frames);
+  void adaptThresholds(uint32_t frames);
+  size_t scan(uint32_t frames, uint8_t* out);
+  size_t emitEdge(uint64_t edge, uint8_t* out);
+  size_t emitPause(uint32_t cycles, uint8_t* out);
+
+  WavFormat format_;
+  uint32_t cpu_hz_;
+
+  // Samples (in 1/256ths) that make 0xFFFFFF cycles: the longest pause that a
+  // single TAP value can hold.
+  uint64_t overflow_span_;
+
+  // Absolute index of the first frame of the current block.
+  uint64_t block_start_;
+  // Time of the last rising edge, in 1/256ths of a sample.
+  uint64_t last_edge_;
+
+  bool high_;
+  int16_t prev_sample_;
+  int32_t peak_;
+  int16_t hi_threshold_;
+  int16_t lo_threshold_;
+
+  int16_t samples_[kBlockFrames];
+};
+
+}  // namespace tapuino
@@ -0,0 +1,256 @@
+#include "io/wav_input_stream.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "io/buffered_writer.h"
+#include "roo_logging.h"
+
+namespace tapuino {
+
+namespace {
+
+// WAV dumps carry no information about the machine; PAL C64 is by far the
+// most common case.
+constexpr uint32_t kC64PalHz = 985248;
+
+// Sidecar layout: magic, WAV file size, PCM data size, TAP data size.
+constexpr uint32_t kLengthMagic = 0x574C4E31;  // "WLN1"
+constexpr uint32_t kLengthFileSize = 16;
+
+void putU32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+uint32_t getU32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+}  // namespace
+
+bool isWavName(const char* name) {
+  size_t len = strlen(name);
+  return len >= 4 && strcasecmp(name + len - 4, ".wav") == 0;
+}
+
+WavInputStreamImpl::WavInputStreamImpl(InputStream source, FS& fs,
+                                       std::string length_path)
+    : WavInputStreamImpl(std::move(source)) {
+  ok_ = init(fs, length_path);
+}
+
+WavInputStreamImpl::WavInputStreamImpl(InputStream source)
+    : source_(std::move(source)),
+      format_(),
+      ok_(false),
+      file_size_(0),
+      tap_size_(0),
+      pos_(0),
+      pcm_pos_(0),
+      finished_(false),
+      out_begin_(0),
+      out_end_(0) {}
+
+bool WavInputStreamImpl::init(FS& fs, const std::string& length_path) {
+  if (!readHeader()) return false;
+  if (!loadLength(fs, length_path)) {
+    if (!scanLength()) return false;
+    storeLength(fs, length_path);
+  }
+  return rewind();
+}
+
+bool WavInputStreamImpl::readHeader() {
+  if (!source_ || !source_.isOpen()) return false;
+  int32_t n = source_.readFully(pcm_, kWavHeaderMaxSize);
+  if (n <= 0 || !parseWavHeader(pcm_, n, format_)) {
+    LOG(WARNING) << "Unsupported WAV file";
+    return false;
+  }
+  file_size_ = source_.size();
+  if (format_.data_offset > file_size_) return false;
+  // Streaming recorders leave the data size unset (or wrong).
+  if (format_.data_size > file_size_ - format_.data_offset) {
+    format_.data_size = file_size_ - format_.data_offset;
+  }
+  format_.data_size -= format_.data_size % format_.frameSize();
+  return true;
+}
+
+bool WavInputStreamImpl::loadLength(FS& fs, const std::string& length_path) {
+  uint8_t entry[kLengthFileSize];
+  File f = fs.open(length_path.c_str(), "r");
+  bool cached = f && f.size() == kLengthFileSize &&
+                f.read(entry, kLengthFileSize) == kLengthFileSize &&
+                getU32(entry) == kLengthMagic &&
+                getU32(entry + 4) == file_size_ &&
+                getU32(entry + 8) == format_.data_size;
+  f.close();
+  if (cached) tap_size_ = getU32(entry + 12);
+  return cached;
+}
+
+void WavInputStreamImpl::storeLength(FS& fs, const std::string& length_path) {
+  uint8_t entry[kLengthFileSize];
+  putU32(entry, kLengthMagic);
+  putU32(entry + 4, file_size_);
+  putU32(entry + 8, format_.data_size);
+  putU32(entry + 12, tap_size_);
+  File f = fs.open(length_path.c_str(), "w");
+  if (f) {
+    writeAll(f, entry, kLengthFileSize);
+    f.close();
+  }
+}
+
+bool WavInputStreamImpl::rewind() {
+  if (!source_.seek(format_.data_offset)) return false;
+  decoder_.begin(format_, kC64PalHz);
+  pos_ = 0;
+  pcm_pos_ = 0;
+  finished_ = false;
+  out_begin_ = 0;
+  out_end_ = 0;
+  return true;
+}
+
+bool WavInputStreamImpl::fill() {
+  out_begin_ = 0;
+  out_end_ = 0;
+  if (finished_) return true;
+  uint32_t remaining = format_.data_size - pcm_pos_;
+  int32_t n = 0;
+  if (remaining > 0) {
+    n = source_.readFully(pcm_, remaining < kPcmChunk ? remaining : kPcmChunk);
+    if (n < 0) return false;
+    // Only a truncated file ends in a partial frame.
+    n -= n % format_.frameSize();
+  }
+  if (n == 0) {
+    out_end_ = decoder_.finish(out_);
+    finished_ = true;
+    return true;
+  }
+  pcm_pos_ += n;
+  out_end_ = decoder_.decode(pcm_, n, out_);
+  return true;
+}
+
+bool WavInputStreamImpl::scanChunks(uint32_t chunks) {
+  for (; chunks > 0 && !finished_; --chunks) {
+    if (!fill()) return false;
+    tap_size_ += out_end_;
+  }
+  return true;
+}
+
+bool WavInputStreamImpl::scanLength() {
+  uint32_t start = millis();
+  if (!rewind()) return false;
+  tap_size_ = 0;
+  if (!scanChunks(UINT32_MAX)) return false;
+  LOG(INFO) << "Scanned " << format_.data_size << " bytes of PCM into "
+            << tap_size_ << " bytes of TAP in " << (millis() - start) << " ms";
+  return true;
+}
+
+int32_t WavInputStreamImpl::read(uint8_t* buf, uint32_t count) {
+  if (!ok_) return -1;
+  if (count == 0) return 0;
+  if (pos_ < kTapHeaderSize) {
+    uint8_t header[kTapHeaderSize];
+    makeTapHeader(1, tap_size_, header);
+    uint32_t n = kTapHeaderSize - pos_;
+    if (n > count) n = count;
+    memcpy(buf, header + pos_, n);
+    pos_ += n;
+    return n;
+  }
+  while (out_begin_ == out_end_) {
+    if (finished_) return 0;
+    if (!fill()) return -1;
+  }
+  uint32_t n = out_end_ - out_begin_;
+  if (n > count) n = count;
+  memcpy(buf, out_ + out_begin_, n);
+  out_begin_ += n;
+  pos_ += n;
+  return n;
+}
+
+bool WavInputStreamImpl::discard(uint32_t count) {
+  while (count > 0) {
+    uint32_t n;
+    if (pos_ < kTapHeaderSize) {
+      n = kTapHeaderSize - pos_;
+    } else {
+      if (out_begin_ == out_end_) {
+        if (finished_ || !fill()) return false;
+        continue;
+      }
+      n = out_end_ - out_begin_;
+      if (n > count) n = count;
+      out_begin_ += n;
+    }
+    if (n > count) n = count;
+    pos_ += n;
+    count -= n;
+  }
+  return true;
+}
+
+bool WavInputStreamImpl::seek(uint32_t pos) {
+  if (!ok_ || pos > size()) return false;
+  // The decoder state depends on all the preceding signal, so going back means
+  // decoding again from the start.
+  if (pos < pos_ && !rewind()) return false;
+  return discard(pos - pos_);
+}
+
+WavLengthScanner::WavLengthScanner() : fs_(nullptr), start_(0) {}
+
+bool WavLengthScanner::begin(InputStream source, FS& fs,
+                             std::string length_path) {
+  stream_.reset(new WavInputStreamImpl(std::move(source)));
+  if (!stream_->readHeader() || stream_->loadLength(fs, length_path) ||
+      !stream_->rewind()) {
+    stream_.reset();
+    return false;
+  }
+  stream_->tap_size_ = 0;
+  fs_ = &fs;
+  length_path_ = std::move(length_path);
+  start_ = millis();
+  return true;
+}
+
+bool WavLengthScanner::step(uint32_t chunks) {
+  if (!stream_) return false;
+  if (!stream_->scanChunks(chunks)) {
+    LOG(WARNING) << "Failed to scan the WAV file";
+    stream_.reset();
+    return false;
+  }
+  if (!stream_->finished_) return true;
+  LOG(INFO) << "Scanned " << stream_->format_.data_size
+            << " bytes of PCM into " << stream_->tap_size_
+            << " bytes of TAP in " << (millis() - start_) << " ms";
+  stream_->storeLength(*fs_, length_path_);
+  stream_.reset();
+  return false;
+}
+
+void WavLengthScanner::finish() {
+  while (step(UINT32_MAX)) {
+  }
+}
+
+int WavLengthScanner::progress() const {
+  if (!stream_ || stream_->format_.data_size == 0) return 100;
+  return (int)((uint64_t)100 * stream_->pcm_pos_ / stream_->format_.data_size);
+}
+
+}  // namespace tapuino
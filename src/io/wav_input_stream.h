@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "FS.h"
+#include "io/input_stream.h"
+#include "io/tap_header.h"
+#include "io/wav_decoder.h"
+
+namespace tapuino {
+
+// Whether the file name has a .wav extension (in any letter case).
+bool isWavName(const char* name);
+
+// Presents a WAV recording of a C64 tape as a TAP v1 file, converted on the
+// fly as it is read. The TAP header is synthesized (C64, PAL).
+//
+// The length of the TAP data is only known after the whole recording has been
+// decoded. It is recorded in the sidecar at `length_path`, normally by a
+// WavLengthScanner run in the background beforehand; without it, opening
+// scans the file first. Seeking decodes forward from the start of the PCM
+// data, or from the current position.
+class WavInputStreamImpl : public InputStreamImpl {
+ public:
+  // Takes over `source`, which reads the WAV file (or a ZIP entry).
+  WavInputStreamImpl(InputStream source, FS& fs, std::string length_path);
+
+  int32_t read(uint8_t* buf, uint32_t count) override;
+
+  bool seek(uint32_t pos) override;
+
+  uint32_t size() const override { return kTapHeaderSize + tap_size_; }
+
+  bool ok() const override { return ok_; }
+
+  void close() override { source_.close(); }
+
+ private:
+  // PCM bytes decoded at a time.
+  static constexpr uint32_t kPcmChunk = 2048;
+
+  friend class WavLengthScanner;
+
+  // Leaves the stream uninitialized, for WavLengthScanner.
+  explicit WavInputStreamImpl(InputStream source);
+
+  bool init(FS& fs, const std::string& length_path);
+  bool readHeader();
+  // Reads the length from the sidecar, if recorded there for this file.
+  bool loadLength(FS& fs, const std::string& length_path);
+  void storeLength(FS& fs, const std::string& length_path);
+  bool rewind();
+  // Decodes the next chunk into out_. Returns false on error; at the end of
+  // the data, leaves out_ empty.
+  bool fill();
+  bool discard(uint32_t count);
+  // Decodes up to `chunks` chunks, adding their output to tap_size_.
+  bool scanChunks(uint32_t chunks);
+  bool scanLength();
+
+  InputStream source_;
+  WavFormat format_;
+  WavPulseDecoder decoder_;
+  bool ok_;
+  uint32_t file_size_;
+  uint32_t tap_size_;
+
+  // Position in the TAP stream, and in the PCM data.
+  uint32_t pos_;
+  uint32_t pcm_pos_;
+  bool finished_;
+
+  uint8_t pcm_[kPcmChunk];
+  uint8_t out_[2 * kPcmChunk + 16];
+  uint32_t out_begin_;
+  uint32_t out_end_;
+};
+
+// Finds the length of the TAP data of a WAV recording, a few chunks at a
+// time, so that it can run in the background (see TapLoader::AnalyzeBlocks).
+// Records it in the sidecar, where WavInputStreamImpl picks it up.
+class WavLengthScanner {
+ public:
+  WavLengthScanner();
+
+  // Starts scanning the WAV read by `source`, unless its length is already
+  // recorded in the sidecar at `length_path`, or the file is not a supported
+  // WAV (which opening it then reports). Returns whether the scan started.
+  bool begin(InputStream source, FS& fs, std::string length_path);
+
+  // Decodes up to `chunks` chunks of the recording, and records the length
+  // once at the end. Returns false when done, or on error.
+  bool step(uint32_t chunks);
+
+  // Scans the rest of the recording.
+  void finish();
+
+  // Drops the scan, closing the file.
+  void cancel() { stream_.reset(); }
+
+  bool active() const { return stream_ != nullptr; }
+  const std::string& lengthPath() const { return length_path_; }
+
+  // How much of the recording has been scanned, in percent.
+  int progress() const;
+
+ private:
+  std::unique_ptr<WavInputStreamImpl> stream_;
+  FS* fs_;
+  std::string length_path_;
+  uint32_t start_;
+};
+
+}  // namespace tapuino
@@ -88,6 +88,7 @@ using std::min;
 #include "core/include/config.h"
 #include "index/mem_index.h"
 #include "io/sd.h"
+#include "io/spi_bus.h"
 #include "memory/mem_buffer.h"
 #include "roo_display.h"
 #include "roo_display/core/orientation.h"
@@ -131,6 +132,7 @@ roo_display::TouchXpt2046<pinTouchCs> touch_device;
 
 tapuino::Sd sd(pinSdCs, SPI);
 roo_scheduler::Scheduler scheduler;
+tapuino::SpiBus spi_bus;
 
 using namespace roo_windows;
 
@@ -151,7 +153,7 @@ roo_windows::Application app(&env, display);
 Keyboard kb(env, kbEngUS());
 TextFieldEditor editor(scheduler, kb);
 
-tapuino::Tapuino tp(env, scheduler, sd, mem_index);
+tapuino::Tapuino tp(env, scheduler, sd, mem_index, spi_bus);
 
 char* __stack_start;
 
@@ -192,6 +194,8 @@ void loop() {
     // heap_caps_print_heap_info(0);
     m = millis() + 1000;
   }
-  app.tick();
+  // The display and the touch share the bus with the card; the playback
+  // refills go first.
+  spi_bus.runDisplay([]() { app.tick(); });
   scheduler.executeEligibleTasks(1);
 }
@@ -9,12 +9,8 @@ namespace membuf {
 // tight on RAM when we do so. Therefore, we allow the index to overlap with the
 // zip memory buffer, since only one of them is used at the time. It means that
 // we need to reload the index from disk every time we used the unzipper
-// library.
-
-// The maximum index size at which it does not overlap with the zip buffer, and
-// does not need to be reloaded after a zip operation.
-static constexpr int kMaxNonSharedIndexSize =
-    (kIndexBufferSize - sizeof(ZIPFILE)) & 0xFFFFFFFC;
+// library. Only scanning the ZIP files does; playback inflates the entries
+// in the separate inflate buffer.
 
 namespace {
 
@@ -33,6 +29,17 @@ membuf_t& AllocateInternal() {
   return *membuf;
 }
 
+uint8_t* InflateBuffer() {
+  static uint8_t* buf =
+      (uint8_t*)heap_caps_malloc(kInflateBufferSize, MALLOC_CAP_DEFAULT);
+  return buf;
+}
+
+bool inflate_buffer_in_use = false;
+
+// Whether the unzip buffer has been handed out since the index was loaded.
+bool unzip_buffer_dirty = false;
+
 }  // namespace
 
 void Allocate() {
@@ -41,6 +48,7 @@ void Allocate() {
   GetMemIndexSortedByPathBuffer();
   GetMemIndexSortedByNameBuffer();
   GetWorkBuffer();
+  InflateBuffer();
   //   heap_caps_print_heap_info(0);
 }
 
@@ -66,7 +74,28 @@ uint16_t* GetWorkBuffer() {
   return buf;
 }
 
-ZIPFILE& GetUnzipBuffer() { return AllocateInternal().zip; }
+ZIPFILE& GetUnzipBuffer() {
+  unzip_buffer_dirty = true;
+  return AllocateInternal().zip;
+}
+
+bool GetDirtyIndexRange(uint32_t& begin, uint32_t& end) {
+  if (!unzip_buffer_dirty) return false;
+  begin = kMaxNonSharedIndexSize;
+  end = kMaxNonSharedIndexSize + sizeof(ZIPFILE);
+  return true;
+}
+
+void ClearDirtyIndexRange() { unzip_buffer_dirty = false; }
+
+uint8_t* AcquireInflateBuffer() {
+  if (inflate_buffer_in_use) return nullptr;
+  uint8_t* buf = InflateBuffer();
+  inflate_buffer_in_use = (buf != nullptr);
+  return buf;
+}
+
+void ReleaseInflateBuffer() { inflate_buffer_in_use = false; }
 
 }  // namespace membuf
 }  // namespace tapuino
@@ -16,6 +16,17 @@ void Allocate();
 // same underlying buffer of kIndexBufferSize bytes). They cannot be used at the
 // same time.
 
+// The unzip buffer takes the top of the index buffer; the index data below
+// this size never overlaps it.
+constexpr uint32_t kMaxNonSharedIndexSize =
+    (kIndexBufferSize - sizeof(ZIPFILE)) & 0xFFFFFFFC;
+
+// The range of the index buffer that the unzipper may have overwritten since
+// the last ClearDirtyIndexRange(), i.e. the unzip buffer, if it has been used.
+// Returns false if nothing has been.
+bool GetDirtyIndexRange(uint32_t& begin, uint32_t& end);
+void ClearDirtyIndexRange();
+
 uint8_t* GetMemIndexBuffer();
 uint32_t* GetMemIndexEntriesBuffer();
 
@@ -26,5 +37,14 @@ uint16_t* GetWorkBuffer();
 
 ZIPFILE& GetUnzipBuffer();
 
+// Holds the state of the inflater that ZIP entries are played with: the
+// 32 KiB window, and the decoding tables. Separate from the index buffer, so
+// that playing from a ZIP leaves the memory index intact.
+constexpr uint32_t kInflateBufferSize = 40 * 1024;
+
+// Returns the inflate buffer, or nullptr if it is already in use.
+uint8_t* AcquireInflateBuffer();
+void ReleaseInflateBuffer();
+
 }  // namespace membuf
 }  // namespace tapuino
\ No newline at end of file
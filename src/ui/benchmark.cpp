@@ -0,0 +1,154 @@
+#include "benchmark.h"
+
+#include "roo_display/ui/string_printer.h"
+#include "roo_smooth_fonts/NotoSans_Condensed/15.h"
+#include "roo_smooth_fonts/NotoSans_Condensed/18.h"
+#include "roo_windows/containers/horizontal_layout.h"
+#include "roo_windows/containers/vertical_layout.h"
+#include "roo_windows/core/application.h"
+#include "roo_windows/widgets/button.h"
+#include "roo_windows/widgets/text_label.h"
+
+using namespace roo_windows;
+
+namespace tapuino {
+
+namespace {
+
+// Turbo TAPs stream at up to ~4 kB/s, from a 4 kB flip buffer that is
+// refilled a half (4 sectors) at a time: it runs dry after ~500 ms. Cards
+// that occasionally stall for longer than a fraction of that are unfit.
+constexpr uint32_t kTurboMaxP99Us = 25000;
+constexpr uint32_t kTurboMaxUs = 100000;
+
+class BenchmarkPanel : public VerticalLayout {
+ public:
+  BenchmarkPanel(const Environment &env, std::function<void()> run_fn,
+                 std::function<void()> close_fn)
+      : VerticalLayout(env),
+        title_(env, "SD card benchmark",
+               roo_display::font_NotoSans_Condensed_18(),
+               roo_display::kLeft | roo_display::kMiddle),
+        clock_(env, "", roo_display::font_NotoSans_Condensed_15(),
+               roo_display::kLeft | roo_display::kMiddle),
+        status_(env, "", roo_display::font_NotoSans_Condensed_15(),
+                roo_display::kLeft | roo_display::kMiddle),
+        sequential_(env, "", roo_display::font_NotoSans_Condensed_15(),
+                    roo_display::kLeft | roo_display::kMiddle),
+        random_(env, "", roo_display::font_NotoSans_Condensed_15(),
+                roo_display::kLeft | roo_display::kMiddle),
+        latency_(env, "", roo_display::font_NotoSans_Condensed_15(),
+                 roo_display::kLeft | roo_display::kMiddle),
+        verdict_(env, "", roo_display::font_NotoSans_Condensed_18(),
+                 roo_display::kLeft | roo_display::kMiddle),
+        buttons_(env),
+        run_(env, "RUN"),
+        close_(env, "CLOSE") {
+    for (TextLabel *label : {&title_, &clock_, &status_, &sequential_,
+                             &random_, &latency_, &verdict_}) {
+      label->setPadding(PaddingSize::PADDING_SMALL);
+      label->setMargins(MarginSize::MARGIN_NONE);
+      add(*label);
+    }
+    run_.setPadding(PADDING_HUGE, PADDING_REGULAR);
+    run_.setMargins(MARGIN_HUGE);
+    close_.setPadding(PADDING_HUGE, PADDING_REGULAR);
+    close_.setMargins(MARGIN_HUGE);
+    buttons_.add(run_);
+    buttons_.add(close_);
+    add(buttons_, VerticalLayout::Params().setGravity(kHorizontalGravityCenter));
+    run_.setOnInteractiveChange(std::move(run_fn));
+    close_.setOnInteractiveChange(std::move(close_fn));
+  }
+
+  void setRunning(uint32_t clock, int progress) {
+    run_.setEnabled(false);
+    clock_.setTextf("SPI clock: %d kHz", clock / 1000);
+    status_.setTextf("Reading... %d%%", progress);
+  }
+
+  void setResult(const SdBenchmark::Result &result) {
+    run_.setEnabled(true);
+    status_.setTextf("Done; %d read errors.", result.errors);
+    sequential_.setTextf("Sequential: %d kB/s", result.sequential_kbps);
+    random_.setTextf("Random: %d kB/s", result.random_kbps);
+    latency_.setTextf("Latency: p50 %d, p90 %d, p99 %d, max %d us",
+                      result.p50_us, result.p90_us, result.p99_us,
+                      result.max_us);
+    bool fit = result.errors == 0 && result.p99_us <= kTurboMaxP99Us &&
+               result.max_us <= kTurboMaxUs;
+    verdict_.setText(fit ? "Fit for turbo TAPs."
+                         : "Turbo TAPs may stutter with this card.");
+  }
+
+  void clearResult() {
+    sequential_.setText("");
+    random_.setText("");
+    latency_.setText("");
+    verdict_.setText("");
+  }
+
+ private:
+  TextLabel title_;
+  TextLabel clock_;
+  TextLabel status_;
+  TextLabel sequential_;
+  TextLabel random_;
+  TextLabel latency_;
+  TextLabel verdict_;
+  HorizontalLayout buttons_;
+  SimpleButton run_;
+  SimpleButton close_;
+};
+
+}  // namespace
+
+SdBenchmarkActivity::SdBenchmarkActivity(const Environment &env,
+                                         roo_scheduler::Scheduler &scheduler,
+                                         Sd &sd)
+    : sd_(sd),
+      benchmark_(sd),
+      step_task_(
+          scheduler, [this]() { step(); }, roo_time::Millis(1)),
+      contents_(nullptr) {}
+
+void SdBenchmarkActivity::onStart() {
+  contents_.reset(new BenchmarkPanel(
+      getApplication()->env(), [this]() { run(); }, [this]() { exit(); }));
+  run();
+}
+
+void SdBenchmarkActivity::onResume() {
+  if (!benchmark_.done()) step_task_.start();
+}
+
+void SdBenchmarkActivity::onPause() { step_task_.stop(); }
+
+void SdBenchmarkActivity::onStop() { contents_.reset(nullptr); }
+
+void SdBenchmarkActivity::run() {
+  BenchmarkPanel *panel = (BenchmarkPanel *)contents_.get();
+  panel->clearResult();
+  benchmark_.start();
+  panel->setRunning(sd_.clock(), 0);
+  step_task_.start();
+}
+
+void SdBenchmarkActivity::step() {
+  BenchmarkPanel *panel = (BenchmarkPanel *)contents_.get();
+  if (benchmark_.step()) {
+    panel->setRunning(sd_.clock(), benchmark_.progress());
+    return;
+  }
+  step_task_.stop();
+  const SdBenchmark::Result &result = benchmark_.result();
+  LOG(INFO) << "SD benchmark at " << sd_.clock() << " Hz: sequential "
+            << result.sequential_kbps << " kB/s, random "
+            << result.random_kbps << " kB/s, latency p50 " << result.p50_us
+            << " p90 " << result.p90_us << " p99 " << result.p99_us
+            << " max " << result.max_us << " us, " << result.errors
+            << " errors";
+  panel->setResult(result);
+}
+
+}  // namespace tapuino
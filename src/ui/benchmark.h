@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+
+#include "io/sd.h"
+#include "io/sd_benchmark.h"
+#include "roo_logging.h"
+#include "roo_scheduler.h"
+#include "roo_windows/core/activity.h"
+#include "roo_windows/core/environment.h"
+
+namespace tapuino {
+
+// Benchmarks the SD card, showing the read throughput and latencies, and
+// whether the card keeps up with turbo TAPs.
+class SdBenchmarkActivity : public roo_windows::Activity {
+ public:
+  SdBenchmarkActivity(const roo_windows::Environment& env,
+                      roo_scheduler::Scheduler& scheduler, Sd& sd);
+
+  void onStart() override;
+  void onResume() override;
+  void onPause() override;
+  void onStop() override;
+
+  roo_windows::Widget& getContents() override {
+    return *CHECK_NOTNULL(contents_);
+  }
+
+ private:
+  void run();
+  void step();
+
+  Sd& sd_;
+  SdBenchmark benchmark_;
+  roo_scheduler::RepetitiveTask step_task_;
+  std::unique_ptr<roo_windows::Widget> contents_;
+};
+
+}  // namespace tapuino
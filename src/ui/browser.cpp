@@ -11,10 +11,12 @@
 #include "roo_icons/outlined/24/content.h"
 #include "roo_icons/outlined/24/file.h"
 #include "roo_icons/outlined/24/navigation.h"
+#include "roo_icons/outlined/24/notification.h"
 #include "roo_icons/outlined/36/action.h"
 #include "roo_icons/outlined/36/content.h"
 #include "roo_icons/outlined/36/file.h"
 #include "roo_icons/outlined/36/navigation.h"
+#include "roo_icons/outlined/36/notification.h"
 #include "roo_smooth_fonts/NotoSans_Bold/15.h"
 #include "roo_smooth_fonts/NotoSans_Condensed/15.h"
 #include "roo_smooth_fonts/NotoSans_Regular/15.h"
@@ -64,6 +66,32 @@ inline const roo_display::Font& base_font() {
   //            : roo_display::font_RobotoCondensed_Regular_11();
 }
 
+// Short description of a TAP that is not a plain C64 PAL one; empty otherwise.
+std::string metaBadge(TapMeta meta) {
+  if (!meta.known()) return "";
+  if (!meta.playable()) return "INVALID";
+  std::string badge;
+  switch (meta.platform()) {
+    case TapMeta::VIC20:
+      badge = "VIC-20";
+      break;
+    case TapMeta::C16:
+      badge = "C16";
+      break;
+    default:
+      break;
+  }
+  if (meta.ntsc()) {
+    if (!badge.empty()) badge += " ";
+    badge += "NTSC";
+  }
+  if (meta.version() == 2) {
+    if (!badge.empty()) badge += " ";
+    badge += "v2";
+  }
+  return badge;
+}
+
 }  // namespace
 
 typedef std::function<void(int)> EntrySelectedFn;
@@ -77,6 +105,8 @@ class ListEntry : public HorizontalLayout {
         icon_(env, SCALED_ROO_ICON(outlined, file_folder)),
         title_(env, "Foo", base_font(),
                roo_display::kLeft | roo_display::kMiddle),
+        badge_(env, "", roo_display::font_NotoSans_Condensed_11(),
+               roo_display::kRight | roo_display::kMiddle),
         select_fn_(select_fn),
         mark_fn_(mark_fn),
         is_readonly_(true) {
@@ -84,19 +114,20 @@ class ListEntry : public HorizontalLayout {
     icon_.setPadding(PADDING_TINY, PADDING_NONE);
     title_.setMargins(MARGIN_NONE);
     title_.setPadding(PADDING_TINY, PADDING_SMALL);
-    add(icon_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
-    add(title_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+    badge_.setMargins(MARGIN_NONE);
+    badge_.setPadding(PADDING_SMALL, PADDING_SMALL);
+    addChildren();
   }
 
   ListEntry(const ListEntry& other)
       : HorizontalLayout(other),
         icon_(other.icon_),
         title_(other.title_),
+        badge_(other.badge_),
         select_fn_(other.select_fn_),
         mark_fn_(other.mark_fn_),
         is_readonly_(other.is_readonly_) {
-    add(icon_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
-    add(title_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+    addChildren();
     setSelected(false);
   }
 
@@ -118,9 +149,10 @@ class ListEntry : public HorizontalLayout {
   }
 
   void setFile(int16_t idx, roo_display::StringView name, bool selected,
-               bool is_readonly) {
+               bool is_readonly, TapMeta meta) {
     set(idx, name, selected, is_readonly);
     icon_.setIcon(SCALED_ROO_ICON(outlined, file_text_snippet));
+    badge_.setText(metaBadge(meta));
   }
 
   bool isClickable() const override { return true; }
@@ -132,16 +164,26 @@ class ListEntry : public HorizontalLayout {
   void onLongPress(XDim x, YDim y) override { mark_fn_(idx_); }
 
  private:
+  void addChildren() {
+    add(icon_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+    add(title_, HorizontalLayout::Params()
+                    .setGravity(kVerticalGravityMiddle)
+                    .setWeight(1));
+    add(badge_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+  }
+
   void set(int16_t idx, roo_display::StringView name, bool selected,
            bool is_readonly) {
     idx_ = idx;
     title_.setText(name);
+    badge_.setText("");
     setSelected(selected);
     is_readonly_ = is_readonly;
   }
 
   Icon icon_;
   TextLabel title_;
+  TextLabel badge_;
   int16_t idx_;
   EntrySelectedFn select_fn_;
   EntrySelectedFn mark_fn_;
@@ -181,9 +223,9 @@ class BrowserListModel : public ListModel<ListEntry> {
     } else if (e.isZip()) {
       dest.setZip(idx, e.getName(), idx == selected_, is_readonly_);
     } else if (e.isTapFile()) {
-      dest.setFile(idx, e.getName(), idx == selected_, is_readonly_);
+      dest.setFile(idx, e.getName(), idx == selected_, is_readonly_, e.meta());
     } else {
-      dest.setFile(idx, e.getName(), idx == selected_, is_readonly_);
+      dest.setFile(idx, e.getName(), idx == selected_, is_readonly_, TapMeta());
     }
   }
 
@@ -336,6 +378,7 @@ class FloatingButtons : public VerticalLayout {
     std::function<void()> home;
     std::function<void()> clear;
     std::function<void()> del;
+    std::function<void()> benchmark;
   };
 
   FloatingButtons(const Environment& env, Callbacks callbacks)
@@ -352,7 +395,9 @@ class FloatingButtons : public VerticalLayout {
                     SCALED_ROO_ICON(outlined, file_drive_file_rename_outline),
                     Button::TEXT),
         clear_btn_(env, SCALED_ROO_ICON(outlined, content_clear),
-                   Button::TEXT) {
+                   Button::TEXT),
+        benchmark_btn_(env, SCALED_ROO_ICON(outlined, notification_sd_card),
+                       Button::TEXT) {
     add(unfold_btn_);
     add(home_btn_);
     add(search_btn_);
@@ -360,11 +405,13 @@ class FloatingButtons : public VerticalLayout {
     add(delete_btn_);
     add(rename_btn_);
     add(clear_btn_);
+    add(benchmark_btn_);
 
     unfold_btn_.setOnInteractiveChange(std::move(callbacks.unfold));
     home_btn_.setOnInteractiveChange(std::move(callbacks.home));
     clear_btn_.setOnInteractiveChange(std::move(callbacks.clear));
     delete_btn_.setOnInteractiveChange(std::move(callbacks.del));
+    benchmark_btn_.setOnInteractiveChange(std::move(callbacks.benchmark));
 
     add_btn_.setEnabled(false);
     search_btn_.setEnabled(false);
@@ -387,6 +434,7 @@ class FloatingButtons : public VerticalLayout {
     delete_btn_.setVisibility(GONE);
     rename_btn_.setVisibility(GONE);
     clear_btn_.setVisibility(GONE);
+    benchmark_btn_.setVisibility(is_root ? VISIBLE : GONE);
   }
 
   void fold() {
@@ -397,6 +445,7 @@ class FloatingButtons : public VerticalLayout {
     delete_btn_.setVisibility(GONE);
     rename_btn_.setVisibility(GONE);
     clear_btn_.setVisibility(GONE);
+    benchmark_btn_.setVisibility(GONE);
   }
 
   void setEdit() {
@@ -407,6 +456,7 @@ class FloatingButtons : public VerticalLayout {
     delete_btn_.setVisibility(VISIBLE);
     rename_btn_.setVisibility(VISIBLE);
     clear_btn_.setVisibility(VISIBLE);
+    benchmark_btn_.setVisibility(GONE);
   }
 
  private:
@@ -417,13 +467,15 @@ class FloatingButtons : public VerticalLayout {
   SimpleButton delete_btn_;
   SimpleButton rename_btn_;
   SimpleButton clear_btn_;
+  SimpleButton benchmark_btn_;
 };
 
 class BrowserPanel : public AlignedLayout {
  public:
   BrowserPanel(const Environment& env, MemIndex& index,
                EntrySelectedFn select_fn, std::function<void()> back_fn,
-               std::function<void()> home_fn, EntrySelectedFn del_fn)
+               std::function<void()> home_fn, EntrySelectedFn del_fn,
+               std::function<void()> benchmark_fn)
       : AlignedLayout(env),
         content_(
             env, index, select_fn, back_fn, [this]() { notifyScrolled(); },
@@ -433,7 +485,8 @@ class BrowserPanel : public AlignedLayout {
                      .unfold = [&]() { unfoldMenuClicked(); },
                      .home = std::move(home_fn),
                      .clear = [&]() { clearClicked(); },
-                     .del = [this, del_fn]() { del_fn(content_.selected()); }}),
+                     .del = [this, del_fn]() { del_fn(content_.selected()); },
+                     .benchmark = std::move(benchmark_fn)}),
         is_root_(false) {
     // floating_buttons_.add(home_btn_);
     // floating_buttons_.add(add_btn_);
@@ -500,18 +553,23 @@ class BrowserPanel : public AlignedLayout {
 
 BrowsingActivity::BrowsingActivity(const Environment& env,
                                    roo_scheduler::Scheduler& scheduler, Sd& sd,
-                                   Catalog& catalog, TapFileSelectFn select_fn)
+                                   Catalog& catalog,
+                                   TapuinoNext::Options& options,
+                                   TapFileSelectFn select_fn,
+                                   std::function<void()> benchmark_fn)
     : scheduler_(scheduler),
       card_checker_(
           scheduler, [this]() { checkCardPresent(); }, roo_time::Millis(1000)),
       contents_(nullptr),
       sd_(sd),
       catalog_(catalog),
-      select_fn_(select_fn) {
+      options_(options),
+      select_fn_(select_fn),
+      benchmark_fn_(benchmark_fn) {
   auto* panel = new BrowserPanel(
       env, catalog_.mem_index(), [&](int idx) { onEntryClicked(idx); },
       [&]() { onParentDir(); }, [&]() { onHomeClicked(); },
-      [&](int idx) { onFileDeleted(idx); });
+      [&](int idx) { onFileDeleted(idx); }, [&]() { benchmark_fn_(); });
   contents_.reset(panel);
 }
 
@@ -553,9 +611,11 @@ void BrowsingActivity::setCwd(MemIndex::PathEntryId cd) {
   // Populate the cd_list_ and element_count_ by iterating over the directory
   // contents.
   element_count_ = 0;
+  bool hide_unplayable = options_.hideUnplayable.GetValue();
   MemIndexElementIterator itr(catalog_.mem_index(), cd);
   MemIndex::PathEntryId i;
   while (itr.next(i)) {
+    if (hide_unplayable && !catalog_.resolve(i).meta().playable()) continue;
     cd_list_[element_count_++] = i;
   }
   BrowserPanel& p = (BrowserPanel&)getContents();
@@ -579,6 +639,12 @@ void BrowsingActivity::onEntryClicked(int idx) {
   if (entry.isContainer()) {
     setCwd(cd_list_[idx]);
     scrollToDim(0);
+  } else if (!entry.meta().playable()) {
+    // Known from the index; no need to open the file to find out.
+    getTask()->showAlertDialog(
+        "Cannot play",
+        "Not a valid TAP file, or of an\nunsupported version or platform.",
+        {"OK"}, nullptr);
   } else {
     select_fn_(entry);
   }
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "catalog/catalog.h"
+#include "core/include/Options.h"
 #include "io/sd.h"
 #include "roo_logging.h"
 #include "roo_scheduler.h"
@@ -22,7 +23,9 @@ class BrowsingActivity : public roo_windows::Activity {
  public:
   BrowsingActivity(const roo_windows::Environment& env,
                    roo_scheduler::Scheduler& scheduler, Sd& sd,
-                   Catalog& catalog, TapFileSelectFn select_fn);
+                   Catalog& catalog, TapuinoNext::Options& options,
+                   TapFileSelectFn select_fn,
+                   std::function<void()> benchmark_fn);
 
   void onStart() override;
   void onResume() override;
@@ -54,10 +57,12 @@ class BrowsingActivity : public roo_windows::Activity {
   std::unique_ptr<roo_windows::Widget> contents_;
   Sd& sd_;
   Catalog& catalog_;
+  TapuinoNext::Options& options_;
   MemIndex::PathEntryId cd_;
   MemIndex::PathEntryId* cd_list_;
   int element_count_;  // Not including '..'
   TapFileSelectFn select_fn_;
+  std::function<void()> benchmark_fn_;
 };
 
 }  // namespace tapuino
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "index/mem_index_builder.h"
 #include "io/unzipper.h"
+#include "io/prg_pulse_source.h"
+#include "io/wav_input_stream.h"
 #include "memory/mem_buffer.h"
 #include "roo_display/core/utf8.h"
 #include "roo_display/ui/string_printer.h"
@@ -247,13 +249,13 @@ void IndexBuilder::stageTryMasterIndex() {
 }
 
 void IndexBuilder::stageInitMasterIndexBuild() {
-  File root = sd_.fs().open("/");
-  if (!root) {
+  DirReader root;
+  if (!root.open(sd_.mountpoint(), "/")) {
     status_ = IO_ERROR;
     error_details_ = strerror(errno);
     return;
   }
-  scan_dir_path_.push_back(root);
+  scan_dir_path_.push_back(std::move(root));
   index_writer_path_.push_back(IndexWriterPathElem(""));
   index_writer_.open(kMasterIndex);
   if (!index_writer_) {
@@ -269,15 +271,16 @@ void IndexBuilder::stageInitMasterIndexBuild() {
 }
 
 void IndexBuilder::stageContinueMasterIndexBuild() {
-  File dir = scan_dir_path_.back();
+  // Only the TAP files get opened, to read their headers. The rest is listed
+  // by name.
+  DirReader &dir = scan_dir_path_.back();
   do {
-    File f = dir.openNextFile();
-    if (f.getWriteError()) {
-      status_ = IO_ERROR;
-      error_details_ = strerror(errno);
-      return;
-    }
-    if (!f) {
+    if (!dir.next()) {
+      if (dir.failed()) {
+        status_ = IO_ERROR;
+        error_details_ = strerror(errno);
+        return;
+      }
       // End of the directory.
       scan_dir_path_.pop_back();
       if (index_writer_path_.back().is_committed()) {
@@ -292,24 +295,45 @@ void IndexBuilder::stageContinueMasterIndexBuild() {
       }
       return;
     }
-    if (strcmp(f.name(), ".") == 0) continue;
-    if (strcmp(f.name(), "..") == 0) continue;
-    activity_.setScannedDir(f.path());
-    if (f.isDirectory()) {
-      index_writer_path_.push_back(IndexWriterPathElem(f.name()));
-      scan_dir_path_.push_back(f);
-      // Keep the file open so that it can be recursively listed.
-    } else if (ends_with(f.name(), ".tap") || ends_with(f.name(), ".TAP") ||
-               ends_with(f.name(), ".Tap")) {
+    const char *name = dir.name();
+    std::string path = dir.path();
+    activity_.setScannedDir(path);
+    if (dir.isDirectory()) {
+      index_writer_path_.push_back(IndexWriterPathElem(name));
+      DirReader subdir;
+      if (!subdir.open(sd_.mountpoint(), path)) {
+        status_ = IO_ERROR;
+        error_details_ = strerror(errno);
+        return;
+      }
+      // Keeps the directory open so that it can be recursively listed.
+      // Invalidates `dir`.
+      scan_dir_path_.push_back(std::move(subdir));
+    } else if (ends_with(name, ".tap") || ends_with(name, ".TAP") ||
+               ends_with(name, ".Tap") || isWavName(name)) {
+      commitPath();
+      TapMeta meta;
+      if (!isWavName(name)) {
+        uint8_t header[kTapHeaderSize];
+        int n = 0;
+        File f = sd_.fs().open(path.c_str());
+        if (f) {
+          n = f.read(header, kTapHeaderSize);
+          f.close();
+        }
+        meta = TapMeta::FromHeader(header, n < 0 ? 0 : n, dir.size());
+      }
+      index_writer_.addFile(TAP_FILE, name, dir.size(), meta);
+      activity_.addTapFile(path, ++tap_files_found_);
+      activity_.getContents().getApplication()->refresh();
+    } else if (isPrgName(name)) {
       commitPath();
-      index_writer_.addFile(TAP_FILE, f.name(), f.size());
-      activity_.addTapFile(f.path(), ++tap_files_found_);
+      index_writer_.addFile(PRG_FILE, name, dir.size());
+      activity_.addTapFile(path, ++tap_files_found_);
       activity_.getContents().getApplication()->refresh();
-      f.close();
-    } else if (ends_with(f.name(), ".zip") || ends_with(f.name(), ".ZIP") ||
-               ends_with(f.name(), ".Zip")) {
-      scanZipFile(f);
-      f.close();
+    } else if (ends_with(name, ".zip") || ends_with(name, ".ZIP") ||
+               ends_with(name, ".Zip")) {
+      scanZipFile(dir);
     }
   } while (false);
 }
@@ -335,12 +359,20 @@ void IndexBuilder::stageBuildMemoryIndex() {
 bool IndexBuilder::buildMemIndex(FileIndexReader &reader) {
   reader.open(kMasterIndex);
   if (!reader) return false;
+  uint32_t start = millis();
+  uint32_t records = 0;
   while (true) {
     const FileIndexReader::Entry *entry = reader.next();
     if (!reader) return false;
-    if (entry == nullptr) return true;
+    if (entry == nullptr) break;
     mem_index_builder_.addEntry(entry);
+    ++records;
   }
+  uint32_t elapsed = millis() - start;
+  LOG(INFO) << "Read " << records << " master index records in " << elapsed
+            << " ms (" << (elapsed == 0 ? 0 : records * 1000 / elapsed)
+            << " records/s)";
+  return true;
 }
 
 void IndexBuilder::stageAddSortIndexes() {
@@ -367,8 +399,9 @@ void IndexBuilder::commitPath() {
   }
 }
 
-void IndexBuilder::scanZipFile(File file) {
-  int rc = unzipper::OpenZip(sd_.fs(), file.path());
+void IndexBuilder::scanZipFile(DirReader &dir) {
+  std::string path = dir.path();
+  int rc = unzipper::OpenZip(sd_.fs(), path.c_str());
   bool committed = false;
   if (rc == UNZ_OK) {
     unzipper::GotoFirstFile();
@@ -383,16 +416,30 @@ void IndexBuilder::scanZipFile(File file) {
         Serial.print("/");
         Serial.println(fi.info.uncompressed_size, DEC);
       }
+      bool is_prg = isPrgName(fi.filename);
       if (ends_with(fi.filename, ".tap") || ends_with(fi.filename, ".TAP") ||
-          ends_with(fi.filename, ".Tap")) {
+          ends_with(fi.filename, ".Tap") || isWavName(fi.filename) || is_prg) {
         if (!committed) {
           commitPath();
-          index_writer_.containerBegin(ZIP, file.name(), file.size());
+          index_writer_.containerBegin(ZIP, dir.name(), dir.size());
           committed = true;
         }
-        index_writer_.addFile(TAP_FILE, fi.filename, fi.info.uncompressed_size);
+        TapMeta meta;
+        if (!is_prg && !isWavName(fi.filename)) {
+          // Inflates just the beginning of the entry.
+          uint8_t header[kTapHeaderSize];
+          int n = 0;
+          if (unzipper::OpenCurrentFile() == UNZ_OK) {
+            n = unzipper::ReadCurrentFile(header, kTapHeaderSize);
+            unzipper::CloseCurrentFile();
+          }
+          meta = TapMeta::FromHeader(header, n < 0 ? 0 : n,
+                                     fi.info.uncompressed_size);
+        }
+        index_writer_.addFile(is_prg ? PRG_FILE : TAP_FILE, fi.filename,
+                              fi.info.uncompressed_size, meta);
         activity_.addTapFile(
-            roo_display::StringPrintf("%s/%s", file.path(), fi.filename),
+            roo_display::StringPrintf("%s/%s", path.c_str(), fi.filename),
             ++tap_files_found_);
       }
       rc = unzipper::GotoNextFile();
@@ -409,7 +456,7 @@ void appendParentPath(const FileIndexReader::Entry *entry, std::string &s) {
     appendParentPath(entry->parent(), s);
     s += "/";
   }
-  s += entry->name();
+  s.append((const char *)entry->name().data(), entry->name().size());
 }
 
 }  // namespace tapuino
\ No newline at end of file
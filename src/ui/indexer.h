@@ -7,6 +7,7 @@
 #include "index/file_index.h"
 #include "index/mem_index.h"
 #include "index/mem_index_builder.h"
+#include "io/dir_reader.h"
 #include "io/sd.h"
 #include "roo_logging.h"
 #include "roo_scheduler.h"
@@ -72,7 +73,7 @@ class IndexBuilder : public roo_scheduler::IteratingTask::Iterator {
   void stageWriteMemoryIndex();
 
   void commitPath();
-  void scanZipFile(File file);
+  void scanZipFile(DirReader& dir);
 
   bool buildMemIndex(FileIndexReader& reader);
 
@@ -85,7 +86,7 @@ class IndexBuilder : public roo_scheduler::IteratingTask::Iterator {
   int tap_files_found_;
 
   roo_scheduler::IteratingTask itr_task_;
-  std::vector<File> scan_dir_path_;
+  std::vector<DirReader> scan_dir_path_;
   std::vector<IndexWriterPathElem> index_writer_path_;
   FileIndexWriter index_writer_;
   MemIndex& mem_index_;
@@ -11,6 +11,7 @@
 
 #include "core/include/Lang.h"
 #include "core/include/TapLoader.h"
+#include "core/include/TapPrgExtractor.h"
 #include "resources/gear_24_00.h"
 #include "resources/gear_24_20.h"
 #include "resources/gear_24_40.h"
@@ -179,21 +180,59 @@ inline const roo_display::Font& base_font() {
                                    : roo_display::font_NotoSans_Condensed_11();
 }
 
+// Maximum number of TAPs that follow the entered one in the playlist.
+constexpr size_t kMaxPlaylistNext = 16;
+
+PlaylistItem makePlaylistItem(Sd& sd, const MemIndexEntry& entry,
+                              bool turbo_prg) {
+  TapFile file(sd);
+  file.set(entry);
+  file.setTurboPrg(turbo_prg);
+  char size[16];
+  entry.printSize(size);
+  return PlaylistItem(std::move(file), entry.parent().getPath(),
+                      entry.getName(), size);
+}
+
 }  // namespace
 
+// Shows whether the fast pilot mode is on, and toggles it when clicked.
+class FastPilotToggle : public TextLabel {
+ public:
+  FastPilotToggle(const Environment& env, std::function<void()> toggle_fn)
+      : TextLabel(env, "", base_font(),
+                  roo_display::kRight | roo_display::kMiddle),
+        toggle_fn_(std::move(toggle_fn)) {}
+
+  bool isClickable() const override { return true; }
+
+  void onClicked() override { toggle_fn_(); }
+
+  void setOn(bool on) { setText(on ? "Fast pilot" : "1x"); }
+
+ private:
+  std::function<void()> toggle_fn_;
+};
+
 class PlayerHeader : public HorizontalLayout {
  public:
-  PlayerHeader(const Environment& env, std::function<void()> back_fn)
+  PlayerHeader(const Environment& env, std::function<void()> back_fn,
+               std::function<void()> fast_pilot_fn)
       : HorizontalLayout(env),
         back_(env, SCALED_ROO_ICON(outlined, navigation_arrow_back)),
         path_(env, "/", base_font(),
-              roo_display::kLeft | roo_display::kMiddle) {
+              roo_display::kLeft | roo_display::kMiddle),
+        fast_pilot_(env, fast_pilot_fn) {
     back_.setMargins(MARGIN_NONE);
     path_.setMargins(MARGIN_NONE);
+    fast_pilot_.setMargins(MARGIN_NONE);
     back_.setPadding(PADDING_TINY, PADDING_SMALL);
     path_.setPadding(PADDING_TINY, PADDING_SMALL);
+    fast_pilot_.setPadding(PADDING_SMALL, PADDING_SMALL);
     add(back_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
     add(path_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+    add(fast_pilot_,
+        HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
     setBackground(env.theme().color.secondary);
     back_.setOnInteractiveChange(back_fn);
   }
@@ -205,28 +244,225 @@ class PlayerHeader : public HorizontalLayout {
 
   void setPath(std::string path) { path_.setText(std::move(path)); }
 
+  void setFastPilot(bool on) { fast_pilot_.setOn(on); }
+
  private:
   Icon back_;
   roo_windows::TextLabel path_;
+  FastPilotToggle fast_pilot_;
+};
+
+// The label of the block bar, which opens the block list when clicked.
+class BlockLabel : public TextLabel {
+ public:
+  BlockLabel(const Environment& env, std::function<void()> click_fn)
+      : TextLabel(env, "", font_body2(),
+                  roo_display::kCenter | roo_display::kMiddle),
+        click_fn_(std::move(click_fn)) {}
+
+  bool isClickable() const override { return true; }
+
+  void onClicked() override { click_fn_(); }
+
+ private:
+  std::function<void()> click_fn_;
+};
+
+// Shows the block of the tape at the playback position, as found by the block
+// analyzer, with buttons to skip to the start of the previous and the next
+// one. Clicking the block opens the list of the header blocks. Hidden when the
+// blocks are not known.
+class BlockBar : public HorizontalLayout {
+ public:
+  BlockBar(const Environment& env, std::function<void()> prev_fn,
+           std::function<void()> next_fn, std::function<void()> list_fn)
+      : HorizontalLayout(env),
+        prev_(env, SCALED_ROO_ICON(outlined, navigation_chevron_left)),
+        label_(env, std::move(list_fn)),
+        next_(env, SCALED_ROO_ICON(outlined, navigation_chevron_right)),
+        shown_block_(kNone) {
+    prev_.setMargins(MARGIN_NONE);
+    label_.setMargins(MARGIN_NONE);
+    next_.setMargins(MARGIN_NONE);
+    prev_.setPadding(PADDING_TINY, PADDING_TINY);
+    label_.setPadding(PADDING_NONE);
+    next_.setPadding(PADDING_TINY, PADDING_TINY);
+    add(prev_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+    add(label_, HorizontalLayout::Params()
+                    .setGravity(kVerticalGravityMiddle)
+                    .setWeight(1));
+    add(next_, HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+    prev_.setOnInteractiveChange(prev_fn);
+    next_.setOnInteractiveChange(next_fn);
+    setVisibility(GONE);
+  }
+
+  PreferredSize getPreferredSize() const override {
+    return PreferredSize(PreferredSize::MatchParentWidth(),
+                         PreferredSize::WrapContentHeight());
+  }
+
+  void hide() {
+    shown_block_ = kNone;
+    setVisibility(GONE);
+  }
+
+  void setAnalyzing(int percent) {
+    shown_block_ = kNone;
+    setVisibility(VISIBLE);
+    prev_.setVisibility(INVISIBLE);
+    next_.setVisibility(INVISIBLE);
+    label_.setTextf("Analyzing the tape... %d%%", percent);
+  }
+
+  // Shows the specified block, or the leader before the first one, if -1.
+  void setBlock(const TapuinoNext::TapBlockIndex& index, int block) {
+    if (index.Count() == 0) {
+      hide();
+      return;
+    }
+    if (block == shown_block_) return;
+    shown_block_ = block;
+    setVisibility(VISIBLE);
+    prev_.setVisibility(VISIBLE);
+    next_.setVisibility(VISIBLE);
+    if (block < 0) {
+      label_.setTextf("Leader (%d blocks)", (int)index.Count());
+      return;
+    }
+    const TapuinoNext::TapBlock& b = index.Get(block);
+    if (b.IsHeader()) {
+      label_.setTextf("%d/%d %s \"%s\"", block + 1, (int)index.Count(),
+                      TapuinoNext::TapBlockTypeName(b.type), b.name);
+    } else {
+      label_.setTextf("%d/%d %s", block + 1, (int)index.Count(),
+                      TapuinoNext::TapBlockTypeName(b.type));
+    }
+  }
+
+ private:
+  // Value of shown_block_ when no block is shown.
+  static constexpr int kNone = -2;
+
+  Icon prev_;
+  BlockLabel label_;
+  Icon next_;
+  int shown_block_;
+};
+
+typedef std::function<void(int)> BlockSelectedFn;
+
+// A header block in the block list: the tape counter at its start, and the
+// file that it announces.
+class BlockListEntry : public HorizontalLayout {
+ public:
+  BlockListEntry(const Environment& env, BlockSelectedFn select_fn)
+      : HorizontalLayout(env),
+        counter_(env, "", base_font(),
+                 roo_display::kLeft | roo_display::kMiddle),
+        title_(env, "", base_font(),
+               roo_display::kLeft | roo_display::kMiddle),
+        select_fn_(std::move(select_fn)),
+        block_(-1) {
+    counter_.setMargins(MARGIN_NONE);
+    counter_.setPadding(PADDING_SMALL, PADDING_TINY);
+    title_.setMargins(MARGIN_NONE);
+    title_.setPadding(PADDING_TINY, PADDING_TINY);
+    addChildren();
+  }
+
+  BlockListEntry(const BlockListEntry& other)
+      : HorizontalLayout(other),
+        counter_(other.counter_),
+        title_(other.title_),
+        select_fn_(other.select_fn_),
+        block_(other.block_) {
+    addChildren();
+  }
+
+  PreferredSize getPreferredSize() const override {
+    return PreferredSize(PreferredSize::MatchParentWidth(),
+                         PreferredSize::ExactHeight(RowHeight()));
+  }
+
+  bool isClickable() const override { return true; }
+
+  void onClicked() override { select_fn_(block_); }
+
+  void set(int block, const TapuinoNext::TapBlock& b) {
+    block_ = block;
+    uint16_t counter = CYCLES_TO_COUNTER(b.cycles);
+    counter_.setTextf("%03u", counter);
+    title_.setTextf("%s \"%s\"", TapuinoNext::TapBlockTypeName(b.type),
+                    b.name);
+  }
+
+ private:
+  void addChildren() {
+    add(counter_,
+        HorizontalLayout::Params().setGravity(kVerticalGravityMiddle));
+    add(title_, HorizontalLayout::Params()
+                    .setGravity(kVerticalGravityMiddle)
+                    .setWeight(1));
+  }
+
+  TextLabel counter_;
+  TextLabel title_;
+  BlockSelectedFn select_fn_;
+  int block_;
+};
+
+// The header blocks of the block index.
+class BlockListModel : public ListModel<BlockListEntry> {
+ public:
+  BlockListModel() : index_(nullptr) {}
+
+  void update(const TapuinoNext::TapBlockIndex& index) {
+    index_ = &index;
+    headers_.clear();
+    for (size_t i = 0; i < index.Count(); ++i) {
+      if (index.Get(i).IsHeader()) headers_.push_back(i);
+    }
+  }
+
+  int elementCount() override { return headers_.size(); }
+
+  void set(int idx, BlockListEntry& dest) override {
+    dest.set(headers_[idx], index_->Get(headers_[idx]));
+  }
+
+ private:
+  const TapuinoNext::TapBlockIndex* index_;
+  std::vector<int> headers_;
 };
 
 class PlayerProgress : public VerticalLayout {
  public:
-  PlayerProgress(const Environment& env)
+  PlayerProgress(const Environment& env, std::function<void()> click_fn,
+                 std::function<void()> long_press_fn)
       : VerticalLayout(env),
+        click_fn_(std::move(click_fn)),
+        long_press_fn_(std::move(long_press_fn)),
         progress_bar_(env),
         footer_(env),
         read_bytes_(env, "0", font_body2()),
+        counter_(env, "000", font_body2(),
+                 roo_display::kCenter | roo_display::kMiddle),
         all_bytes_(env, "", font_body2(),
-                   roo_display::kRight | roo_display::kMiddle) {
+                   roo_display::kRight | roo_display::kMiddle),
+        counter_value_(0),
+        counter_mark_(-1) {
     footer_.add(read_bytes_, roo_display::kLeft | roo_display::kTop);
+    footer_.add(counter_, roo_display::kCenter | roo_display::kTop);
     footer_.add(all_bytes_, roo_display::kRight | roo_display::kTop);
     progress_bar_.setMargins(MARGIN_NONE);
     add(progress_bar_);
     add(footer_);
     read_bytes_.setPadding(PADDING_NONE);
+    counter_.setPadding(PADDING_NONE);
     all_bytes_.setPadding(PADDING_NONE);
     read_bytes_.setMargins(MARGIN_NONE);
+    counter_.setMargins(MARGIN_NONE);
     all_bytes_.setMargins(MARGIN_NONE);
     // footer_.setBackground(roo_display::color::PaleGreen);
   }
@@ -240,8 +476,28 @@ class PlayerProgress : public VerticalLayout {
     return Margins(MARGIN_LARGE, MARGIN_LARGE);
   }
 
+  bool isClickable() const override { return true; }
+
+  bool supportsLongPress() override { return true; }
+
+  void onClicked() override { click_fn_(); }
+
+  void onLongPress(XDim x, YDim y) override { long_press_fn_(); }
+
   void setTotalLabel(std::string label) { all_bytes_.setText(label); }
 
+  // Shows the tape counter, and the counter memory (if set, i.e. >= 0).
+  void setCounter(uint16_t counter, int mark) {
+    if (counter == counter_value_ && mark == counter_mark_) return;
+    counter_value_ = counter;
+    counter_mark_ = mark;
+    if (mark < 0) {
+      counter_.setTextf("%03u", counter);
+    } else {
+      counter_.setTextf("%03u [M %03d]", counter, mark);
+    }
+  }
+
   void setProgress(uint32_t read_bytes, uint16_t progress) {
     progress_bar_.setProgress(progress);
     const char* suffix[] = {"B", "KiB", "MiB", "GiB"};
@@ -266,10 +522,80 @@ class PlayerProgress : public VerticalLayout {
   }
 
  private:
+  std::function<void()> click_fn_;
+  std::function<void()> long_press_fn_;
   roo_dashboard::PercentProgressBar progress_bar_;
   AlignedLayout footer_;
   TextLabel read_bytes_;
+  TextLabel counter_;
   TextLabel all_bytes_;
+  uint16_t counter_value_;
+  int counter_mark_;
+};
+
+// Debug overlay with playback health statistics. Hidden by default; toggled by
+// a long press on the progress bar.
+class TelemetryOverlay : public VerticalLayout {
+ public:
+  TelemetryOverlay(const Environment& env)
+      : VerticalLayout(env),
+        buffer_(env, "", font_caption()),
+        timing_(env, "", font_caption()),
+        bus_(env, "", font_caption()),
+        shown_(false) {
+    buffer_.setPadding(PADDING_NONE);
+    buffer_.setMargins(MARGIN_NONE);
+    timing_.setPadding(PADDING_NONE);
+    timing_.setMargins(MARGIN_NONE);
+    bus_.setPadding(PADDING_NONE);
+    bus_.setMargins(MARGIN_NONE);
+    add(buffer_);
+    add(timing_);
+    add(bus_);
+    setVisibility(GONE);
+  }
+
+  PreferredSize getPreferredSize() const override {
+    return PreferredSize(PreferredSize::MatchParentWidth(),
+                         PreferredSize::WrapContentHeight());
+  }
+
+  Margins getMargins() const override {
+    return Margins(MARGIN_LARGE, MARGIN_NONE);
+  }
+
+  void toggle() {
+    shown_ = !shown_;
+    setVisibility(shown_ ? VISIBLE : GONE);
+  }
+
+  void update(const TapuinoNext::PlaybackTelemetry& t, const SpiBus* bus) {
+    if (!shown_) return;
+    buffer_.setTextf("buf min %u avg %u, underruns %u, src %u KiB/s",
+                     t.MinBufferFill(), t.AvgBufferFill(), t.Underruns(),
+                     t.SourceBytesPerSecond() / 1024);
+    // ISR histograms are in 0.5 us timer ticks.
+    timing_.setTextf("refill p50 %u p99 %u ms, isr max %u us, late p99 %u us",
+                     t.RefillMicros().Percentile(50) / 1000,
+                     t.RefillMicros().Percentile(99) / 1000,
+                     t.IsrExecTicks().Max() / 2,
+                     t.IsrLatenessTicks().Percentile(99) / 2);
+    if (bus == nullptr) return;
+    // Time on the bus, and the refills that had to wait behind a redraw.
+    const SpiBus::Stats& s = bus->stats();
+    const SpiBus::Occupancy& sd = s.clients[SpiBus::SD];
+    const SpiBus::Occupancy& lcd = s.clients[SpiBus::DISPLAY];
+    bus_.setTextf("spi sd %u/%u ms, lcd %u/%u ms, waits %u (%u ms)",
+                  (uint32_t)(sd.busy_us / 1000), sd.max_us / 1000,
+                  (uint32_t)(lcd.busy_us / 1000), lcd.max_us / 1000, s.waits,
+                  s.max_wait_us / 1000);
+  }
+
+ private:
+  TextLabel buffer_;
+  TextLabel timing_;
+  TextLabel bus_;
+  bool shown_;
 };
 
 class PlayerContentPanel : public VerticalLayout {
@@ -277,19 +603,35 @@ class PlayerContentPanel : public VerticalLayout {
   PlayerContentPanel(const Environment& env, std::function<void()> back_fn,
                      std::function<void()> play_fn,
                      std::function<void()> stop_fn,
-                     std::function<void()> rewind_fn)
+                     std::function<void()> rewind_fn,
+                     std::function<void()> mark_fn,
+                     std::function<void()> fast_pilot_fn,
+                     std::function<void()> prev_block_fn,
+                     std::function<void()> next_block_fn,
+                     std::function<void()> block_list_fn,
+                     BlockSelectedFn select_block_fn)
       : VerticalLayout(env),
-        header_(env, back_fn),
+        header_(env, back_fn, fast_pilot_fn),
         filename_(env, "", base_font(),
                   roo_display::kCenter | roo_display::kMiddle),
-        progress_(env),
+        blocks_(env, prev_block_fn, next_block_fn, block_list_fn),
+        block_list_(env, block_model_,
+                    BlockListEntry(env, std::move(select_block_fn))),
+        block_panel_(env, block_list_),
+        block_list_shown_(false),
+        progress_(env, mark_fn, [this]() { telemetry_.toggle(); }),
+        telemetry_(env),
         buttons_(env),
         play_(env),
         stop_(env) {
     add(header_);
     add(filename_, VerticalLayout::Params().setWeight(0).setGravity(
                        kHorizontalGravityCenter));
+    add(blocks_);
+    add(block_panel_, VerticalLayout::Params().setWeight(1));
+    block_panel_.setVisibility(GONE);
     add(progress_);
+    add(telemetry_);
     play_.setPadding(PADDING_HUGE, PADDING_TINY);
     play_.setMargins(MARGIN_LARGE, MARGIN_HUMONGOUS);
     stop_.setPadding(PADDING_HUGE, PADDING_TINY);
@@ -318,12 +660,15 @@ class PlayerContentPanel : public VerticalLayout {
                          PreferredSize::MatchParentHeight());
   }
 
-  void enter(const MemIndexEntry& entry) {
-    header_.setPath(entry.parent().getPath());
-    filename_.setText(entry.getName());
-    char size[16];
-    entry.printSize(size);
-    progress_.setTotalLabel(size);
+  void enter(const PlaylistItem& item, size_t pos, size_t count) {
+    header_.setPath(item.dir);
+    if (count > 1) {
+      filename_.setTextf("%s (%d/%d)", item.name.c_str(), (int)pos + 1,
+                         (int)count);
+    } else {
+      filename_.setText(item.name);
+    }
+    progress_.setTotalLabel(item.size);
   }
 
   void setPlayStatus(bool is_playing, uint32_t total, uint32_t read,
@@ -346,10 +691,54 @@ class PlayerContentPanel : public VerticalLayout {
     play_.tick();
   }
 
+  void setCounter(uint16_t counter, int mark) {
+    progress_.setCounter(counter, mark);
+  }
+
+  void setFastPilot(bool on) { header_.setFastPilot(on); }
+
+  BlockBar& blocks() { return blocks_; }
+
+  // Shows the header blocks of the index to pick from, or hides them if
+  // shown. Returns whether shown.
+  bool toggleBlockList(const TapuinoNext::TapBlockIndex& index) {
+    if (block_list_shown_) {
+      hideBlockList();
+      return false;
+    }
+    block_model_.update(index);
+    if (block_model_.elementCount() == 0) return false;
+    block_list_.modelChanged();
+    block_list_shown_ = true;
+    block_panel_.setVisibility(VISIBLE);
+    block_panel_.scrollTo(0, 0);
+    if (getMainWindow() != nullptr) {
+      getMainWindow()->updateLayout();
+    }
+    return true;
+  }
+
+  void hideBlockList() {
+    if (!block_list_shown_) return;
+    block_list_shown_ = false;
+    block_panel_.setVisibility(GONE);
+  }
+
+  void setTelemetry(const TapuinoNext::PlaybackTelemetry& telemetry,
+                    const SpiBus* bus) {
+    telemetry_.update(telemetry, bus);
+  }
+
  private:
   PlayerHeader header_;
   TextLabel filename_;
+  BlockBar blocks_;
+  BlockListModel block_model_;
+  ListLayout<BlockListEntry> block_list_;
+  ScrollablePanel block_panel_;
+  bool block_list_shown_;
   PlayerProgress progress_;
+  TelemetryOverlay telemetry_;
   HorizontalLayout buttons_;
   PlayButton play_;
   StopButton stop_;
@@ -362,57 +751,163 @@ PlayerActivity::PlayerActivity(const Environment& env,
     : scheduler_(scheduler),
       sd_(sd),
       mem_index_(mem_index),
+      spi_bus_(utility->spiBus),
       contents_(nullptr),
       tap_file_(sd),
+      playlist_pos_(0),
+      prefetch_failed_(false),
+      not_plain_prg_(false),
       shows_playing_(false),
+      counter_mark_(-1),
+      blocks_known_(false),
+      options_(*utility->options),
       loader_(utility, scheduler),
+      tape_cart_(utility, scheduler),
       player_status_updater_(
           scheduler, [this]() { updateLoaderStatus(); },
           roo_time::Millis(100)) {
   auto* panel = new PlayerContentPanel(
       env, [&]() { exit(); }, [&]() { play(); }, [&]() { stop(); },
-      [&]() { rewind(); });
+      [&]() { rewind(); }, [&]() { markCounter(); },
+      [&]() { toggleFastPilot(); }, [&]() { skipBlock(-1); },
+      [&]() { skipBlock(1); }, [&]() { toggleBlockList(); },
+      [&](int block) { seekToBlock(block); });
+  panel->setFastPilot(options_.fastPilot.GetValue());
   contents_.reset(panel);
 }
 
 void PlayerActivity::onStart() {}
 
 void PlayerActivity::onStop() {
-  mem_index_.clear();
+  // ZIP entries are played without the unzip buffer, so this is normally a
+  // no-op; it repairs the index if anything has used that buffer anyway.
   // SdMount mount(sd_);
   if (sd_.is_mounted()) {
-    mem_index_.Load(sd_.fs(), kIndexFilePath);
+    mem_index_.ReloadDirty(sd_.fs(), kIndexFilePath);
   }
 }
 
-void PlayerActivity::onResume() { player_status_updater_.start(); }
+void PlayerActivity::onResume() {
+  player_status_updater_.start();
+  if (options_.tapeCart.GetValue()) {
+    // The fastloader may announce itself any time before PLAY is pressed.
+    tape_cart_.Init();
+  }
+  analyzeBlocks();
+}
 
 void PlayerActivity::onPause() {
   player_status_updater_.stop();
+  tape_cart_.Abort();
+  tape_cart_.Stop();
   loader_.Reset();
   updateLoaderStatus();
 }
 
 void PlayerActivity::enter(const MemIndexEntry& entry) {
-  tap_file_.set(entry);
-  ((PlayerContentPanel&)getContents()).enter(entry);
+  playlist_.clear();
+  bool turbo_prg = options_.turboPrg.GetValue();
+  playlist_.push_back(makePlaylistItem(sd_, entry, turbo_prg));
+  // The siblings follow the entry in the path order, interleaved with the
+  // contents of sibling directories.
+  const MemIndex& index = *entry.fs();
+  MemIndex::Handle parent = entry.parent_handle();
+  MemIndex::PathEntryId end(index.count());
+  MemIndex::PathEntryId id(0);
+  while (id < end && index.entry_by_path(id) != entry.handle()) ++id;
+  for (++id; id < end && playlist_.size() <= kMaxPlaylistNext; ++id) {
+    MemIndexEntry sibling(&index, index.entry_by_path(id));
+    if (!sibling.isDescendantOf(parent)) break;
+    if (sibling.parent_handle() == parent && sibling.isTapFile() &&
+        sibling.meta().playable()) {
+      playlist_.push_back(makePlaylistItem(sd_, sibling, turbo_prg));
+    }
+  }
+  playlist_pos_ = 0;
+  prefetch_failed_ = false;
+  not_plain_prg_ = false;
+  tap_file_ = playlist_[0].file;
+  counter_mark_ = -1;
+  blocks_known_ = false;
+  ((PlayerContentPanel&)getContents()).enter(playlist_[0], 0, playlist_.size());
+}
+
+void PlayerActivity::advancePlaylist() {
+  ++playlist_pos_;
+  prefetch_failed_ = false;
+  not_plain_prg_ = false;
+  tap_file_ = playlist_[playlist_pos_].file;
+  counter_mark_ = -1;
+  // The blocks are analyzed again when rewound.
+  blocks_known_ = false;
+  ((PlayerContentPanel&)getContents())
+      .enter(playlist_[playlist_pos_], playlist_pos_, playlist_.size());
+}
+
+void PlayerActivity::prefetchIfNeeded() {
+  if (!hasNext() || prefetch_failed_ || loader_.HasPrefetched() ||
+      !loader_.IsPlaying() || !loader_.IsReadyForPrefetch()) {
+    return;
+  }
+  const PlaylistItem& next = playlist_[playlist_pos_ + 1];
+  if (loader_.PrefetchNext(next.file) != TapuinoNext::ErrorCodes::OK) {
+    LOG(WARNING) << "Failed to prefetch " << next.name;
+    prefetch_failed_ = true;
+  }
 }
 
 void PlayerActivity::updateLoaderStatus() {
   PlayerContentPanel& contents = (PlayerContentPanel&)getContents();
+  if (tape_cart_.IsSending()) {
+    contents.setPlayStatus(true, tape_cart_.GetTotalBytes(),
+                           tape_cart_.GetBytesSent(),
+                           digitalRead(C64_MOTOR_PIN));
+    contents.blocks().hide();
+    return;
+  }
   const TapuinoNext::TAP_INFO* tap_info = loader_.GetTapInfo();
+  if (loader_.IsAnalyzing()) {
+    // The position is that of the analysis; the tape is at the start.
+    contents.setPlayStatus(false, tap_info->length, 0,
+                           digitalRead(C64_MOTOR_PIN));
+    contents.setCounter(0, counter_mark_);
+    contents.blocks().setAnalyzing(loader_.GetAnalysisProgress());
+    return;
+  }
   if (tap_info->length > 0 && tap_info->position == tap_info->length) {
     // Playback finished; force 'stop'.
     shows_playing_ = false;
   }
   contents.setPlayStatus(shows_playing_, tap_info->length, tap_info->position,
                          digitalRead(C64_MOTOR_PIN));
+  contents.setCounter(tap_info->counterActual, counter_mark_);
+  if (blocks_known_) {
+    const TapuinoNext::TapBlockIndex& index = loader_.GetBlockIndex();
+    contents.blocks().setBlock(index, index.Find(tap_info->position));
+  } else {
+    contents.blocks().hide();
+    contents.hideBlockList();
+  }
+  contents.setTelemetry(loader_.GetTelemetry(), spi_bus_);
+  prefetchIfNeeded();
 }
 
 void PlayerActivity::loadFinished(TapuinoNext::ErrorCodes result) {
   shows_playing_ = false;
   switch (result) {
     case TapuinoNext::ErrorCodes::OK: {
+      if (hasNext()) {
+        getTask()->showAlertDialog("Loading complete",
+                                   "Reached the end of file.",
+                                   {"EXIT", "NEXT PART"}, [this](int id) {
+                                     if (id == 1) {
+                                       playNext();
+                                     } else {
+                                       exit();
+                                     }
+                                   });
+        break;
+      }
       getTask()->showAlertDialog("Loading complete", "Reached the end of file.",
                                  {"OK"}, [this](int) { exit(); });
       break;
@@ -428,10 +923,74 @@ void PlayerActivity::loadFinished(TapuinoNext::ErrorCodes result) {
   }
 }
 
+bool PlayerActivity::fastLoad() {
+  // Decoding the whole TAP takes much longer than looking for the fastloader,
+  // so it is only done when there is one, and only once per file.
+  if (!tap_file_.isPrg() && not_plain_prg_) return false;
+  if (!tape_cart_.CheckForMode()) {
+    LOG(INFO) << "No TapeCart fastloader; playing the file";
+    return false;
+  }
+  // Only one input can be open at a time.
+  loader_.Reset();
+  blocks_known_ = false;
+  InputStream prg;
+  if (tap_file_.isPrg()) {
+    // Streamed from the SD card as it is being sent.
+    prg = tap_file_.openRaw();
+  } else {
+    std::vector<uint8_t> data;
+    InputStream input = tap_file_.open();
+    TapuinoNext::TapPrgExtractor extractor;
+    if (extractor.Extract(input, data) != TapuinoNext::ErrorCodes::OK) {
+      LOG(INFO) << "Not a plain ROM loader TAP; playing it";
+      not_plain_prg_ = true;
+      return false;
+    }
+    input.close();
+    prg = InputStream(std::unique_ptr<InputStreamImpl>(
+        new MemoryInputStreamImpl(std::move(data))));
+  }
+  LOG(INFO) << "Sending " << prg.size() << " bytes through TapeCart";
+  TapuinoNext::ErrorCodes res = tape_cart_.Send(
+      std::move(prg), [this](TapuinoNext::ErrorCodes result) {
+        fastLoadFinished(result);
+      });
+  if (res != TapuinoNext::ErrorCodes::OK) {
+    shows_playing_ = false;
+    getTask()->showAlertDialog(TapuinoNext::S_ERROR, TapuinoNext::S_FILE_ERROR,
+                               {"OK"}, [](int) {});
+  }
+  updateLoaderStatus();
+  return true;
+}
+
+void PlayerActivity::fastLoadFinished(TapuinoNext::ErrorCodes result) {
+  LOG(INFO) << "TapeCart transfer: " << tape_cart_.GetBytesSent() << " bytes, "
+            << tape_cart_.GetBytesPerSecond() << " bytes/s";
+  if (result == TapuinoNext::ErrorCodes::OPERATION_ABORTED) {
+    shows_playing_ = false;
+    getTask()->showAlertDialog("Fast load failed",
+                               "The transfer was aborted by the C64.", {"OK"},
+                               [](int) {});
+    return;
+  }
+  loadFinished(result);
+}
+
 void PlayerActivity::play() {
+  if (tape_cart_.IsSending()) return;
   shows_playing_ = true;
   updateLoaderStatus();
   getApplication()->refresh();
+  // The whole program is sent, so the tape must be at the start (it is, while
+  // the blocks are analyzed).
+  if (options_.tapeCart.GetValue() && !loader_.IsPlaying() &&
+      (loader_.IsAnalyzing() || loader_.GetTapInfo()->position == 0) &&
+      fastLoad()) {
+    return;
+  }
+  setUpAutoContinue();
   TapuinoNext::ErrorCodes res = loader_.Play(
       tap_file_,
       [this](TapuinoNext::ErrorCodes result) { loadFinished(result); });
@@ -445,8 +1004,138 @@ void PlayerActivity::play() {
   }
 }
 
-void PlayerActivity::stop() { loader_.Stop(); }
+void PlayerActivity::playNext() {
+  if (!hasNext()) return;
+  if (!loader_.HasPrefetched()) {
+    loader_.Reset();
+    advancePlaylist();
+    play();
+    return;
+  }
+  advancePlaylist();
+  setUpAutoContinue();
+  loader_.PlayPrefetched(
+      [this](TapuinoNext::ErrorCodes result) { loadFinished(result); });
+  shows_playing_ = true;
+  updateLoaderStatus();
+}
+
+void PlayerActivity::partContinued() {
+  advancePlaylist();
+  shows_playing_ = true;
+  updateLoaderStatus();
+}
+
+void PlayerActivity::setUpAutoContinue() {
+  if (options_.autoContinue.GetValue()) {
+    loader_.SetAutoContinue([this]() { partContinued(); });
+  } else {
+    loader_.SetAutoContinue(nullptr);
+  }
+}
+
+void PlayerActivity::stop() {
+  if (tape_cart_.IsSending()) {
+    tape_cart_.Abort();
+    shows_playing_ = false;
+    updateLoaderStatus();
+    return;
+  }
+  loader_.Stop();
+}
+
+void PlayerActivity::rewind() {
+  if (counter_mark_ < 0) {
+    loader_.Rewind();
+    analyzeBlocks();
+  } else {
+    seekToCounter(counter_mark_);
+  }
+}
+
+void PlayerActivity::analyzeBlocks() {
+  blocks_known_ = false;
+  loader_.AnalyzeBlocks(tap_file_, [this]() {
+    blocks_known_ = loader_.GetBlockIndex().Count() > 0;
+  });
+  updateLoaderStatus();
+}
+
+void PlayerActivity::skipBlock(int delta) {
+  if (!blocks_known_) return;
+  const TapuinoNext::TapBlockIndex& index = loader_.GetBlockIndex();
+  uint32_t position = loader_.GetTapInfo()->position;
+  // Back goes to the start of the current block, unless already there.
+  int block = delta < 0 ? index.Find(position == 0 ? 0 : position - 1)
+                        : index.Find(position) + 1;
+  if (block >= (int)index.Count()) return;
+  seekToBlock(block);
+}
+
+void PlayerActivity::toggleBlockList() {
+  if (!blocks_known_) return;
+  ((PlayerContentPanel&)getContents())
+      .toggleBlockList(loader_.GetBlockIndex());
+}
+
+void PlayerActivity::seekToBlock(int block) {
+  ((PlayerContentPanel&)getContents()).hideBlockList();
+  TapuinoNext::ErrorCodes res = TapuinoNext::ErrorCodes::OK;
+  if (block < 0) {
+    loader_.Rewind();
+  } else {
+    res = loader_.SeekToBlock(tap_file_, block);
+  }
+  updateLoaderStatus();
+  if (res != TapuinoNext::ErrorCodes::OK) {
+    getTask()->showAlertDialog(TapuinoNext::S_ERROR, TapuinoNext::S_FILE_ERROR,
+                               {"OK"}, [](int) {});
+  }
+}
+
+void PlayerActivity::toggleFastPilot() {
+  options_.fastPilot.SetValue(!options_.fastPilot.GetValue());
+  options_.fastPilot.Commit();
+  ((PlayerContentPanel&)getContents())
+      .setFastPilot(options_.fastPilot.GetValue());
+  if (loader_.IsPlaying()) {
+    // Restart the timer, which picks up the new setting.
+    loader_.Stop();
+    play();
+  }
+}
+
+void PlayerActivity::markCounter() {
+  uint16_t counter = loader_.GetTapInfo()->counterActual;
+  // Tapping again at the marked position clears the mark.
+  counter_mark_ = (counter_mark_ == counter) ? -1 : counter;
+  updateLoaderStatus();
+}
 
-void PlayerActivity::rewind() { loader_.Reset(); }
+void PlayerActivity::seekToCounter(uint16_t counter) {
+  // Without a counter index yet, the seek waits for the analysis to build it.
+  loader_.SeekToCounter(tap_file_, counter, [this](TapuinoNext::ErrorCodes res) {
+    blocks_known_ = loader_.GetBlockIndex().Count() > 0;
+    updateLoaderStatus();
+    switch (res) {
+      case TapuinoNext::ErrorCodes::OK:
+      case TapuinoNext::ErrorCodes::OPERATION_ABORTED: {
+        break;
+      }
+      case TapuinoNext::ErrorCodes::INVALID_COUNTER_POS: {
+        getTask()->showAlertDialog(TapuinoNext::S_ERROR,
+                                   TapuinoNext::S_COUNTER_GR_SIZE, {"OK"},
+                                   [](int) {});
+        break;
+      }
+      default: {
+        getTask()->showAlertDialog(TapuinoNext::S_ERROR,
+                                   TapuinoNext::S_FILE_ERROR, {"OK"},
+                                   [](int) {});
+      }
+    }
+  });
+  updateLoaderStatus();
+}
 
 }  // namespace tapuino
\ No newline at end of file
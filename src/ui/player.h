@@ -7,7 +7,9 @@
 #include "FS.h"
 #include "SPI.h"
 #include "core/include/ESP32TapLoader.h"
+#include "core/include/ESP32TapeCartLoader.h"
 #include "index/mem_index.h"
+#include "io/spi_bus.h"
 #include "io/tap_file.h"
 #include "roo_logging.h"
 #include "roo_scheduler.h"
@@ -18,6 +20,22 @@ namespace tapuino {
 
 class PlayerActivity;
 
+// A TAP of the playlist. Captured when the player is entered, since the memory
+// index is not available while a ZIP file is open.
+struct PlaylistItem {
+  PlaylistItem(TapFile file, std::string dir, std::string name,
+               std::string size)
+      : file(std::move(file)),
+        dir(std::move(dir)),
+        name(std::move(name)),
+        size(std::move(size)) {}
+
+  TapFile file;
+  std::string dir;
+  std::string name;
+  std::string size;
+};
+
 class PlayerActivity : public roo_windows::Activity {
  public:
   PlayerActivity(const roo_windows::Environment& env,
@@ -39,20 +57,98 @@ class PlayerActivity : public roo_windows::Activity {
   void stop();
   void rewind();
 
+  // Starts playing the next TAP of the playlist; instantly, if prefetched.
+  void playNext();
+
+  // Positions the tape at the specified counter. Playback must be stopped.
+  void seekToCounter(uint16_t counter);
+
+  // Sets the counter memory to the current counter, or clears it. When set,
+  // rewinding returns to the memorized position rather than to the start.
+  void markCounter();
+
+  // Positions the tape at the start of the previous (delta < 0) or the next
+  // block, as found by the block analyzer.
+  void skipBlock(int delta);
+
+  // Shows (or hides) the list of the header blocks found by the block
+  // analyzer, to pick one to seek to.
+  void toggleBlockList();
+
+  // Positions the tape at the start of the specified block, or at the start
+  // of the tape if -1.
+  void seekToBlock(int block);
+
+  // Toggles shortening of pilot tones and pauses, for the known loaders.
+  void toggleFastPilot();
+
+  const TapuinoNext::PlaybackTelemetry& telemetry() const {
+    return loader_.GetTelemetry();
+  }
+
  private:
   void updateLoaderStatus();
   void loadFinished(TapuinoNext::ErrorCodes result);
 
+  // Sends the PRG, or the program of a plain ROM loader TAP, through
+  // TapeCart, if the C64 runs a TapeCart fastloader. Returns false if the file
+  // should be played instead.
+  bool fastLoad();
+  void fastLoadFinished(TapuinoNext::ErrorCodes result);
+
+  bool hasNext() const { return playlist_pos_ + 1 < playlist_.size(); }
+
+  // Makes the next TAP of the playlist current, in the UI and in tap_file_.
+  void advancePlaylist();
+
+  // Called when the loader continued with the next TAP on its own.
+  void partContinued();
+
+  void prefetchIfNeeded();
+
+  // Makes the blocks of the current TAP known: from the sidecar, or analyzed
+  // in the background.
+  void analyzeBlocks();
+
+  // Makes the loader continue with the next TAP at the end of the current one,
+  // if the auto-continue option is on.
+  void setUpAutoContinue();
+
   roo_scheduler::Scheduler& scheduler_;
   Sd& sd_;
   MemIndex& mem_index_;
+  // For the bus occupancy in the telemetry overlay; may be null.
+  const SpiBus* spi_bus_;
   std::unique_ptr<roo_windows::Widget> contents_;
   TapFile tap_file_;
 
+  // The TAP that the player has been entered with, followed by its siblings
+  // (in the path index order), which make up the playlist of a multi-part
+  // release.
+  std::vector<PlaylistItem> playlist_;
+  size_t playlist_pos_;
+
+  // Whether prefetching the next TAP has been attempted and failed; it is then
+  // opened normally.
+  bool prefetch_failed_;
+
+  // Whether the current TAP is known not to hold a plain ROM loader program,
+  // so that fastLoad() doesn't decode it again.
+  bool not_plain_prg_;
+
   // Whether the UI displays the view as playing.
   bool shows_playing_;
 
+  // Counter memory, or -1 when not set.
+  int counter_mark_;
+
+  // Whether the blocks of the current TAP are in the loader's block index.
+  bool blocks_known_;
+
+  TapuinoNext::Options& options_;
+
   TapuinoNext::ESP32TapLoader loader_;
+  TapuinoNext::ESP32TapeCartLoader tape_cart_;
   roo_scheduler::RepetitiveTask player_status_updater_;
 };
 
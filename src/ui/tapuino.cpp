@@ -8,17 +8,19 @@ using namespace roo_windows;
 namespace tapuino {
 
 Tapuino::Tapuino(const Environment& env, roo_scheduler::Scheduler& scheduler,
-                 Sd& sd, MemIndex& mem_index)
+                 Sd& sd, MemIndex& mem_index, SpiBus& spi_bus)
     : options_(nullptr, nullptr),
       flip_buffer_(4096),
-      utility_(nullptr, &options_, &flip_buffer_),
+      utility_(nullptr, &options_, &flip_buffer_, &spi_bus),
       catalog_(sd, mem_index),
       start_(env, scheduler, sd, mem_index, indexer_, browser_),
       indexer_(env, scheduler, sd, mem_index),
       browser_(
-          env, scheduler, sd, catalog_,
-          [this](const tapuino::MemIndexEntry& e) { enterPlayer(e); }),
-      player_(env, scheduler, sd, mem_index, &utility_) {
+          env, scheduler, sd, catalog_, options_,
+          [this](const tapuino::MemIndexEntry& e) { enterPlayer(e); },
+          [this]() { enterBenchmark(); }),
+      player_(env, scheduler, sd, mem_index, &utility_),
+      benchmark_(env, scheduler, sd) {
   flip_buffer_.Init();
 }
 
@@ -32,4 +34,6 @@ void Tapuino::enterPlayer(const tapuino::MemIndexEntry& e) {
   player_.enter(e);
 }
 
+void Tapuino::enterBenchmark() { task_->enterActivity(&benchmark_); }
+
 }  // namespace tapuino
\ No newline at end of file
@@ -3,11 +3,13 @@
 #include "catalog/catalog.h"
 #include "index/mem_index.h"
 #include "io/sd.h"
+#include "io/spi_bus.h"
 #include "roo_logging.h"
 #include "roo_scheduler.h"
 #include "roo_windows/core/activity.h"
 #include "roo_windows/core/environment.h"
 #include "roo_windows/dialogs/alert_dialog.h"
+#include "ui/benchmark.h"
 #include "ui/browser.h"
 #include "ui/indexer.h"
 #include "ui/player.h"
@@ -20,13 +22,15 @@ namespace tapuino {
 class Tapuino {
  public:
   Tapuino(const roo_windows::Environment& env,
-          roo_scheduler::Scheduler& scheduler, Sd& sd, MemIndex& mem_index);
+          roo_scheduler::Scheduler& scheduler, Sd& sd, MemIndex& mem_index,
+          SpiBus& spi_bus);
 
  public:
   void start(roo_windows::Application& application);
 
  private:
   void enterPlayer(const tapuino::MemIndexEntry& e);
+  void enterBenchmark();
 
   TapuinoNext::Options options_;
 
@@ -39,6 +43,7 @@ class Tapuino {
   IndexingActivity indexer_;
   BrowsingActivity browser_;
   PlayerActivity player_;
+  SdBenchmarkActivity benchmark_;
 
   std::unique_ptr<roo_windows::Task> task_;
 };
@@ -0,0 +1,188 @@
+// Host-side check and benchmark of the file index reader.
+//
+//   file_index_bench           writes a synthetic index (directories, ZIPs
+//                              and files), reads it back, verifies the
+//                              entries, and reports the throughput of plain
+//                              reads and of reads that skip the ZIPs, along
+//                              with the heap allocations they make.
+//   file_index_bench index     reads an existing index file (e.g. a copy of
+//                              the one on the SD card).
+//
+// The index goes through the filesystem of the host, mounted at /.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <new>
+#include <string>
+
+#include "FS.h"
+#include "index/file_index.h"
+#include "vfs_api.h"
+
+using tapuino::FileIndexReader;
+using tapuino::FileIndexWriter;
+
+namespace {
+
+// Counts the heap allocations, to show that reading the entries doesn't make
+// any.
+size_t allocations = 0;
+
+constexpr const char* kIndexPath = "/tmp/file_index_bench.idx";
+
+// Reads of the whole index, averaged.
+constexpr int kPasses = 20;
+
+// The shape of the synthetic index.
+constexpr int kDirs = 200;
+constexpr int kZipsPerDir = 10;
+constexpr int kFilesPerZip = 20;
+constexpr int kFilesPerDir = 100;
+
+// The filesystem of the host.
+class HostFs : public fs::FS {
+ public:
+  HostFs() : fs::FS(fs::FSImplPtr(new VFSImpl())) { _impl->mountpoint(""); }
+};
+
+double now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string nameOf(const char* prefix, int i, const char* suffix) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s %04d%s", prefix, i, suffix);
+  return name;
+}
+
+// Returns the number of entries written, or 0 on error.
+uint32_t writeIndex(fs::FS& fs) {
+  FileIndexWriter writer(fs);
+  writer.open(kIndexPath);
+  uint32_t entries = 1;
+  writer.containerBegin(tapuino::DIR, "", 0);
+  for (int d = 0; d < kDirs; ++d) {
+    writer.containerBegin(tapuino::DIR, nameOf("Collection", d, ""), 0);
+    ++entries;
+    for (int z = 0; z < kZipsPerDir; ++z) {
+      writer.containerBegin(tapuino::ZIP, nameOf("Release", z, ".zip"),
+                            100000 + z);
+      ++entries;
+      for (int f = 0; f < kFilesPerZip; ++f) {
+        writer.addFile(tapuino::TAP_FILE, nameOf("Part", f, ".tap"),
+                       200000 + f);
+        ++entries;
+      }
+      writer.containerEnd();
+    }
+    for (int f = 0; f < kFilesPerDir; ++f) {
+      writer.addFile(f % 4 == 0 ? tapuino::PRG_FILE : tapuino::TAP_FILE,
+                     nameOf("Game with a somewhat longer name", f,
+                            f % 4 == 0 ? ".prg" : ".tap"),
+                     30000 + f);
+      ++entries;
+    }
+    writer.containerEnd();
+  }
+  writer.containerEnd();
+  writer.close();
+  if (!writer) {
+    printf("Can't write %s\n", kIndexPath);
+    return 0;
+  }
+  const tapuino::WriteStats& stats = writer.stats();
+  printf("Wrote %u entries: %u bytes in %u writes\n", entries,
+         stats.bytes, stats.flushes);
+  return entries;
+}
+
+struct Pass {
+  uint32_t entries = 0;
+  uint32_t files = 0;
+  uint8_t max_depth = 0;
+  size_t allocations = 0;
+  bool ok = false;
+};
+
+// Reads the whole index; skips the contents of the ZIPs if requested.
+Pass readIndex(fs::FS& fs, const char* path, bool skip_zips) {
+  Pass pass;
+  FileIndexReader reader(fs);
+  reader.open(path);
+  size_t allocations_before = allocations;
+  const FileIndexReader::Entry* entry;
+  while ((entry = reader.next()) != nullptr) {
+    ++pass.entries;
+    if (entry->isFile()) ++pass.files;
+    if (entry->depth() > pass.max_depth) pass.max_depth = entry->depth();
+    if (skip_zips && entry->isContainer() &&
+        entry->container_type() == tapuino::ZIP) {
+      reader.skipSubtree();
+    }
+  }
+  pass.allocations = allocations - allocations_before;
+  pass.ok = reader;
+  reader.close();
+  return pass;
+}
+
+bool bench(fs::FS& fs, const char* path, bool skip_zips,
+           uint32_t expected_entries) {
+  Pass pass;
+  double start = now();
+  for (int i = 0; i < kPasses; ++i) {
+    pass = readIndex(fs, path, skip_zips);
+    if (!pass.ok) {
+      printf("Can't read %s\n", path);
+      return false;
+    }
+  }
+  double elapsed = (now() - start) / kPasses;
+  printf("%s: %u entries (%u files, depth %u), %.2f ms, %.0f entries/s, "
+         "%zu allocations\n",
+         skip_zips ? "Skipping ZIPs" : "All entries", pass.entries, pass.files,
+         pass.max_depth, elapsed * 1000, pass.entries / elapsed,
+         pass.allocations);
+  if (expected_entries != 0 && pass.entries != expected_entries) {
+    printf("Expected %u entries\n", expected_entries);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocations;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+int main(int argc, char** argv) {
+  HostFs fs;
+  if (argc == 2) {
+    return bench(fs, argv[1], false, 0) && bench(fs, argv[1], true, 0) ? 0
+                                                                       : 1;
+  }
+  if (argc != 1) {
+    fprintf(stderr, "Usage: %s [index]\n", argv[0]);
+    return 2;
+  }
+  uint32_t entries = writeIndex(fs);
+  if (entries == 0) return 1;
+  uint32_t without_zip_contents = entries - kDirs * kZipsPerDir * kFilesPerZip;
+  bool ok = bench(fs, kIndexPath, false, entries);
+  ok &= bench(fs, kIndexPath, true, without_zip_contents);
+  fs.remove(kIndexPath);
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+// Host-side check that PRG files played in the turbo mode survive the fast
+// pilot mode: generates the TAP of a program with long runs of zero bytes (in
+// pulses that fall within the pilot profiles), drops pulses the way the
+// player does, decodes the turbo part of what remains, and compares it with
+// the program. Also checks that the pauses are only clamped after the blocks
+// of shortened pilots.
+//
+//   prg_turbo_check
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "core/include/PilotProfiles.h"
+#include "io/prg_pulse_source.h"
+
+using TapuinoNext::PilotRunTracker;
+using tapuino::InputStream;
+using tapuino::PrgPulseSourceImpl;
+
+namespace {
+
+// Midpoint of the turbo encoding's short (1) and long (0) pulses.
+constexpr uint8_t kTurboThreshold = 0x12;
+constexpr uint8_t kTurboPilotByte = 0x02;
+constexpr uint8_t kTurboSync = 0x09;
+
+// A BASIC-area program: random bytes, with `zeros` zero bytes in the middle.
+std::vector<uint8_t> makePrg(uint32_t size, uint32_t zeros) {
+  std::vector<uint8_t> prg = {0x01, 0x08};
+  srand(1);
+  for (uint32_t i = 0; i < size; ++i) {
+    bool zero = i >= (size - zeros) / 2 && i < (size + zeros) / 2;
+    prg.push_back(zero ? 0 : rand() & 0xFF);
+  }
+  return prg;
+}
+
+// Reads the TAP data (past the header) of the PRG.
+bool makeTap(const std::vector<uint8_t>& prg, PrgPulseSourceImpl::Mode mode,
+             std::vector<uint8_t>& tap) {
+  PrgPulseSourceImpl source(
+      InputStream(std::unique_ptr<tapuino::InputStreamImpl>(
+          new tapuino::MemoryInputStreamImpl(prg))),
+      "TURBO CHECK", mode);
+  if (!source.ok()) return false;
+  std::vector<uint8_t> stream(source.size());
+  uint32_t pos = 0;
+  int32_t n;
+  while (pos < stream.size() &&
+         (n = source.read(&stream[pos], stream.size() - pos)) > 0) {
+    pos += n;
+  }
+  if (pos != stream.size()) return false;
+  tap.assign(stream.begin() + tapuino::kTapHeaderSize, stream.end());
+  return true;
+}
+
+// Drops pulses like TapLoader does in the fast pilot mode (C64, from the
+// start of the TAP). Returns the number of pulses dropped.
+uint32_t skipPilots(const std::vector<uint8_t>& tap, std::vector<uint8_t>& out) {
+  PilotRunTracker runs;
+  runs.Reset(0, true);
+  uint32_t dropped = 0;
+  for (size_t i = 0; i < tap.size(); ++i) {
+    out.push_back(tap[i]);
+    if (tap[i] == 0) {
+      runs.Pause();
+      out.insert(out.end(), tap.begin() + i + 1, tap.begin() + i + 4);
+      i += 3;
+      continue;
+    }
+    uint32_t max_skip = runs.Pulse(tap[i]);
+    uint32_t skipped = 0;
+    while (skipped < max_skip && i + 1 < tap.size() && tap[i + 1] == tap[i]) {
+      ++i;
+      ++skipped;
+    }
+    runs.Skipped(skipped);
+    dropped += skipped;
+  }
+  return dropped;
+}
+
+// Decodes the turbo part (past the second pause, which ends the starter
+// block): the pilot bytes, the sync byte, the load parameters, and the
+// program. Returns false if there is no sync.
+bool decodeTurbo(const std::vector<uint8_t>& tap, uint32_t size,
+                 std::vector<uint8_t>& program) {
+  size_t i = 0;
+  for (int pauses = 0; pauses < 2; ++i) {
+    if (i >= tap.size()) return false;
+    if (tap[i] == 0) {
+      ++pauses;
+      i += 3;
+    }
+  }
+  auto bit = [&]() { return tap[i++] < kTurboThreshold ? 1 : 0; };
+  // Find the byte alignment on the pilot, then the sync byte.
+  uint8_t b = 0;
+  while (b != kTurboPilotByte) {
+    if (i >= tap.size()) return false;
+    b = (b << 1) | bit();
+  }
+  while (b == kTurboPilotByte) {
+    if (i + 8 > tap.size()) return false;
+    b = 0;
+    for (int k = 0; k < 8; ++k) b = (b << 1) | bit();
+  }
+  if (b != kTurboSync) return false;
+  // The load parameters, then the program.
+  i += 5 * 8;
+  program.clear();
+  while (program.size() < size && i + 8 <= tap.size()) {
+    b = 0;
+    for (int k = 0; k < 8; ++k) b = (b << 1) | bit();
+    program.push_back(b);
+  }
+  return program.size() == size;
+}
+
+bool check(uint32_t size, uint32_t zeros) {
+  std::vector<uint8_t> prg = makePrg(size, zeros);
+  std::vector<uint8_t> tap;
+  if (!makeTap(prg, PrgPulseSourceImpl::TURBO, tap)) {
+    printf("%u bytes, %u zeros: can't generate the TAP\n", size, zeros);
+    return false;
+  }
+  std::vector<uint8_t> played;
+  uint32_t dropped = skipPilots(tap, played);
+  std::vector<uint8_t> program;
+  bool ok = decodeTurbo(played, size, program) &&
+            std::equal(program.begin(), program.end(), prg.begin() + 2);
+  printf("%5u bytes, %5u zeros: %u of %zu pulses dropped, %s\n", size, zeros,
+         dropped, tap.size(), ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// The pilots of the ROM loader mode are long enough to be shortened, which
+// shows that the pulses are dropped at all.
+bool checkRomPilots() {
+  std::vector<uint8_t> tap;
+  std::vector<uint8_t> played;
+  bool ok = makeTap(makePrg(2048, 0), PrgPulseSourceImpl::ROM_LOADER, tap) &&
+            skipPilots(tap, played) > 0;
+  printf("ROM loader pilots shortened: %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+void addPause(std::vector<uint8_t>& tap, uint32_t length) {
+  tap.push_back(0);
+  tap.push_back(length & 0xFF);
+  tap.push_back((length >> 8) & 0xFF);
+  tap.push_back((length >> 16) & 0xFF);
+}
+
+// Plays the TAP like TapLoader does in the fast pilot mode, and returns the
+// pauses, clamped like TapLoader does (the TAP values are close enough to
+// microseconds here).
+std::vector<uint32_t> playedGaps(const std::vector<uint8_t>& tap) {
+  PilotRunTracker runs;
+  runs.Reset(0, true);
+  std::vector<uint32_t> gaps;
+  for (size_t i = 0; i < tap.size(); ++i) {
+    if (tap[i] == 0) {
+      runs.Pause();
+      uint32_t gap = tap[i + 1] | (tap[i + 2] << 8) | (tap[i + 3] << 16);
+      const TapuinoNext::PilotProfile* profile = runs.GapProfile();
+      if (profile != nullptr && gap > profile->maxGapMicros) {
+        gap = profile->maxGapMicros;
+      }
+      gaps.push_back(gap);
+      i += 3;
+      continue;
+    }
+    uint32_t max_skip = runs.Pulse(tap[i]);
+    uint32_t skipped = 0;
+    while (skipped < max_skip && i + 1 < tap.size() && tap[i + 1] == tap[i]) {
+      ++i;
+      ++skipped;
+    }
+    runs.Skipped(skipped);
+  }
+  return gaps;
+}
+
+// Only the pause after the block of a shortened pilot is clamped: a turbo
+// block whose pilot matches no profile keeps its pause (during which many
+// loaders depack, with the motor on), even after a shortened ROM pilot.
+bool checkGaps() {
+  constexpr uint32_t kRomGap = 3000000;
+  constexpr uint32_t kTurboGap = 5000000;
+  std::vector<uint8_t> tap;
+  // A ROM loader block: a long pilot of short pulses, and some data.
+  tap.insert(tap.end(), 8000, 0x30);
+  for (int i = 0; i < 1000; ++i) tap.push_back(i % 2 ? 0x42 : 0x56);
+  addPause(tap, kRomGap);
+  // A turbo block with a pilot of pulses no profile matches.
+  tap.insert(tap.end(), 8000, 0x08);
+  for (int i = 0; i < 1000; ++i) tap.push_back(i % 2 ? 0x08 : 0x10);
+  addPause(tap, kTurboGap);
+  tap.insert(tap.end(), 100, 0x08);
+  std::vector<uint32_t> gaps = playedGaps(tap);
+  const TapuinoNext::PilotProfile* rom = TapuinoNext::FindPilotProfile(0, 0x30);
+  bool ok = rom != nullptr && gaps.size() == 2 &&
+            gaps[0] == rom->maxGapMicros && gaps[1] == kTurboGap;
+  printf("Gap after an unmatched turbo block kept: %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = checkRomPilots();
+  ok &= checkGaps();
+  ok &= check(2048, 0);
+  // Runs of 8192 zero pulses and more: longer than any profile keeps.
+  ok &= check(8192, 1024);
+  ok &= check(30000, 16384);
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+// Host-side check and throughput benchmark of the WAV to TAP converter.
+//
+//   wav2tap_bench                  decodes synthetic signals in all supported
+//                                  formats, verifies the pulses, and reports
+//                                  the throughput.
+//   wav2tap_bench in.wav out.tap   converts a WAV file, like the player does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "io/wav_decoder.h"
+
+using tapuino::WavFormat;
+using tapuino::WavPulseDecoder;
+
+namespace {
+
+constexpr uint32_t kC64PalHz = 985248;
+
+// Amplitude of the synthetic signal, relative to the full scale.
+constexpr double kAmplitude = 0.6;
+
+double now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Writes the sample, scaled to [-1, 1], to all channels of a frame.
+void putFrame(std::vector<uint8_t>& pcm, const WavFormat& format, double v) {
+  for (int c = 0; c < format.channels; ++c) {
+    if (format.bits_per_sample == 8) {
+      pcm.push_back((uint8_t)lround(128 + v * 127));
+    } else {
+      int16_t s = (int16_t)lround(v * 32767);
+      pcm.push_back(s & 0xFF);
+      pcm.push_back((s >> 8) & 0xFF);
+    }
+  }
+}
+
+// A CBM-like pulse stream: a pilot, then random short/medium/long pulses.
+std::vector<uint8_t> makePulses(size_t count) {
+  std::vector<uint8_t> pulses;
+  srand(1);
+  for (size_t i = 0; i < count; ++i) {
+    if (i < count / 10) {
+      pulses.push_back(0x30);
+    } else {
+      static const uint8_t kPulses[] = {0x30, 0x42, 0x56};
+      pulses.push_back(kPulses[rand() % 3]);
+    }
+  }
+  return pulses;
+}
+
+// Renders the pulses as a square wave with sloped edges, the way a tape
+// signal looks after the datasette's electronics and the sound card.
+std::vector<uint8_t> render(const std::vector<uint8_t>& pulses,
+                            const WavFormat& format) {
+  std::vector<uint8_t> pcm;
+  double samples_per_cycle = (double)format.sample_rate / kC64PalHz;
+  double t = 0;     // Current position, in samples.
+  double edge = 0;  // Start of the current pulse.
+  // Leading silence.
+  for (int i = 0; i < 100; ++i) {
+    putFrame(pcm, format, 0);
+    t += 1;
+  }
+  edge = t;
+  for (uint8_t p : pulses) {
+    double length = p * 8 * samples_per_cycle;
+    double mid = edge + length / 2;
+    double end = edge + length;
+    while (t < end) {
+      // Rising at `edge`, falling at `mid`; ramps of 1 sample.
+      double v;
+      if (t < mid) {
+        v = std::min(1.0, 2 * (t - edge) - 1);
+      } else {
+        v = std::max(-1.0, 1.0 - 2 * (t - mid));
+        v = std::min(v, 1.0);
+      }
+      putFrame(pcm, format, v * kAmplitude);
+      t += 1;
+    }
+    edge = end;
+  }
+  // Trailing silence.
+  for (int i = 0; i < 100; ++i) putFrame(pcm, format, 0);
+  return pcm;
+}
+
+std::vector<uint8_t> decodeAll(const std::vector<uint8_t>& pcm,
+                               const WavFormat& format) {
+  WavPulseDecoder decoder;
+  decoder.begin(format, kC64PalHz);
+  std::vector<uint8_t> tap;
+  const size_t kChunk = 4096;
+  std::vector<uint8_t> out(decoder.maxOutput(kChunk));
+  for (size_t pos = 0; pos < pcm.size(); pos += kChunk) {
+    size_t n = std::min(kChunk, pcm.size() - pos);
+    size_t written = decoder.decode(&pcm[pos], n, out.data());
+    tap.insert(tap.end(), out.begin(), out.begin() + written);
+  }
+  size_t written = decoder.finish(out.data());
+  tap.insert(tap.end(), out.begin(), out.begin() + written);
+  return tap;
+}
+
+bool bench(const std::vector<uint8_t>& pulses, uint16_t channels,
+           uint16_t bits, uint32_t rate) {
+  WavFormat format;
+  format.channels = channels;
+  format.bits_per_sample = bits;
+  format.sample_rate = rate;
+  format.data_offset = 0;
+  std::vector<uint8_t> pcm = render(pulses, format);
+  format.data_size = pcm.size();
+
+  std::vector<uint8_t> tap;
+  double start = now();
+  const int kRounds = 5;
+  for (int i = 0; i < kRounds; ++i) tap = decodeAll(pcm, format);
+  double elapsed = (now() - start) / kRounds;
+
+  // The first value is the leading silence (a pause at low sample rates). The
+  // last pulse has no rising edge after it, so it merges into the trailing
+  // pause; the rest should match the pulses.
+  size_t errors = 0;
+  int max_error = 0;
+  size_t decoded = 0;
+  size_t expected = pulses.size() - 1;
+  for (size_t i = (tap[0] == 0 ? 4 : 1); i < tap.size() && decoded < expected;
+       ++i) {
+    if (tap[i] == 0) {
+      i += 3;
+      ++errors;
+      ++decoded;
+      continue;
+    }
+    int error = abs((int)tap[i] - (int)pulses[decoded]);
+    if (error > max_error) max_error = error;
+    if (error > 2) ++errors;
+    ++decoded;
+  }
+  if (decoded != expected) errors += expected - decoded;
+  printf("%2u-bit %s %6u Hz: %8zu KiB in %7.2f ms, %8.1f MiB/s, "
+         "%zu pulses, max error %d, %zu bad\n",
+         bits, channels == 1 ? "mono  " : "stereo", rate, pcm.size() / 1024,
+         elapsed * 1000, pcm.size() / elapsed / (1024 * 1024), decoded,
+         max_error, errors);
+  return errors == 0;
+}
+
+// A block that starts above the trigger threshold of the previous one, but
+// equal to its last sample, once the threshold drops with the decaying peak.
+bool checkThresholdDrop() {
+  WavFormat format;
+  format.channels = 1;
+  format.bits_per_sample = 16;
+  format.sample_rate = 44100;
+  format.data_offset = 0;
+  std::vector<uint8_t> pcm;
+  for (int i = 0; i < 1024; ++i) {
+    double v = i < 256 ? 28800 : i < 511 ? -28800 : 7000;
+    putFrame(pcm, format, v / 32767);
+  }
+  format.data_size = pcm.size();
+  std::vector<uint8_t> tap = decodeAll(pcm, format);
+  // Rising at 0 and at 511 (as the threshold is below the sample before it):
+  // the pulse of the first edge, 511 samples as a pause value, and the final
+  // pause.
+  uint32_t expected = (511 * kC64PalHz + 44100 / 2) / 44100;
+  bool ok = tap.size() == 9 && tap[0] == 1 && tap[1] == 0 &&
+            (uint32_t)(tap[2] | (tap[3] << 8) | (tap[4] << 16)) == expected;
+  printf("Threshold drop at a block boundary: %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int convert(const char* in_path, const char* out_path) {
+  FILE* in = fopen(in_path, "rb");
+  if (in == nullptr) {
+    perror(in_path);
+    return 1;
+  }
+  std::vector<uint8_t> file;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    file.insert(file.end(), buf, buf + n);
+  }
+  fclose(in);
+  WavFormat format;
+  if (!tapuino::parseWavHeader(
+          file.data(),
+          std::min<size_t>(file.size(), tapuino::kWavHeaderMaxSize),
+          format)) {
+    fprintf(stderr, "%s: unsupported WAV format\n", in_path);
+    return 1;
+  }
+  uint32_t data_size = std::min<size_t>(format.data_size,
+                                        file.size() - format.data_offset);
+  data_size -= data_size % format.frameSize();
+  std::vector<uint8_t> pcm(file.begin() + format.data_offset,
+                           file.begin() + format.data_offset + data_size);
+  double start = now();
+  std::vector<uint8_t> tap = decodeAll(pcm, format);
+  double elapsed = now() - start;
+
+  FILE* out = fopen(out_path, "wb");
+  if (out == nullptr) {
+    perror(out_path);
+    return 1;
+  }
+  uint8_t header[20] = {0};
+  memcpy(header, "C64-TAPE-RAW", 12);
+  header[12] = 1;
+  uint32_t length = tap.size();
+  memcpy(header + 16, &length, 4);
+  fwrite(header, 1, sizeof(header), out);
+  fwrite(tap.data(), 1, tap.size(), out);
+  fclose(out);
+  printf("%u Hz, %u-bit, %u channel(s): %u KiB of PCM into %u bytes of TAP "
+         "in %.1f ms (%.1f MiB/s)\n",
+         format.sample_rate, format.bits_per_sample, format.channels,
+         data_size / 1024, length, elapsed * 1000,
+         data_size / elapsed / (1024 * 1024));
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc == 3) return convert(argv[1], argv[2]);
+  if (argc != 1) {
+    fprintf(stderr, "Usage: %s [in.wav out.tap]\n", argv[0]);
+    return 2;
+  }
+  std::vector<uint8_t> pulses = makePulses(200000);
+  bool ok = checkThresholdDrop();
+  ok &= bench(pulses, 1, 8, 44100);
+  ok &= bench(pulses, 2, 8, 44100);
+  ok &= bench(pulses, 1, 16, 44100);
+  ok &= bench(pulses, 2, 16, 44100);
+  ok &= bench(pulses, 1, 16, 48000);
+  ok &= bench(pulses, 2, 16, 96000);
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}